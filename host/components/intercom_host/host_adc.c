@@ -0,0 +1,157 @@
+#include "esp_adc/adc_continuous.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#define HOST_ADC_RING_LEVEL     60      // synthetic ring, well above the detector thresholds
+#define HOST_ADC_RING_MS        1500
+#define HOST_ADC_RING_PERIOD_MS 15000
+#define HOST_ADC_RING_STAGGER_MS 2000   // between the synthetic rings of consecutive channels
+#define HOST_ADC_MAX_PATTERNS   8
+
+static const char *TAG_HOST_ADC = "host_adc";
+
+struct adc_continuous_ctx_t {
+    adc_continuous_config_t config;
+    adc_digi_pattern_config_t patterns[HOST_ADC_MAX_PATTERNS];
+    FILE *trace;
+    uint32_t repeat;            // conversion rounds per trace line
+    uint32_t repeated;
+    uint16_t values[HOST_ADC_MAX_PATTERNS];
+    int64_t start_us;
+    uint64_t produced;
+    bool running;
+};
+
+static struct adc_continuous_ctx_t host_adc;
+
+esp_err_t adc_continuous_new_handle(const adc_continuous_handle_cfg_t *hdl_config, adc_continuous_handle_t *ret_handle)
+{
+    memset(&host_adc, 0, sizeof(host_adc));
+    *ret_handle = &host_adc;
+    return ESP_OK;
+}
+
+esp_err_t adc_continuous_config(adc_continuous_handle_t handle, const adc_continuous_config_t *config)
+{
+    if (config->pattern_num == 0 || config->pattern_num > HOST_ADC_MAX_PATTERNS || config->sample_freq_hz == 0) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+    handle->config = *config;
+    memcpy(handle->patterns, config->adc_pattern, config->pattern_num * sizeof(config->adc_pattern[0]));
+
+    const char *path = getenv("INTERCOM_HOST_ADC_TRACE");
+    if (path != NULL) {
+        handle->trace = fopen(path, "r");
+        if (handle->trace == NULL) {
+            ESP_LOGE(TAG_HOST_ADC, "Cannot open trace %s", path);
+            return ESP_ERR_NOT_FOUND;
+        }
+        // Traces are recorded at the sampler's output rate, the patterns convert in turn
+        const char *rate = getenv("INTERCOM_HOST_ADC_TRACE_HZ");
+        uint32_t trace_hz = rate != NULL ? strtoul(rate, NULL, 10) : CONFIG_INTERCOM_ADC_SAMPLE_RATE_HZ;
+        uint32_t round_hz = config->sample_freq_hz / config->pattern_num;
+        handle->repeat = trace_hz > 0 && round_hz > trace_hz ? round_hz / trace_hz : 1;
+        ESP_LOGI(TAG_HOST_ADC, "Replaying %s at %" PRIu32 " Hz", path, trace_hz);
+    }
+    return ESP_OK;
+}
+
+esp_err_t adc_continuous_start(adc_continuous_handle_t handle)
+{
+    handle->start_us = esp_timer_get_time();
+    handle->produced = 0;
+    handle->running = true;
+    return ESP_OK;
+}
+
+esp_err_t adc_continuous_stop(adc_continuous_handle_t handle)
+{
+    handle->running = false;
+    return ESP_OK;
+}
+
+/* Next trace line: one value per pattern, comma separated, missing columns repeat the last one */
+static void host_adc_read_line(adc_continuous_handle_t handle)
+{
+    char line[128];
+    do {
+        if (fgets(line, sizeof(line), handle->trace) == NULL) {
+            rewind(handle->trace);
+            line[0] = '#';
+        }
+    } while (line[0] == '#' || line[0] == '\n' || line[0] == '\r');
+
+    char *p = line;
+    long value = 0;
+    for (uint32_t i = 0; i < handle->config.pattern_num; i++) {
+        char *end;
+        long parsed = strtol(p, &end, 10);
+        if (end != p) {
+            value = parsed;
+            p = *end == ',' ? end + 1 : end;
+        }
+        handle->values[i] = value < 0 ? 0 : (value > 4095 ? 4095 : value);
+    }
+}
+
+static uint16_t host_adc_next(adc_continuous_handle_t handle, uint32_t pattern)
+{
+    if (handle->trace == NULL) {
+        uint64_t ms = handle->produced * 1000 / handle->config.sample_freq_hz + pattern * HOST_ADC_RING_STAGGER_MS;
+        return ms % HOST_ADC_RING_PERIOD_MS < HOST_ADC_RING_MS ? HOST_ADC_RING_LEVEL : 0;
+    }
+    if (pattern == 0 && handle->repeated++ % handle->repeat == 0) {
+        host_adc_read_line(handle);
+    }
+    return handle->values[pattern];
+}
+
+/* Hands out the conversions that are due by now, like the DMA pool would */
+esp_err_t adc_continuous_read(adc_continuous_handle_t handle, uint8_t *buf, uint32_t length_max,
+                              uint32_t *out_length, uint32_t timeout_ms)
+{
+    uint32_t max_results = length_max / SOC_ADC_DIGI_RESULT_BYTES;
+    int64_t waited_ms = 0;
+
+    if (!handle->running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    while (1) {
+        uint64_t due = (esp_timer_get_time() - handle->start_us) * handle->config.sample_freq_hz / 1000000;
+        uint64_t available = due - handle->produced;
+        if (available >= max_results || (available > 0 && waited_ms > 0)) {
+            uint32_t count = available < max_results ? available : max_results;
+            adc_digi_output_data_t *results = (adc_digi_output_data_t *)buf;
+            for (uint32_t i = 0; i < count; i++) {
+                uint32_t pattern = handle->produced % handle->config.pattern_num;
+                uint16_t value = host_adc_next(handle, pattern);
+                results[i].val = 0;
+                if (handle->config.format == ADC_DIGI_OUTPUT_FORMAT_TYPE1) {
+                    results[i].type1.channel = handle->patterns[pattern].channel;
+                    results[i].type1.data = value;
+                } else {
+                    results[i].type2.channel = handle->patterns[pattern].channel;
+                    results[i].type2.data = value > 2047 ? 2047 : value;
+                }
+                handle->produced++;
+            }
+            *out_length = count * SOC_ADC_DIGI_RESULT_BYTES;
+            return ESP_OK;
+        }
+        if (timeout_ms != ADC_MAX_DELAY && waited_ms >= timeout_ms) {
+            *out_length = 0;
+            return ESP_ERR_TIMEOUT;
+        }
+        vTaskDelay(1);
+        waited_ms += portTICK_PERIOD_MS;
+    }
+}
@@ -0,0 +1,85 @@
+#include "driver/gpio.h"
+#include "driver/ledc.h"
+
+#include <inttypes.h>
+
+#include "esp_log.h"
+
+static const char *TAG_HOST_GPIO = "host_gpio";
+
+static uint32_t gpio_levels[GPIO_NUM_MAX];
+static uint32_t ledc_duty[LEDC_SPEED_MODE_MAX][LEDC_CHANNEL_MAX];
+static uint32_t ledc_pending[LEDC_SPEED_MODE_MAX][LEDC_CHANNEL_MAX];
+static int ledc_gpio[LEDC_SPEED_MODE_MAX][LEDC_CHANNEL_MAX];
+
+esp_err_t gpio_config(const gpio_config_t *config)
+{
+    ESP_LOGI(TAG_HOST_GPIO, "Configured pins 0x%010" PRIx64 " mode %d", config->pin_bit_mask, config->mode);
+    return ESP_OK;
+}
+
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level)
+{
+    if (gpio_num < 0 || gpio_num >= GPIO_NUM_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (gpio_levels[gpio_num] != !!level) {
+        ESP_LOGI(TAG_HOST_GPIO, "GPIO%d -> %d", gpio_num, !!level);
+    }
+    gpio_levels[gpio_num] = !!level;
+    return ESP_OK;
+}
+
+int gpio_get_level(gpio_num_t gpio_num)
+{
+    return gpio_num >= 0 && gpio_num < GPIO_NUM_MAX ? gpio_levels[gpio_num] : 0;
+}
+
+esp_err_t ledc_timer_config(const ledc_timer_config_t *timer_conf)
+{
+    return ESP_OK;
+}
+
+esp_err_t ledc_channel_config(const ledc_channel_config_t *ledc_conf)
+{
+    ledc_gpio[ledc_conf->speed_mode][ledc_conf->channel] = ledc_conf->gpio_num;
+    ledc_duty[ledc_conf->speed_mode][ledc_conf->channel] = ledc_conf->duty;
+    ledc_pending[ledc_conf->speed_mode][ledc_conf->channel] = ledc_conf->duty;
+    return ESP_OK;
+}
+
+esp_err_t ledc_set_duty(ledc_mode_t speed_mode, ledc_channel_t channel, uint32_t duty)
+{
+    ledc_pending[speed_mode][channel] = duty;
+    return ESP_OK;
+}
+
+esp_err_t ledc_update_duty(ledc_mode_t speed_mode, ledc_channel_t channel)
+{
+    if (ledc_duty[speed_mode][channel] != ledc_pending[speed_mode][channel]) {
+        ESP_LOGD(TAG_HOST_GPIO, "LEDC channel %d (GPIO%d) duty %" PRIu32, channel,
+                 ledc_gpio[speed_mode][channel], ledc_pending[speed_mode][channel]);
+    }
+    ledc_duty[speed_mode][channel] = ledc_pending[speed_mode][channel];
+    return ESP_OK;
+}
+
+uint32_t ledc_get_duty(ledc_mode_t speed_mode, ledc_channel_t channel)
+{
+    return ledc_duty[speed_mode][channel];
+}
+
+esp_err_t ledc_fade_func_install(int intr_alloc_flags)
+{
+    return ESP_OK;
+}
+
+esp_err_t ledc_set_fade_with_time(ledc_mode_t speed_mode, ledc_channel_t channel, uint32_t target_duty, int max_fade_time_ms)
+{
+    return ledc_set_duty(speed_mode, channel, target_duty);
+}
+
+esp_err_t ledc_fade_start(ledc_mode_t speed_mode, ledc_channel_t channel, ledc_fade_mode_t fade_mode)
+{
+    return ledc_update_duty(speed_mode, channel);
+}
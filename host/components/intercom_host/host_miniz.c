@@ -0,0 +1,51 @@
+#include "rom/miniz.h"
+
+#include <string.h>
+
+tinfl_status tinfl_decompress(tinfl_decompressor *r, const uint8_t *in_buf_next, size_t *in_buf_size,
+                              uint8_t *out_buf_start, uint8_t *out_buf_next, size_t *out_buf_size,
+                              const uint32_t decomp_flags)
+{
+    if (!r->started) {
+        memset(&r->stream, 0, sizeof(r->stream));
+        int window_bits = decomp_flags & TINFL_FLAG_PARSE_ZLIB_HEADER ? MAX_WBITS : -MAX_WBITS;
+        if (inflateInit2(&r->stream, window_bits) != Z_OK) {
+            return TINFL_STATUS_FAILED;
+        }
+        r->started = 1;
+    }
+
+    r->stream.next_in = (Bytef *)in_buf_next;
+    r->stream.avail_in = *in_buf_size;
+    r->stream.next_out = out_buf_next;
+    r->stream.avail_out = *out_buf_size;
+    int ret = inflate(&r->stream, Z_NO_FLUSH);
+    *in_buf_size -= r->stream.avail_in;
+    *out_buf_size -= r->stream.avail_out;
+
+    if (ret == Z_STREAM_END) {
+        tinfl_end(r);
+        return TINFL_STATUS_DONE;
+    }
+    if (ret != Z_OK && ret != Z_BUF_ERROR) {
+        tinfl_end(r);
+        return TINFL_STATUS_FAILED;
+    }
+    if (r->stream.avail_out == 0) {
+        return TINFL_STATUS_HAS_MORE_OUTPUT;
+    }
+    if (decomp_flags & TINFL_FLAG_HAS_MORE_INPUT) {
+        return TINFL_STATUS_NEEDS_MORE_INPUT;
+    }
+    // All input given and the stream is not over: truncated
+    tinfl_end(r);
+    return TINFL_STATUS_FAILED;
+}
+
+void tinfl_end(tinfl_decompressor *r)
+{
+    if (r->started) {
+        inflateEnd(&r->stream);
+        r->started = 0;
+    }
+}
@@ -0,0 +1,102 @@
+#include "esp_ota_ops.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+static const char *TAG_HOST_OTA = "host_ota";
+
+static const esp_partition_t *boot_partition = NULL;
+
+static const esp_partition_t *host_ota_slot(esp_partition_subtype_t subtype)
+{
+    return esp_partition_find_first(ESP_PARTITION_TYPE_APP, subtype, NULL);
+}
+
+const esp_partition_t *esp_ota_get_running_partition(void)
+{
+    const char *running = getenv("INTERCOM_HOST_RUNNING");
+    if (running != NULL && strcmp(running, "ota_1") == 0) {
+        return host_ota_slot(ESP_PARTITION_SUBTYPE_APP_OTA_1);
+    }
+    return host_ota_slot(ESP_PARTITION_SUBTYPE_APP_OTA_0);
+}
+
+const esp_partition_t *esp_ota_get_boot_partition(void)
+{
+    return boot_partition != NULL ? boot_partition : esp_ota_get_running_partition();
+}
+
+const esp_partition_t *esp_ota_get_next_update_partition(const esp_partition_t *start_from)
+{
+    const esp_partition_t *from = start_from != NULL ? start_from : esp_ota_get_running_partition();
+    if (from == NULL) {
+        return NULL;
+    }
+    return host_ota_slot(from->subtype == ESP_PARTITION_SUBTYPE_APP_OTA_0 ?
+                         ESP_PARTITION_SUBTYPE_APP_OTA_1 : ESP_PARTITION_SUBTYPE_APP_OTA_0);
+}
+
+const esp_partition_t *esp_ota_get_last_invalid_partition(void)
+{
+    return NULL;
+}
+
+esp_err_t esp_ota_get_partition_description(const esp_partition_t *partition, esp_app_desc_t *app_desc)
+{
+    if (partition == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    // The running image is this host binary
+    if (partition == esp_ota_get_running_partition()) {
+        *app_desc = *esp_app_get_description();
+        return ESP_OK;
+    }
+
+    esp_err_t err = esp_partition_read(partition, sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t),
+                                       app_desc, sizeof(*app_desc));
+    if (err != ESP_OK) {
+        return err;
+    }
+    return app_desc->magic_word == ESP_APP_DESC_MAGIC_WORD ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t esp_ota_get_state_partition(const esp_partition_t *partition, esp_ota_img_states_t *ota_state)
+{
+    if (partition == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    *ota_state = ESP_OTA_IMG_VALID;
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_set_boot_partition(const esp_partition_t *partition)
+{
+    esp_image_header_t header;
+
+    if (partition == NULL || partition->type != ESP_PARTITION_TYPE_APP) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    esp_err_t err = esp_partition_read(partition, 0, &header, sizeof(header));
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (header.magic != ESP_IMAGE_HEADER_MAGIC) {
+        return ESP_ERR_OTA_VALIDATE_FAILED;
+    }
+    boot_partition = partition;
+    ESP_LOGI(TAG_HOST_OTA, "Boot partition set to %s", partition->label);
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_mark_app_valid_cancel_rollback(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t esp_ota_mark_app_invalid_rollback_and_reboot(void)
+{
+    ESP_LOGE(TAG_HOST_OTA, "Image marked invalid, exiting instead of rebooting");
+    exit(EXIT_FAILURE);
+}
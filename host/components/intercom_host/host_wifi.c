@@ -0,0 +1,104 @@
+#include "esp_wifi.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#define HOST_WIFI_CONNECT_US    200000  // time from esp_wifi_connect() to the outcome event
+
+ESP_EVENT_DEFINE_BASE(WIFI_EVENT);
+
+static const char *TAG_HOST_WIFI = "host_wifi";
+
+static wifi_config_t host_wifi_config;
+static esp_timer_handle_t connect_timer = NULL;
+static int fail_remaining = 0;
+static bool connected = false;
+
+static void host_wifi_connect_done(void *arg)
+{
+    if (fail_remaining > 0) {
+        fail_remaining--;
+        wifi_event_sta_disconnected_t event = { .reason = 201 };    // no AP found
+        memcpy(event.ssid, host_wifi_config.sta.ssid, sizeof(event.ssid));
+        event.ssid_len = strnlen((const char *)event.ssid, sizeof(event.ssid));
+        ESP_LOGI(TAG_HOST_WIFI, "Simulated connect failure, %d left", fail_remaining);
+        esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &event, sizeof(event), 0);
+        return;
+    }
+
+    connected = true;
+    esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_CONNECTED, NULL, 0, 0);
+    ip_event_got_ip_t event = { 0 };
+    event.ip_info.ip.addr = ESP_IP4TOADDR(127, 0, 0, 1);
+    event.ip_info.netmask.addr = ESP_IP4TOADDR(255, 0, 0, 0);
+    esp_event_post(IP_EVENT, IP_EVENT_STA_GOT_IP, &event, sizeof(event), 0);
+}
+
+esp_err_t esp_wifi_init(const wifi_init_config_t *config)
+{
+    const char *fail = getenv("INTERCOM_HOST_WIFI_FAIL");
+    fail_remaining = fail != NULL ? atoi(fail) : 0;
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = host_wifi_connect_done,
+        .name = "host_wifi_connect",
+    };
+    return esp_timer_create(&timer_args, &connect_timer);
+}
+
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode)
+{
+    return mode == WIFI_MODE_STA ? ESP_OK : ESP_ERR_NOT_SUPPORTED;
+}
+
+esp_err_t esp_wifi_set_config(wifi_interface_t interface, wifi_config_t *conf)
+{
+    host_wifi_config = *conf;
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_start(void)
+{
+    return esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_START, NULL, 0, 0);
+}
+
+esp_err_t esp_wifi_connect(void)
+{
+    esp_timer_stop(connect_timer);
+    return esp_timer_start_once(connect_timer, HOST_WIFI_CONNECT_US);
+}
+
+esp_err_t esp_wifi_disconnect(void)
+{
+    esp_timer_stop(connect_timer);
+    if (connected) {
+        connected = false;
+        wifi_event_sta_disconnected_t event = { .reason = 8 };     // assoc leave
+        esp_event_post(WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, &event, sizeof(event), 0);
+    }
+    return ESP_OK;
+}
+
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t *ap_info)
+{
+    if (!connected) {
+        return ESP_ERR_WIFI_NOT_CONNECT;
+    }
+    static const uint8_t host_bssid[6] = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+    memset(ap_info, 0, sizeof(*ap_info));
+    memcpy(ap_info->bssid, host_bssid, sizeof(host_bssid));
+    memcpy(ap_info->ssid, host_wifi_config.sta.ssid, sizeof(host_wifi_config.sta.ssid));
+    ap_info->primary = 1;
+    ap_info->rssi = -40;
+    return ESP_OK;
+}
+
+esp_netif_t *esp_netif_create_default_wifi_sta(void)
+{
+    // Never dereferenced by the application, only kept
+    static int host_sta_netif;
+    return (esp_netif_t *)&host_sta_netif;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+/*
+ * Host stand-in for the continuous ADC driver.
+ *
+ * Conversion results are paced at the configured rate, the patterns take
+ * turns, and come from the trace file named by INTERCOM_HOST_ADC_TRACE
+ * (see main/core/adc_trace.h), looped at its end. A trace line may hold one
+ * comma separated column per pattern. Without a trace each line rings for
+ * 1.5 s every 15 s, consecutive patterns 2 s apart.
+ */
+
+#include <stdint.h>
+
+#include "esp_err.h"
+
+#ifndef SOC_ADC_DIGI_RESULT_BYTES
+#define SOC_ADC_DIGI_RESULT_BYTES       2
+#endif
+#ifndef SOC_ADC_DIGI_MAX_BITWIDTH
+#define SOC_ADC_DIGI_MAX_BITWIDTH       12
+#endif
+#ifndef SOC_ADC_SAMPLE_FREQ_THRES_LOW
+#define SOC_ADC_SAMPLE_FREQ_THRES_LOW   20000
+#endif
+
+#define ADC_MAX_DELAY   UINT32_MAX
+
+typedef enum {
+    ADC_UNIT_1,
+    ADC_UNIT_2,
+} adc_unit_t;
+
+typedef enum {
+    ADC_CHANNEL_0, ADC_CHANNEL_1, ADC_CHANNEL_2, ADC_CHANNEL_3, ADC_CHANNEL_4,
+    ADC_CHANNEL_5, ADC_CHANNEL_6, ADC_CHANNEL_7, ADC_CHANNEL_8, ADC_CHANNEL_9,
+} adc_channel_t;
+
+typedef enum {
+    ADC_ATTEN_DB_0,
+    ADC_ATTEN_DB_2_5,
+    ADC_ATTEN_DB_6,
+    ADC_ATTEN_DB_12,
+} adc_atten_t;
+
+typedef enum {
+    ADC_CONV_SINGLE_UNIT_1 = 1,
+    ADC_CONV_SINGLE_UNIT_2 = 2,
+} adc_digi_convert_mode_t;
+
+typedef enum {
+    ADC_DIGI_OUTPUT_FORMAT_TYPE1,
+    ADC_DIGI_OUTPUT_FORMAT_TYPE2,
+} adc_digi_output_format_t;
+
+typedef struct {
+    uint8_t atten;
+    uint8_t channel;
+    uint8_t unit;
+    uint8_t bit_width;
+} adc_digi_pattern_config_t;
+
+/* Same layout as the ESP32 DMA results */
+typedef struct {
+    union {
+        struct {
+            uint16_t data: 12;
+            uint16_t channel: 4;
+        } type1;
+        struct {
+            uint16_t data: 11;
+            uint16_t channel: 4;
+            uint16_t unit: 1;
+        } type2;
+        uint16_t val;
+    };
+} adc_digi_output_data_t;
+
+typedef struct {
+    uint32_t max_store_buf_size;
+    uint32_t conv_frame_size;
+} adc_continuous_handle_cfg_t;
+
+typedef struct {
+    uint32_t pattern_num;
+    adc_digi_pattern_config_t *adc_pattern;
+    uint32_t sample_freq_hz;
+    adc_digi_convert_mode_t conv_mode;
+    adc_digi_output_format_t format;
+} adc_continuous_config_t;
+
+typedef struct adc_continuous_ctx_t *adc_continuous_handle_t;
+
+esp_err_t adc_continuous_new_handle(const adc_continuous_handle_cfg_t *hdl_config, adc_continuous_handle_t *ret_handle);
+esp_err_t adc_continuous_config(adc_continuous_handle_t handle, const adc_continuous_config_t *config);
+esp_err_t adc_continuous_start(adc_continuous_handle_t handle);
+esp_err_t adc_continuous_stop(adc_continuous_handle_t handle);
+esp_err_t adc_continuous_read(adc_continuous_handle_t handle, uint8_t *buf, uint32_t length_max,
+                              uint32_t *out_length, uint32_t timeout_ms);
@@ -0,0 +1,6 @@
+#pragma once
+
+/* Host stand-in for esp_mac.h, only the formatting helpers */
+
+#define MACSTR "%02x:%02x:%02x:%02x:%02x:%02x"
+#define MAC2STR(a) (a)[0], (a)[1], (a)[2], (a)[3], (a)[4], (a)[5]
@@ -0,0 +1,52 @@
+#pragma once
+
+/*
+ * Host stand-in for the ROM tinfl inflater, backed by the system zlib.
+ *
+ * Follows the tinfl contract the OTA decoder relies on: output goes to
+ * out_next, at most *out_size bytes, and the caller keeps the 32 KB window.
+ * zlib keeps its own window, so the one passed in is only written to.
+ * That state lives until the stream ends or fails; a caller that gives up
+ * on a stream earlier releases it with tinfl_end. The ROM inflater holds
+ * nothing outside the decompressor and has no such call, callers test
+ * TINFL_HAS_END.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <zlib.h>
+
+#define TINFL_LZ_DICT_SIZE  32768
+
+enum {
+    TINFL_FLAG_PARSE_ZLIB_HEADER = 1,
+    TINFL_FLAG_HAS_MORE_INPUT = 2,
+    TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF = 4,
+    TINFL_FLAG_COMPUTE_ADLER32 = 8,
+};
+
+typedef enum {
+    TINFL_STATUS_BAD_PARAM = -3,
+    TINFL_STATUS_ADLER32_MISMATCH = -2,
+    TINFL_STATUS_FAILED = -1,
+    TINFL_STATUS_DONE = 0,
+    TINFL_STATUS_NEEDS_MORE_INPUT = 1,
+    TINFL_STATUS_HAS_MORE_OUTPUT = 2,
+} tinfl_status;
+
+typedef struct {
+    z_stream stream;
+    int started;
+} tinfl_decompressor;
+
+#define tinfl_init(r)   do { (r)->started = 0; } while (0)
+
+#define TINFL_HAS_END   1
+
+tinfl_status tinfl_decompress(tinfl_decompressor *r, const uint8_t *in_buf_next, size_t *in_buf_size,
+                              uint8_t *out_buf_start, uint8_t *out_buf_next, size_t *out_buf_size,
+                              const uint32_t decomp_flags);
+
+/* Releases the zlib state of a stream that did not end, a no-op otherwise */
+void tinfl_end(tinfl_decompressor *r);
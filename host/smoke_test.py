@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+"""Boot the linux-target firmware against tools/ota_server.py.
+
+Serves IMAGE as firmware.bin (and its manifest) on localhost:8001, with
+connections cut at random offsets, starts the ELF and follows its log
+until every milestone below has appeared in order, or fails after the
+timeout. The build must point OTA_MANIFEST_URL and OTA_FIRMWARE_UPG_URL
+at localhost:8001 in main/credentials.h.
+
+Milestones: all boot stages started, the manifest answered, and when it
+offers IMAGE, the image hash verified after a download that the server
+cut and the firmware resumed as often as it happened.
+
+Usage:
+    cd host && idf.py --preview set-target linux && idf.py build
+    ./smoke_test.py build/smart-intercom.elf new_firmware.bin
+"""
+
+import argparse
+import os
+import re
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+SERVER = os.path.join(HERE, "..", "tools", "ota_server.py")
+
+BOOTED = re.compile(r"All boot stages started")
+MANIFEST = re.compile(r"Manifest (offers|unchanged)")
+OFFERED = re.compile(r"Manifest offers \S+ \(running")
+RESUMED = re.compile(r"Resuming download at")
+VERIFIED = re.compile(r"Image hash verified")
+FAILED = re.compile(r"Image hash mismatch|Image validation failed|Guru Meditation|abort\(\)")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("elf")
+    parser.add_argument("image", help="firmware image the server offers")
+    parser.add_argument("--cut-probability", type=float, default=0.5)
+    parser.add_argument("--timeout", type=float, default=300, help="seconds")
+    args = parser.parse_args()
+
+    served = tempfile.mkdtemp()
+    shutil.copy(args.image, os.path.join(served, "firmware.bin"))
+    server = subprocess.Popen([sys.executable, SERVER, "--dir", served, "--port", "8001",
+                               "--cut-probability", str(args.cut_probability)])
+    device = subprocess.Popen([os.path.abspath(args.elf)], stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                              text=True, errors="replace")
+    expected = [BOOTED, MANIFEST]
+    resumes = 0
+    deadline = time.monotonic() + args.timeout
+    try:
+        for line in device.stdout:
+            sys.stdout.write(line)
+            if FAILED.search(line):
+                print("smoke test failed: %s" % line.strip())
+                return 1
+            if OFFERED.search(line):
+                expected.append(VERIFIED)
+            resumes += bool(RESUMED.search(line))
+            if expected and expected[0].search(line):
+                expected.pop(0)
+                if not expected:
+                    print("smoke test passed, %d resumed downloads" % resumes)
+                    return 0
+            if time.monotonic() > deadline:
+                break
+        print("smoke test failed: no line matching %r" % (expected[0].pattern if expected else "?"))
+        return 1
+    finally:
+        device.kill()
+        server.terminate()
+        shutil.rmtree(served)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,81 @@
+#!/usr/bin/env python3
+"""Sample firmware images and the artifacts tools/ota_artifact.py builds from them.
+
+Writes into the output directory:
+    base.bin            the image devices run, with an ESP-IDF app description
+    image.bin           the next release: new version, an inserted function that
+                        shifts everything after it, a removed block, relocated
+                        addresses every 4 KB and a longer tail
+    unrelated.bin       an image with nothing in common with base.bin
+    delta.iota          image.bin against base.bin, op stream left uncompressed
+    delta_z.iota        the same, compressed
+    compressed.iota     image.bin compressed, no delta
+    unrelated.iota      unrelated.bin against base.bin, uncompressed
+
+Usage:
+    host/test/delta_samples.py build/test/delta_samples
+"""
+
+import os
+import random
+import struct
+import subprocess
+import sys
+
+TOOL = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "..", "tools", "ota_artifact.py")
+
+IMAGE_SIZE = 128 * 1024
+WORDS = [b"mov ", b"ldr a2, ", b"call8 ", b"l32i.n ", b"bnez ", b"s32i ", b"ret.n ", b"addi "]
+
+
+def firmware(rng, size, version):
+    """Code-like bytes behind an image header and app description."""
+    body = bytearray()
+    while len(body) < size:
+        body += rng.choice(WORDS) + bytes([rng.randrange(256)])
+    body = body[:size]
+    body[0] = 0xE9
+    # esp_app_desc_t after the image and segment headers: magic, secure_version, reserved, version
+    body[32:80] = struct.pack("<II8x32s", 0xABCD5432, 0, version.encode())
+    return bytes(body)
+
+
+def next_release(base, rng):
+    image = bytearray(base)
+    image[48:80] = struct.pack("32s", b"1.1.0")
+    for off in range(4096, len(image) - 4, 4096):
+        image[off:off + 4] = struct.pack("<I", 0x40080000 + off)
+    image[70000:72000] = b""
+    inserted = firmware(rng, 700, "")[80:]
+    image[20000:20000] = inserted
+    image += firmware(rng, 3000, "")[80:]
+    return bytes(image)
+
+
+def tool(*args):
+    subprocess.run([sys.executable, TOOL] + list(args), check=True, stdout=subprocess.DEVNULL)
+
+
+def main():
+    out = sys.argv[1]
+    os.makedirs(out, exist_ok=True)
+    rng = random.Random(11)
+    base = firmware(rng, IMAGE_SIZE, "1.0.0")
+    files = {
+        "base.bin": base,
+        "image.bin": next_release(base, rng),
+        "unrelated.bin": firmware(random.Random(12), IMAGE_SIZE // 2, "2.0.0"),
+    }
+    for name, data in files.items():
+        with open(os.path.join(out, name), "wb") as f:
+            f.write(data)
+
+    base_bin, image_bin = os.path.join(out, "base.bin"), os.path.join(out, "image.bin")
+    tool("delta", base_bin, image_bin, os.path.join(out, "delta.iota"), "--no-compress")
+    tool("delta", base_bin, image_bin, os.path.join(out, "delta_z.iota"))
+    tool("compress", image_bin, os.path.join(out, "compressed.iota"))
+    tool("delta", base_bin, os.path.join(out, "unrelated.bin"), os.path.join(out, "unrelated.iota"), "--no-compress")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,146 @@
+#include "flash_file.h"
+
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static uint32_t next_random(flash_file_t *flash)
+{
+    flash->rng ^= flash->rng << 13;
+    flash->rng ^= flash->rng >> 17;
+    flash->rng ^= flash->rng << 5;
+    return flash->rng;
+}
+
+bool flash_file_open(flash_file_t *flash, const char *path, uint32_t size, uint32_t sector_size)
+{
+    struct stat st;
+
+    memset(flash, 0, sizeof(*flash));
+    flash->size = size;
+    flash->sector_size = sector_size;
+    flash->rng = 0x2545f491;
+    if (size / sector_size > sizeof(flash->sector_erases) / sizeof(flash->sector_erases[0])) {
+        return false;
+    }
+    flash->fd = open(path, O_RDWR | O_CREAT, 0600);
+    if (flash->fd < 0 || fstat(flash->fd, &st) != 0) {
+        return false;
+    }
+    if (st.st_size != size) {
+        uint8_t erased[4096];
+        memset(erased, 0xff, sizeof(erased));
+        for (uint32_t pos = 0; pos < size; pos += sizeof(erased)) {
+            size_t n = size - pos < sizeof(erased) ? size - pos : sizeof(erased);
+            if (pwrite(flash->fd, erased, n, pos) != (ssize_t)n) {
+                return false;
+            }
+        }
+        if (ftruncate(flash->fd, size) != 0) {
+            return false;
+        }
+    }
+    flash->cells = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, flash->fd, 0);
+    return flash->cells != MAP_FAILED;
+}
+
+void flash_file_close(flash_file_t *flash)
+{
+    if (flash->cells != NULL && flash->cells != MAP_FAILED) {
+        munmap(flash->cells, flash->size);
+    }
+    if (flash->fd >= 0) {
+        close(flash->fd);
+    }
+    flash->cells = NULL;
+    flash->fd = -1;
+}
+
+/* Bytes of an operation of len that still complete before the cut, len if none is due */
+static size_t until_cut(flash_file_t *flash, size_t len)
+{
+    if (flash->cut_at == 0 || flash->progress + len < flash->cut_at) {
+        flash->progress += len;
+        return len;
+    }
+    size_t done = flash->cut_at - flash->progress;
+    flash->progress = flash->cut_at;
+    flash->powered_off = true;
+    return done;
+}
+
+static int flash_file_read(void *ctx, uint32_t addr, void *buf, size_t len)
+{
+    flash_file_t *flash = ctx;
+    if (flash->powered_off || addr + len > flash->size) {
+        return -1;
+    }
+    memcpy(buf, &flash->cells[addr], len);
+    flash->bytes_read += len;
+    return 0;
+}
+
+static int flash_file_write(void *ctx, uint32_t addr, const void *buf, size_t len)
+{
+    flash_file_t *flash = ctx;
+    const uint8_t *data = buf;
+
+    if (flash->powered_off || addr + len > flash->size) {
+        return -1;
+    }
+    uint8_t *cells = &flash->cells[addr];
+
+    size_t done = until_cut(flash, len);
+    for (size_t i = 0; i < len; i++) {
+        if ((cells[i] & data[i]) != data[i]) {
+            flash->set_bits++;
+        }
+        if (i < done) {
+            cells[i] &= data[i];
+        } else if (i == done) {
+            cells[i] &= data[i] | (uint8_t)next_random(flash);  // half programmed
+        }
+    }
+
+    flash->writes++;
+    flash->bytes_written += len;
+    uint32_t pages = (addr + len - 1) / FLASH_FILE_PAGE_SIZE - addr / FLASH_FILE_PAGE_SIZE + 1;
+    flash->device_us += pages * FLASH_FILE_PAGE_US;
+    return flash->powered_off ? -1 : 0;
+}
+
+static int flash_file_erase(void *ctx, uint32_t addr)
+{
+    flash_file_t *flash = ctx;
+
+    if (flash->powered_off || addr % flash->sector_size != 0 || addr + flash->sector_size > flash->size) {
+        return -1;
+    }
+    uint8_t *cells = &flash->cells[addr];
+
+    size_t done = until_cut(flash, flash->sector_size);
+    flash->cut_in_erase = flash->powered_off;
+    for (size_t i = 0; i < flash->sector_size; i++) {
+        // An interrupted erase leaves cells erased at random, in proportion to how far it got
+        if (done == flash->sector_size || next_random(flash) % flash->sector_size < done) {
+            cells[i] = 0xff;
+        }
+    }
+
+    flash->erases++;
+    flash->sector_erases[addr / flash->sector_size]++;
+    flash->device_us += FLASH_FILE_ERASE_US;
+    return flash->powered_off ? -1 : 0;
+}
+
+void flash_file_ops(flash_file_t *flash, flash_ops_t *ops)
+{
+    ops->read = flash_file_read;
+    ops->write = flash_file_write;
+    ops->erase_sector = flash_file_erase;
+    ops->size = flash->size;
+    ops->sector_size = flash->sector_size;
+    ops->ctx = flash;
+}
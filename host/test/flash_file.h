@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "flash_log.h"
+
+/*
+ * NOR flash emulated in a file, for flash_log and anything else that takes
+ * flash_ops_t. The file is mapped shared, so what a test leaves in it is what
+ * the next open finds, as after a power cycle.
+ *
+ * Writes only clear bits and erase sets a sector to 0xff, as on the chip.
+ * A power cut can be scheduled after a number of programmed plus erased
+ * bytes: the write that crosses it stops part way, leaving its last byte
+ * half programmed, an erase leaves a random part of the sector erased, and
+ * every access fails until the file is opened again. Device time is
+ * modelled from typical SPI NOR figures so throughput can be reported for
+ * the target, not only the host.
+ */
+
+#define FLASH_FILE_PAGE_SIZE    256
+#define FLASH_FILE_PAGE_US      700     // page program
+#define FLASH_FILE_ERASE_US     45000   // 4 KB sector erase
+#define FLASH_FILE_READ_BPS     (20 * 1024 * 1024)
+
+typedef struct {
+    int fd;
+    uint8_t *cells;             // the file, mapped shared
+    uint32_t size;
+    uint32_t sector_size;
+    uint32_t rng;
+
+    uint64_t cut_at;            // power fails when progress reaches this, 0 never
+    uint64_t progress;          // bytes programmed and erased so far
+    bool powered_off;
+    bool cut_in_erase;          // the cut hit an erase, not a write
+
+    uint64_t bytes_read;
+    uint64_t bytes_written;
+    uint32_t writes;
+    uint32_t erases;
+    uint32_t set_bits;          // writes that tried to turn a 0 bit back into 1
+    uint32_t sector_erases[64]; // per sector, for wear
+    int64_t device_us;         // programs and erases, reads are bytes_read at FLASH_FILE_READ_BPS
+} flash_file_t;
+
+/* Creates the file filled with 0xff if it does not exist or has the wrong size */
+bool flash_file_open(flash_file_t *flash, const char *path, uint32_t size, uint32_t sector_size);
+void flash_file_close(flash_file_t *flash);
+
+void flash_file_ops(flash_file_t *flash, flash_ops_t *ops);
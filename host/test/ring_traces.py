@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+"""Handset LED traces for test_ring_detector, written to vectors/ring.
+
+Each trace is in the core/adc_trace.h format, one raw reading per line, with
+a header the test reads:
+    # rate_hz <samples per second>
+    # tolerance_ms <how far detected edges may be from the listed ones>
+    # ring <start ms> <duration ms>     one per expected ring, -1 if still ringing at the end
+
+The traces are modelled on the ADC readings of the LED lines: near-zero idle
+noise, LED turn-on and turn-off through the RC of the input divider, and
+rings that are either a steady level, a cadence of bursts or the rectified
+ringing voltage. Recordings from a device (`idf.py monitor` output filtered
+down to the numbers) can be added to the directory the same way, with a
+header written by hand.
+
+Usage:
+    host/test/ring_traces.py host/test/vectors/ring
+"""
+
+import math
+import os
+import random
+import sys
+
+RATE_HZ = 2000
+RC_MS = 1.5         # LED input divider time constant
+
+
+def idle(rng):
+    return rng.randint(0, 3)
+
+
+class Trace:
+    def __init__(self, name, description, duration_ms, tolerance_ms, seed):
+        self.name = name
+        self.description = description
+        self.tolerance_ms = tolerance_ms
+        self.rng = random.Random(seed)
+        self.target = [0.0] * (duration_ms * RATE_HZ // 1000)   # level the LED drives towards
+        self.rings = []
+
+    def level(self, start_ms, length_ms, value):
+        """value is a number or a function of the time in ms since start_ms."""
+        first = start_ms * RATE_HZ // 1000
+        for i in range(first, min(first + length_ms * RATE_HZ // 1000, len(self.target))):
+            t_ms = (i - first) * 1000 / RATE_HZ
+            self.target[i] = value(t_ms) if callable(value) else value
+
+    def ring(self, start_ms, duration_ms):
+        self.rings.append((start_ms, duration_ms))
+
+    def write(self, directory):
+        alpha = 1 - math.exp(-1000 / RATE_HZ / RC_MS)
+        led = 0.0
+        with open(os.path.join(directory, self.name + ".trace"), "w") as f:
+            for line in self.description:
+                f.write("# %s\n" % line)
+            f.write("# rate_hz %d\n# tolerance_ms %d\n" % (RATE_HZ, self.tolerance_ms))
+            for start_ms, duration_ms in self.rings:
+                f.write("# ring %d %d\n" % (start_ms, duration_ms))
+            for target in self.target:
+                led += (target - led) * alpha
+                noise = self.rng.uniform(-2, 2) if led > 4 else 0
+                f.write("%d\n" % max(0, round(led + noise) + idle(self.rng)))
+
+
+def rectified(amplitude, hz):
+    return lambda t_ms: max(0.0, amplitude * math.sin(2 * math.pi * hz * t_ms / 1000))
+
+
+def traces():
+    t = Trace("steady", ["One ring, the LED fully on for 1.5 s"], 4000, 15, 1)
+    t.level(1000, 1500, 40)
+    t.ring(1000, 1500)
+    yield t
+
+    t = Trace("rectified_ac", ["Two rings on a line that follows the 25 Hz ringing voltage,",
+                               "the Schmitt trigger drops out every half cycle"], 6000, 25, 2)
+    t.level(800, 2000, rectified(60, 25))
+    t.level(4000, 1000, rectified(60, 25))
+    t.ring(800, 1980)     # ends with the last positive half cycle
+    t.ring(4000, 980)
+    yield t
+
+    t = Trace("cadence", ["Two rings of the 400/200/400 ms double cadence, 2 s apart,",
+                          "the 200 ms gap is shorter than MONITOR_MIN_OFF_MS"], 5500, 10, 3)
+    for start_ms in (500, 3300):
+        t.level(start_ms, 400, 30)
+        t.level(start_ms + 600, 400, 30)
+        t.ring(start_ms, 1000)
+    yield t
+
+    t = Trace("glitches", ["Spikes shorter than MONITOR_MIN_ON_MS and a second of",
+                           "readings between the two thresholds, then a ring that is",
+                           "still going when the trace ends"], 4000, 10, 4)
+    for i, start_ms in enumerate(range(100, 1500, 140)):
+        t.level(start_ms, 2 + i % 5, 30 + 4 * i)
+    t.level(1700, 1000, lambda t_ms: 5 + math.sin(t_ms / 37))
+    t.level(3000, 1000, 35)
+    t.ring(3000, -1)
+    yield t
+
+
+def main():
+    directory = sys.argv[1]
+    os.makedirs(directory, exist_ok=True)
+    for trace in traces():
+        trace.write(directory)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
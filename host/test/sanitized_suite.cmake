@@ -0,0 +1,11 @@
+# Configures, builds and runs the host tests under ASan/UBSan in their own build tree:
+#   cmake -DSOURCE_DIR=host/test -DBINARY_DIR=<dir> -P sanitized_suite.cmake
+foreach(step
+        "${CMAKE_COMMAND};-S;${SOURCE_DIR};-B;${BINARY_DIR};-DINTERCOM_HOST_SANITIZE=ON"
+        "${CMAKE_COMMAND};--build;${BINARY_DIR};--parallel"
+        "${CMAKE_CTEST_COMMAND};--test-dir;${BINARY_DIR};--output-on-failure")
+    execute_process(COMMAND ${step} RESULT_VARIABLE result)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "${step} failed: ${result}")
+    endif()
+endforeach()
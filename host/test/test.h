@@ -0,0 +1,38 @@
+#pragma once
+
+/*
+ * Checks for the host tests. A failed check prints where and exits, so each
+ * test program is one ctest case that passes when main returns 0.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define CHECK(cond) do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            exit(1); \
+        } \
+    } while (0)
+
+#define CHECK_EQ(actual, expected) do { \
+        long long _a = (long long)(actual), _e = (long long)(expected); \
+        if (_a != _e) { \
+            fprintf(stderr, "%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__, #actual, _a, _e); \
+            exit(1); \
+        } \
+    } while (0)
+
+#define TEST_RUN(fn) do { \
+        fn(); \
+        printf("ok %s\n", #fn); \
+    } while (0)
+
+static inline int64_t test_now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
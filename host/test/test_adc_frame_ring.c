@@ -0,0 +1,160 @@
+/*
+ * adc_frame_ring with the producer protocol of adc_sampler_task: a slot is
+ * claimed only before the first sample of a frame, a frame without a slot
+ * is dropped whole. Sample values are the global sample index, so a frame
+ * is correct when it holds seq * capacity .. seq * capacity + count - 1.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+
+#include "adc_frame_ring.h"
+#include "test.h"
+
+#define FRAME_COUNT     4
+#define FRAME_SAMPLES   64
+#define STRESS_FRAMES   200000
+
+static adc_frame_t frames[FRAME_COUNT];
+static uint16_t storage[FRAME_COUNT * FRAME_SAMPLES];
+
+typedef struct {
+    adc_frame_ring_t *ring;
+    adc_frame_t *frame;
+    size_t fill;
+    uint32_t sample;    // global sample index
+} producer_t;
+
+static void producer_push(producer_t *p)
+{
+    if (p->fill == 0) {
+        p->frame = adc_frame_ring_begin_write(p->ring);
+    }
+    if (p->frame != NULL) {
+        p->frame->samples[p->fill] = (uint16_t)p->sample;
+    }
+    p->sample++;
+    if (++p->fill < FRAME_SAMPLES) {
+        return;
+    }
+    if (p->frame != NULL) {
+        adc_frame_ring_commit(p->ring, p->fill, (int64_t)(p->sample - FRAME_SAMPLES));
+    } else {
+        adc_frame_ring_drop(p->ring);
+    }
+    p->frame = NULL;
+    p->fill = 0;
+}
+
+static void check_frame(const adc_frame_t *frame)
+{
+    CHECK_EQ(frame->count, FRAME_SAMPLES);
+    CHECK_EQ(frame->timestamp_us, (int64_t)frame->seq * FRAME_SAMPLES);
+    for (size_t i = 0; i < frame->count; i++) {
+        CHECK_EQ(frame->samples[i], (uint16_t)(frame->seq * FRAME_SAMPLES + i));
+    }
+}
+
+static void test_full_ring_drops_whole_frames(void)
+{
+    adc_frame_ring_t ring;
+    producer_t p = { .ring = &ring };
+
+    CHECK(adc_frame_ring_init(&ring, frames, storage, FRAME_COUNT, FRAME_SAMPLES));
+    for (int i = 0; i < (FRAME_COUNT + 2) * FRAME_SAMPLES; i++) {
+        producer_push(&p);
+    }
+    CHECK_EQ(adc_frame_ring_pending(&ring), FRAME_COUNT);
+    CHECK_EQ(adc_frame_ring_overruns(&ring), 2);
+
+    // Free a slot in the middle of a frame: that frame is still dropped
+    for (int i = 0; i < FRAME_SAMPLES / 2; i++) {
+        producer_push(&p);
+    }
+    adc_frame_t *frame = adc_frame_ring_peek(&ring);
+    CHECK(frame != NULL);
+    CHECK_EQ(frame->seq, 0);
+    check_frame(frame);
+    adc_frame_ring_release(&ring);
+    for (int i = 0; i < FRAME_SAMPLES / 2; i++) {
+        producer_push(&p);
+    }
+    CHECK_EQ(adc_frame_ring_overruns(&ring), 3);
+    CHECK_EQ(adc_frame_ring_pending(&ring), FRAME_COUNT - 1);
+
+    // The next frame starts with a free slot and is kept, after a seq gap of 3
+    for (int i = 0; i < FRAME_SAMPLES; i++) {
+        producer_push(&p);
+    }
+    CHECK_EQ(adc_frame_ring_pending(&ring), FRAME_COUNT);
+    uint32_t expected_seq = 1;
+    while ((frame = adc_frame_ring_peek(&ring)) != NULL) {
+        CHECK_EQ(frame->seq, expected_seq);
+        check_frame(frame);
+        adc_frame_ring_release(&ring);
+        expected_seq = expected_seq == 3 ? 7 : expected_seq + 1;
+    }
+    CHECK_EQ(expected_seq, 8);
+}
+
+static atomic_bool producer_done;
+
+static void *producer_thread(void *arg)
+{
+    producer_t p = { .ring = arg };
+
+    for (uint32_t i = 0; i < STRESS_FRAMES * FRAME_SAMPLES; i++) {
+        producer_push(&p);
+        if (i % FRAME_SAMPLES == 0) {
+            sched_yield();      // the DMA paces the real producer
+        }
+    }
+    atomic_store(&producer_done, true);
+    return NULL;
+}
+
+static void test_concurrent_frames_are_whole(void)
+{
+    adc_frame_ring_t ring;
+    pthread_t producer;
+    uint32_t received = 0, last_seq = 0;
+
+    CHECK(adc_frame_ring_init(&ring, frames, storage, FRAME_COUNT, FRAME_SAMPLES));
+    atomic_store(&producer_done, false);
+    CHECK(pthread_create(&producer, NULL, producer_thread, &ring) == 0);
+
+    for (;;) {
+        bool done = atomic_load(&producer_done);
+        adc_frame_t *frame = adc_frame_ring_peek(&ring);
+        if (frame == NULL) {
+            if (done) {
+                break;
+            }
+            sched_yield();
+            continue;
+        }
+        CHECK(received == 0 || frame->seq > last_seq);
+        check_frame(frame);
+        last_seq = frame->seq;
+        received++;
+        adc_frame_ring_release(&ring);
+        if (received % 3 == 0) {
+            // A slow consumer now and then, so the producer also sees a full ring
+            for (int i = 0; i < FRAME_COUNT + 1; i++) {
+                sched_yield();
+            }
+        }
+    }
+    pthread_join(producer, NULL);
+
+    printf("%u frames received, %u dropped\n", received, adc_frame_ring_overruns(&ring));
+    CHECK_EQ(received + adc_frame_ring_overruns(&ring), STRESS_FRAMES);
+}
+
+int main(void)
+{
+    TEST_RUN(test_full_ring_drops_whole_frames);
+    TEST_RUN(test_concurrent_frames_are_whole);
+    return 0;
+}
@@ -0,0 +1,150 @@
+/*
+ * backoff: delay bounds, the cap, the spread of the full jitter and the
+ * reset after a stable connection. The configuration is mqtt_task's.
+ */
+
+#include <string.h>
+
+#include "backoff.h"
+#include "test.h"
+
+#define DRAWS   20000
+
+static const backoff_config_t mqtt_cfg = {
+    .min_ms = 250,
+    .base_ms = 1000,
+    .cap_ms = 60000,
+    .stable_ms = 30000,
+};
+
+static uint32_t ceiling_ms(uint32_t attempt)
+{
+    uint64_t ceiling = (uint64_t)mqtt_cfg.base_ms << (attempt < 20 ? attempt : 20);
+    return ceiling > mqtt_cfg.cap_ms ? mqtt_cfg.cap_ms : (uint32_t)ceiling;
+}
+
+static void test_delays_within_min_and_cap(void)
+{
+    for (uint32_t attempt = 0; attempt < 12; attempt++) {
+        uint32_t lowest = UINT32_MAX, highest = 0;
+        for (uint32_t seed = 1; seed <= DRAWS; seed++) {
+            backoff_t b;
+            backoff_init(&b, &mqtt_cfg, seed * 2654435761u);
+            b.attempt = attempt;
+            uint32_t delay = backoff_next_delay_ms(&b);
+            CHECK(delay >= mqtt_cfg.min_ms);
+            CHECK(delay <= ceiling_ms(attempt));
+            CHECK_EQ(backoff_attempt(&b), attempt + 1);
+            lowest = delay < lowest ? delay : lowest;
+            highest = delay > highest ? delay : highest;
+        }
+        // The whole range gets used, from min up to the ceiling
+        CHECK(lowest < mqtt_cfg.min_ms + ceiling_ms(attempt) / 100);
+        CHECK(highest > ceiling_ms(attempt) - ceiling_ms(attempt) / 100);
+    }
+}
+
+static void test_cap_holds_for_large_attempts(void)
+{
+    backoff_t b;
+
+    backoff_init(&b, &mqtt_cfg, 7);
+    b.attempt = UINT32_MAX - 1;
+    for (int i = 0; i < 1000; i++) {
+        CHECK(backoff_next_delay_ms(&b) <= mqtt_cfg.cap_ms);
+    }
+    CHECK_EQ(backoff_attempt(&b), UINT32_MAX);
+}
+
+static void test_min_above_ceiling(void)
+{
+    const backoff_config_t cfg = { .min_ms = 5000, .base_ms = 1000, .cap_ms = 60000, .stable_ms = 1000 };
+    backoff_t b;
+
+    backoff_init(&b, &cfg, 3);
+    CHECK_EQ(backoff_next_delay_ms(&b), 5000);
+    CHECK_EQ(backoff_next_delay_ms(&b), 5000);
+    CHECK(backoff_next_delay_ms(&b) >= 5000);
+}
+
+static void test_full_jitter_is_uniform(void)
+{
+    // Attempt 6 of one device, its ceiling is the cap: 10 equal buckets over [min, cap]
+    enum { BUCKETS = 10 };
+    uint32_t hist[BUCKETS] = { 0 };
+    double sum = 0;
+    backoff_t b;
+
+    backoff_init(&b, &mqtt_cfg, 12345);
+    for (int i = 0; i < DRAWS * 5; i++) {
+        b.attempt = 6;
+        uint32_t delay = backoff_next_delay_ms(&b);
+        sum += delay;
+        hist[(uint64_t)(delay - mqtt_cfg.min_ms) * BUCKETS / (mqtt_cfg.cap_ms - mqtt_cfg.min_ms + 1)]++;
+    }
+    double mean = sum / (DRAWS * 5);
+    double expected = (mqtt_cfg.min_ms + mqtt_cfg.cap_ms) / 2.0;
+    CHECK(mean > expected * 0.98 && mean < expected * 1.02);
+    for (int i = 0; i < BUCKETS; i++) {
+        CHECK(hist[i] > DRAWS * 5 / BUCKETS * 9 / 10);
+        CHECK(hist[i] < DRAWS * 5 / BUCKETS * 11 / 10);
+    }
+}
+
+static void test_seeds_decorrelate(void)
+{
+    backoff_t a, b, zero;
+    int same = 0;
+
+    backoff_init(&a, &mqtt_cfg, 1);
+    backoff_init(&b, &mqtt_cfg, 2);
+    backoff_init(&zero, &mqtt_cfg, 0);
+    for (int i = 0; i < 100; i++) {
+        a.attempt = b.attempt = zero.attempt = 6;
+        same += backoff_next_delay_ms(&a) == backoff_next_delay_ms(&b);
+        CHECK(backoff_next_delay_ms(&zero) >= mqtt_cfg.min_ms);     // seed 0 still jitters
+    }
+    CHECK(same < 5);
+}
+
+static void test_reset_only_after_stable_connection(void)
+{
+    backoff_t b;
+
+    backoff_init(&b, &mqtt_cfg, 9);
+    for (int i = 0; i < 5; i++) {
+        backoff_next_delay_ms(&b);
+    }
+    CHECK_EQ(backoff_attempt(&b), 5);
+
+    // Failed attempts never connected, nothing to reset
+    backoff_on_disconnected(&b, 1000);
+    CHECK_EQ(backoff_attempt(&b), 5);
+
+    // A flapping link keeps its place in the backoff
+    backoff_on_connected(&b, 10000);
+    backoff_on_disconnected(&b, 10000 + mqtt_cfg.stable_ms - 1);
+    CHECK_EQ(backoff_attempt(&b), 5);
+    CHECK(backoff_next_delay_ms(&b) <= ceiling_ms(5));
+
+    // Up for stable_ms: the next outage starts from the first delay again
+    backoff_on_connected(&b, 100000);
+    backoff_on_disconnected(&b, 100000 + mqtt_cfg.stable_ms);
+    CHECK_EQ(backoff_attempt(&b), 0);
+    CHECK(backoff_next_delay_ms(&b) <= mqtt_cfg.base_ms);
+
+    // Disconnect reported twice: the second one does not see a connection
+    backoff_on_disconnected(&b, 500000);
+    CHECK_EQ(backoff_attempt(&b), 1);
+}
+
+int main(void)
+{
+    TEST_RUN(test_delays_within_min_and_cap);
+    TEST_RUN(test_cap_holds_for_large_attempts);
+    TEST_RUN(test_min_above_ceiling);
+    TEST_RUN(test_full_jitter_is_uniform);
+    TEST_RUN(test_seeds_decorrelate);
+    TEST_RUN(test_reset_only_after_stable_connection);
+    return 0;
+}
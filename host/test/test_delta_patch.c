@@ -0,0 +1,288 @@
+/*
+ * delta_patch on artifacts built by tools/ota_artifact.py.
+ *
+ * delta_samples.py writes two releases of a sample image and runs the tool
+ * on them at build time (DELTA_SAMPLES_DIR). The patch must rebuild the
+ * image in any chunking, also when the stream stops anywhere and continues
+ * later. Corrupted and truncated patches must end in the matching
+ * DELTA_PATCH_ERR_*, or never report done, without writing past the
+ * image. Compressed artifacts go through ota_decoder and the tinfl shim.
+ */
+
+#include <string.h>
+
+#include "delta_patch.h"
+#include "ota_artifact.h"
+#include "ota_decoder.h"
+#include "test.h"
+
+#define MAX_FILE    (256 * 1024)
+
+typedef struct {
+    uint8_t data[MAX_FILE];
+    size_t len;
+} blob_t;
+
+static blob_t base, image, unrelated, delta, delta_z, compressed, unrelated_delta;
+
+static void load(blob_t *blob, const char *name)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", DELTA_SAMPLES_DIR, name);
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "%s missing, build the delta_samples target\n", path);
+        exit(1);
+    }
+    blob->len = fread(blob->data, 1, sizeof(blob->data), f);
+    CHECK(feof(f));
+    fclose(f);
+}
+
+/* Output of one apply */
+typedef struct {
+    const blob_t *base;
+    uint8_t out[MAX_FILE];
+    size_t len;
+    bool fail_read;
+    size_t fail_write_at;       // a write reaching past this many bytes fails, 0 never
+} target_t;
+
+static int read_base(void *ctx, uint32_t offset, uint8_t *buf, size_t len)
+{
+    target_t *t = ctx;
+    if (t->fail_read || offset + len > t->base->len) {
+        return -1;
+    }
+    memcpy(buf, &t->base->data[offset], len);
+    return 0;
+}
+
+static int write_out(void *ctx, const uint8_t *data, size_t len)
+{
+    target_t *t = ctx;
+    if ((t->fail_write_at != 0 && t->len + len > t->fail_write_at) || t->len + len > sizeof(t->out)) {
+        return -1;
+    }
+    memcpy(&t->out[t->len], data, len);
+    t->len += len;
+    return 0;
+}
+
+static target_t target;
+static delta_patch_t patch;
+
+/* Op stream of an uncompressed delta artifact, and its header */
+static const uint8_t *ops_of(const blob_t *artifact, ota_artifact_header_t *header, size_t *len)
+{
+    CHECK(ota_artifact_parse(artifact->data, artifact->len, header));
+    CHECK_EQ(header->flags, OTA_ARTIFACT_DELTA);
+    *len = artifact->len - OTA_ARTIFACT_HEADER_SIZE;
+    return artifact->data + OTA_ARTIFACT_HEADER_SIZE;
+}
+
+static void start(uint32_t base_size)
+{
+    memset(&target, 0, sizeof(target));
+    target.base = &base;
+    delta_patch_init(&patch, base_size, read_base, write_out, &target);
+}
+
+/* Feed in chunks of step bytes, stops at the first error */
+static delta_patch_err_t feed(const uint8_t *ops, size_t len, size_t step)
+{
+    for (size_t pos = 0; pos < len; pos += step) {
+        size_t n = len - pos < step ? len - pos : step;
+        delta_patch_err_t err = delta_patch_feed(&patch, &ops[pos], n);
+        if (err != DELTA_PATCH_OK) {
+            return err;
+        }
+    }
+    return DELTA_PATCH_OK;
+}
+
+static void test_round_trip_any_chunking(void)
+{
+    static const size_t steps[] = { 1, 3, 8, 13, 512, 4096, MAX_FILE };
+    const struct {
+        const blob_t *artifact;
+        const blob_t *expected;
+    } cases[] = {
+        { &delta, &image },
+        { &unrelated_delta, &unrelated },
+    };
+
+    for (size_t c = 0; c < sizeof(cases) / sizeof(cases[0]); c++) {
+        ota_artifact_header_t header;
+        size_t len;
+        const uint8_t *ops = ops_of(cases[c].artifact, &header, &len);
+        CHECK_EQ(header.image_size, cases[c].expected->len);
+        CHECK_EQ(header.source_size, base.len);
+
+        for (size_t s = 0; s < sizeof(steps) / sizeof(steps[0]); s++) {
+            start(header.source_size);
+            CHECK_EQ(feed(ops, len, steps[s]), DELTA_PATCH_OK);
+            CHECK(delta_patch_done(&patch));
+            CHECK_EQ(patch.written, cases[c].expected->len);
+            CHECK_EQ(target.len, cases[c].expected->len);
+            CHECK(memcmp(target.out, cases[c].expected->data, target.len) == 0);
+        }
+        printf("%zu B image from a %zu B patch against a %zu B base\n", cases[c].expected->len, len, base.len);
+    }
+}
+
+/* Stopping anywhere, inside op bytes, arguments or literals, is not an error and not done */
+static void test_truncated_then_resumed(void)
+{
+    ota_artifact_header_t header;
+    size_t len;
+    const uint8_t *ops = ops_of(&delta, &header, &len);
+
+    for (size_t cut = 0; cut < len; cut++) {
+        start(header.source_size);
+        CHECK_EQ(feed(ops, cut, 64), DELTA_PATCH_OK);
+        CHECK(!delta_patch_done(&patch));
+        CHECK(target.len <= image.len);
+        CHECK(memcmp(target.out, image.data, target.len) == 0);
+
+        CHECK_EQ(feed(ops + cut, len - cut, 64), DELTA_PATCH_OK);
+        CHECK(delta_patch_done(&patch));
+        CHECK_EQ(target.len, image.len);
+    }
+}
+
+/* Offset of the first op of the given kind in a valid stream */
+static size_t find_op(const uint8_t *ops, size_t len, uint8_t kind)
+{
+    size_t pos = 0;
+    while (pos < len && ops[pos] != kind) {
+        uint8_t op = ops[pos];
+        CHECK(op == DELTA_OP_COPY || op == DELTA_OP_INSERT);
+        pos += op == DELTA_OP_COPY ? 9 : 5 + (ops[pos + 1] | ops[pos + 2] << 8 | ops[pos + 3] << 16 |
+                                              (uint32_t)ops[pos + 4] << 24);
+    }
+    CHECK(pos < len);
+    return pos;
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static void test_corrupt_patches(void)
+{
+    static uint8_t bad[MAX_FILE + 1];
+    ota_artifact_header_t header;
+    size_t len;
+    const uint8_t *ops = ops_of(&delta, &header, &len);
+    size_t copy = find_op(ops, len, DELTA_OP_COPY);
+    size_t insert = find_op(ops, len, DELTA_OP_INSERT);
+
+    // Unknown op where an op is expected
+    memcpy(bad, ops, len);
+    bad[insert] = 0x7f;
+    start(header.source_size);
+    CHECK_EQ(feed(bad, len, 4096), DELTA_PATCH_ERR_FORMAT);
+
+    // Anything after the end op
+    memcpy(bad, ops, len);
+    bad[len] = DELTA_OP_END;
+    start(header.source_size);
+    CHECK_EQ(feed(bad, len + 1, 4096), DELTA_PATCH_ERR_FORMAT);
+    CHECK(delta_patch_done(&patch));
+
+    // Copy starting past the base, and one whose end wraps around 32 bits
+    memcpy(bad, ops, len);
+    put_u32(&bad[copy + 1], header.source_size + 1);
+    start(header.source_size);
+    CHECK_EQ(feed(bad, len, 4096), DELTA_PATCH_ERR_RANGE);
+    put_u32(&bad[copy + 1], header.source_size - 1);
+    put_u32(&bad[copy + 5], UINT32_MAX);
+    start(header.source_size);
+    CHECK_EQ(feed(bad, len, 4096), DELTA_PATCH_ERR_RANGE);
+
+    // A base shorter than the one the patch was made from
+    start(header.source_size / 2);
+    CHECK_EQ(feed(ops, len, 4096), DELTA_PATCH_ERR_RANGE);
+
+    // Base read and output write failures
+    start(header.source_size);
+    target.fail_read = true;
+    CHECK_EQ(feed(ops, len, 4096), DELTA_PATCH_ERR_IO);
+    CHECK_EQ(target.len, 0);
+    start(header.source_size);
+    target.fail_write_at = image.len / 2;
+    CHECK_EQ(feed(ops, len, 4096), DELTA_PATCH_ERR_IO);
+    CHECK(target.len <= image.len / 2);
+
+    // A literal length running past the stream only leaves the patch unfinished
+    memcpy(bad, ops, len);
+    put_u32(&bad[insert + 1], 0x00100000);
+    start(header.source_size);
+    CHECK_EQ(feed(bad, len, 4096), DELTA_PATCH_OK);
+    CHECK(!delta_patch_done(&patch));
+}
+
+/* Compressed artifacts through ota_decoder, the way the OTA task applies them */
+static bool accept_begin(void *ctx, const ota_decoder_t *decoder)
+{
+    return true;
+}
+
+static bool accept_head(void *ctx, const uint8_t *head, size_t len)
+{
+    return true;
+}
+
+static const ota_decoder_ops_t decoder_ops = {
+    .begin = accept_begin,
+    .check_head = accept_head,
+    .write = write_out,
+    .read_base = read_base,
+};
+
+static void test_compressed_artifacts(void)
+{
+    static uint8_t arena_storage[64 * 1024];
+    const blob_t *artifacts[] = { &delta_z, &compressed };
+
+    for (size_t a = 0; a < 2; a++) {
+        arena_t arena;
+        ota_decoder_t decoder;
+
+        memset(&target, 0, sizeof(target));
+        target.base = &base;
+        arena_init(&arena, arena_storage, sizeof(arena_storage));
+        ota_decoder_init(&decoder, &decoder_ops, &target, &arena, 289, false);
+        for (size_t pos = 0; pos < artifacts[a]->len; pos += 1000) {
+            size_t n = artifacts[a]->len - pos < 1000 ? artifacts[a]->len - pos : 1000;
+            CHECK_EQ(ota_decoder_feed(&decoder, &artifacts[a]->data[pos], n), OTA_DECODER_OK);
+        }
+        CHECK(ota_decoder_complete(&decoder));
+        ota_decoder_end(&decoder);
+        CHECK_EQ(target.len, image.len);
+        CHECK(memcmp(target.out, image.data, image.len) == 0);
+        printf("%zu B compressed %s artifact\n", artifacts[a]->len, a == 0 ? "delta" : "image");
+    }
+}
+
+int main(void)
+{
+    load(&base, "base.bin");
+    load(&image, "image.bin");
+    load(&unrelated, "unrelated.bin");
+    load(&delta, "delta.iota");
+    load(&delta_z, "delta_z.iota");
+    load(&compressed, "compressed.iota");
+    load(&unrelated_delta, "unrelated.iota");
+
+    TEST_RUN(test_round_trip_any_chunking);
+    TEST_RUN(test_truncated_then_resumed);
+    TEST_RUN(test_corrupt_patches);
+    TEST_RUN(test_compressed_artifacts);
+    return 0;
+}
@@ -0,0 +1,402 @@
+/*
+ * dlog: dlog_format against snprintf over a table of conversions (flags,
+ * * width and precision, h/hh/l/ll/j/z/t, doubles, strings, 64-bit values
+ * between 32-bit ones), truncation, the ring filling, dropping and wrapping
+ * with concurrent producers and a consumer, and the batch encoding.
+ *
+ * With --batch DIR it also writes DIR/dlog_batch.bin, records encoded the
+ * way dlog_task publishes them, and DIR/dlog_expected.txt, the lines
+ * tools/dlog_decode.py must print for them given this executable as the
+ * ELF. test_dlog_decode.py runs that round trip.
+ */
+
+#include <inttypes.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "dlog.h"
+#include "test.h"
+
+#define LINE_SIZE       256
+#define PRODUCERS       4
+#define PER_PRODUCER    20000
+#define CONCURRENT_RING 64
+
+/* Its address in the batch header lets the decoder undo the PIE load bias, as in dlog_task.c */
+static const char dlog_anchor[] __attribute__((used)) = "dlog_anchor";
+
+static const char *resolve_any(void *ctx, uintptr_t addr)
+{
+    (void)ctx;
+    return (const char *)addr;
+}
+
+static const char *resolve_none(void *ctx, uintptr_t addr)
+{
+    (void)ctx;
+    (void)addr;
+    return NULL;
+}
+
+static void check_same(const char *fmt, const char *got, const char *want, int line)
+{
+    if (strcmp(got, want) != 0) {
+        fprintf(stderr, "%s:%d: \"%s\" formats to \"%s\", snprintf gives \"%s\"\n", __FILE__, line, fmt, got, want);
+        exit(1);
+    }
+}
+
+/* Pack the arguments the way the DLOG macros do and compare with snprintf, at every buffer size too */
+#define CHECK_FORMAT(fmt, ...) do { \
+        uint32_t _words[DLOG_MAX_WORDS]; \
+        size_t _n = 0; \
+        DLOG_PACK(_words, _n, ##__VA_ARGS__); \
+        char _want[LINE_SIZE], _got[LINE_SIZE]; \
+        int _len = snprintf(_want, sizeof(_want), fmt, ##__VA_ARGS__); \
+        CHECK_EQ(dlog_format(_got, sizeof(_got), fmt, _words, _n, resolve_any, NULL), _len); \
+        check_same(fmt, _got, _want, __LINE__); \
+        for (size_t _size = 1; _size <= (size_t)_len; _size++) { \
+            snprintf(_want, _size, fmt, ##__VA_ARGS__); \
+            CHECK_EQ(dlog_format(_got, _size, fmt, _words, _n, resolve_any, NULL), _size - 1); \
+            check_same(fmt, _got, _want, __LINE__); \
+        } \
+    } while (0)
+
+static void test_format_matches_snprintf(void)
+{
+    static int object;
+    short s = -2;
+    unsigned short us = 65535;
+    signed char sc = -3;
+    unsigned char uc = 250;
+
+    CHECK_FORMAT("plain text, no conversions");
+    CHECK_FORMAT("100%% of %d%%", 5);
+    CHECK_FORMAT("%d %i %u", -42, 17, 4000000000u);
+    CHECK_FORMAT("%d %d", INT_MIN, INT_MAX);
+    CHECK_FORMAT("[%5d|%-5d|%05d|%+d|% d|%.3d]", 42, 42, 42, 42, 42, 7);
+    CHECK_FORMAT("%x %X %#x %#X %o %#o %#x", 0xbeefu, 0xbeefu, 255u, 255u, 8u, 8u, 0u);
+
+    // * takes width and precision from the arguments, negative width means left aligned
+    CHECK_FORMAT("[%*d|%-*d|%.*d|%*d]", 6, 42, 6, 42, 4, 7, -6, 42);
+    CHECK_FORMAT("[%*.*f|%.*s]", 10, 3, 3.14159, 2, "abc");
+
+    // h and hh arguments arrive promoted to int, the formatter truncates and sign-extends
+    CHECK_FORMAT("%hd %hu %hhd %hhu %hx", s, us, sc, uc, s);
+    CHECK_FORMAT("%hd %hhd %hhd %hhu %hu", 0x12345, 0x1ff, -129, 0x1ff, -1);
+
+    // 64-bit arguments take two words, also between 32-bit ones
+    CHECK_FORMAT("%ld %lu %lx", -5L, ULONG_MAX, 0x123456789abcL);
+    CHECK_FORMAT("%lld %llu %llx", LLONG_MIN, ULLONG_MAX, 0x1122334455667788ULL);
+    CHECK_FORMAT("%jd %zu %td %zx", (intmax_t)-9, (size_t)12345678901ULL, (ptrdiff_t)-7, (size_t)SIZE_MAX);
+    CHECK_FORMAT("%d %lld %d %f %d", 1, -2LL, 3, 4.5, 5);
+    CHECK_FORMAT("%" PRIu64 " %" PRId32 " %" PRIx64, UINT64_MAX, INT32_MIN, (uint64_t)0xdeadbeef00ULL);
+
+    CHECK_FORMAT("%f %e %g %E", 1.5, 12345.678, 0.0001, -2.5e-10);
+    CHECK_FORMAT("%G %.2f %a", 1e20, 2.675, 1.0);
+    CHECK_FORMAT("[%8.3f|%-8.2e|%+.0f|%#.0f]", -3.14159, 0.5, 2.5, 3.0);
+    CHECK_FORMAT("%f %f", 1.0 / 0.0, -1.0 / 0.0);
+    CHECK_FORMAT("%.3f", (double)1.25f);
+
+    CHECK_FORMAT("%c%c%c [%3c|%-3c]", 'a', 'b', 'c', 'x', 'y');
+    CHECK_FORMAT("[%s|%10s|%-10s|%.3s]", "abc", "right", "left", "truncate");
+    CHECK_FORMAT("%p", (void *)&object);
+
+    // Eight words, the most a record holds
+    CHECK_FORMAT("%d %d %d %d %d %d %d %d", 1, 2, 3, 4, 5, 6, 7, 8);
+    CHECK_FORMAT("%lld %f %llu %g", 1LL, 2.0, 3ULL, 4.0);
+}
+
+static void test_format_differences(void)
+{
+    char out[LINE_SIZE];
+    uint32_t words[DLOG_MAX_WORDS] = { 0 };
+    size_t n = 0;
+
+    // Unresolved %s print the address instead of dereferencing it
+    const char *text = "stale";
+    DLOG_PACK(words, n, text);
+    char want[64];
+    snprintf(want, sizeof(want), "[<str 0x%llx>]", (unsigned long long)(uintptr_t)text);
+    dlog_format(out, sizeof(out), "[%s]", words, n, resolve_none, NULL);
+    check_same("[%s]", out, want, __LINE__);
+    dlog_format(out, sizeof(out), "[%s]", words, n, NULL, NULL);
+    check_same("[%s]", out, want, __LINE__);
+
+    // Missing words read as zero
+    words[0] = 7;
+    dlog_format(out, sizeof(out), "%d %d %lld", words, 1, NULL, NULL);
+    check_same("%d %d %lld", out, "7 0 0", __LINE__);
+
+    // Unknown conversions and a trailing % print as written
+    dlog_format(out, sizeof(out), "%5q %d %", words, 1, NULL, NULL);
+    check_same("%5q %d %", out, "%5q 7 ", __LINE__);
+
+    CHECK_EQ(dlog_format(out, 0, "%d", words, 1, NULL, NULL), 0);
+}
+
+static void test_ring_full_drop_wrap(void)
+{
+    dlog_slot_t slots[8];
+    dlog_ring_t ring;
+    uint32_t next_in = 0, next_out = 0;
+
+    // Start a few laps short of the unsigned wrap, positions must survive it
+    dlog_ring_init(&ring, slots, 8);
+    uint32_t start = UINT32_MAX - 8 * 5 + 1;
+    atomic_store(&ring.head, start);
+    ring.tail = start;
+    for (uint32_t i = 0; i < 8; i++) {
+        atomic_store(&slots[(start + i) & 7].seq, start + i);
+    }
+
+    CHECK(dlog_ring_peek(&ring) == NULL);
+    for (int lap = 0; lap < 20; lap++) {
+        // Fill up, then one more is dropped
+        while (dlog_ring_push(&ring, DLOG_LEVEL_INFO, 0, "tag", "fmt %u", next_in, &next_in, 1)) {
+            next_in++;
+        }
+        CHECK_EQ(next_in - next_out, 8);
+        CHECK_EQ(atomic_load(&ring.dropped), lap + 1);
+
+        // Drain a varying number, oldest first
+        for (int i = 0; i < 3 + lap % 6; i++) {
+            const dlog_slot_t *slot = dlog_ring_peek(&ring);
+            CHECK(slot != NULL);
+            CHECK_EQ(slot->words[0], next_out);
+            CHECK_EQ(slot->timestamp_us, next_out);
+            CHECK_EQ(slot->n_words, 1);
+            // Peeking again gives the same record until it is released
+            CHECK(dlog_ring_peek(&ring) == slot);
+            dlog_ring_release(&ring);
+            next_out++;
+        }
+    }
+    CHECK((uint32_t)(ring.tail - start) > 8 * 5);   // wrapped around zero
+
+    // More words than fit are cut to DLOG_MAX_WORDS
+    while (dlog_ring_peek(&ring) != NULL) {
+        dlog_ring_release(&ring);
+    }
+    uint32_t many[DLOG_MAX_WORDS + 4] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12 };
+    CHECK(dlog_ring_push(&ring, DLOG_LEVEL_WARN, 1, "tag", "fmt", -1, many, DLOG_MAX_WORDS + 4));
+    const dlog_slot_t *slot = dlog_ring_peek(&ring);
+    CHECK(slot != NULL);
+    CHECK_EQ(slot->n_words, DLOG_MAX_WORDS);
+    CHECK_EQ(slot->words[DLOG_MAX_WORDS - 1], DLOG_MAX_WORDS);
+    CHECK_EQ(slot->level, DLOG_LEVEL_WARN);
+    CHECK_EQ(slot->core, 1);
+    CHECK_EQ(slot->timestamp_us, -1);
+}
+
+typedef struct {
+    dlog_ring_t *ring;
+    uint8_t id;
+    uint32_t pushed;
+    uint32_t refused;
+} producer_t;
+
+static atomic_int producers_running;
+
+static void *producer(void *arg)
+{
+    producer_t *p = arg;
+    for (uint32_t i = 0; i < PER_PRODUCER; i++) {
+        // Words repeat the identity so a torn record shows
+        uint32_t words[4] = { p->id, i, p->id ^ i, ~i };
+        if (dlog_ring_push(p->ring, DLOG_LEVEL_INFO, p->id, "tag", "producer %u record %u", ((int64_t)p->id << 32) | i,
+                           words, 2 + i % 3)) {
+            p->pushed++;
+        } else {
+            p->refused++;
+            sched_yield();      // let the consumer catch up, so pushes both succeed and fail
+        }
+    }
+    atomic_fetch_sub(&producers_running, 1);
+    return NULL;
+}
+
+static void test_ring_concurrent(void)
+{
+    static dlog_slot_t slots[CONCURRENT_RING];
+    dlog_ring_t ring;
+    pthread_t threads[PRODUCERS];
+    producer_t producers[PRODUCERS];
+    uint32_t received[PRODUCERS] = { 0 };
+    int64_t last[PRODUCERS];
+
+    dlog_ring_init(&ring, slots, CONCURRENT_RING);
+    atomic_store(&producers_running, PRODUCERS);
+    for (int i = 0; i < PRODUCERS; i++) {
+        producers[i] = (producer_t){ .ring = &ring, .id = (uint8_t)i };
+        last[i] = -1;
+        CHECK(pthread_create(&threads[i], NULL, producer, &producers[i]) == 0);
+    }
+
+    // Consume until every producer is done and the ring is empty
+    while (1) {
+        bool done = atomic_load(&producers_running) == 0;
+        const dlog_slot_t *slot = dlog_ring_peek(&ring);
+        if (slot == NULL) {
+            if (done) {
+                break;
+            }
+            sched_yield();
+            continue;
+        }
+        uint8_t id = slot->core;
+        CHECK(id < PRODUCERS);
+        uint32_t i = slot->words[1];
+        CHECK_EQ(slot->words[0], id);
+        CHECK_EQ(slot->timestamp_us, ((int64_t)id << 32) | i);
+        CHECK_EQ(slot->n_words, 2 + i % 3);
+        if (slot->n_words > 2) {
+            CHECK_EQ(slot->words[2], id ^ i);
+        }
+        if (slot->n_words > 3) {
+            CHECK_EQ(slot->words[3], ~i);
+        }
+        // Each producer's records arrive in the order it pushed them
+        CHECK((int64_t)i > last[id]);
+        last[id] = i;
+        received[id]++;
+        dlog_ring_release(&ring);
+    }
+
+    uint32_t refused = 0;
+    for (int i = 0; i < PRODUCERS; i++) {
+        pthread_join(threads[i], NULL);
+        CHECK_EQ(producers[i].pushed + producers[i].refused, PER_PRODUCER);
+        CHECK_EQ(received[i], producers[i].pushed);
+        refused += producers[i].refused;
+    }
+    CHECK_EQ(atomic_load(&ring.dropped), refused);
+    printf("%d producers, %u records each: %u dropped by a %d slot ring\n", PRODUCERS, PER_PRODUCER, refused,
+           CONCURRENT_RING);
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void test_encode(void)
+{
+    dlog_slot_t slot = {
+        .fmt = (const char *)(uintptr_t)0x3f401234,
+        .tag = (const char *)(uintptr_t)0x3f405678,
+        .timestamp_us = 0x123456789aLL,
+        .level = DLOG_LEVEL_ERROR,
+        .core = 1,
+        .n_words = 3,
+        .words = { 0xdeadbeef, 1, 0x80000000 },
+    };
+    uint8_t buf[DLOG_RECORD_MAX_SIZE];
+
+    CHECK_EQ(dlog_encode_record(&slot, buf, DLOG_RECORD_HEADER_SIZE + 11), 0);
+    CHECK_EQ(dlog_encode_record(&slot, buf, sizeof(buf)), DLOG_RECORD_HEADER_SIZE + 12);
+    CHECK_EQ(get_u32(buf), 0x3f401234);
+    CHECK_EQ(get_u32(buf + 4), 0x3f405678);
+    CHECK_EQ(get_u32(buf + 8), 0x3456789a);
+    CHECK_EQ(get_u32(buf + 12), 0x12);
+    CHECK(buf[16] == DLOG_LEVEL_ERROR && buf[17] == 1 && buf[18] == 3 && buf[19] == 0);
+    CHECK_EQ(get_u32(buf + 20), 0xdeadbeef);
+    CHECK_EQ(get_u32(buf + 28), 0x80000000);
+
+    CHECK_EQ(dlog_encode_header(buf, 0x1234, 0x3f400000, 70000), DLOG_BATCH_HEADER_SIZE);
+    CHECK(buf[0] == DLOG_BATCH_MAGIC && buf[1] == DLOG_BATCH_VERSION && buf[2] == 0x34 && buf[3] == 0x12);
+    CHECK_EQ(get_u32(buf + 4), 0x3f400000);
+    CHECK_EQ(get_u32(buf + 8), 70000);
+}
+
+/* Records for the decoder round trip, the expected line is what snprintf makes of the same call */
+static dlog_slot_t batch_slots[32];
+static dlog_ring_t batch_ring;
+static FILE *expected;
+
+#define BATCH_LOG(level, tag, ts, fmt, ...) do { \
+        uint32_t _words[DLOG_MAX_WORDS]; \
+        size_t _n = 0; \
+        DLOG_PACK(_words, _n, ##__VA_ARGS__); \
+        CHECK(dlog_ring_push(&batch_ring, level, 0, tag, fmt, ts, _words, _n)); \
+        char _text[LINE_SIZE]; \
+        snprintf(_text, sizeof(_text), fmt, ##__VA_ARGS__); \
+        fprintf(expected, "%c (%lld) %s: %s\n", "?EWID"[level], (long long)(ts) / 1000, tag, _text); \
+    } while (0)
+
+/* Encode what the ring holds as one batch, the way dlog_task does */
+static size_t write_batch(FILE *f, uint32_t dropped)
+{
+    uint8_t batch[2048];
+    size_t len = DLOG_BATCH_HEADER_SIZE;
+    uint16_t n_records = 0;
+    const dlog_slot_t *slot;
+
+    while ((slot = dlog_ring_peek(&batch_ring)) != NULL) {
+        size_t size = dlog_encode_record(slot, batch + len, sizeof(batch) - len);
+        CHECK(size > 0);
+        len += size;
+        n_records++;
+        dlog_ring_release(&batch_ring);
+    }
+    dlog_encode_header(batch, n_records, (uint32_t)(uintptr_t)dlog_anchor, dropped);
+    CHECK(fwrite(batch, 1, len, f) == len);
+    return n_records;
+}
+
+static void write_round_trip(const char *dir)
+{
+    static const char *const TAG = "intercom_mqtt";
+    static const char *const topic = "/topic/intercom/ring";
+    char path[512];
+
+    snprintf(path, sizeof(path), "%s/dlog_batch.bin", dir);
+    FILE *batch = fopen(path, "wb");
+    snprintf(path, sizeof(path), "%s/dlog_expected.txt", dir);
+    expected = fopen(path, "w");
+    CHECK(batch != NULL && expected != NULL);
+    dlog_ring_init(&batch_ring, batch_slots, 32);
+
+    BATCH_LOG(DLOG_LEVEL_INFO, TAG, 1234567, "Published %d bytes to %s", 42, topic);
+    BATCH_LOG(DLOG_LEVEL_WARN, "intercom_ring", 2000000, "Ring on channel %u, peak %u, %lld us", 6u, 2900u,
+              -1500000LL);
+    BATCH_LOG(DLOG_LEVEL_ERROR, TAG, 3000001, "[%5d|%-5d|%05d|%+d|% d|%.3d]", 42, 42, 42, 42, 42, 7);
+    BATCH_LOG(DLOG_LEVEL_DEBUG, TAG, 3500000, "%x %X %#x %#X %o %#o %#x %#5o", 0xbeefu, 0xbeefu, 255u, 255u, 8u,
+              8u, 0u, 8u);
+    BATCH_LOG(DLOG_LEVEL_INFO, TAG, 4000000, "[%*d|%-*d|%.*d]", 6, 42, 6, 42, 4, 7);
+    BATCH_LOG(DLOG_LEVEL_INFO, TAG, 5000000, "%hd %hu %hhd %hhu %hd", -2, 65535, -3, 250, 0x12345);
+    BATCH_LOG(DLOG_LEVEL_INFO, TAG, 6000000, "%ld %lu %zu %jd", -5L, ULONG_MAX, (size_t)7, (intmax_t)-9);
+    BATCH_LOG(DLOG_LEVEL_INFO, TAG, 7000000, "%d %lld %d %f %d", 1, -2LL, 3, 4.5, 5);
+    BATCH_LOG(DLOG_LEVEL_INFO, TAG, 8000000, "%f %e %g %.2f", 1.5, 12345.678, 0.0001, 2.675);
+    BATCH_LOG(DLOG_LEVEL_INFO, TAG, 8500000, "%8.3f %c%c [%3c] 100%%", -3.14159, 'o', 'k', 'x');
+    BATCH_LOG(DLOG_LEVEL_INFO, TAG, 9000000, "[%s|%8s|%-8s|%.3s]", topic, "ab", "cd", "truncate");
+    BATCH_LOG(DLOG_LEVEL_INFO, TAG, 9500000, "no arguments");
+    CHECK_EQ(write_batch(batch, 0), 12);
+
+    // A second batch after drops, the decoder notes them first
+    fprintf(expected, "# 3 records dropped since boot\n");
+    BATCH_LOG(DLOG_LEVEL_WARN, TAG, 10000000, "after the drop %u", 3u);
+    CHECK_EQ(write_batch(batch, 3), 1);
+
+    fclose(batch);
+    fclose(expected);
+    printf("wrote %s/dlog_batch.bin\n", dir);
+}
+
+int main(int argc, char **argv)
+{
+    if (argc > 2 && strcmp(argv[1], "--batch") == 0) {
+        write_round_trip(argv[2]);
+        return 0;
+    }
+
+    TEST_RUN(test_format_matches_snprintf);
+    TEST_RUN(test_format_differences);
+    TEST_RUN(test_ring_full_drop_wrap);
+    TEST_RUN(test_ring_concurrent);
+    TEST_RUN(test_encode);
+    return 0;
+}
@@ -0,0 +1,79 @@
+#!/usr/bin/env python3
+"""tools/dlog_decode.py against records test_dlog encodes.
+
+Runs TEST_DLOG --batch into a temporary directory and decodes the batches
+with TEST_DLOG itself as the ELF: the format strings, tags and %s constants
+are in its image and its dlog_anchor gives the load bias, like the firmware.
+Every line must match what snprintf printed for the same call. Malformed
+batches must be refused with ValueError.
+
+Usage:
+    host/test/test_dlog_decode.py build/test_dlog
+"""
+
+import importlib.util
+import os
+import subprocess
+import sys
+import tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+TOOL = os.path.join(HERE, "..", "..", "tools", "dlog_decode.py")
+
+
+def load_tool():
+    spec = importlib.util.spec_from_file_location("dlog_decode", TOOL)
+    module = importlib.util.module_from_spec(spec)
+    spec.loader.exec_module(module)
+    return module
+
+
+def main():
+    if len(sys.argv) != 2:
+        print(__doc__)
+        return 2
+    tool = load_tool()
+    failed = False
+
+    with tempfile.TemporaryDirectory() as out:
+        subprocess.run([sys.argv[1], "--batch", out], check=True, stdout=subprocess.DEVNULL)
+        with open(os.path.join(out, "dlog_batch.bin"), "rb") as f:
+            data = f.read()
+        with open(os.path.join(out, "dlog_expected.txt")) as f:
+            expected = f.read().splitlines()
+
+    elf = tool.Elf(sys.argv[1])
+    anchor = elf.symbol(tool.ANCHOR_SYMBOL)
+    if anchor is None:
+        print("no %s symbol in %s" % (tool.ANCHOR_SYMBOL, sys.argv[1]))
+        return 1
+    decoded = list(tool.decode(data, elf, anchor))
+    for i in range(max(len(decoded), len(expected))):
+        got = decoded[i] if i < len(decoded) else "<missing>"
+        want = expected[i] if i < len(expected) else "<missing>"
+        if got != want:
+            print("line %d: decoded %r, expected %r" % (i + 1, got, want))
+            failed = True
+    if not failed:
+        print("ok %d lines" % len(decoded))
+
+    bad = {
+        "short": data[:5],
+        "magic": b"X" + data[1:],
+        "version": data[:1] + b"\x09" + data[2:],
+        "truncated record": data[:tool.HEADER.size + 10],
+        "truncated words": data[:-1],
+    }
+    for what, blob in bad.items():
+        try:
+            list(tool.decode(blob, elf, anchor))
+            print("%s batch was accepted" % what)
+            failed = True
+        except ValueError:
+            pass
+
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
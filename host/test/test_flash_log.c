@@ -0,0 +1,380 @@
+/*
+ * flash_log on a file-backed NOR flash emulator (flash_file.c) sized like
+ * the evlog partition: 48 sectors of 4 KB.
+ *
+ * Throughput and wear are measured on outage-sized bursts of 20 byte event
+ * records, with device time modelled from page program and erase times.
+ * Crash consistency is checked by cutting power at random points of a mixed
+ * append and drain workload, again and again on the same file: after each
+ * remount every record that was acked and not drained must come back intact
+ * and in order, nothing drained may come back unless the cut hit an erase,
+ * and the log must go on working. The torn sector header and torn record
+ * cases are also run on purpose.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "flash_file.h"
+#include "flash_log.h"
+#include "test.h"
+
+#define FLASH_SIZE      0x30000
+#define SECTOR_SIZE     4096
+#define EVENT_SIZE      20
+#define MAX_IDS         (1 << 23)
+
+static char path[64];
+static flash_file_t flash;
+static flash_ops_t ops;
+static flash_log_t log_;
+
+static void power_on(void)
+{
+    CHECK(flash_file_open(&flash, path, FLASH_SIZE, SECTOR_SIZE));
+    flash_file_ops(&flash, &ops);
+    CHECK(flash_log_mount(&log_, &ops));
+}
+
+static void reboot(void)
+{
+    flash_file_close(&flash);
+    power_on();
+}
+
+static void wipe(void)
+{
+    flash_file_close(&flash);
+    unlink(path);
+    power_on();
+}
+
+/* Record contents follow from the id, so any record read back can be checked on its own */
+static size_t make_record(uint32_t id, size_t len, uint8_t *out)
+{
+    memcpy(out, &id, sizeof(id));
+    for (size_t i = sizeof(id); i < len; i++) {
+        out[i] = (uint8_t)(id * 31 + i);
+    }
+    return len;
+}
+
+static size_t random_len(uint32_t id)
+{
+    return 8 + (id * 7) % 41;
+}
+
+static uint32_t rng = 0x9e3779b9;
+
+static uint32_t next_random(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static void test_throughput_and_wear(void)
+{
+    uint8_t record[EVENT_SIZE], buf[FLASH_LOG_MAX_RECORD];
+    const int bursts = 40, burst = 5000;
+    int64_t append_ns = 0, drain_ns = 0, append_us = 0, drain_us = 0;
+    uint64_t payload = 0;
+    uint32_t id = 0;
+
+    wipe();
+    uint64_t written_before = flash.bytes_written;
+    for (int b = 0; b < bursts; b++) {
+        // An outage: events pile up, then the backlog is replayed
+        int64_t device = flash.device_us, start = test_now_ns();
+        for (int i = 0; i < burst; i++, id++) {
+            CHECK(flash_log_append(&log_, record, make_record(id, EVENT_SIZE, record)));
+        }
+        append_ns += test_now_ns() - start;
+        append_us += flash.device_us - device;
+        payload += (uint64_t)burst * EVENT_SIZE;
+
+        device = flash.device_us;
+        start = test_now_ns();
+        uint32_t expected = id - burst;
+        while (flash_log_peek(&log_, buf, sizeof(buf)) == EVENT_SIZE) {
+            uint32_t got;
+            memcpy(&got, buf, sizeof(got));
+            CHECK_EQ(got, expected);
+            expected++;
+            CHECK(flash_log_consume(&log_));
+        }
+        drain_ns += test_now_ns() - start;
+        drain_us += flash.device_us - device;
+        CHECK_EQ(flash_log_pending(&log_), 0);
+        CHECK_EQ(expected, id);
+    }
+
+    uint32_t min_erases = UINT32_MAX, max_erases = 0;
+    for (uint32_t s = 0; s < FLASH_SIZE / SECTOR_SIZE; s++) {
+        min_erases = flash.sector_erases[s] < min_erases ? flash.sector_erases[s] : min_erases;
+        max_erases = flash.sector_erases[s] > max_erases ? flash.sector_erases[s] : max_erases;
+    }
+    uint32_t appends = bursts * burst;
+    double amplification = (double)(flash.bytes_written - written_before) / payload;
+
+    printf("%u x %d B appends: host %.0f appends/s, device %.0f us each (%.0f appends/s), drain %.0f us each\n",
+           appends, EVENT_SIZE, appends * 1e9 / append_ns, (double)append_us / appends,
+           appends * 1e6 / append_us, (double)drain_us / appends);
+    printf("%.2f bytes programmed per payload byte, %u erases, %u..%u per sector, %u records dropped, host drain %.0f ns\n",
+           amplification, flash.erases, min_erases, max_erases, log_.dropped, (double)drain_ns / appends);
+
+    // A burst of 5000 is 0.6 of the ring, nothing may be dropped
+    CHECK_EQ(log_.dropped, 0);
+    CHECK_EQ(flash.set_bits, 0);
+    CHECK(amplification < 1.3);
+    CHECK(max_erases - min_erases <= 1);
+
+    // Mount of a full ring reads every sector header and record once
+    for (int i = 0; i < 7000; i++, id++) {
+        CHECK(flash_log_append(&log_, record, make_record(id, EVENT_SIZE, record)));
+    }
+    uint32_t pending = flash_log_pending(&log_);
+    flash_file_close(&flash);
+    CHECK(flash_file_open(&flash, path, FLASH_SIZE, SECTOR_SIZE));
+    flash_file_ops(&flash, &ops);
+    int64_t start = test_now_ns();
+    CHECK(flash_log_mount(&log_, &ops));
+    printf("mount of %u pending records: host %.0f us, device %.1f ms for %llu bytes read\n", pending,
+           (test_now_ns() - start) / 1000.0, flash.bytes_read * 1000.0 / FLASH_FILE_READ_BPS,
+           (unsigned long long)flash.bytes_read);
+    CHECK_EQ(flash_log_pending(&log_), pending);
+}
+
+/*
+ * Model of what the log holds: ids lo..hi-1 were acked and are neither drained
+ * nor dropped, lower ids are gone one way or the other.
+ */
+static uint8_t consumed[MAX_IDS];
+static uint32_t lo, hi;
+
+static bool append_next(void)
+{
+    uint8_t record[FLASH_LOG_MAX_RECORD];
+    uint32_t dropped = log_.dropped;
+    bool ok = flash_log_append(&log_, record, make_record(hi, random_len(hi), record));
+    lo += log_.dropped - dropped;
+    if (ok) {
+        hi++;
+    }
+    return ok;
+}
+
+static bool consume_next(void)
+{
+    uint8_t buf[FLASH_LOG_MAX_RECORD], expected[FLASH_LOG_MAX_RECORD];
+    int len = flash_log_peek(&log_, buf, sizeof(buf));
+    if (len < 0) {
+        return !flash.powered_off;
+    }
+    CHECK_EQ(len, make_record(lo, random_len(lo), expected));
+    CHECK(memcmp(buf, expected, len) == 0);
+    if (!flash_log_consume(&log_)) {
+        return false;
+    }
+    consumed[lo++] = 1;
+    return true;
+}
+
+typedef struct {
+    uint32_t recovered;
+    uint32_t lost;
+    uint32_t resurrected;       // drained records back after a cut inside an erase
+} recovery_t;
+
+/* Remount after a cut and drain everything, checking it against the model */
+static void recover(bool consume_in_flight, recovery_t *stats)
+{
+    uint8_t buf[FLASH_LOG_MAX_RECORD], expected[FLASH_LOG_MAX_RECORD];
+    bool erase_cut = flash.cut_in_erase;
+    uint32_t next = lo;     // oldest acked record not seen yet
+    uint32_t last = 0;
+    bool first = true;
+
+    reboot();
+    uint32_t pending = flash_log_pending(&log_);
+    uint32_t drained = 0;
+    int len;
+    while ((len = flash_log_peek(&log_, buf, sizeof(buf))) >= 0) {
+        uint32_t id;
+        CHECK(len >= (int)sizeof(id));
+        memcpy(&id, buf, sizeof(id));
+        CHECK(id <= hi);        // hi only if its append was cut after the record made it
+        CHECK(first || id > last);
+        CHECK_EQ(len, make_record(id, random_len(id), expected));
+        CHECK(memcmp(buf, expected, len) == 0);
+        if (consumed[id]) {
+            CHECK(erase_cut);
+            stats->resurrected++;
+        }
+        // Everything acked and not drained must be there, lo itself may have been drained by the cut
+        if (id >= lo) {
+            if (consume_in_flight && next == lo && id > lo) {
+                next = lo + 1;
+            }
+            if (id != next) {
+                fprintf(stderr, "records %u..%u missing after a cut\n", next, id - 1);
+                stats->lost += id - next;
+            }
+            next = id + 1;
+        }
+        first = false;
+        last = id;
+        CHECK(flash_log_consume(&log_));
+        consumed[id] = 1;
+        drained++;
+    }
+    CHECK_EQ(drained, pending);
+    if (consume_in_flight && next == lo) {
+        next = lo + 1;
+    }
+    if (next < hi) {
+        fprintf(stderr, "records %u..%u missing after a cut\n", next, hi - 1);
+        stats->lost += hi - next;
+    }
+    stats->recovered += drained;
+
+    // The log is empty now, the model starts over past anything that came back
+    if (!first && last >= hi) {
+        hi = last + 1;
+    }
+    lo = hi;
+}
+
+static void test_power_cuts(void)
+{
+    const int cuts = 250;
+    recovery_t stats = { 0 };
+    int in_erase = 0, in_consume = 0;
+
+    wipe();
+    lo = hi = 0;
+    memset(consumed, 0, sizeof(consumed));
+
+    for (int c = 0; c < cuts; c++) {
+        // Fill past the ring now and then, so rotation and dropping sectors get cut too
+        int fill = next_random() % 8 == 0 ? 9000 : (int)(next_random() % 1500);
+        for (int i = 0; i < fill; i++) {
+            CHECK(append_next());
+        }
+
+        // A drain only writes one byte per record, every fourth cut aims at one
+        bool drain = c % 4 == 1;
+        flash.cut_at = flash.progress + 1 + next_random() % (drain ? 64 : 3 * SECTOR_SIZE);
+        bool consume_in_flight = false;
+        while (!flash.powered_off) {
+            bool ok;
+            if ((drain || next_random() % 3 == 0) && flash_log_pending(&log_) > 0) {
+                ok = consume_next();
+                consume_in_flight = !ok;
+            } else {
+                ok = append_next();
+                consume_in_flight = false;
+            }
+            CHECK(ok || flash.powered_off);
+        }
+        in_erase += flash.cut_in_erase;
+        in_consume += consume_in_flight;
+        recover(consume_in_flight, &stats);
+        CHECK(hi < MAX_IDS - 20000);
+
+        // The log keeps working after the cut
+        for (int i = 0; i < 50; i++) {
+            CHECK(append_next());
+        }
+        for (int i = 0; i < 50; i++) {
+            CHECK(consume_next());
+        }
+        CHECK_EQ(flash_log_pending(&log_), 0);
+    }
+
+    printf("%d power cuts (%d in an erase, %d in a drain): %u records recovered, %u lost, "
+           "%u drained records back after a cut erase\n",
+           cuts, in_erase, in_consume, stats.recovered, stats.lost, stats.resurrected);
+    CHECK_EQ(stats.lost, 0);
+}
+
+/* Sector header cut after each byte: the sector must never shadow the older ones */
+static void test_torn_sector_header(void)
+{
+    uint8_t record[EVENT_SIZE], buf[FLASH_LOG_MAX_RECORD];
+
+    for (uint32_t cut = 0; cut <= 8; cut++) {
+        for (int variant = 0; variant < 16; variant++) {
+            wipe();
+            flash.rng += variant * 77 + cut;
+            uint32_t id = 0;
+
+            // Fill the first sector exactly, the next append has to start sector 1
+            while (log_.head_sector == 0 && log_.head_offset + 4 + EVENT_SIZE <= SECTOR_SIZE) {
+                CHECK(flash_log_append(&log_, record, make_record(id++, EVENT_SIZE, record)));
+            }
+            flash.cut_at = flash.progress + SECTOR_SIZE + cut;  // through the erase, into the header
+            CHECK(!flash_log_append(&log_, record, make_record(id, EVENT_SIZE, record)));
+
+            reboot();
+            CHECK_EQ(flash_log_pending(&log_), id);
+            for (uint32_t i = 0; i < id; i++) {
+                uint32_t got;
+                CHECK_EQ(flash_log_peek(&log_, buf, sizeof(buf)), EVENT_SIZE);
+                memcpy(&got, buf, sizeof(got));
+                CHECK_EQ(got, i);
+                CHECK(flash_log_consume(&log_));
+            }
+            CHECK(flash_log_append(&log_, record, make_record(id, EVENT_SIZE, record)));
+            CHECK_EQ(flash_log_pending(&log_), 1);
+        }
+    }
+}
+
+/* Record cut after each byte: earlier records stay, the torn one is skipped, appends go on */
+static void test_torn_record(void)
+{
+    uint8_t record[EVENT_SIZE], buf[FLASH_LOG_MAX_RECORD];
+
+    for (uint32_t cut = 0; cut < 4 + EVENT_SIZE; cut++) {
+        wipe();
+        for (uint32_t id = 0; id < 10; id++) {
+            CHECK(flash_log_append(&log_, record, make_record(id, EVENT_SIZE, record)));
+        }
+        flash.cut_at = flash.progress + cut;
+        CHECK(!flash_log_append(&log_, record, make_record(10, EVENT_SIZE, record)));
+
+        reboot();
+        CHECK_EQ(flash_log_pending(&log_), 10);
+        CHECK(flash_log_append(&log_, record, make_record(11, EVENT_SIZE, record)));
+        for (uint32_t id = 0; id < 12; id++) {
+            uint32_t got;
+            if (id == 10) {
+                continue;
+            }
+            CHECK_EQ(flash_log_peek(&log_, buf, sizeof(buf)), EVENT_SIZE);
+            memcpy(&got, buf, sizeof(got));
+            CHECK_EQ(got, id);
+            CHECK(flash_log_consume(&log_));
+        }
+        CHECK_EQ(flash_log_peek(&log_, buf, sizeof(buf)), -1);
+    }
+}
+
+int main(void)
+{
+    const char *dir = getenv("TMPDIR");
+    snprintf(path, sizeof(path), "%s/flash_log_%d.bin", dir != NULL ? dir : "/tmp", (int)getpid());
+    CHECK(flash_file_open(&flash, path, FLASH_SIZE, SECTOR_SIZE));
+
+    TEST_RUN(test_torn_record);
+    TEST_RUN(test_torn_sector_header);
+    TEST_RUN(test_throughput_and_wear);
+    TEST_RUN(test_power_cuts);
+
+    flash_file_close(&flash);
+    unlink(path);
+    return 0;
+}
@@ -0,0 +1,135 @@
+/*
+ * The zlib backed tinfl stand-in, driven the way ota_decoder_inflate drives
+ * the ROM inflater: input in arbitrary chunks, output into a 32 KB window
+ * that wraps. Streams given up on release zlib's state through tinfl_end,
+ * which the sanitizer build checks for leaks.
+ */
+
+#include <string.h>
+
+#include "rom/miniz.h"
+#include "test.h"
+
+#define IMAGE_SIZE  (200 * 1024)
+
+static uint8_t image[IMAGE_SIZE];
+static uint8_t packed[IMAGE_SIZE + 1024];
+static uint8_t window[TINFL_LZ_DICT_SIZE];
+static uint8_t unpacked[IMAGE_SIZE];
+
+static size_t pack_image(void)
+{
+    // Firmware-like content: runs, repeats and some noise
+    uint32_t seed = 1;
+    for (size_t i = 0; i < IMAGE_SIZE; i++) {
+        seed = seed * 1103515245 + 12345;
+        image[i] = (i & 0x400) ? (uint8_t)(i >> 3) : (uint8_t)(seed >> 24);
+    }
+    uLongf packed_len = sizeof(packed);
+    CHECK(compress2(packed, &packed_len, image, IMAGE_SIZE, 9) == Z_OK);
+    return packed_len;
+}
+
+/* Returns the final status, the output goes to unpacked */
+static tinfl_status inflate_chunked(const uint8_t *in, size_t in_len, size_t chunk, size_t *out_len)
+{
+    tinfl_decompressor inflator;
+    tinfl_status status = TINFL_STATUS_NEEDS_MORE_INPUT;
+    size_t window_ofs = 0;
+
+    tinfl_init(&inflator);
+    *out_len = 0;
+    while (in_len > 0 || status == TINFL_STATUS_HAS_MORE_OUTPUT) {
+        size_t len = in_len < chunk ? in_len : chunk;
+        const uint8_t *data = in;
+        in += len;
+        in_len -= len;
+
+        for (;;) {
+            size_t in_bytes = len;
+            size_t out_bytes = TINFL_LZ_DICT_SIZE - window_ofs;
+            status = tinfl_decompress(&inflator, data, &in_bytes, window, window + window_ofs, &out_bytes,
+                                      TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_HAS_MORE_INPUT);
+            data += in_bytes;
+            len -= in_bytes;
+            CHECK(*out_len + out_bytes <= IMAGE_SIZE);
+            memcpy(unpacked + *out_len, window + window_ofs, out_bytes);
+            *out_len += out_bytes;
+            window_ofs = (window_ofs + out_bytes) & (TINFL_LZ_DICT_SIZE - 1);
+
+            if (status < TINFL_STATUS_DONE || status == TINFL_STATUS_DONE) {
+                tinfl_end(&inflator);   // already released, must be harmless
+                return status;
+            }
+            if (status == TINFL_STATUS_NEEDS_MORE_INPUT && len == 0) {
+                break;
+            }
+        }
+    }
+    // Out of input mid-stream, the caller gives up on it
+    tinfl_end(&inflator);
+    return status;
+}
+
+static void test_chunk_sizes(void)
+{
+    size_t packed_len = pack_image();
+    const size_t chunks[] = { 1, 7, 512, 4096, 65536, IMAGE_SIZE };
+
+    for (size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+        size_t out_len;
+        memset(unpacked, 0, sizeof(unpacked));
+        CHECK_EQ(inflate_chunked(packed, packed_len, chunks[i], &out_len), TINFL_STATUS_DONE);
+        CHECK_EQ(out_len, IMAGE_SIZE);
+        CHECK(memcmp(unpacked, image, IMAGE_SIZE) == 0);
+    }
+}
+
+static void test_truncated_waits_for_input(void)
+{
+    size_t packed_len = pack_image();
+    size_t out_len;
+
+    CHECK_EQ(inflate_chunked(packed, packed_len / 2, 4096, &out_len), TINFL_STATUS_NEEDS_MORE_INPUT);
+    CHECK(out_len < IMAGE_SIZE);
+    CHECK(memcmp(unpacked, image, out_len) == 0);
+}
+
+/* Without TINFL_FLAG_HAS_MORE_INPUT a short stream is an error, and releases zlib's state */
+static void test_truncated_final_fails(void)
+{
+    size_t packed_len = pack_image();
+    tinfl_decompressor inflator;
+    tinfl_status status;
+    size_t pos = 0, window_ofs = 0;
+
+    tinfl_init(&inflator);
+    do {
+        size_t in_bytes = packed_len / 2 - pos;
+        size_t out_bytes = TINFL_LZ_DICT_SIZE - window_ofs;
+        status = tinfl_decompress(&inflator, packed + pos, &in_bytes, window, window + window_ofs, &out_bytes,
+                                  TINFL_FLAG_PARSE_ZLIB_HEADER);
+        pos += in_bytes;
+        window_ofs = (window_ofs + out_bytes) & (TINFL_LZ_DICT_SIZE - 1);
+    } while (status == TINFL_STATUS_HAS_MORE_OUTPUT);
+    CHECK_EQ(status, TINFL_STATUS_FAILED);
+    CHECK_EQ(inflator.started, 0);
+}
+
+static void test_corrupt_fails(void)
+{
+    size_t packed_len = pack_image();
+    size_t out_len;
+
+    packed[0] ^= 0xff;      // zlib header check
+    CHECK_EQ(inflate_chunked(packed, packed_len, 4096, &out_len), TINFL_STATUS_FAILED);
+}
+
+int main(void)
+{
+    TEST_RUN(test_chunk_sizes);
+    TEST_RUN(test_truncated_waits_for_input);
+    TEST_RUN(test_truncated_final_fails);
+    TEST_RUN(test_corrupt_fails);
+    return 0;
+}
@@ -0,0 +1,277 @@
+/*
+ * latency_hist and task_metrics: the numbers of the diagnostics report.
+ *
+ * Histogram bucket edges and percentiles are checked against the exact
+ * percentiles of the recorded values, which they may overstate by at most
+ * 2x and never understate, and recording threads race a thread taking
+ * snapshots without losing a count. CPU shares are checked across counter
+ * wraps, tasks that come and go and two cores.
+ */
+
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "latency_hist.h"
+#include "task_metrics.h"
+#include "test.h"
+
+static uint32_t rng = 0x1f123bb5;
+
+static uint32_t next_random(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static void test_buckets(void)
+{
+    static const struct {
+        int64_t us;
+        unsigned bucket;
+    } cases[] = {
+        { -5, 0 }, { 0, 0 }, { 1, 1 }, { 2, 2 }, { 3, 2 }, { 4, 3 }, { 1023, 10 }, { 1024, 11 },
+        { (1 << 22) - 1, 22 }, { 1 << 22, 23 }, { INT64_MAX, 23 },
+    };
+    latency_hist_t hist;
+    latency_snapshot_t snap;
+
+    latency_hist_init(&hist);
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        latency_hist_record(&hist, cases[i].us);
+        latency_hist_take(&hist, &snap);
+        CHECK_EQ(snap.count, 1);
+        CHECK_EQ(snap.buckets[cases[i].bucket], 1);
+        uint32_t expected_max = cases[i].us < 0 ? 0 : cases[i].us > UINT32_MAX ? UINT32_MAX : (uint32_t)cases[i].us;
+        CHECK_EQ(snap.max_us, expected_max);
+    }
+
+    // take starts a new interval
+    latency_hist_take(&hist, &snap);
+    CHECK_EQ(snap.count, 0);
+    CHECK_EQ(snap.max_us, 0);
+    CHECK_EQ(latency_snapshot_percentile(&snap, 50), 0);
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/* Exact percentile with the same rank rule as latency_snapshot_percentile */
+static uint32_t exact_percentile(const uint32_t *sorted, uint32_t n, uint32_t pct)
+{
+    uint64_t rank = ((uint64_t)n * pct + 99) / 100;
+    return sorted[(rank == 0 ? 1 : rank > n ? n : rank) - 1];
+}
+
+static void test_percentiles(void)
+{
+    enum { N = 20000 };
+    static uint32_t values[N];
+    static const uint32_t pcts[] = { 0, 1, 10, 50, 90, 99, 100 };
+    latency_hist_t hist;
+    latency_snapshot_t snap;
+
+    for (int shape = 0; shape < 3; shape++) {
+        uint32_t n = shape == 2 ? 7 : N;
+        latency_hist_init(&hist);
+        for (uint32_t i = 0; i < n; i++) {
+            if (shape == 0) {
+                // Log-uniform from 1 us to 10 s, the span of the report
+                values[i] = (uint32_t)pow(10.0, 7.0 * (next_random() % 100000) / 100000.0);
+            } else {
+                // Fast path with a slow tail, e.g. publishes that waited for a reconnect
+                values[i] = next_random() % 100 < 95 ? 200 + next_random() % 300 : 2000000 + next_random() % 3000000;
+            }
+            latency_hist_record(&hist, values[i]);
+        }
+        latency_hist_take(&hist, &snap);
+        CHECK_EQ(snap.count, n);
+        qsort(values, n, sizeof(values[0]), compare_u32);
+        CHECK_EQ(snap.max_us, values[n - 1]);
+
+        for (size_t p = 0; p < sizeof(pcts) / sizeof(pcts[0]); p++) {
+            uint32_t exact = exact_percentile(values, n, pcts[p]);
+            uint32_t reported = latency_snapshot_percentile(&snap, pcts[p]);
+            if (reported < exact || reported > 2 * exact || reported > snap.max_us) {
+                fprintf(stderr, "shape %d p%u: reported %u us, exact %u us, max %u us\n", shape, pcts[p],
+                        reported, exact, snap.max_us);
+                exit(1);
+            }
+        }
+        CHECK_EQ(latency_snapshot_percentile(&snap, 100), snap.max_us);
+    }
+}
+
+#define RECORDERS       3
+#define RECORDS         400000
+#define SPIKE_AT        (RECORDS / 2 + 1)
+
+static latency_hist_t shared;
+static atomic_int finished;
+
+static void *recorder(void *arg)
+{
+    uintptr_t id = (uintptr_t)arg;
+    for (uint32_t i = 0; i < RECORDS; i++) {
+        // One spike per thread, the largest is the interval's max
+        latency_hist_record(&shared, i == SPIKE_AT ? 1000000 * (int64_t)(id + 1) : i % 5000);
+    }
+    atomic_fetch_add(&finished, 1);
+    return NULL;
+}
+
+static void accumulate(uint64_t *total, uint64_t *zeros, uint32_t *max)
+{
+    latency_snapshot_t snap;
+    latency_hist_take(&shared, &snap);
+    *total += snap.count;
+    *zeros += snap.buckets[0];
+    *max = snap.max_us > *max ? snap.max_us : *max;
+}
+
+/* Tasks record while the metrics task takes snapshots: no count is lost or counted twice */
+static void test_concurrent_take(void)
+{
+    pthread_t threads[RECORDERS];
+    uint64_t total = 0, zeros = 0;
+    uint32_t max = 0;
+    int takes = 0;
+
+    latency_hist_init(&shared);
+    atomic_store(&finished, 0);
+    for (uintptr_t t = 0; t < RECORDERS; t++) {
+        CHECK(pthread_create(&threads[t], NULL, recorder, (void *)t) == 0);
+    }
+    while (atomic_load(&finished) < RECORDERS) {
+        accumulate(&total, &zeros, &max);
+        takes++;
+        sched_yield();
+    }
+    for (int t = 0; t < RECORDERS; t++) {
+        pthread_join(threads[t], NULL);
+    }
+    accumulate(&total, &zeros, &max);
+
+    CHECK_EQ(total, (uint64_t)RECORDERS * RECORDS);
+    CHECK_EQ(zeros, RECORDERS * (RECORDS / 5000));
+    CHECK_EQ(max, 1000000 * RECORDERS);
+    printf("%d snapshots during %d x %d records\n", takes, RECORDERS, RECORDS);
+}
+
+static void test_task_shares(void)
+{
+    task_metrics_t m;
+    uint16_t permille[TASK_METRICS_MAX_TASKS];
+
+    task_metrics_init(&m);
+    task_runtime_t first[] = { { 1, 1000 }, { 2, 3000 }, { 3, 6000 } };
+    task_metrics_update(&m, first, 3, 10000, 1, permille);
+    CHECK_EQ(permille[0], 100);
+    CHECK_EQ(permille[1], 300);
+    CHECK_EQ(permille[2], 600);
+
+    // Deltas only: task 1 idle for the period, task 3 took all of it
+    task_runtime_t second[] = { { 1, 1000 }, { 2, 3000 }, { 3, 16000 } };
+    task_metrics_update(&m, second, 3, 20000, 1, permille);
+    CHECK_EQ(permille[0], 0);
+    CHECK_EQ(permille[1], 0);
+    CHECK_EQ(permille[2], 1000);
+
+    // Task 2 deleted, task 7 created during the period and charged its whole counter
+    task_runtime_t third[] = { { 7, 2500 }, { 1, 8500 }, { 3, 16000 } };
+    task_metrics_update(&m, third, 3, 30000, 1, permille);
+    CHECK_EQ(permille[0], 250);
+    CHECK_EQ(permille[1], 750);
+    CHECK_EQ(permille[2], 0);
+
+    // No time passed: no share instead of a division by zero
+    task_metrics_update(&m, third, 3, 30000, 1, permille);
+    CHECK_EQ(permille[0] + permille[1] + permille[2], 0);
+}
+
+static void test_task_wrap(void)
+{
+    task_metrics_t m;
+    uint16_t permille[2];
+
+    // Both the total and a task counter wrap within the period
+    task_metrics_init(&m);
+    task_runtime_t before[] = { { 1, UINT32_MAX - 999 }, { 2, 100 } };
+    task_metrics_update(&m, before, 2, UINT32_MAX - 4999, 1, permille);
+    task_runtime_t after[] = { { 1, 3000 }, { 2, 1100 } };
+    task_metrics_update(&m, after, 2, 5000, 1, permille);
+    CHECK_EQ(permille[0], 400);     // 4000 of 10000
+    CHECK_EQ(permille[1], 100);
+}
+
+/* Two cores: the counters of both add up to twice the elapsed time */
+static void test_task_two_cores(void)
+{
+    task_metrics_t m;
+    uint16_t permille[3];
+
+    task_metrics_init(&m);
+    task_runtime_t zero[] = { { 1, 0 }, { 2, 0 }, { 3, 0 } };
+    task_metrics_update(&m, zero, 3, 0, 2, permille);
+    task_runtime_t busy[] = { { 1, 60000 }, { 2, 60000 }, { 3, 0 } };   // two idle tasks, one per core
+    task_metrics_update(&m, busy, 3, 60000, 2, permille);
+    CHECK_EQ(permille[0], 500);
+    CHECK_EQ(permille[1], 500);
+    CHECK_EQ(permille[2], 0);
+}
+
+/* A scheduler splitting each period among the tasks: shares add up to the whole CPU */
+static void test_task_random_periods(void)
+{
+    enum { TASKS = 12 };
+    task_metrics_t m;
+    task_runtime_t tasks[TASKS];
+    uint16_t permille[TASKS];
+    uint32_t total = UINT32_MAX - 50000000;
+
+    task_metrics_init(&m);
+    for (int t = 0; t < TASKS; t++) {
+        tasks[t] = (task_runtime_t) { .id = 100 + t, .runtime = next_random() };
+    }
+    task_metrics_update(&m, tasks, TASKS, total, 2, permille);
+
+    for (int period = 0; period < 5000; period++) {
+        uint32_t elapsed = 1 + next_random() % 60000000;        // up to a minute at 1 MHz
+        uint64_t capacity = (uint64_t)elapsed * 2, left = capacity;
+        uint64_t given[TASKS];
+        for (int t = 0; t < TASKS; t++) {
+            given[t] = t == TASKS - 1 ? left : next_random() % (left / 2 + 1);
+            left -= given[t];
+            tasks[t].runtime += (uint32_t)given[t];
+        }
+        total += elapsed;
+        task_metrics_update(&m, tasks, TASKS, total, 2, permille);
+
+        uint32_t sum = 0;
+        for (int t = 0; t < TASKS; t++) {
+            CHECK_EQ(permille[t], given[t] * 1000 / capacity);
+            sum += permille[t];
+        }
+        CHECK(sum <= 1000 && sum > 1000 - TASKS);
+    }
+}
+
+int main(void)
+{
+    TEST_RUN(test_buckets);
+    TEST_RUN(test_percentiles);
+    TEST_RUN(test_concurrent_take);
+    TEST_RUN(test_task_shares);
+    TEST_RUN(test_task_wrap);
+    TEST_RUN(test_task_two_cores);
+    TEST_RUN(test_task_random_periods);
+    return 0;
+}
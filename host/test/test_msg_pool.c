@@ -0,0 +1,268 @@
+/*
+ * msg_pool, alone and wired like the MQTT client task and worker.
+ *
+ * The client side allocates a slot, copies the message in and queues the
+ * slot pointer; the worker takes it off the queue, runs the "handler" and
+ * frees it. The queue holds one entry more than the pool, as in mqtt_task.c,
+ * so sending never waits. Every message must be delivered once, intact and
+ * in order, or be counted as dropped, and drops may only happen with every
+ * slot taken. Several threads also hammer alloc and free on a small pool to
+ * check that a slot never has two owners.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+
+#include "msg_pool.h"
+#include "test.h"
+
+#define POOL_SIZE       8       // INTERCOM_MQTT_MSG_POOL_SIZE default
+#define DATA_MAX        256     // INTERCOM_MQTT_MSG_DATA_MAX default
+
+typedef struct {
+    uint32_t seq;
+    uint16_t data_len;
+    uint8_t data[DATA_MAX];
+} msg_t;
+
+static void test_alloc_free(void)
+{
+    static msg_t storage[MSG_POOL_MAX_SLOTS + 4];
+    msg_t *slots[MSG_POOL_MAX_SLOTS];
+    msg_pool_stats_t stats;
+    msg_pool_t pool;
+
+    msg_pool_init(&pool, storage, sizeof(msg_t), POOL_SIZE);
+    for (int i = 0; i < POOL_SIZE; i++) {
+        slots[i] = msg_pool_alloc(&pool);
+        CHECK(slots[i] >= &storage[0] && slots[i] < &storage[POOL_SIZE]);
+        for (int j = 0; j < i; j++) {
+            CHECK(slots[i] != slots[j]);
+        }
+    }
+    CHECK(msg_pool_alloc(&pool) == NULL);
+    msg_pool_count_drop(&pool);     // e.g. too large
+    msg_pool_stats(&pool, &stats);
+    CHECK_EQ(stats.in_use, POOL_SIZE);
+    CHECK_EQ(stats.high_water, POOL_SIZE);
+    CHECK_EQ(stats.allocated, POOL_SIZE);
+    CHECK_EQ(stats.drops, 2);
+
+    // A freed slot is the next one handed out
+    msg_pool_free(&pool, slots[3]);
+    CHECK(msg_pool_alloc(&pool) == slots[3]);
+    for (int i = 0; i < POOL_SIZE; i++) {
+        msg_pool_free(&pool, slots[i]);
+    }
+    msg_pool_stats(&pool, &stats);
+    CHECK_EQ(stats.in_use, 0);
+    CHECK_EQ(stats.high_water, POOL_SIZE);
+    CHECK_EQ(stats.allocated, POOL_SIZE + 1);
+
+    // Counts above the bitmap width are clamped, a full 32 bit map still works
+    msg_pool_init(&pool, storage, sizeof(msg_t), MSG_POOL_MAX_SLOTS + 4);
+    CHECK_EQ(pool.count, MSG_POOL_MAX_SLOTS);
+    for (int i = 0; i < MSG_POOL_MAX_SLOTS; i++) {
+        slots[i] = msg_pool_alloc(&pool);
+        CHECK(slots[i] != NULL && slots[i] < &storage[MSG_POOL_MAX_SLOTS]);
+    }
+    CHECK(msg_pool_alloc(&pool) == NULL);
+    msg_pool_free(&pool, slots[MSG_POOL_MAX_SLOTS - 1]);
+    CHECK(msg_pool_alloc(&pool) == slots[MSG_POOL_MAX_SLOTS - 1]);
+}
+
+/* Slot pointer queue standing in for mqtt_msg_queue */
+typedef struct {
+    msg_t *items[POOL_SIZE + 1];
+    int head, count;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} ptr_queue_t;
+
+static void queue_send(ptr_queue_t *q, msg_t *msg)
+{
+    pthread_mutex_lock(&q->lock);
+    CHECK(q->count < POOL_SIZE + 1);    // xQueueSend(..., 0) must never find it full
+    q->items[(q->head + q->count) % (POOL_SIZE + 1)] = msg;
+    q->count++;
+    pthread_cond_signal(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static msg_t *queue_receive(ptr_queue_t *q)
+{
+    pthread_mutex_lock(&q->lock);
+    while (q->count == 0) {
+        pthread_cond_wait(&q->cond, &q->lock);
+    }
+    msg_t *msg = q->items[q->head];
+    q->head = (q->head + 1) % (POOL_SIZE + 1);
+    q->count--;
+    pthread_mutex_unlock(&q->lock);
+    return msg;
+}
+
+static msg_t storage[POOL_SIZE];
+static msg_pool_t pool;
+static ptr_queue_t queue = { .lock = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER };
+static msg_t stop;
+
+typedef struct {
+    uint32_t delivered;
+    uint32_t last_seq;
+    int busy_every;     // handler sleeps on every nth message, 0 never
+} worker_t;
+
+static uint8_t payload_byte(uint32_t seq, int i)
+{
+    return (uint8_t)(seq * 13 + i);
+}
+
+static void *worker_thread(void *arg)
+{
+    worker_t *w = arg;
+    msg_t *msg;
+    while ((msg = queue_receive(&queue)) != &stop) {
+        CHECK(w->delivered == 0 || msg->seq > w->last_seq);
+        CHECK_EQ(msg->data_len, msg->seq % DATA_MAX);
+        for (int i = 0; i < msg->data_len; i++) {
+            CHECK_EQ(msg->data[i], payload_byte(msg->seq, i));
+        }
+        w->last_seq = msg->seq;
+        w->delivered++;
+        if (w->busy_every != 0 && w->delivered % w->busy_every == 0) {
+            struct timespec ts = { .tv_sec = 0, .tv_nsec = 200000 };   // slow handler
+            nanosleep(&ts, NULL);
+        }
+        // Clobber before handing it back, a late reader would see garbage
+        memset(msg, 0xa5, sizeof(*msg));
+        msg_pool_free(&pool, msg);
+    }
+    return NULL;
+}
+
+/* Messages arrive in bursts of burst with a pause of gap_us in between */
+static uint32_t run_client(uint32_t messages, uint32_t burst, int gap_us, int busy_every)
+{
+    worker_t w = { .busy_every = busy_every };
+    uint32_t dropped = 0;
+    pthread_t worker;
+
+    msg_pool_init(&pool, storage, sizeof(msg_t), POOL_SIZE);
+    CHECK(pthread_create(&worker, NULL, worker_thread, &w) == 0);
+
+    for (uint32_t seq = 0; seq < messages; seq++) {
+        msg_t *msg = msg_pool_alloc(&pool);
+        if (msg == NULL) {
+            dropped++;
+            continue;
+        }
+        msg->seq = seq;
+        msg->data_len = seq % DATA_MAX;
+        for (int i = 0; i < msg->data_len; i++) {
+            msg->data[i] = payload_byte(seq, i);
+        }
+        queue_send(&queue, msg);
+        if (seq % burst == burst - 1) {
+            struct timespec ts = { .tv_sec = 0, .tv_nsec = gap_us * 1000L };
+            nanosleep(&ts, NULL);
+        }
+    }
+    queue_send(&queue, &stop);
+    pthread_join(worker, NULL);
+
+    msg_pool_stats_t stats;
+    msg_pool_stats(&pool, &stats);
+    printf("%u messages in bursts of %u, handler slow every %d: %u delivered, %u dropped, high water %u of %d\n",
+           messages, burst, busy_every, w.delivered, dropped, stats.high_water, POOL_SIZE);
+    CHECK_EQ(w.delivered + dropped, messages);
+    CHECK_EQ(stats.drops, dropped);
+    CHECK_EQ(stats.allocated, w.delivered);
+    CHECK_EQ(stats.in_use, 0);
+    CHECK(stats.high_water <= POOL_SIZE);
+    if (dropped > 0) {
+        CHECK_EQ(stats.high_water, POOL_SIZE);
+    }
+    return dropped;
+}
+
+static void test_client_to_worker(void)
+{
+    // Bursts that fit the pool with time to drain in between, nothing may be lost
+    CHECK_EQ(run_client(2000, POOL_SIZE / 2, 1000, 0), 0);
+    // Bursts larger than the pool on a worker in slow handlers, drops are counted
+    CHECK(run_client(2000, 4 * POOL_SIZE, 1000, 4) > 0);
+}
+
+#define HAMMER_THREADS  4
+#define HAMMER_SLOTS    3
+#define HAMMER_ROUNDS   200000
+
+static uint32_t hammer_storage[HAMMER_SLOTS];
+static msg_pool_t hammer_pool;
+static atomic_uint hammer_owner[HAMMER_SLOTS];
+
+typedef struct {
+    uint32_t id;
+    uint32_t got;
+    uint32_t missed;
+} hammer_t;
+
+static void *hammer_thread(void *arg)
+{
+    hammer_t *h = arg;
+    for (int i = 0; i < HAMMER_ROUNDS; i++) {
+        uint32_t *slot = msg_pool_alloc(&hammer_pool);
+        if (slot == NULL) {
+            h->missed++;
+            continue;
+        }
+        unsigned index = slot - hammer_storage;
+        unsigned none = 0;
+        CHECK(atomic_compare_exchange_strong(&hammer_owner[index], &none, h->id));
+        *slot = h->id;
+        CHECK_EQ(*slot, h->id);
+        CHECK(atomic_exchange(&hammer_owner[index], 0) == h->id);
+        msg_pool_free(&hammer_pool, slot);
+        h->got++;
+    }
+    return NULL;
+}
+
+static void test_contended_alloc(void)
+{
+    pthread_t threads[HAMMER_THREADS];
+    hammer_t args[HAMMER_THREADS];
+    uint32_t got = 0, missed = 0;
+
+    msg_pool_init(&hammer_pool, hammer_storage, sizeof(hammer_storage[0]), HAMMER_SLOTS);
+    for (int t = 0; t < HAMMER_THREADS; t++) {
+        args[t] = (hammer_t) { .id = t + 1 };
+        CHECK(pthread_create(&threads[t], NULL, hammer_thread, &args[t]) == 0);
+    }
+    for (int t = 0; t < HAMMER_THREADS; t++) {
+        pthread_join(threads[t], NULL);
+        got += args[t].got;
+        missed += args[t].missed;
+    }
+
+    msg_pool_stats_t stats;
+    msg_pool_stats(&hammer_pool, &stats);
+    printf("%d threads on %d slots: %u allocations, %u found the pool empty, high water %u\n",
+           HAMMER_THREADS, HAMMER_SLOTS, got, missed, stats.high_water);
+    CHECK_EQ(got + missed, HAMMER_THREADS * HAMMER_ROUNDS);
+    CHECK_EQ(stats.allocated, got);
+    CHECK_EQ(stats.drops, missed);
+    CHECK_EQ(stats.in_use, 0);
+    CHECK(stats.high_water <= HAMMER_SLOTS);
+}
+
+int main(void)
+{
+    TEST_RUN(test_alloc_free);
+    TEST_RUN(test_client_to_worker);
+    TEST_RUN(test_contended_alloc);
+    return 0;
+}
@@ -0,0 +1,181 @@
+/*
+ * ota_manifest: parsing of the manifest tools/ota_artifact.py writes, escapes,
+ * unknown and nested keys, strings that do not fit their field, malformed
+ * input cut at every offset, and the update decision.
+ */
+
+#include <string.h>
+
+#include "ota_manifest.h"
+#include "test.h"
+
+#define SHA256_HEX  "9f86d081884c7d659a2feaa0c55ad015a3bf4f1b2b0b822cd15d6c15b0f00a08"
+
+static bool parse(const char *json, ota_manifest_t *manifest)
+{
+    return ota_manifest_parse(json, strlen(json), manifest);
+}
+
+/* json with the string value of one key made len characters long */
+static const char *with_length(const char *key, size_t len)
+{
+    static char json[1024];
+    char value[512];
+
+    memset(value, 'a', len);
+    value[len] = '\0';
+    snprintf(json, sizeof(json), "{\"version\": \"1.0\", \"%s\": \"%s\"}", key, value);
+    return json;
+}
+
+static void test_parse_full(void)
+{
+    ota_manifest_t m;
+
+    CHECK(parse("{\"version\": \"1.4.2\", \"size\": 912384, \"sha256\": \"" SHA256_HEX "\", "
+                "\"url\": \"http://ota.local/fw.bin\"}", &m));
+    CHECK(strcmp(m.version, "1.4.2") == 0);
+    CHECK_EQ(m.size, 912384);
+    CHECK(strcmp(m.sha256, SHA256_HEX) == 0);
+    CHECK(strcmp(m.url, "http://ota.local/fw.bin") == 0);
+
+    // Only version is required, whitespace anywhere between tokens
+    CHECK(parse(" \r\n{ \"version\" :\t\"2.0\" } ", &m));
+    CHECK(strcmp(m.version, "2.0") == 0);
+    CHECK_EQ(m.size, 0);
+    CHECK_EQ(m.sha256[0], '\0');
+    CHECK_EQ(m.url[0], '\0');
+
+    CHECK(!parse("{}", &m));
+    CHECK(!parse("{\"size\": 1}", &m));
+    CHECK(!parse("{\"version\": \"\"}", &m));
+}
+
+static void test_escapes(void)
+{
+    ota_manifest_t m;
+
+    CHECK(parse("{\"version\": \"a\\\"b\\\\c\\/d\\ne\\tf\"}", &m));
+    CHECK(strcmp(m.version, "a\"b\\c/d\ne\tf") == 0);
+
+    // \u is not supported and fails the parse instead of passing through
+    CHECK(!parse("{\"version\": \"\\u0041\"}", &m));
+    // An escaped quote does not end the string
+    CHECK(!parse("{\"version\": \"1.0\\\"}", &m));
+}
+
+static void test_unknown_and_nested_keys(void)
+{
+    ota_manifest_t m;
+
+    CHECK(parse("{\"notes\": \"fixes \\\"ring\\\" detection, {not an object}\", \"build\": 42, "
+                "\"beta\": true, \"signed\": null, \"version\": \"1.5\", "
+                "\"a_key_longer_than_the_key_buffer\": \"x\"}", &m));
+    CHECK(strcmp(m.version, "1.5") == 0);
+
+    CHECK(parse("{\"targets\": [\"esp32\", {\"chip\": \"s3\", \"revs\": [0, 1]}], "
+                "\"meta\": {\"version\": \"9.9\", \"nested\": {\"url\": \"}]\"}}, "
+                "\"version\": \"1.6\", \"size\": 10}", &m));
+    CHECK(strcmp(m.version, "1.6") == 0);       // the nested version is not the manifest's
+    CHECK_EQ(m.size, 10);
+    CHECK_EQ(m.url[0], '\0');
+
+    // A long key that starts like a known one is still unknown
+    CHECK(parse("{\"version\": \"1.7\", \"url_of_the_release_notes\": \"http://x\"}", &m));
+    CHECK_EQ(m.url[0], '\0');
+
+    CHECK(!parse("{\"version\": \"1.0\", \"meta\": {\"a\": 1}}}", &m));
+    CHECK(!parse("{\"version\": \"1.0\", \"meta\": {\"a\": [1, 2}}", &m));
+    CHECK(!parse("{\"version\": \"1.0\", \"empty\": }", &m));
+}
+
+static void test_oversize_strings_rejected(void)
+{
+    ota_manifest_t m;
+
+    CHECK(parse(with_length("url", OTA_MANIFEST_URL_LEN - 1), &m));
+    CHECK_EQ(strlen(m.url), OTA_MANIFEST_URL_LEN - 1);
+    CHECK(!parse(with_length("url", OTA_MANIFEST_URL_LEN), &m));
+    CHECK(!parse(with_length("url", 400), &m));
+
+    CHECK(parse(with_length("version", OTA_MANIFEST_VERSION_LEN - 1), &m));
+    CHECK(!parse(with_length("version", OTA_MANIFEST_VERSION_LEN), &m));
+
+    // Long values of unknown keys are skipped, not stored
+    CHECK(parse(with_length("notes", 400), &m));
+}
+
+static void test_sha256_must_be_64_hex_digits(void)
+{
+    ota_manifest_t m;
+
+    CHECK(parse("{\"version\": \"1.0\", \"sha256\": \"" SHA256_HEX "\"}", &m));
+    CHECK(parse("{\"version\": \"1.0\", \"sha256\": \"9F86D081884C7D659A2FEAA0C55AD015A3BF4F1B2B0B822CD15D6C15B0F00A08\"}",
+                &m));
+    CHECK(parse("{\"version\": \"1.0\", \"sha256\": \"\"}", &m));
+
+    CHECK(!parse(with_length("sha256", 63), &m));
+    CHECK(!parse(with_length("sha256", 65), &m));
+    CHECK(!parse("{\"version\": \"1.0\", \"sha256\": \"9f86d081884c7d659a2feaa0c55ad015a3bf4f1b2b0b822cd15d6c15b0f00a0g\"}",
+                 &m));
+    CHECK(!parse("{\"version\": \"1.0\", \"sha256\": \"9f86d081\"}", &m));
+}
+
+static void test_malformed(void)
+{
+    static const char *const bad[] = {
+        "", "[]", "\"version\"", "{\"version\" \"1.0\"}", "{\"version\": 1}", "{\"version\": \"1.0\",}",
+        "{\"version\": \"1.0\" \"size\": 1}", "{\"version\": \"1.0\", \"size\": \"1\"}",
+        "{\"version\": \"1.0\", \"size\": -1}", "{\"version\": \"1.0\", \"size\": 4294967296}",
+        "{version: \"1.0\"}",
+    };
+    ota_manifest_t m;
+
+    for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+        CHECK(!parse(bad[i], &m));
+    }
+    CHECK(parse("{\"version\": \"1.0\", \"size\": 4294967295}", &m));
+    CHECK_EQ(m.size, UINT32_MAX);
+}
+
+static void test_truncated_input(void)
+{
+    static const char json[] = "{\"version\": \"1.4.2\", \"meta\": {\"a\": [1, \"}\"]}, \"size\": 912384, "
+                               "\"sha256\": \"" SHA256_HEX "\", \"url\": \"http://ota.local/fw.bin\"}";
+    ota_manifest_t m;
+
+    CHECK(ota_manifest_parse(json, strlen(json), &m));
+    // Every prefix is an incomplete object, the body of a cut download
+    for (size_t len = 0; len < strlen(json); len++) {
+        CHECK(!ota_manifest_parse(json, len, &m));
+    }
+}
+
+static void test_check(void)
+{
+    ota_manifest_t m;
+
+    CHECK(parse("{\"version\": \"1.5.0\"}", &m));
+    CHECK_EQ(ota_manifest_check(&m, "1.4.2", NULL), OTA_MANIFEST_UPDATE);
+    CHECK_EQ(ota_manifest_check(&m, "1.5.0", NULL), OTA_MANIFEST_CURRENT);
+    CHECK_EQ(ota_manifest_check(&m, "1.4.2", "1.5.0"), OTA_MANIFEST_REJECTED);
+    CHECK_EQ(ota_manifest_check(&m, "1.4.2", "1.3.0"), OTA_MANIFEST_UPDATE);
+    // Rolled back wins even when it is running again somehow
+    CHECK_EQ(ota_manifest_check(&m, "1.5.0", "1.5.0"), OTA_MANIFEST_REJECTED);
+    // A downgrade is still a different version
+    CHECK_EQ(ota_manifest_check(&m, "2.0.0", NULL), OTA_MANIFEST_UPDATE);
+    CHECK_EQ(ota_manifest_check(&m, "1.5.0-dirty", NULL), OTA_MANIFEST_UPDATE);
+}
+
+int main(void)
+{
+    TEST_RUN(test_parse_full);
+    TEST_RUN(test_escapes);
+    TEST_RUN(test_unknown_and_nested_keys);
+    TEST_RUN(test_oversize_strings_rejected);
+    TEST_RUN(test_sha256_must_be_64_hex_digits);
+    TEST_RUN(test_malformed);
+    TEST_RUN(test_truncated_input);
+    TEST_RUN(test_check);
+    return 0;
+}
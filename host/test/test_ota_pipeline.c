@@ -0,0 +1,535 @@
+/*
+ * OTA download/flash pipeline and ota_decoder against a fake NOR flash.
+ *
+ * Wired like ota_download_session: a downloader thread fills OTA_BUF_COUNT
+ * buffers from the "server" and a flash writer thread feeds them to the
+ * decoder, which writes through an ota_partition_write stand-in that
+ * erases 4 KB sectors just ahead of the data. The flash only clears bits
+ * on write, so writing over unerased bytes is caught. Raw, compressed,
+ * delta and compressed delta artifacts must come out byte for byte; a
+ * refused version writes nothing; a dropped raw download resumes; flash
+ * and format errors surface as the decoder errors ota_task maps.
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+#include "ota_decoder.h"
+#include "ota_metrics.h"
+#include "test.h"
+
+#define BUF_SIZE        8192    // INTERCOM_OTA_BUF_SIZE default
+#define BUF_COUNT       4       // INTERCOM_OTA_BUF_COUNT default
+#define SECTOR_SIZE     4096
+#define PARTITION_SIZE  (1024 * 1024)
+#define HEAD_SIZE       289     // OTA_IMAGE_HEAD_SIZE: image, segment header and app description + 1
+#define VERSION_OFFSET  48      // esp_app_desc_t.version in the image
+#define BASE_SIZE       (300 * 1024)
+#define NET_US_PER_BUF  150     // simulated link, about 50 MB/s
+#define ERASE_US        60      // simulated sector erase
+
+static const char running_version[] = "1.0.0";
+
+static void sleep_us(long us)
+{
+    struct timespec ts = { .tv_sec = 0, .tv_nsec = us * 1000 };
+    nanosleep(&ts, NULL);
+}
+
+/* Fake flash: erase sets 0xff, a write can only clear bits */
+typedef struct {
+    uint8_t bytes[PARTITION_SIZE];
+    uint32_t erases;
+    uint32_t writes;
+    uint32_t dirty_writes;      // writes over bytes that were not erased
+    uint32_t fail_from;         // writes reaching past this offset fail, 0 never
+} fake_flash_t;
+
+static fake_flash_t flash;
+
+static void flash_reset(void)
+{
+    memset(flash.bytes, 0, sizeof(flash.bytes));    // stale content from an older image
+    flash.erases = flash.writes = flash.dirty_writes = flash.fail_from = 0;
+}
+
+static int flash_erase(uint32_t offset)
+{
+    memset(&flash.bytes[offset], 0xff, SECTOR_SIZE);
+    flash.erases++;
+    sleep_us(ERASE_US);
+    return 0;
+}
+
+static int flash_write(uint32_t offset, const uint8_t *data, size_t len)
+{
+    if (flash.fail_from != 0 && offset + len > flash.fail_from) {
+        return -1;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if ((flash.bytes[offset + i] & data[i]) != data[i]) {
+            flash.dirty_writes++;
+        }
+        flash.bytes[offset + i] &= data[i];
+    }
+    flash.writes++;
+    return 0;
+}
+
+/* One download session, the pipeline and the decoder callbacks */
+typedef struct {
+    int items[BUF_COUNT + 1];
+    unsigned head, tail;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} index_queue_t;
+
+typedef struct {
+    const uint8_t *stream;      // what the server sends
+    size_t stream_len;
+    size_t stream_pos;
+    size_t cut_at;              // connection drops after this many bytes, 0 never
+
+    uint8_t buffers[BUF_COUNT][BUF_SIZE];
+    int lens[BUF_COUNT];
+    index_queue_t free_queue;
+    index_queue_t full_queue;
+
+    ota_decoder_t decoder;
+    arena_t arena;
+    uint8_t arena_storage[sizeof(tinfl_decompressor) + TINFL_LZ_DICT_SIZE + sizeof(delta_patch_t) + 64];
+    const uint8_t *base;        // running image for delta artifacts
+    uint32_t offset;            // ota_progress.offset
+    uint32_t erased_until;
+    _Atomic ota_decoder_err_t write_err;    // set by the writer, polled by the downloader
+    bool head_refused;
+    ota_metrics_t metrics;
+} session_t;
+
+static void queue_init(index_queue_t *q)
+{
+    q->head = q->tail = 0;
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->cond, NULL);
+}
+
+static void queue_send(index_queue_t *q, int item)
+{
+    pthread_mutex_lock(&q->lock);
+    q->items[q->head++ % (BUF_COUNT + 1)] = item;
+    pthread_cond_signal(&q->cond);
+    pthread_mutex_unlock(&q->lock);
+}
+
+static int queue_receive(index_queue_t *q, int64_t *waited_us)
+{
+    int64_t start = test_now_ns();
+    pthread_mutex_lock(&q->lock);
+    while (q->head == q->tail) {
+        pthread_cond_wait(&q->cond, &q->lock);
+    }
+    int item = q->items[q->tail++ % (BUF_COUNT + 1)];
+    pthread_mutex_unlock(&q->lock);
+    *waited_us = (test_now_ns() - start) / 1000;
+    return item;
+}
+
+static bool session_begin(void *ctx, const ota_decoder_t *decoder)
+{
+    return decoder->header.image_size <= PARTITION_SIZE && decoder->header.source_size <= BASE_SIZE;
+}
+
+static bool session_check_head(void *ctx, const uint8_t *head, size_t len)
+{
+    session_t *s = ctx;
+    CHECK_EQ(len, HEAD_SIZE);
+    s->head_refused = strcmp((const char *)&head[VERSION_OFFSET], running_version) == 0;
+    return !s->head_refused;
+}
+
+/* ota_partition_write: erase sectors just ahead of the data, then write at the progress offset */
+static int session_write(void *ctx, const uint8_t *data, size_t len)
+{
+    session_t *s = ctx;
+    uint32_t end = s->offset + (uint32_t)len;
+
+    if (end > PARTITION_SIZE) {
+        return -1;
+    }
+    while (s->erased_until < end) {
+        flash_erase(s->erased_until);
+        s->erased_until += SECTOR_SIZE;
+    }
+    if (flash_write(s->offset, data, len) != 0) {
+        return -1;
+    }
+    s->offset = end;
+    return 0;
+}
+
+static int session_read_base(void *ctx, uint32_t offset, uint8_t *buf, size_t len)
+{
+    session_t *s = ctx;
+    if (offset + len > BASE_SIZE) {
+        return -1;
+    }
+    memcpy(buf, &s->base[offset], len);
+    return 0;
+}
+
+static const ota_decoder_ops_t session_ops = {
+    .begin = session_begin,
+    .check_head = session_check_head,
+    .write = session_write,
+    .read_base = session_read_base,
+};
+
+/* ota_flash_writer_task */
+static void *writer_thread(void *arg)
+{
+    session_t *s = arg;
+
+    for (;;) {
+        int64_t waited_us;
+        int index = queue_receive(&s->full_queue, &waited_us);
+        ota_metrics_write_wait(&s->metrics, waited_us);
+        if (index < 0) {
+            break;
+        }
+        int64_t start = test_now_ns();
+        if (s->write_err == OTA_DECODER_OK) {
+            s->write_err = ota_decoder_feed(&s->decoder, s->buffers[index], s->lens[index]);
+            ota_metrics_chunk_written(&s->metrics, s->lens[index], (test_now_ns() - start) / 1000);
+        }
+        queue_send(&s->free_queue, index);
+    }
+    return NULL;
+}
+
+/* ota_read_chunk against the fake server, a short read ends the stream */
+static int read_chunk(session_t *s, uint8_t *buffer)
+{
+    size_t end = s->cut_at != 0 && s->cut_at < s->stream_len ? s->cut_at : s->stream_len;
+    size_t n = end - s->stream_pos < BUF_SIZE ? end - s->stream_pos : BUF_SIZE;
+
+    sleep_us(NET_US_PER_BUF);
+    memcpy(buffer, &s->stream[s->stream_pos], n);
+    s->stream_pos += n;
+    return (int)n;
+}
+
+/* The download loop of ota_download_session, resume_from > 0 continues a raw image */
+static void run_session(session_t *s, uint32_t resume_from)
+{
+    pthread_t writer;
+    bool writer_started = false;
+
+    memset(&s->metrics, 0, sizeof(s->metrics));
+    s->stream_pos = resume_from;
+    s->offset = s->erased_until = resume_from;
+    s->write_err = OTA_DECODER_OK;
+    s->head_refused = false;
+    arena_init(&s->arena, s->arena_storage, sizeof(s->arena_storage));
+    ota_decoder_init(&s->decoder, &session_ops, s, &s->arena, HEAD_SIZE, resume_from > 0);
+    queue_init(&s->free_queue);
+    queue_init(&s->full_queue);
+    for (int i = 0; i < BUF_COUNT; i++) {
+        queue_send(&s->free_queue, i);
+    }
+
+    while (s->write_err == OTA_DECODER_OK) {
+        int64_t waited_us;
+        int index = queue_receive(&s->free_queue, &waited_us);
+        ota_metrics_fetch_wait(&s->metrics, waited_us);
+
+        s->lens[index] = read_chunk(s, s->buffers[index]);
+        if (s->lens[index] == 0) {
+            queue_send(&s->free_queue, index);
+            break;
+        }
+        if (!writer_started) {
+            writer_started = true;
+            ota_metrics_start(&s->metrics, test_now_ns() / 1000);
+            CHECK(pthread_create(&writer, NULL, writer_thread, s) == 0);
+        }
+        queue_send(&s->full_queue, index);
+        if (s->lens[index] < BUF_SIZE) {
+            break;
+        }
+    }
+    if (writer_started) {
+        queue_send(&s->full_queue, -1);
+        pthread_join(writer, NULL);
+        ota_metrics_finish(&s->metrics, test_now_ns() / 1000);
+    }
+    ota_decoder_end(&s->decoder);
+}
+
+/* Images and artifacts */
+static uint8_t base_image[BASE_SIZE];
+static uint8_t new_image[PARTITION_SIZE];
+static size_t new_size;
+static uint8_t patch[PARTITION_SIZE];
+static size_t patch_len;
+static uint8_t artifact[PARTITION_SIZE];
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+/* Code-like content: repeated words with some noise, compresses about 3:1 */
+static void fill_image(uint8_t *image, size_t len, uint32_t seed, const char *version)
+{
+    static const char *words[] = { "mov ", "ldr a2, ", "call8 ", "l32i.n ", "bnez ", "s32i ", "ret.n ", "addi " };
+    uint32_t x = seed;
+    size_t pos = 0;
+
+    while (pos < len) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        const char *word = words[x % 8];
+        for (size_t i = 0; word[i] != '\0' && pos < len; i++) {
+            image[pos++] = (uint8_t)word[i];
+        }
+        if (pos < len) {
+            image[pos++] = (uint8_t)(x >> 8);
+        }
+    }
+    image[0] = 0xe9;    // ESP image magic
+    memset(&image[VERSION_OFFSET], 0, 32);
+    strcpy((char *)&image[VERSION_OFFSET], version);
+}
+
+static void patch_copy(uint32_t offset, uint32_t len)
+{
+    patch[patch_len++] = DELTA_OP_COPY;
+    put_u32(&patch[patch_len], offset);
+    put_u32(&patch[patch_len + 4], len);
+    patch_len += 8;
+    memcpy(&new_image[new_size], &base_image[offset], len);
+    new_size += len;
+}
+
+static void patch_insert(const uint8_t *data, uint32_t len)
+{
+    patch[patch_len++] = DELTA_OP_INSERT;
+    put_u32(&patch[patch_len], len);
+    patch_len += 4;
+    memcpy(&patch[patch_len], data, len);
+    patch_len += len;
+    memcpy(&new_image[new_size], data, len);
+    new_size += len;
+}
+
+/* The new image is the base with a new head, an inserted block, a patched run and a longer tail */
+static void build_images(void)
+{
+    static uint8_t fresh[16 * 1024];
+
+    fill_image(base_image, BASE_SIZE, 1, running_version);
+    fill_image(fresh, sizeof(fresh), 2, "1.1.0");
+    new_size = patch_len = 0;
+
+    patch_insert(fresh, 512);
+    patch_copy(512, 40 * 1024 - 512);
+    patch_insert(&fresh[512], 3 * 1024);
+    patch_copy(40 * 1024, 60 * 1024);
+    patch_insert(&fresh[4 * 1024], 64);
+    patch_copy(100 * 1024 + 64, BASE_SIZE - 100 * 1024 - 64);
+    patch_insert(&fresh[5 * 1024], 5 * 1024);
+    patch[patch_len++] = DELTA_OP_END;
+}
+
+/* Header and payload, deflated if compressed; returns the artifact length */
+static size_t build_artifact(uint8_t flags)
+{
+    const uint8_t *payload = flags & OTA_ARTIFACT_DELTA ? patch : new_image;
+    size_t payload_len = flags & OTA_ARTIFACT_DELTA ? patch_len : new_size;
+
+    if (flags == 0) {
+        memcpy(artifact, new_image, new_size);
+        return new_size;
+    }
+    memset(artifact, 0, OTA_ARTIFACT_HEADER_SIZE);
+    put_u32(&artifact[0], OTA_ARTIFACT_MAGIC);
+    artifact[4] = OTA_ARTIFACT_VERSION;
+    artifact[5] = flags;
+    put_u32(&artifact[8], (uint32_t)new_size);
+    put_u32(&artifact[12], flags & OTA_ARTIFACT_DELTA ? BASE_SIZE : 0);
+
+    if (!(flags & OTA_ARTIFACT_COMPRESSED)) {
+        memcpy(&artifact[OTA_ARTIFACT_HEADER_SIZE], payload, payload_len);
+        return OTA_ARTIFACT_HEADER_SIZE + payload_len;
+    }
+    uLongf deflated = sizeof(artifact) - OTA_ARTIFACT_HEADER_SIZE;
+    CHECK(compress2(&artifact[OTA_ARTIFACT_HEADER_SIZE], &deflated, payload, payload_len, 9) == Z_OK);
+    return OTA_ARTIFACT_HEADER_SIZE + deflated;
+}
+
+static session_t session;
+
+static void start_session(size_t stream_len)
+{
+    session.stream = artifact;
+    session.stream_len = stream_len;
+    session.cut_at = 0;
+    session.base = base_image;
+}
+
+static void check_flash_holds_new_image(void)
+{
+    CHECK(memcmp(flash.bytes, new_image, new_size) == 0);
+    CHECK_EQ(flash.dirty_writes, 0);
+    CHECK_EQ(flash.erases, (new_size + SECTOR_SIZE - 1) / SECTOR_SIZE);
+}
+
+static void test_artifacts_round_trip(void)
+{
+    static const struct {
+        const char *name;
+        uint8_t flags;
+    } kinds[] = {
+        { "raw", 0 },
+        { "compressed", OTA_ARTIFACT_COMPRESSED },
+        { "delta", OTA_ARTIFACT_DELTA },
+        { "compressed delta", OTA_ARTIFACT_COMPRESSED | OTA_ARTIFACT_DELTA },
+    };
+
+    for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++) {
+        size_t len = build_artifact(kinds[k].flags);
+        flash_reset();
+        start_session(len);
+        run_session(&session, 0);
+
+        CHECK_EQ(session.write_err, OTA_DECODER_OK);
+        CHECK(ota_decoder_complete(&session.decoder));
+        CHECK_EQ(session.offset, new_size);
+        check_flash_holds_new_image();
+        CHECK_EQ(session.metrics.bytes, len);
+        printf("%-17s %7zu B download -> %zu B image, %2u chunks, %6u kB/s, fetch stalls %u, write stalls %u, "
+               "arena %zu B\n", kinds[k].name, len, new_size, session.metrics.chunks,
+               ota_metrics_throughput(&session.metrics) / 1024, session.metrics.fetch_stalls,
+               session.metrics.write_stalls, session.arena.high_water);
+    }
+}
+
+static void test_same_version_writes_nothing(void)
+{
+    uint8_t flags[] = { 0, OTA_ARTIFACT_COMPRESSED | OTA_ARTIFACT_DELTA };
+
+    // The running image offered again, raw and as a delta that copies it whole
+    patch_len = new_size = 0;
+    patch_copy(0, BASE_SIZE);
+    patch[patch_len++] = DELTA_OP_END;
+    for (size_t k = 0; k < sizeof(flags); k++) {
+        size_t len = build_artifact(flags[k]);
+        flash_reset();
+        start_session(len);
+        run_session(&session, 0);
+        CHECK_EQ(session.write_err, OTA_DECODER_ERR_VERSION);
+        CHECK(session.head_refused);
+        CHECK(!ota_decoder_complete(&session.decoder));
+        CHECK_EQ(flash.writes, 0);
+        CHECK_EQ(flash.erases, 0);
+    }
+    build_images();
+}
+
+static void test_dropped_raw_download_resumes(void)
+{
+    size_t len = build_artifact(0);
+
+    // Connection drops mid buffer, the resume point is rounded down to a sector
+    flash_reset();
+    start_session(len);
+    session.cut_at = 100 * 1024 + 1234;
+    run_session(&session, 0);
+    CHECK_EQ(session.write_err, OTA_DECODER_OK);
+    CHECK_EQ(session.offset, session.cut_at);
+    CHECK(ota_decoder_head_checked(&session.decoder));
+
+    uint32_t resume_from = session.offset & ~(SECTOR_SIZE - 1);
+    uint32_t erases_before = flash.erases;
+    start_session(len);
+    run_session(&session, resume_from);
+    CHECK_EQ(session.write_err, OTA_DECODER_OK);
+    CHECK(ota_decoder_complete(&session.decoder));
+    CHECK(memcmp(flash.bytes, new_image, new_size) == 0);
+    CHECK_EQ(flash.dirty_writes, 0);
+    // The sector holding the resume point is erased again, nothing before it
+    CHECK_EQ(flash.erases - erases_before, (new_size - resume_from + SECTOR_SIZE - 1) / SECTOR_SIZE);
+}
+
+static void test_errors(void)
+{
+    // Truncated compressed delta: no error while it streams, but never complete
+    size_t len = build_artifact(OTA_ARTIFACT_COMPRESSED | OTA_ARTIFACT_DELTA);
+    flash_reset();
+    start_session(len - 100);
+    run_session(&session, 0);
+    CHECK_EQ(session.write_err, OTA_DECODER_OK);
+    CHECK(!ota_decoder_complete(&session.decoder));
+
+    // Corrupt deflate stream
+    len = build_artifact(OTA_ARTIFACT_COMPRESSED);
+    artifact[OTA_ARTIFACT_HEADER_SIZE + 2] ^= 0xff;
+    flash_reset();
+    start_session(len);
+    run_session(&session, 0);
+    CHECK_EQ(session.write_err, OTA_DECODER_ERR_INFLATE);
+
+    // Unknown delta op
+    len = build_artifact(OTA_ARTIFACT_DELTA);
+    artifact[OTA_ARTIFACT_HEADER_SIZE] = 0x7f;
+    flash_reset();
+    start_session(len);
+    run_session(&session, 0);
+    CHECK_EQ(session.write_err, OTA_DECODER_ERR_PATCH);
+    CHECK_EQ(session.decoder.patch_err, DELTA_PATCH_ERR_FORMAT);
+
+    // Unsupported artifact flags
+    len = build_artifact(OTA_ARTIFACT_COMPRESSED);
+    artifact[5] |= 0x80;
+    flash_reset();
+    start_session(len);
+    run_session(&session, 0);
+    CHECK_EQ(session.write_err, OTA_DECODER_ERR_ARTIFACT);
+
+    // Flash write failure half way, raw and through the delta applier
+    uint8_t flags[] = { 0, OTA_ARTIFACT_COMPRESSED | OTA_ARTIFACT_DELTA };
+    for (size_t k = 0; k < sizeof(flags); k++) {
+        len = build_artifact(flags[k]);
+        flash_reset();
+        flash.fail_from = 150 * 1024;
+        start_session(len);
+        run_session(&session, 0);
+        CHECK_EQ(session.write_err, OTA_DECODER_ERR_WRITE);
+        CHECK(session.offset <= 150 * 1024);
+    }
+
+    // Arena without room for the inflate window
+    len = build_artifact(OTA_ARTIFACT_COMPRESSED);
+    flash_reset();
+    start_session(len);
+    session.stream_pos = 0;
+    arena_init(&session.arena, session.arena_storage, 1024);
+    ota_decoder_init(&session.decoder, &session_ops, &session, &session.arena, HEAD_SIZE, false);
+    CHECK_EQ(ota_decoder_feed(&session.decoder, artifact, BUF_SIZE), OTA_DECODER_ERR_NO_MEM);
+}
+
+int main(void)
+{
+    build_images();
+    TEST_RUN(test_artifacts_round_trip);
+    TEST_RUN(test_same_version_writes_nothing);
+    TEST_RUN(test_dropped_raw_download_resumes);
+    TEST_RUN(test_errors);
+    return 0;
+}
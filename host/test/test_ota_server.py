@@ -0,0 +1,104 @@
+#!/usr/bin/env python3
+"""tools/ota_server.py with connections cut at random offsets.
+
+Starts the server on the sample images of delta_samples.py and downloads
+image.bin the way ota_download_session does: the first request plain, every
+retry with Range from the bytes kept and If-Range with the ETag, until the
+image is complete. The result must match X-Image-SHA256 and the manifest,
+and at least one response must have been cut. Also checks the manifest's
+If-None-Match answer and that a stale If-Range gets the full image.
+
+Usage:
+    host/test/test_ota_server.py build/test/delta_samples
+"""
+
+import hashlib
+import http.client
+import json
+import os
+import subprocess
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+SERVER = os.path.join(HERE, "..", "..", "tools", "ota_server.py")
+ATTEMPTS = 200
+
+
+def get(port, path, headers=None):
+    """Status, headers and as much of the body as arrived before the connection ended."""
+    conn = http.client.HTTPConnection("127.0.0.1", port, timeout=10)
+    conn.request("GET", path, headers=headers or {})
+    response = conn.getresponse()
+    body = b""
+    try:
+        while True:
+            part = response.read(4096)
+            if not part:
+                break
+            body += part
+    except http.client.IncompleteRead as e:
+        body += e.partial
+    conn.close()
+    return response.status, response.headers, body
+
+
+def download(port, name):
+    """Resumable download, returns the image, its advertised SHA-256, the cuts and the resumed responses."""
+    data, etag, sha256, cuts, resumed = b"", None, None, 0, 0
+    for _ in range(ATTEMPTS):
+        headers = {}
+        if data:
+            headers = {"Range": "bytes=%d-" % len(data), "If-Range": etag}
+        status, response_headers, body = get(port, "/" + name, headers)
+        if status == 200:
+            data, etag, sha256 = b"", response_headers["ETag"], response_headers["X-Image-SHA256"]
+            total = int(response_headers["Content-Length"])
+        elif status == 206 and response_headers["ETag"] == etag:
+            resumed += 1
+        else:
+            raise AssertionError("unexpected status %d" % status)
+        data += body
+        if len(data) == total:
+            return data, sha256, cuts, resumed
+        cuts += 1
+    raise AssertionError("no complete download in %d attempts" % ATTEMPTS)
+
+
+def main():
+    samples = sys.argv[1]
+    server = subprocess.Popen([sys.executable, SERVER, "--dir", samples, "--port", "0", "--cut-probability", "0.7",
+                               "--seed", "1"], stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, text=True)
+    try:
+        port = int(server.stdout.readline().split()[-1])
+        with open(os.path.join(samples, "image.bin"), "rb") as f:
+            image = f.read()
+
+        data, sha256, cuts, resumed = download(port, "image.bin")
+        assert data == image, "downloaded image differs"
+        assert sha256 == hashlib.sha256(image).hexdigest(), "X-Image-SHA256 is not the image's"
+        assert cuts > 0, "no connection was cut"
+        assert resumed == cuts, "a retry after a cut was not resumed"
+        print("ok resumed download, %d cuts" % cuts)
+
+        status, headers, body = get(port, "/image.bin.json")
+        assert status == 200
+        manifest = json.loads(body)
+        assert manifest["sha256"] == sha256 and manifest["size"] == len(image)
+        status, _, body = get(port, "/image.bin.json", {"If-None-Match": headers["ETag"]})
+        assert status == 304 and body == b""
+        print("ok manifest")
+
+        # A changed image invalidates the kept bytes: the server answers with the whole file
+        status, _, _ = get(port, "/image.bin", {"Range": "bytes=100-", "If-Range": '"stale"'})
+        assert status == 200
+        status, _, _ = get(port, "/missing.bin")
+        assert status == 404
+        print("ok If-Range")
+    finally:
+        server.terminate()
+        server.wait()
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,311 @@
+/*
+ * power_policy on a virtual clock.
+ *
+ * Activities begin and end at chosen times, the linger timer fires when the
+ * clock passes its deadline, and every level change the policy applies is
+ * recorded. Scripted cases check raising, lingering, bursts and the
+ * statistics; random activity streams check that the level never falls
+ * below what a running activity needs, never stays above it without a timer
+ * armed to lower it, and that level time and busy time add up.
+ */
+
+#include <string.h>
+
+#include "power_policy.h"
+#include "test.h"
+
+/* power_task's activities */
+enum { FRAME, PUBLISH, COMMAND, OTA, ACTIVITIES };
+
+static const uint8_t needs[ACTIVITIES] = {
+    [FRAME] = POWER_LEVEL_AWAKE,
+    [PUBLISH] = POWER_LEVEL_FULL,
+    [COMMAND] = POWER_LEVEL_FULL,
+    [OTA] = POWER_LEVEL_FULL,
+};
+
+#define LINGER_US   20000   // INTERCOM_PM_LINGER_MS default
+
+typedef struct {
+    int64_t now_us;
+    bool armed;
+    int64_t deadline_us;
+    int arms;
+    int applies;
+    power_level_t applied;      // what the PM locks say
+} virtual_t;
+
+static virtual_t clock_;
+static power_policy_t policy;
+
+static int64_t virtual_now(void *ctx)
+{
+    return ((virtual_t *)ctx)->now_us;
+}
+
+static void virtual_apply(void *ctx, power_level_t from, power_level_t to)
+{
+    virtual_t *v = ctx;
+    CHECK_EQ(from, v->applied);
+    CHECK(from != to);
+    v->applied = to;
+    v->applies++;
+}
+
+static void virtual_arm(void *ctx, uint64_t delay_us)
+{
+    virtual_t *v = ctx;
+    CHECK(delay_us > 0);
+    v->armed = true;
+    v->deadline_us = v->now_us + (int64_t)delay_us;
+    v->arms++;
+}
+
+static void setup(uint64_t linger_us)
+{
+    memset(&clock_, 0, sizeof(clock_));
+    clock_.now_us = 1000000;
+    const power_ops_t ops = {
+        .now_us = virtual_now,
+        .apply = virtual_apply,
+        .arm_timer = virtual_arm,
+        .ctx = &clock_,
+    };
+    power_policy_init(&policy, &ops, needs, ACTIVITIES, linger_us);
+    CHECK_EQ(power_policy_level(&policy), POWER_LEVEL_IDLE);
+}
+
+/* Move the clock to t, firing the linger timer on the way */
+static void advance_to(int64_t t)
+{
+    while (clock_.armed && clock_.deadline_us <= t) {
+        clock_.now_us = clock_.deadline_us;
+        clock_.armed = false;
+        power_policy_expire(&policy);
+    }
+    clock_.now_us = t;
+}
+
+static void advance_us(int64_t us)
+{
+    advance_to(clock_.now_us + us);
+}
+
+static void test_raise_and_linger(void)
+{
+    setup(LINGER_US);
+
+    // Up at once, to the highest level needed
+    power_policy_begin(&policy, FRAME);
+    CHECK_EQ(clock_.applied, POWER_LEVEL_AWAKE);
+    power_policy_begin(&policy, PUBLISH);
+    CHECK_EQ(clock_.applied, POWER_LEVEL_FULL);
+
+    // Down only after the linger time, and only to what is still running
+    advance_us(3000);
+    power_policy_end(&policy, PUBLISH);
+    CHECK_EQ(clock_.applied, POWER_LEVEL_FULL);
+    advance_us(LINGER_US - 1);
+    CHECK_EQ(clock_.applied, POWER_LEVEL_FULL);
+    advance_us(1);
+    CHECK_EQ(clock_.applied, POWER_LEVEL_AWAKE);
+
+    power_policy_end(&policy, FRAME);
+    advance_us(LINGER_US);
+    CHECK_EQ(clock_.applied, POWER_LEVEL_IDLE);
+    CHECK_EQ(clock_.applies, 4);
+}
+
+/* Publishes 5 ms apart keep the full clock instead of toggling it each time */
+static void test_burst(void)
+{
+    setup(LINGER_US);
+    for (int i = 0; i < 50; i++) {
+        power_policy_begin(&policy, PUBLISH);
+        advance_us(300);
+        power_policy_end(&policy, PUBLISH);
+        advance_us(4700);
+    }
+    CHECK_EQ(clock_.applies, 1);
+    advance_us(LINGER_US);
+    CHECK_EQ(clock_.applied, POWER_LEVEL_IDLE);
+    CHECK_EQ(clock_.applies, 2);
+
+    // Without linger every publish toggles the clock
+    setup(0);
+    for (int i = 0; i < 50; i++) {
+        power_policy_begin(&policy, PUBLISH);
+        advance_us(300);
+        power_policy_end(&policy, PUBLISH);
+        CHECK_EQ(clock_.applied, POWER_LEVEL_IDLE);
+        advance_us(4700);
+    }
+    CHECK_EQ(clock_.applies, 100);
+    CHECK_EQ(clock_.arms, 0);
+}
+
+/* The timer armed by the first end fires early for the second one and re-arms */
+static void test_rearm(void)
+{
+    setup(LINGER_US);
+    power_policy_begin(&policy, COMMAND);
+    power_policy_end(&policy, COMMAND);
+    int64_t first_deadline = clock_.deadline_us;
+    advance_us(LINGER_US / 2);
+    power_policy_begin(&policy, OTA);
+    power_policy_end(&policy, OTA);
+
+    // The callback of the first arm was already dispatched
+    clock_.now_us = first_deadline;
+    clock_.armed = false;
+    power_policy_expire(&policy);
+    CHECK_EQ(clock_.applied, POWER_LEVEL_FULL);
+    CHECK(clock_.armed);
+    CHECK_EQ(clock_.deadline_us, first_deadline + LINGER_US / 2);
+    advance_to(clock_.deadline_us);
+    CHECK_EQ(clock_.applied, POWER_LEVEL_IDLE);
+
+    // A stale callback after the drop changes nothing
+    power_policy_expire(&policy);
+    CHECK_EQ(clock_.applies, 2);
+}
+
+/* A lower activity starting while a higher level lingers leaves the drop to the timer */
+static void test_lower_during_linger(void)
+{
+    setup(LINGER_US);
+    power_policy_begin(&policy, PUBLISH);
+    power_policy_end(&policy, PUBLISH);
+    advance_us(5000);
+    power_policy_begin(&policy, FRAME);
+    CHECK_EQ(clock_.applied, POWER_LEVEL_FULL);
+    advance_us(LINGER_US);
+    CHECK_EQ(clock_.applied, POWER_LEVEL_AWAKE);
+
+    // Ends without a begin and unknown activities are ignored
+    power_policy_end(&policy, OTA);
+    power_policy_begin(&policy, ACTIVITIES);
+    power_policy_end(&policy, 200);
+    CHECK_EQ(clock_.applied, POWER_LEVEL_AWAKE);
+    power_policy_end(&policy, FRAME);
+    advance_us(LINGER_US);
+    CHECK_EQ(clock_.applied, POWER_LEVEL_IDLE);
+}
+
+static void test_stats(void)
+{
+    power_stats_t stats;
+    int64_t period_us;
+
+    setup(LINGER_US);
+    advance_us(100000);
+    power_policy_begin(&policy, FRAME);             // AWAKE from 100 ms
+    advance_us(10000);
+    power_policy_begin(&policy, FRAME);             // nested instance of the same activity
+    power_policy_begin(&policy, PUBLISH);           // FULL from 110 ms
+    advance_us(5000);
+    power_policy_end(&policy, PUBLISH);             // FULL until 135 ms
+    power_policy_end(&policy, FRAME);
+    advance_us(45000);                              // 160 ms, take stats with FRAME still running
+
+    power_policy_take_stats(&policy, &stats, &period_us);
+    CHECK_EQ(period_us, 160000);
+    CHECK_EQ(stats.level_us[POWER_LEVEL_IDLE], 100000);
+    CHECK_EQ(stats.level_us[POWER_LEVEL_FULL], 25000);
+    CHECK_EQ(stats.level_us[POWER_LEVEL_AWAKE], 35000);
+    CHECK_EQ(stats.begins[FRAME], 2);
+    CHECK_EQ(stats.begins[PUBLISH], 1);
+    CHECK_EQ(stats.busy_us[FRAME], 60000);          // union of the two instances, still open
+    CHECK_EQ(stats.busy_us[PUBLISH], 5000);
+    CHECK_EQ(stats.transitions, 3);
+
+    // The next period starts where this one ended
+    advance_us(20000);
+    power_policy_end(&policy, FRAME);
+    advance_us(80000);
+    power_policy_take_stats(&policy, &stats, &period_us);
+    CHECK_EQ(period_us, 100000);
+    CHECK_EQ(stats.busy_us[FRAME], 20000);
+    CHECK_EQ(stats.begins[FRAME], 0);
+    CHECK_EQ(stats.level_us[POWER_LEVEL_AWAKE], 40000);
+    CHECK_EQ(stats.level_us[POWER_LEVEL_IDLE], 60000);
+}
+
+static uint32_t rng = 0x7b3d1e59;
+
+static uint32_t next_random(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static void test_random_activities(void)
+{
+    uint16_t running[ACTIVITIES] = { 0 };
+    int64_t busy[ACTIVITIES] = { 0 }, busy_since[ACTIVITIES] = { 0 };
+    uint64_t level_total[POWER_LEVEL_COUNT] = { 0 };
+    int64_t stats_total = 0;
+
+    setup(LINGER_US);
+    for (int i = 0; i < 200000; i++) {
+        uint32_t op = next_random() % 10;
+        uint8_t a = next_random() % ACTIVITIES;
+        if (op < 2 && running[a] < 2) {
+            if (running[a]++ == 0) {
+                busy_since[a] = clock_.now_us;
+            }
+            power_policy_begin(&policy, a);
+        } else if (op < 6) {
+            if (running[a] > 0 && --running[a] == 0) {
+                busy[a] += clock_.now_us - busy_since[a];
+            }
+            power_policy_end(&policy, a);
+        } else if (op < 9) {
+            advance_us(next_random() % (3 * LINGER_US));
+        } else if (next_random() % 100 == 0) {
+            power_stats_t stats;
+            int64_t period_us;
+            power_policy_take_stats(&policy, &stats, &period_us);
+            stats_total += period_us;
+            uint64_t sum = 0;
+            for (int l = 0; l < POWER_LEVEL_COUNT; l++) {
+                level_total[l] += stats.level_us[l];
+                sum += stats.level_us[l];
+            }
+            CHECK_EQ(sum, period_us);
+            for (int k = 0; k < ACTIVITIES; k++) {
+                int64_t expected = busy[k] + (running[k] ? clock_.now_us - busy_since[k] : 0);
+                CHECK_EQ(stats.busy_us[k], expected);
+                busy[k] = 0;
+                busy_since[k] = clock_.now_us;
+            }
+        }
+
+        power_level_t required = POWER_LEVEL_IDLE;
+        for (int k = 0; k < ACTIVITIES; k++) {
+            if (running[k] && needs[k] > required) {
+                required = needs[k];
+            }
+        }
+        CHECK_EQ(clock_.applied, power_policy_level(&policy));
+        CHECK(clock_.applied >= required);                          // never under-powered
+        CHECK(clock_.applied == required || clock_.armed);          // a higher level always has a drop pending
+        CHECK(!clock_.armed || clock_.deadline_us <= clock_.now_us + LINGER_US);
+    }
+    printf("%d level changes, %llu/%llu/%llu us idle/awake/full over %lld us\n", clock_.applies,
+           (unsigned long long)level_total[POWER_LEVEL_IDLE], (unsigned long long)level_total[POWER_LEVEL_AWAKE],
+           (unsigned long long)level_total[POWER_LEVEL_FULL], (long long)stats_total);
+}
+
+int main(void)
+{
+    TEST_RUN(test_raise_and_linger);
+    TEST_RUN(test_burst);
+    TEST_RUN(test_rearm);
+    TEST_RUN(test_lower_during_linger);
+    TEST_RUN(test_stats);
+    TEST_RUN(test_random_activities);
+    return 0;
+}
@@ -0,0 +1,348 @@
+/*
+ * publish_policy through a 5 minute broker outage, against a fake client
+ * outbox on a simulated clock.
+ *
+ * Telemetry (state, 436 B) every 10 s and a ring event (96 B) every 2 s,
+ * QoS 1, over a 2 kB/s uplink. The outbox delivers in order while the link
+ * is up and the broker acknowledges on delivery. Three setups:
+ * - direct: everything goes straight into the outbox, which expires
+ *   messages after 30 s like esp-mqtt's default;
+ * - direct, no expiry;
+ * - the policy with the firmware's default caps, the outbox still expiring.
+ * Reported: peak bytes held (outbox plus waiting slots), time from
+ * reconnect until the broker has the telemetry value that was current at
+ * reconnect, and events lost without the caller knowing.
+ */
+
+#include <string.h>
+
+#include "publish_policy.h"
+#include "test.h"
+
+#define TICK_US             10000
+#define UPLINK_BYTES_PER_S  2000
+#define TELEMETRY_PERIOD_US 10000000
+#define TELEMETRY_BYTES     436
+#define EVENT_PERIOD_US     2000000
+#define EVENT_BYTES         96
+#define OUTAGE_START_US     60000000
+#define OUTAGE_END_US       360000000
+#define RUN_END_US          420000000
+#define OUTBOX_EXPIRY_US    30000000
+#define OUTBOX_MAX          1024
+
+#define TELEMETRY_TOPIC     "/topic/intercom/telemetry"
+#define EVENT_TOPIC         "/topic/intercom/event"
+#define CAPTURE_TOPIC       "/topic/intercom/capture"
+
+typedef struct {
+    int msg_id;
+    bool telemetry;
+    bool capture;
+    uint32_t len;
+    int64_t queued_us;
+    int64_t value_us;       // when the value was produced, carried in the payload
+} outbox_msg_t;
+
+typedef struct {
+    outbox_msg_t msgs[OUTBOX_MAX];
+    size_t n;
+    uint32_t bytes;
+    int next_id;
+    bool expiry;
+    double uplink_credit;
+} outbox_t;
+
+typedef struct {
+    const char *name;
+    bool use_policy;
+    bool outbox_expiry;
+
+    uint32_t peak_held;
+    int64_t fresh_after_us;         // -1 if the broker never caught up
+    uint32_t events_expired;        // lost without the caller knowing
+    uint32_t events_refused;        // caller told, the firmware keeps them in the flash log
+    uint32_t events_delivered;
+} outage_result_t;
+
+static int64_t sim_now;
+static outbox_t outbox;
+static publish_policy_t policy;
+
+static int outbox_send(void *ctx, const char *topic, const uint8_t *data, size_t len, int qos, int retain)
+{
+    CHECK(outbox.n < OUTBOX_MAX);
+    outbox_msg_t *msg = &outbox.msgs[outbox.n++];
+    msg->msg_id = ++outbox.next_id;
+    msg->telemetry = strcmp(topic, TELEMETRY_TOPIC) == 0;
+    msg->capture = strcmp(topic, CAPTURE_TOPIC) == 0;
+    msg->len = (uint32_t)len;
+    msg->queued_us = sim_now;
+    memcpy(&msg->value_us, data, sizeof(msg->value_us));
+    outbox.bytes += (uint32_t)len;
+    return msg->msg_id;
+}
+
+static int64_t sim_now_us(void *ctx)
+{
+    return sim_now;
+}
+
+static void outbox_remove(size_t i)
+{
+    outbox.bytes -= outbox.msgs[i].len;
+    memmove(&outbox.msgs[i], &outbox.msgs[i + 1], (outbox.n - i - 1) * sizeof(outbox.msgs[0]));
+    outbox.n--;
+}
+
+static void run_outage(outage_result_t *r)
+{
+    static const publish_caps_t caps[PUBLISH_CLASS_COUNT] = {
+        [PUBLISH_CLASS_STATE] = { .max_count = 4, .max_bytes = 2048 },
+        [PUBLISH_CLASS_EVENT] = { .max_count = 8, .max_bytes = 2048 },
+        [PUBLISH_CLASS_BULK] = { .max_count = 2, .max_bytes = 2048 },
+    };
+    static uint8_t telemetry_buf[TELEMETRY_BYTES];
+    publish_slot_t slots[] = {
+        { .topic = TELEMETRY_TOPIC, .buf = telemetry_buf, .size = sizeof(telemetry_buf) },
+    };
+    const publish_ops_t ops = { .send = outbox_send, .now_us = sim_now_us };
+    uint8_t payload[TELEMETRY_BYTES] = { 0 };
+    int64_t latest_telemetry_us = -1, telemetry_at_reconnect_us = -1, broker_telemetry_us = -1;
+
+    memset(&outbox, 0, sizeof(outbox));
+    outbox.expiry = r->outbox_expiry;
+    publish_policy_init(&policy, &ops, slots, 1, NULL, 0, caps, 60000000);
+    publish_policy_set_connected(&policy, true);
+    r->fresh_after_us = -1;
+
+    for (sim_now = 0; sim_now < RUN_END_US; sim_now += TICK_US) {
+        bool connected = sim_now < OUTAGE_START_US || sim_now >= OUTAGE_END_US;
+
+        if (sim_now == OUTAGE_START_US || sim_now == OUTAGE_END_US) {
+            if (r->use_policy) {
+                publish_policy_set_connected(&policy, connected);
+            }
+            if (connected) {
+                telemetry_at_reconnect_us = latest_telemetry_us;
+            }
+        }
+
+        // Producers
+        memcpy(payload, &sim_now, sizeof(sim_now));
+        if (sim_now % TELEMETRY_PERIOD_US == 0) {
+            latest_telemetry_us = sim_now;
+            if (r->use_policy) {
+                publish_policy_publish(&policy, TELEMETRY_TOPIC, payload, TELEMETRY_BYTES, 1, 0);
+            } else {
+                outbox_send(NULL, TELEMETRY_TOPIC, payload, TELEMETRY_BYTES, 1, 0);
+            }
+        }
+        if (sim_now % EVENT_PERIOD_US == 0) {
+            if (!r->use_policy) {
+                outbox_send(NULL, EVENT_TOPIC, payload, EVENT_BYTES, 1, 0);
+            } else if (publish_policy_publish(&policy, EVENT_TOPIC, payload, EVENT_BYTES, 1, 0) < 0) {
+                r->events_refused++;
+            }
+        }
+
+        // Client: expiry, then in order delivery at the uplink rate, acknowledged on arrival
+        for (size_t i = 0; outbox.expiry && i < outbox.n;) {
+            if (sim_now - outbox.msgs[i].queued_us < OUTBOX_EXPIRY_US) {
+                i++;
+                continue;
+            }
+            if (!outbox.msgs[i].telemetry) {
+                r->events_expired++;
+            }
+            int msg_id = outbox.msgs[i].msg_id;
+            outbox_remove(i);
+            if (r->use_policy) {
+                publish_policy_done(&policy, msg_id, false);
+            }
+        }
+        if (connected) {
+            outbox.uplink_credit += (double)UPLINK_BYTES_PER_S * TICK_US / 1000000;
+            while (outbox.n > 0 && outbox.uplink_credit >= outbox.msgs[0].len) {
+                outbox_msg_t msg = outbox.msgs[0];
+                outbox.uplink_credit -= msg.len;
+                outbox_remove(0);
+                if (msg.telemetry) {
+                    if (msg.value_us > broker_telemetry_us) {
+                        broker_telemetry_us = msg.value_us;
+                    }
+                } else {
+                    r->events_delivered++;
+                }
+                if (r->use_policy) {
+                    publish_policy_done(&policy, msg.msg_id, true);
+                }
+            }
+            if (outbox.n == 0) {
+                outbox.uplink_credit = 0;   // an idle link does not save up
+            }
+        }
+        if (r->use_policy) {
+            publish_policy_expire(&policy);
+        }
+
+        uint32_t held = outbox.bytes + (slots[0].waiting ? (uint32_t)slots[0].len : 0);
+        if (held > r->peak_held) {
+            r->peak_held = held;
+        }
+        if (sim_now >= OUTAGE_END_US && r->fresh_after_us < 0 && broker_telemetry_us >= telemetry_at_reconnect_us) {
+            r->fresh_after_us = sim_now - OUTAGE_END_US;
+        }
+    }
+
+    printf("%-22s peak %6u B held, fresh telemetry %6lld ms after reconnect, events: %3u delivered, "
+           "%3u refused, %3u lost\n", r->name, r->peak_held, (long long)r->fresh_after_us / 1000,
+           r->events_delivered, r->events_refused, r->events_expired);
+}
+
+static void test_broker_outage(void)
+{
+    outage_result_t direct = { .name = "direct, 30 s expiry", .outbox_expiry = true };
+    outage_result_t direct_keep = { .name = "direct, no expiry" };
+    outage_result_t policed = { .name = "publish_policy", .use_policy = true, .outbox_expiry = true };
+
+    run_outage(&direct);
+    run_outage(&direct_keep);
+    run_outage(&policed);
+
+    const int events = RUN_END_US / EVENT_PERIOD_US;
+
+    // Without the policy the outbox either grows with the outage or silently loses events
+    CHECK(direct.events_expired > 0);
+    CHECK(direct_keep.peak_held > 20000);
+    CHECK_EQ(direct_keep.events_delivered, events);
+
+    // With it: bounded memory, the newest telemetry goes out first, no silent loss
+    CHECK(policed.peak_held <= 2048 + 2048);
+    CHECK(policed.peak_held < direct.peak_held);
+    CHECK(policed.fresh_after_us >= 0);
+    CHECK(policed.fresh_after_us < direct.fresh_after_us);
+    CHECK(policed.fresh_after_us < direct_keep.fresh_after_us);
+    // The held message and the fresh value, each 436 B at 2 kB/s
+    CHECK(policed.fresh_after_us <= 2 * (int64_t)TELEMETRY_BYTES * 1000000 / UPLINK_BYTES_PER_S + 2 * TICK_US);
+    CHECK_EQ(policed.events_expired, 0);
+    CHECK_EQ(policed.events_delivered + policed.events_refused, events);
+
+    publish_stats_t stats[PUBLISH_CLASS_COUNT];
+    publish_policy_take_stats(&policy, stats);
+    CHECK(stats[PUBLISH_CLASS_STATE].coalesced > 0);
+    CHECK_EQ(stats[PUBLISH_CLASS_STATE].count, 0);
+    CHECK_EQ(stats[PUBLISH_CLASS_EVENT].count, 0);
+}
+
+/*
+ * A waveform capture (32 chunks of 940 B, retried every 200 ms while
+ * refused, as capture_task does) uploads over the same link while each ring
+ * sends a burst of three events. In the event class the chunks take the
+ * event budget and ring events are refused; with capture as a bulk topic
+ * none are, and the upload only takes as much longer as the events it no
+ * longer pushes aside need on the link.
+ */
+#define CAPTURE_CHUNKS      32
+#define CAPTURE_CHUNK_BYTES 940
+#define CAPTURE_RETRY_US    200000
+#define RING_BURST          3
+
+typedef struct {
+    uint32_t events_refused;
+    uint32_t events_delivered;
+    int64_t upload_us;
+    uint32_t peak_event_bytes;
+} capture_result_t;
+
+static capture_result_t run_capture(bool bulk)
+{
+    static const publish_caps_t caps[PUBLISH_CLASS_COUNT] = {
+        [PUBLISH_CLASS_STATE] = { .max_count = 4, .max_bytes = 2048 },
+        [PUBLISH_CLASS_EVENT] = { .max_count = 8, .max_bytes = 2048 },
+        [PUBLISH_CLASS_BULK] = { .max_count = 2, .max_bytes = 2048 },
+    };
+    static const char *const bulk_topics[] = { CAPTURE_TOPIC };
+    const publish_ops_t ops = { .send = outbox_send, .now_us = sim_now_us };
+    uint8_t payload[CAPTURE_CHUNK_BYTES] = { 0 };
+    capture_result_t r = { .upload_us = -1 };
+    int chunks_sent = 0, chunks_delivered = 0;
+    int64_t retry_at = 0;
+
+    memset(&outbox, 0, sizeof(outbox));
+    publish_policy_init(&policy, &ops, NULL, 0, bulk_topics, bulk ? 1 : 0, caps, 60000000);
+    publish_policy_set_connected(&policy, true);
+
+    for (sim_now = 0; sim_now < 60000000; sim_now += TICK_US) {
+        if (sim_now % EVENT_PERIOD_US == 0) {
+            for (int i = 0; i < RING_BURST; i++) {
+                if (publish_policy_publish(&policy, EVENT_TOPIC, payload, EVENT_BYTES, 1, 0) < 0) {
+                    r.events_refused++;
+                }
+            }
+        }
+        while (chunks_sent < CAPTURE_CHUNKS && sim_now >= retry_at) {
+            if (publish_policy_publish(&policy, CAPTURE_TOPIC, payload, CAPTURE_CHUNK_BYTES, 1, 0) < 0) {
+                retry_at = sim_now + CAPTURE_RETRY_US;
+            } else {
+                chunks_sent++;
+            }
+        }
+
+        outbox.uplink_credit += (double)UPLINK_BYTES_PER_S * TICK_US / 1000000;
+        while (outbox.n > 0 && outbox.uplink_credit >= outbox.msgs[0].len) {
+            outbox_msg_t msg = outbox.msgs[0];
+            outbox.uplink_credit -= msg.len;
+            outbox_remove(0);
+            if (msg.capture) {
+                if (++chunks_delivered == CAPTURE_CHUNKS) {
+                    r.upload_us = sim_now;
+                }
+            } else {
+                r.events_delivered++;
+            }
+            publish_policy_done(&policy, msg.msg_id, true);
+        }
+        if (outbox.n == 0) {
+            outbox.uplink_credit = 0;
+        }
+        if (policy.stats[PUBLISH_CLASS_EVENT].bytes > r.peak_event_bytes) {
+            r.peak_event_bytes = policy.stats[PUBLISH_CLASS_EVENT].bytes;
+        }
+    }
+
+    printf("capture %-12s upload %5lld ms, peak event bytes %4u, events: %3u delivered, %3u refused\n",
+           bulk ? "bulk class," : "event class,", (long long)r.upload_us / 1000, r.peak_event_bytes,
+           r.events_delivered, r.events_refused);
+    return r;
+}
+
+static void test_capture_upload(void)
+{
+    const uint32_t events = 60000000 / EVENT_PERIOD_US * RING_BURST;
+    capture_result_t shared = run_capture(false);
+    capture_result_t bulk = run_capture(true);
+
+    CHECK(shared.events_refused > 0);
+    CHECK(shared.upload_us > 0);
+
+    CHECK_EQ(bulk.events_refused, 0);
+    CHECK_EQ(bulk.events_delivered, events);
+    CHECK(bulk.peak_event_bytes <= RING_BURST * EVENT_BYTES);
+    CHECK(bulk.upload_us > 0);
+    CHECK(bulk.upload_us <= shared.upload_us +
+          (int64_t)shared.events_refused * EVENT_BYTES * 1000000 / UPLINK_BYTES_PER_S + TICK_US);
+
+    publish_stats_t stats[PUBLISH_CLASS_COUNT];
+    publish_policy_take_stats(&policy, stats);
+    CHECK_EQ(stats[PUBLISH_CLASS_BULK].acked, CAPTURE_CHUNKS);
+    CHECK(stats[PUBLISH_CLASS_BULK].peak_bytes <= 2 * CAPTURE_CHUNK_BYTES);
+    CHECK_EQ(stats[PUBLISH_CLASS_BULK].count, 0);
+}
+
+int main(void)
+{
+    TEST_RUN(test_broker_outage);
+    TEST_RUN(test_capture_upload);
+    return 0;
+}
@@ -0,0 +1,288 @@
+/*
+ * pulse_engine on a virtual clock.
+ *
+ * The clock only moves when the test advances it, and the one-shot timer
+ * fires when the clock passes its deadline, optionally late by a dispatch
+ * latency, by calling pulse_engine_expire the way door_timer_cb does. Every
+ * output edge is recorded with its time, so on-times, caps, extensions and
+ * early stops are checked to the microsecond. A random command stream then
+ * checks that the output never stays on past the hold cap plus the timer
+ * latency and that every pulse reports what the output actually did.
+ */
+
+#include <string.h>
+
+#include "pulse_engine.h"
+#include "test.h"
+
+#define MAX_HOLD_MS     5000    // INTERCOM_DOOR_MAX_HOLD_MS default
+
+typedef struct {
+    int64_t now_us;
+    bool output;
+    int64_t on_at_us;           // last rising edge
+    int64_t longest_on_us;
+    int edges;
+    bool armed;
+    int64_t deadline_us;
+    int64_t latency_us;         // timer callbacks run this late
+    int arms;
+    int cancels;
+    int expired;                // pulses ended by the timer
+    pulse_result_t last;
+} virtual_t;
+
+static int64_t virtual_now(void *ctx)
+{
+    return ((virtual_t *)ctx)->now_us;
+}
+
+static void virtual_output(void *ctx, bool on)
+{
+    virtual_t *v = ctx;
+    if (on && !v->output) {
+        v->on_at_us = v->now_us;
+        v->edges++;
+    } else if (!on && v->output) {
+        int64_t held = v->now_us - v->on_at_us;
+        v->longest_on_us = held > v->longest_on_us ? held : v->longest_on_us;
+        v->edges++;
+    }
+    v->output = on;
+}
+
+static void virtual_arm(void *ctx, uint64_t delay_us)
+{
+    virtual_t *v = ctx;
+    v->armed = true;
+    v->deadline_us = v->now_us + (int64_t)delay_us;
+    v->arms++;
+}
+
+static void virtual_cancel(void *ctx)
+{
+    virtual_t *v = ctx;
+    v->armed = false;
+    v->cancels++;
+}
+
+static virtual_t clock_;
+static pulse_engine_t engine;
+
+static void setup(int64_t latency_us)
+{
+    memset(&clock_, 0, sizeof(clock_));
+    clock_.now_us = 1000000;
+    clock_.latency_us = latency_us;
+    const pulse_ops_t ops = {
+        .now_us = virtual_now,
+        .set_output = virtual_output,
+        .arm_timer = virtual_arm,
+        .cancel_timer = virtual_cancel,
+        .ctx = &clock_,
+    };
+    pulse_engine_init(&engine, &ops, MAX_HOLD_MS);
+    CHECK(!clock_.output);
+}
+
+/* Move the clock to t, firing the timer on the way as often as it gets re-armed */
+static void advance_to(int64_t t)
+{
+    while (clock_.armed && clock_.deadline_us + clock_.latency_us <= t) {
+        clock_.now_us = clock_.deadline_us + clock_.latency_us;
+        clock_.armed = false;
+        if (pulse_engine_expire(&engine, &clock_.last)) {
+            clock_.expired++;
+        }
+    }
+    clock_.now_us = t;
+}
+
+static void advance_ms(int64_t ms)
+{
+    advance_to(clock_.now_us + ms * 1000);
+}
+
+static void test_single_pulse(void)
+{
+    setup(0);
+    int64_t start = clock_.now_us;
+    CHECK_EQ(pulse_engine_start(&engine, 800), 1);
+    CHECK(clock_.output && pulse_engine_active(&engine));
+    CHECK_EQ(clock_.deadline_us - start, 800000);
+
+    advance_ms(799);
+    CHECK(clock_.output);
+    advance_ms(1);
+    CHECK(!clock_.output && !pulse_engine_active(&engine));
+    CHECK_EQ(clock_.expired, 1);
+    CHECK_EQ(clock_.last.seq, 1);
+    CHECK_EQ(clock_.last.requested_ms, 800);
+    CHECK_EQ(clock_.last.granted_ms, 800);
+    CHECK_EQ(clock_.last.on_time_us, 800000);
+    CHECK(!clock_.last.capped && !clock_.last.stopped);
+
+    // A timer that fires again after the end changes nothing
+    pulse_result_t result;
+    CHECK(!pulse_engine_expire(&engine, &result));
+    CHECK_EQ(pulse_engine_start(&engine, 100), 2);
+}
+
+static void test_capped(void)
+{
+    setup(0);
+    pulse_engine_start(&engine, 60000);
+    advance_ms(60000);
+    CHECK_EQ(clock_.last.granted_ms, MAX_HOLD_MS);
+    CHECK_EQ(clock_.last.on_time_us, MAX_HOLD_MS * 1000);
+    CHECK(clock_.last.capped);
+}
+
+/* A command during a pulse moves its end, the total stays under the cap */
+static void test_extend(void)
+{
+    setup(0);
+    pulse_engine_start(&engine, 1000);
+    advance_ms(600);
+    CHECK_EQ(pulse_engine_start(&engine, 1000), 1);     // same pulse
+    advance_ms(999);
+    CHECK(clock_.output);
+    advance_ms(1);
+    CHECK_EQ(clock_.expired, 1);
+    CHECK_EQ(clock_.last.on_time_us, 1600000);
+    CHECK_EQ(clock_.last.granted_ms, 1600);
+    CHECK(!clock_.last.capped);
+
+    // Keep extending: the output goes off at the cap however often it is asked
+    setup(0);
+    pulse_engine_start(&engine, 2000);
+    for (int i = 0; i < 4; i++) {
+        advance_ms(1000);
+        pulse_engine_start(&engine, 2000);
+    }
+    CHECK(clock_.last.seq == 0 && clock_.output);
+    advance_ms(10000);
+    CHECK_EQ(clock_.expired, 1);
+    CHECK_EQ(clock_.last.on_time_us, MAX_HOLD_MS * 1000);
+    CHECK(clock_.last.capped);
+    CHECK_EQ(clock_.longest_on_us, MAX_HOLD_MS * 1000);
+
+    // A shorter command moves the end earlier
+    setup(0);
+    pulse_engine_start(&engine, 3000);
+    advance_ms(100);
+    pulse_engine_start(&engine, 200);
+    advance_ms(5000);
+    CHECK_EQ(clock_.last.on_time_us, 300000);
+}
+
+/* A moved deadline and a timer armed for the old one: the early callback re-arms */
+static void test_early_timer(void)
+{
+    setup(0);
+    pulse_engine_start(&engine, 500);
+    int64_t first_deadline = clock_.deadline_us;
+    advance_ms(100);
+    pulse_engine_start(&engine, 1000);
+
+    // The old callback was already dispatched when the deadline moved
+    clock_.now_us = first_deadline;
+    CHECK(!pulse_engine_expire(&engine, &clock_.last));
+    CHECK(clock_.output && clock_.armed);
+    CHECK_EQ(clock_.deadline_us - clock_.now_us, 600000);
+    advance_ms(600);
+    CHECK(!clock_.output);
+    CHECK_EQ(clock_.last.on_time_us, 1100000);
+}
+
+static void test_stop(void)
+{
+    setup(0);
+    pulse_engine_start(&engine, 2000);
+    advance_ms(250);
+    pulse_result_t result;
+    CHECK(pulse_engine_stop(&engine, &result));
+    CHECK(!clock_.output && !clock_.armed);
+    CHECK(result.stopped);
+    CHECK_EQ(result.on_time_us, 250000);
+    CHECK(!pulse_engine_stop(&engine, &result));
+
+    // The cancelled callback may still run once, it must not end anything
+    CHECK(!pulse_engine_expire(&engine, &result));
+    advance_ms(5000);
+    CHECK_EQ(clock_.expired, 0);
+    CHECK_EQ(clock_.edges, 2);
+}
+
+/* Late timer callbacks: the output is on for the grant plus the latency, and the ack says so */
+static void test_timer_latency(void)
+{
+    setup(3500);
+    pulse_engine_start(&engine, 1000);
+    advance_ms(2000);
+    CHECK_EQ(clock_.last.granted_ms, 1000);
+    CHECK_EQ(clock_.last.on_time_us, 1003500);
+}
+
+static uint32_t rng = 0x6c8e9cf5;
+
+static uint32_t next_random(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static void test_random_commands(void)
+{
+    const int64_t latency_us = 2000;
+    int pulses = 0, stopped = 0, capped = 0;
+
+    setup(latency_us);
+    for (int i = 0; i < 100000; i++) {
+        uint32_t op = next_random() % 10;
+        int64_t rising = clock_.on_at_us;
+        bool was_on = clock_.output;
+        pulse_result_t result;
+        if (op < 6) {
+            uint32_t seq = pulse_engine_start(&engine, next_random() % 8000);
+            CHECK(clock_.output);
+            CHECK_EQ(seq, was_on ? (uint32_t)pulses : (uint32_t)pulses + 1);
+            pulses += !was_on;
+        } else if (op < 7) {
+            if (pulse_engine_stop(&engine, &result)) {
+                CHECK(was_on && result.stopped);
+                CHECK_EQ(result.on_time_us, clock_.now_us - rising);
+                stopped++;
+            }
+        } else {
+            int expired = clock_.expired;
+            advance_ms(next_random() % 3000);
+            if (clock_.expired != expired) {
+                CHECK(!clock_.last.stopped);
+                CHECK(clock_.last.on_time_us >= (int64_t)clock_.last.granted_ms * 1000);
+                CHECK(clock_.last.on_time_us <= (int64_t)clock_.last.granted_ms * 1000 + latency_us);
+                capped += clock_.last.capped;
+            }
+        }
+        CHECK(clock_.output == pulse_engine_active(&engine));
+        CHECK(!clock_.output || clock_.armed);
+        CHECK(clock_.longest_on_us <= MAX_HOLD_MS * 1000 + latency_us);
+    }
+    printf("%d pulses, %d stopped, %d ended by the timer (%d capped), longest on %lld us\n",
+           pulses, stopped, clock_.expired, capped, (long long)clock_.longest_on_us);
+    CHECK(stopped > 0 && clock_.expired > 0 && capped > 0);
+}
+
+int main(void)
+{
+    TEST_RUN(test_single_pulse);
+    TEST_RUN(test_capped);
+    TEST_RUN(test_extend);
+    TEST_RUN(test_early_timer);
+    TEST_RUN(test_stop);
+    TEST_RUN(test_timer_latency);
+    TEST_RUN(test_random_commands);
+    return 0;
+}
@@ -0,0 +1,205 @@
+/*
+ * rgb_pattern on a fake clock.
+ *
+ * The renderer only wakes when a step's next_ms runs out, so the checks are
+ * that a renderer driven by next_ms alone, woken on time or late, shows what
+ * a 1 ms poll would, to within one breathe step, and wakes no more often
+ * than the pattern changes.
+ */
+
+#include "rgb_pattern.h"
+#include "test.h"
+
+#define RUN_MS      20000
+
+static const rgb_color_t amber = { 100, 40, 0 };
+static const rgb_color_t off = { 0, 0, 0 };
+
+/* Fake clock renderer: wakes at each step's end, late by up to max_late_ms */
+typedef struct {
+    uint32_t now_ms;
+    uint32_t wakes;
+    uint32_t changes;       // steps that changed the color, i.e. LEDC writes
+    rgb_color_t shown;
+} renderer_t;
+
+static uint32_t rng = 0x2545f491;
+
+static uint32_t next_random(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static int level_diff(uint8_t a, uint8_t b)
+{
+    return a > b ? a - b : b - a;
+}
+
+/* max_diff is how far a 1 ms poll may be from the shown color on any channel */
+static renderer_t render(const rgb_pattern_t *pattern, uint32_t run_ms, uint32_t max_late_ms, int max_diff)
+{
+    renderer_t r = { .shown = off };
+    while (r.now_ms < run_ms) {
+        rgb_pattern_step_t step = rgb_pattern_eval(pattern, r.now_ms, false);
+        CHECK(step.next_ms > 0);
+        r.wakes++;
+        if (!rgb_color_equal(step.color, r.shown)) {
+            r.changes++;
+            r.shown = step.color;
+        }
+        if (step.next_ms == RGB_PATTERN_FOREVER) {
+            break;
+        }
+        uint32_t late = max_late_ms ? next_random() % (max_late_ms + 1) : 0;
+
+        // Between wakes the LED shows the step's color, a 1 ms poll must agree
+        for (uint32_t t = r.now_ms + 1; t < r.now_ms + step.next_ms + late && t < run_ms; t++) {
+            rgb_color_t polled = rgb_pattern_eval(pattern, t, false).color;
+            if (level_diff(polled.r, step.color.r) > max_diff || level_diff(polled.g, step.color.g) > max_diff ||
+                level_diff(polled.b, step.color.b) > max_diff) {
+                fprintf(stderr, "pattern %d: color changes at %u ms, step at %u ms said %u ms\n",
+                        pattern->kind, t, r.now_ms, step.next_ms);
+                exit(1);
+            }
+        }
+        r.now_ms += step.next_ms + late;
+    }
+    return r;
+}
+
+static void test_solid(void)
+{
+    const rgb_pattern_t solid = { RGB_PATTERN_SOLID, amber };
+    renderer_t r = render(&solid, RUN_MS, 0, 0);
+    CHECK_EQ(r.wakes, 1);
+    CHECK_EQ(r.changes, 1);
+    CHECK(rgb_color_equal(r.shown, amber));
+
+    // Same answer at any time, with or without hardware fades
+    for (uint32_t t = 0; t < 100000; t += 997) {
+        rgb_pattern_step_t step = rgb_pattern_eval(&solid, t, true);
+        CHECK(rgb_color_equal(step.color, amber));
+        CHECK_EQ(step.next_ms, RGB_PATTERN_FOREVER);
+        CHECK_EQ(step.fade_ms, 0);
+    }
+}
+
+static void test_blink(void)
+{
+    static const struct {
+        rgb_pattern_kind_t kind;
+        uint32_t half_ms;
+    } blinks[] = {
+        { RGB_PATTERN_BLINK, RGB_PATTERN_BLINK_MS },
+        { RGB_PATTERN_FAST_BLINK, RGB_PATTERN_FAST_BLINK_MS },
+    };
+
+    for (size_t i = 0; i < sizeof(blinks) / sizeof(blinks[0]); i++) {
+        const rgb_pattern_t blink = { blinks[i].kind, amber };
+        uint32_t half_ms = blinks[i].half_ms;
+
+        // On time: one wake and one LEDC write per half period
+        renderer_t r = render(&blink, RUN_MS, 0, 0);
+        CHECK_EQ(r.wakes, RUN_MS / half_ms);
+        CHECK_EQ(r.changes, RUN_MS / half_ms);
+
+        // On for the first half of each period, off for the second
+        for (uint32_t t = 0; t < 4 * half_ms; t++) {
+            rgb_pattern_step_t step = rgb_pattern_eval(&blink, t, false);
+            CHECK(rgb_color_equal(step.color, (t / half_ms) % 2 == 0 ? amber : off));
+            CHECK_EQ(step.next_ms, half_ms - t % half_ms);
+            CHECK_EQ(step.fade_ms, 0);
+        }
+
+        // Late wakes do not shift the phase: the next deadline is still the period boundary.
+        // The LED is then wrong for the lateness, which the poll check skips here
+        r = render(&blink, RUN_MS, half_ms / 5, 100);
+        CHECK(r.wakes <= RUN_MS / half_ms);
+        CHECK(r.wakes >= RUN_MS / (half_ms + half_ms / 5));
+    }
+}
+
+static void test_breathe_software(void)
+{
+    const rgb_pattern_t breathe = { RGB_PATTERN_BREATHE, amber };
+
+    const int step_diff = amber.r * RGB_PATTERN_BREATHE_STEP_MS / RGB_PATTERN_BREATHE_MS;
+    renderer_t r = render(&breathe, RUN_MS, 0, step_diff);
+    CHECK_EQ(r.wakes, RUN_MS / RGB_PATTERN_BREATHE_STEP_MS);
+
+    // Ramps up to the full color at the half period and back to off
+    uint32_t prev_r = 0;
+    for (uint32_t t = 0; t <= 2 * RGB_PATTERN_BREATHE_MS; t += RGB_PATTERN_BREATHE_STEP_MS) {
+        rgb_pattern_step_t step = rgb_pattern_eval(&breathe, t, false);
+        CHECK_EQ(step.fade_ms, 0);
+        CHECK(step.color.b == 0);
+        CHECK(step.color.g <= step.color.r);
+        if (t <= RGB_PATTERN_BREATHE_MS) {
+            CHECK(t == 0 || step.color.r > prev_r);
+        } else {
+            CHECK(step.color.r < prev_r);
+        }
+        prev_r = step.color.r;
+        // Symmetric around the peak
+        rgb_pattern_step_t mirror = rgb_pattern_eval(&breathe, 2 * RGB_PATTERN_BREATHE_MS - t, false);
+        CHECK(t == 0 || rgb_color_equal(step.color, mirror.color));
+    }
+    CHECK(rgb_color_equal(rgb_pattern_eval(&breathe, RGB_PATTERN_BREATHE_MS, false).color, amber));
+    CHECK(rgb_color_equal(rgb_pattern_eval(&breathe, 0, false).color, off));
+
+    // Late wakes show the level for the time they run at and land back on the step grid,
+    // so lateness neither adds wakes nor lets the shown level drift
+    r = render(&breathe, RUN_MS, 30, 2 * step_diff);
+    CHECK(r.wakes <= RUN_MS / RGB_PATTERN_BREATHE_STEP_MS + 1);
+}
+
+static void test_breathe_hardware(void)
+{
+    const rgb_pattern_t breathe = { RGB_PATTERN_BREATHE, amber };
+
+    // One fade per half period, alternately towards the color and towards off
+    uint32_t now_ms = 0, fades = 0;
+    while (now_ms < RUN_MS) {
+        rgb_pattern_step_t step = rgb_pattern_eval(&breathe, now_ms, true);
+        CHECK_EQ(step.fade_ms, RGB_PATTERN_BREATHE_MS);
+        CHECK_EQ(step.next_ms, step.fade_ms);
+        CHECK(rgb_color_equal(step.color, fades % 2 == 0 ? amber : off));
+        now_ms += step.next_ms;
+        fades++;
+    }
+    CHECK_EQ(fades, RUN_MS / RGB_PATTERN_BREATHE_MS);
+
+    // Woken mid-ramp, the fade covers what is left of the half period
+    for (uint32_t t = 1; t < 2 * RGB_PATTERN_BREATHE_MS; t += 37) {
+        rgb_pattern_step_t step = rgb_pattern_eval(&breathe, t, true);
+        CHECK_EQ(step.fade_ms, RGB_PATTERN_BREATHE_MS - t % RGB_PATTERN_BREATHE_MS);
+        CHECK_EQ(step.next_ms, step.fade_ms);
+        CHECK(rgb_color_equal(step.color, t < RGB_PATTERN_BREATHE_MS ? amber : off));
+    }
+}
+
+/* Patterns restart on a state change: eval depends only on the time since the start */
+static void test_restart(void)
+{
+    const rgb_pattern_t blink = { RGB_PATTERN_BLINK, amber };
+    const rgb_pattern_t solid = { RGB_PATTERN_SOLID, off };
+    rgb_pattern_step_t a = rgb_pattern_eval(&blink, 0, false);
+    CHECK_EQ(rgb_pattern_eval(&solid, 0, false).next_ms, RGB_PATTERN_FOREVER);
+    rgb_pattern_step_t b = rgb_pattern_eval(&blink, 0, false);
+    CHECK(rgb_color_equal(a.color, b.color) && a.next_ms == b.next_ms && a.fade_ms == b.fade_ms);
+    CHECK(rgb_color_equal(a.color, amber));
+    CHECK_EQ(a.next_ms, RGB_PATTERN_BLINK_MS);
+}
+
+int main(void)
+{
+    TEST_RUN(test_solid);
+    TEST_RUN(test_blink);
+    TEST_RUN(test_breathe_software);
+    TEST_RUN(test_breathe_hardware);
+    TEST_RUN(test_restart);
+    return 0;
+}
@@ -0,0 +1,265 @@
+/*
+ * ring_detector against the traces in vectors/ring.
+ *
+ * Every *.trace is run through a detector with the firmware settings
+ * (intercom_constants.h) and must produce exactly one start and, unless the
+ * trace ends mid-ring, one stop per ring listed in its header, within the
+ * trace's tolerance. The same trace is then fed in blocks of other sizes and
+ * on several channels at once, delayed against each other, which must not
+ * change a single event. Traces are made by ring_traces.py, recordings from
+ * a device can be dropped in next to them.
+ *
+ * Also benchmarks detection plus telemetry aggregation per sample for 1 to
+ * 8 channels with monitor_bench, as INTERCOM_MONITOR_BENCHMARK does on the
+ * target.
+ */
+
+#include <dirent.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "adc_trace.h"
+#include "intercom_constants.h"
+#include "monitor_bench.h"
+#include "ring_detector.h"
+#include "test.h"
+
+#define TRACES          "vectors/ring/"
+#define MAX_RINGS       16
+#define MAX_EVENTS      (4 * MAX_RINGS)
+#define MAX_SAMPLES     (60 * 2000)
+#define DELAY_MS        100         // between consecutive channels in the multi-channel run
+#define T0_US           5000000LL
+
+typedef struct {
+    char name[64];
+    uint32_t rate_hz;
+    int64_t tolerance_us;
+    int n_rings;
+    int64_t ring_start_us[MAX_RINGS];
+    int64_t ring_duration_us[MAX_RINGS];    // -1 while ringing at the end
+    uint16_t samples[MAX_SAMPLES];
+    size_t n_samples;
+} trace_t;
+
+static trace_t trace;
+
+static void load_trace(const char *name)
+{
+    char path[128], line[128];
+    snprintf(path, sizeof(path), TRACES "%s", name);
+    FILE *f = fopen(path, "r");
+    CHECK(f != NULL);
+
+    memset(&trace, 0, sizeof(trace));
+    snprintf(trace.name, sizeof(trace.name), "%s", name);
+    trace.tolerance_us = 10000;
+    while (fgets(line, sizeof(line), f) != NULL && line[0] == '#') {
+        long long a, b;
+        if (sscanf(line, "# rate_hz %lld", &a) == 1) {
+            trace.rate_hz = (uint32_t)a;
+        } else if (sscanf(line, "# tolerance_ms %lld", &a) == 1) {
+            trace.tolerance_us = a * 1000;
+        } else if (sscanf(line, "# ring %lld %lld", &a, &b) == 2) {
+            CHECK(trace.n_rings < MAX_RINGS);
+            trace.ring_start_us[trace.n_rings] = a * 1000;
+            trace.ring_duration_us[trace.n_rings] = b < 0 ? -1 : b * 1000;
+            trace.n_rings++;
+        }
+    }
+    CHECK(trace.rate_hz > 0);
+
+    rewind(f);
+    trace.n_samples = adc_trace_read(f, trace.samples, MAX_SAMPLES);
+    CHECK(fgetc(f) == EOF);
+    fclose(f);
+}
+
+static ring_detector_config_t detector_config(void)
+{
+    return (ring_detector_config_t) {
+        .threshold_on = MONITOR_THRESHOLD,
+        .threshold_off = MONITOR_THRESHOLD_OFF,
+        .sample_period_us = 1000000 / trace.rate_hz,
+        .min_on_us = MONITOR_MIN_ON_MS * 1000,
+        .min_off_us = MONITOR_MIN_OFF_MS * 1000,
+        .smoothing_shift = MONITOR_SMOOTHING_SHIFT,
+    };
+}
+
+/* Feed n_sets interleaved sets in blocks of block_sets, as the monitor task does with frames */
+static size_t run(const uint16_t *samples, size_t n_sets, uint8_t n_channels, size_t block_sets,
+                  ring_event_t *events)
+{
+    ring_detector_t det;
+    ring_detector_config_t cfg = detector_config();
+    size_t n_events = 0;
+
+    ring_detector_init(&det, &cfg, n_channels);
+    for (size_t set = 0; set < n_sets; set += block_sets) {
+        size_t n = n_sets - set < block_sets ? n_sets - set : block_sets;
+        n_events += ring_detector_process(&det, samples + set * n_channels, n,
+                                          T0_US + (int64_t)set * cfg.sample_period_us,
+                                          events + n_events, MAX_EVENTS - n_events);
+    }
+    return n_events;
+}
+
+static int near(int64_t actual, int64_t expected)
+{
+    return llabs(actual - expected) <= trace.tolerance_us;
+}
+
+static void check_rings(const ring_event_t *events, size_t n_events)
+{
+    size_t e = 0;
+    for (int r = 0; r < trace.n_rings; r++) {
+        int64_t start = T0_US + trace.ring_start_us[r];
+        CHECK(e < n_events && events[e].type == RING_EVENT_START);
+        if (!near(events[e].timestamp_us, start)) {
+            fprintf(stderr, "%s: ring %d starts at %lld ms, expected %lld ms\n", trace.name, r,
+                    (long long)(events[e].timestamp_us - T0_US) / 1000, (long long)trace.ring_start_us[r] / 1000);
+            exit(1);
+        }
+        CHECK(events[e].peak >= MONITOR_THRESHOLD);
+        e++;
+        if (trace.ring_duration_us[r] < 0) {
+            continue;
+        }
+        CHECK(e < n_events && events[e].type == RING_EVENT_STOP);
+        if (!near(events[e].timestamp_us, start + trace.ring_duration_us[r]) ||
+            !near(events[e].duration_us, trace.ring_duration_us[r])) {
+            fprintf(stderr, "%s: ring %d lasts %lld ms, expected %lld ms\n", trace.name, r,
+                    (long long)events[e].duration_us / 1000, (long long)trace.ring_duration_us[r] / 1000);
+            exit(1);
+        }
+        CHECK_EQ(events[e].duration_us, events[e].timestamp_us - events[e - 1].timestamp_us);
+        e++;
+    }
+    if (e != n_events) {
+        fprintf(stderr, "%s: %zu events, expected %zu\n", trace.name, n_events, e);
+        exit(1);
+    }
+}
+
+static int same_event(const ring_event_t *a, const ring_event_t *b, int64_t shift_us)
+{
+    return a->type == b->type && a->timestamp_us + shift_us == b->timestamp_us &&
+           a->duration_us == b->duration_us && a->peak == b->peak;
+}
+
+static void test_trace(const char *name)
+{
+    static ring_event_t expected[MAX_EVENTS], events[MAX_EVENTS];
+    load_trace(name);
+
+    // A frame at a time, the firmware default
+    size_t n_expected = run(trace.samples, trace.n_samples, 1, 256, expected);
+    check_rings(expected, n_expected);
+    printf("%s: %zu samples, %d rings, %zu events\n", name, trace.n_samples, trace.n_rings, n_expected);
+
+    // Block boundaries do not matter
+    static const size_t blocks[] = { 1, 7, 1000, MAX_SAMPLES };
+    for (size_t b = 0; b < sizeof(blocks) / sizeof(blocks[0]); b++) {
+        size_t n_events = run(trace.samples, trace.n_samples, 1, blocks[b], events);
+        CHECK_EQ(n_events, n_expected);
+        for (size_t i = 0; i < n_events; i++) {
+            CHECK(same_event(&expected[i], &events[i], 0));
+        }
+    }
+
+    // Channel c gets the trace DELAY_MS * c later, padded with its first and last reading
+    const uint8_t n_channels = RING_DETECTOR_MAX_CHANNELS;
+    const size_t delay = DELAY_MS * trace.rate_hz / 1000;
+    const size_t n_sets = trace.n_samples + (n_channels - 1) * delay;
+    uint16_t *sets = malloc(n_sets * n_channels * sizeof(uint16_t));
+    CHECK(sets != NULL);
+    for (size_t s = 0; s < n_sets; s++) {
+        for (uint8_t c = 0; c < n_channels; c++) {
+            size_t i = s < c * delay ? 0 : s - c * delay;
+            sets[s * n_channels + c] = trace.samples[i < trace.n_samples ? i : trace.n_samples - 1];
+        }
+    }
+    static ring_event_t all[MAX_EVENTS * RING_DETECTOR_MAX_CHANNELS];
+    ring_detector_t det;
+    ring_detector_config_t cfg = detector_config();
+    ring_detector_init(&det, &cfg, n_channels);
+    size_t n_all = 0;
+    for (size_t set = 0; set < n_sets; set += 256) {
+        size_t n = n_sets - set < 256 ? n_sets - set : 256;
+        n_all += ring_detector_process(&det, sets + set * n_channels, n, T0_US + (int64_t)set * cfg.sample_period_us,
+                                       all + n_all, sizeof(all) / sizeof(all[0]) - n_all);
+    }
+    free(sets);
+
+    CHECK_EQ(n_all, n_expected * n_channels);
+    for (uint8_t c = 0; c < n_channels; c++) {
+        size_t i = 0;
+        for (size_t e = 0; e < n_all; e++) {
+            if (all[e].channel == c) {
+                CHECK(i < n_expected);
+                CHECK(same_event(&expected[i], &all[e], (int64_t)c * DELAY_MS * 1000));
+                i++;
+            }
+        }
+        CHECK_EQ(i, n_expected);
+    }
+}
+
+#define BENCH_RATE_HZ       2000
+#define BENCH_FRAME_SETS    256         // sets per sampler frame
+#define BENCH_SETS          (100 * BENCH_RATE_HZ)
+
+/* The loop of INTERCOM_MONITOR_BENCHMARK, see monitor_bench.h */
+static void bench_channels(void)
+{
+    static uint16_t samples[BENCH_FRAME_SETS * RING_DETECTOR_MAX_CHANNELS];
+    static monitor_bench_t bench;
+    ring_detector_config_t cfg = detector_config();
+
+    cfg.sample_period_us = 1000000 / BENCH_RATE_HZ;
+    monitor_bench_init(&bench, samples, BENCH_FRAME_SETS);
+    for (uint8_t n = 1; n <= RING_DETECTOR_MAX_CHANNELS; n++) {
+        size_t n_events;
+        int64_t elapsed_ns = monitor_bench_run(&bench, &cfg, MONITOR_PUBLISH_PERIOD_MS, n, BENCH_SETS, test_now_ns,
+                                               &n_events);
+
+        // A start and a stop per ring, 20 rings per channel in 100 s give or take one at either end
+        CHECK(n_events >= 2 * 20 * n && n_events <= 2 * 21 * n);
+        printf("bench %u channels: %5.1f ns per sample, %6.1f ns per set\n", n,
+               (double)elapsed_ns / ((double)BENCH_SETS * n), (double)elapsed_ns / BENCH_SETS);
+    }
+}
+
+static int compare_names(const void *a, const void *b)
+{
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+int main(void)
+{
+    char *names[64];
+    int n_names = 0;
+
+    DIR *dir = opendir(TRACES);
+    CHECK(dir != NULL);
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        size_t len = strlen(entry->d_name);
+        if (len > 6 && strcmp(entry->d_name + len - 6, ".trace") == 0) {
+            CHECK(n_names < 64);
+            names[n_names++] = strdup(entry->d_name);
+        }
+    }
+    closedir(dir);
+    CHECK(n_names > 0);
+    qsort(names, n_names, sizeof(names[0]), compare_names);
+
+    for (int i = 0; i < n_names; i++) {
+        test_trace(names[i]);
+        printf("ok %s\n", names[i]);
+        free(names[i]);
+    }
+    TEST_RUN(bench_channels);
+    return 0;
+}
@@ -0,0 +1,316 @@
+/*
+ * MQTT 5 request/response round trips through a broker stand-in.
+ *
+ * Three pthreads: a backend publishing commands with a response topic and
+ * correlation data, an in-memory broker routing by topic filter, and a
+ * device worker wired like mqtt_worker_task (rpc_tracker, topic_router,
+ * mqtt_payload, deferred replies, timeouts). Every request must be answered
+ * exactly once with the right correlation and status, and the round-trip
+ * latency is reported. tools/mqtt_rpc_bench.py measures the same against a
+ * real device and broker.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include "mqtt_payload.h"
+#include "rpc_tracker.h"
+#include "test.h"
+#include "topic_router.h"
+
+#define COMMAND_TOPIC       "/topic/intercom/open_state"
+#define RESPONSE_TOPIC      "/test/rpc/harness"
+#define RPC_TIMEOUT_MS      50
+#define ROUNDS              200
+#define MAILBOX_SIZE        64
+
+typedef struct {
+    char topic[64];
+    char data[256];
+    size_t data_len;
+    char response_topic[RPC_TOPIC_MAX];
+    uint8_t correlation[RPC_CORRELATION_MAX];
+    size_t correlation_len;
+} broker_msg_t;
+
+typedef struct {
+    broker_msg_t msgs[MAILBOX_SIZE];
+    unsigned head, tail;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} mailbox_t;
+
+static mailbox_t device_box, backend_box;
+
+static int64_t now_us(void)
+{
+    return test_now_ns() / 1000;
+}
+
+static void mailbox_init(mailbox_t *box)
+{
+    memset(box, 0, sizeof(*box));
+    pthread_mutex_init(&box->lock, NULL);
+    pthread_cond_init(&box->cond, NULL);
+}
+
+/* Waits up to wait_us, false on timeout */
+static bool mailbox_take(mailbox_t *box, broker_msg_t *msg, int64_t wait_us)
+{
+    struct timespec until;
+    clock_gettime(CLOCK_REALTIME, &until);
+    int64_t ns = until.tv_nsec + (wait_us % 1000000) * 1000;
+    until.tv_sec += wait_us / 1000000 + ns / 1000000000;
+    until.tv_nsec = ns % 1000000000;
+
+    pthread_mutex_lock(&box->lock);
+    while (box->head == box->tail) {
+        if (pthread_cond_timedwait(&box->cond, &box->lock, &until) != 0) {
+            pthread_mutex_unlock(&box->lock);
+            return false;
+        }
+    }
+    *msg = box->msgs[box->tail++ % MAILBOX_SIZE];
+    pthread_mutex_unlock(&box->lock);
+    return true;
+}
+
+/* Broker stand-in: the device subscribes to /topic/intercom/#, the backend to /test/rpc/+ */
+static void broker_publish(const char *topic, const char *data, size_t data_len, const char *response_topic,
+                           const uint8_t *correlation, size_t correlation_len)
+{
+    mailbox_t *box;
+    if (topic_filter_matches("/topic/intercom/#", topic, strlen(topic))) {
+        box = &device_box;
+    } else if (topic_filter_matches("/test/rpc/+", topic, strlen(topic))) {
+        box = &backend_box;
+    } else {
+        return;
+    }
+
+    pthread_mutex_lock(&box->lock);
+    CHECK(box->head - box->tail < MAILBOX_SIZE);
+    broker_msg_t *msg = &box->msgs[box->head++ % MAILBOX_SIZE];
+    snprintf(msg->topic, sizeof(msg->topic), "%s", topic);
+    memcpy(msg->data, data, data_len);
+    msg->data_len = data_len;
+    snprintf(msg->response_topic, sizeof(msg->response_topic), "%s", response_topic != NULL ? response_topic : "");
+    memcpy(msg->correlation, correlation, correlation_len);
+    msg->correlation_len = correlation_len;
+    pthread_cond_signal(&box->cond);
+    pthread_mutex_unlock(&box->lock);
+}
+
+/* Device side, only touched by the device thread */
+static rpc_tracker_t tracker;
+static uint32_t rpc_current;
+static struct {
+    uint32_t id;
+    int64_t due_us;
+} pulses[RPC_MAX_INFLIGHT];
+static int late_replies;
+
+static void device_send(const rpc_request_t *request, const char *status)
+{
+    char payload[128];
+    int len = snprintf(payload, sizeof(payload), "{\"status\":\"%s\",\"latency_us\":%lld}", status,
+                       (long long)(now_us() - request->received_us));
+    broker_publish(request->response_topic, payload, len, NULL, request->correlation, request->correlation_len);
+}
+
+static void device_reply(uint32_t id, const char *status)
+{
+    rpc_request_t request;
+    if (rpc_tracker_complete(&tracker, id, &request)) {
+        device_send(&request, status);
+    } else if (id != 0) {
+        late_replies++;     // already answered with a timeout
+    }
+}
+
+/* Same contract as handle_open_state, the pulse end stands in for the door task's ack */
+static bool handle_open_state(const char *topic, size_t topic_len, const char *data, size_t data_len, void *ctx)
+{
+    const char *value;
+    size_t value_len;
+    uint32_t duration_ms;
+    bool open;
+
+    if (mqtt_payload_field(data, data_len, "open_for_ms", &value, &value_len)) {
+        if (!mqtt_payload_uint(value, value_len, &duration_ms) || duration_ms == 0) {
+            return false;
+        }
+        for (int i = 0; i < RPC_MAX_INFLIGHT; i++) {
+            if (pulses[i].id == 0) {
+                pulses[i].id = rpc_current;
+                pulses[i].due_us = now_us() + duration_ms * 1000;
+                rpc_current = 0;
+                break;
+            }
+        }
+        return true;
+    }
+    return mqtt_payload_bool(data, data_len, &open);
+}
+
+static const topic_route_t routes[] = {
+    { COMMAND_TOPIC, handle_open_state, NULL },
+};
+
+static atomic_bool device_stop;
+
+static void *device_thread(void *arg)
+{
+    const topic_route_t *index[1];
+    topic_router_t router;
+
+    CHECK(topic_router_init(&router, routes, 1, index));
+    rpc_tracker_init(&tracker, RPC_TIMEOUT_MS);
+
+    while (!atomic_load(&device_stop)) {
+        rpc_request_t request;
+        broker_msg_t msg;
+
+        while (rpc_tracker_expire(&tracker, now_us(), &request)) {
+            device_send(&request, "timeout");
+        }
+        for (int i = 0; i < RPC_MAX_INFLIGHT; i++) {
+            if (pulses[i].id != 0 && pulses[i].due_us <= now_us()) {
+                device_reply(pulses[i].id, "ok");
+                pulses[i].id = 0;
+            }
+        }
+        if (!mailbox_take(&device_box, &msg, 1000)) {
+            continue;
+        }
+
+        rpc_current = 0;
+        if (msg.response_topic[0] != '\0') {
+            rpc_current = rpc_tracker_begin(&tracker, msg.response_topic, strlen(msg.response_topic),
+                                            msg.correlation, msg.correlation_len, now_us());
+        }
+        topic_dispatch_t result = topic_router_dispatch(&router, msg.topic, strlen(msg.topic), msg.data, msg.data_len);
+        if (rpc_current != 0) {
+            device_reply(rpc_current, result == TOPIC_DISPATCH_OK ? "ok" :
+                         result == TOPIC_DISPATCH_REJECTED ? "rejected" : "no_route");
+        }
+    }
+    return NULL;
+}
+
+/* Backend side */
+typedef struct {
+    const char *topic;
+    const char *payload;
+    const char *status;
+} request_case_t;
+
+static const request_case_t cases[] = {
+    { COMMAND_TOPIC, "false", "ok" },                   // answered by the worker right away
+    { COMMAND_TOPIC, "open_for_ms=5", "ok" },           // deferred until the pulse ends
+    { COMMAND_TOPIC, "open_for_ms=abc", "rejected" },
+    { "/topic/intercom/unknown", "1", "no_route" },
+    { COMMAND_TOPIC, "open_for_ms=200", "timeout" },    // pulse outlasts RPC_TIMEOUT_MS
+};
+
+#define CASE_COUNT  (sizeof(cases) / sizeof(cases[0]))
+
+static int compare_i64(const void *a, const void *b)
+{
+    int64_t x = *(const int64_t *)a, y = *(const int64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void test_round_trips(void)
+{
+    static int64_t rtt_us[CASE_COUNT][ROUNDS];
+    pthread_t device;
+
+    mailbox_init(&device_box);
+    mailbox_init(&backend_box);
+    atomic_store(&device_stop, false);
+    CHECK(pthread_create(&device, NULL, device_thread, NULL) == 0);
+
+    for (int round = 0; round < ROUNDS; round++) {
+        for (size_t c = 0; c < CASE_COUNT; c++) {
+            // Keep the slow timeout case to a few rounds
+            if (c == CASE_COUNT - 1 && round % 20 != 0) {
+                rtt_us[c][round] = -1;
+                continue;
+            }
+            char correlation[16];
+            int correlation_len = snprintf(correlation, sizeof(correlation), "r%d-%zu", round, c);
+            int64_t sent_us = now_us();
+            broker_publish(cases[c].topic, cases[c].payload, strlen(cases[c].payload), RESPONSE_TOPIC,
+                           (const uint8_t *)correlation, correlation_len);
+
+            broker_msg_t reply;
+            CHECK(mailbox_take(&backend_box, &reply, 2000000));
+            rtt_us[c][round] = now_us() - sent_us;
+
+            CHECK_EQ(reply.correlation_len, correlation_len);
+            CHECK(memcmp(reply.correlation, correlation, correlation_len) == 0);
+            char expected[64];
+            snprintf(expected, sizeof(expected), "{\"status\":\"%s\",\"latency_us\":", cases[c].status);
+            reply.data[reply.data_len] = '\0';
+            if (strncmp(reply.data, expected, strlen(expected)) != 0) {
+                fprintf(stderr, "%s %s: got %s\n", cases[c].topic, cases[c].payload, reply.data);
+                CHECK(false);
+            }
+        }
+    }
+
+    // The timed out pulses end later, their replies must not go out a second time
+    broker_msg_t extra;
+    CHECK(!mailbox_take(&backend_box, &extra, 300000));
+    atomic_store(&device_stop, true);
+    pthread_join(device, NULL);
+    CHECK_EQ(late_replies, ROUNDS / 20);
+    CHECK_EQ(tracker.timed_out, ROUNDS / 20);
+    CHECK_EQ(tracker.rejected, 0);
+
+    for (size_t c = 0; c < CASE_COUNT; c++) {
+        int64_t sorted[ROUNDS];
+        size_t n = 0;
+        for (int round = 0; round < ROUNDS; round++) {
+            if (rtt_us[c][round] >= 0) {
+                sorted[n++] = rtt_us[c][round];
+            }
+        }
+        qsort(sorted, n, sizeof(sorted[0]), compare_i64);
+        printf("%-26s %-16s %-8s n=%3zu  p50 %6lld us  p99 %6lld us\n", cases[c].topic, cases[c].payload,
+               cases[c].status, n, (long long)sorted[n / 2], (long long)sorted[n * 99 / 100]);
+    }
+}
+
+static void test_tracker_limits(void)
+{
+    rpc_tracker_t t;
+    rpc_request_t request;
+    uint8_t long_correlation[RPC_CORRELATION_MAX + 1] = { 0 };
+
+    rpc_tracker_init(&t, 1000);
+    CHECK_EQ(rpc_tracker_begin(&t, "", 0, NULL, 0, 0), 0);
+    CHECK_EQ(rpc_tracker_begin(&t, "a", 1, long_correlation, sizeof(long_correlation), 0), 0);
+    for (int i = 0; i < RPC_MAX_INFLIGHT; i++) {
+        CHECK(rpc_tracker_begin(&t, "a", 1, NULL, 0, i * 1000) != 0);
+    }
+    CHECK_EQ(rpc_tracker_begin(&t, "a", 1, NULL, 0, 0), 0);
+    CHECK_EQ(t.rejected, 3);
+
+    CHECK_EQ(rpc_tracker_next_deadline(&t), 1000000);
+    CHECK(!rpc_tracker_expire(&t, 999999, &request));
+    CHECK(rpc_tracker_expire(&t, 1000000, &request));
+    CHECK_EQ(request.id, 1);
+    CHECK(!rpc_tracker_complete(&t, 1, &request));
+    CHECK(rpc_tracker_complete(&t, 2, &request));
+    CHECK_EQ(rpc_tracker_next_deadline(&t), 1002000);
+}
+
+int main(void)
+{
+    TEST_RUN(test_tracker_limits);
+    TEST_RUN(test_round_trips);
+    return 0;
+}
@@ -0,0 +1,189 @@
+/*
+ * state_bus under concurrent writers and readers.
+ *
+ * Each writer owns two slots and publishes the same counter to the first
+ * and then to the second, so at every instant first - second is 0 or 1.
+ * A reader that mixed slot values from different instants could see the
+ * second slot ahead of the first, which is what "torn" means here. The same
+ * check on plain per-slot loads shows the test can see tears at all.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include "state_bus.h"
+#include "test.h"
+
+#define WRITES_PER_WRITER   2000000
+#define READERS             4
+
+typedef struct {
+    state_bus_t *bus;
+    state_bus_slot_t first;
+    state_bus_slot_t second;
+} writer_arg_t;
+
+typedef struct {
+    state_bus_t *bus;
+    bool unsynchronised;
+    uint64_t reads;
+    uint64_t torn;
+} reader_arg_t;
+
+static atomic_int writers_running;
+
+static uint16_t resolve_ota_first(const state_bus_snapshot_t *snapshot)
+{
+    if (snapshot->slots[STATE_BUS_OTA] != STATE_BUS_NONE) {
+        return snapshot->slots[STATE_BUS_OTA];
+    }
+    return snapshot->slots[STATE_BUS_WIFI];
+}
+
+static void *writer_thread(void *arg)
+{
+    writer_arg_t *w = arg;
+
+    // Counter values 1..65535, 0 is STATE_BUS_NONE
+    for (uint32_t i = 0; i < WRITES_PER_WRITER; i++) {
+        uint16_t value = (uint16_t)(i % 0xffff + 1);
+        state_bus_publish(w->bus, w->first, value);
+        state_bus_publish(w->bus, w->second, value);
+    }
+    atomic_fetch_sub(&writers_running, 1);
+    return NULL;
+}
+
+/* first is published before second, a consistent view never has second ahead */
+static bool pair_consistent(uint16_t first, uint16_t second)
+{
+    if (first == STATE_BUS_NONE || second == STATE_BUS_NONE) {
+        return second == STATE_BUS_NONE;
+    }
+    uint16_t ahead = (uint16_t)((first - second + 0xffff) % 0xffff);
+    return ahead <= 1;
+}
+
+static void *reader_thread(void *arg)
+{
+    reader_arg_t *r = arg;
+    uint32_t last_version = 0;
+
+    while (atomic_load(&writers_running) > 0) {
+        state_bus_snapshot_t snapshot;
+        if (r->unsynchronised) {
+            for (int i = 0; i < STATE_BUS_SLOT_COUNT; i++) {
+                snapshot.slots[i] = state_bus_get(r->bus, i);
+            }
+        } else {
+            state_bus_snapshot(r->bus, &snapshot);
+            CHECK(snapshot.version >= last_version);
+            last_version = snapshot.version;
+        }
+        if (!pair_consistent(snapshot.slots[STATE_BUS_WIFI], snapshot.slots[STATE_BUS_MQTT]) ||
+            !pair_consistent(snapshot.slots[STATE_BUS_ACTIVITY], snapshot.slots[STATE_BUS_OTA])) {
+            r->torn++;
+        }
+        r->reads++;
+    }
+    return NULL;
+}
+
+static uint64_t run_stress(bool unsynchronised)
+{
+    state_bus_t bus;
+    pthread_t writers[2], readers[READERS];
+    writer_arg_t writer_args[2] = {
+        { &bus, STATE_BUS_WIFI, STATE_BUS_MQTT },
+        { &bus, STATE_BUS_ACTIVITY, STATE_BUS_OTA },
+    };
+    reader_arg_t reader_args[READERS];
+    uint64_t reads = 0, torn = 0;
+
+    state_bus_init(&bus, resolve_ota_first);
+    atomic_store(&writers_running, 2);
+    for (int i = 0; i < READERS; i++) {
+        reader_args[i] = (reader_arg_t) { .bus = &bus, .unsynchronised = unsynchronised };
+        CHECK(pthread_create(&readers[i], NULL, reader_thread, &reader_args[i]) == 0);
+    }
+    for (int i = 0; i < 2; i++) {
+        CHECK(pthread_create(&writers[i], NULL, writer_thread, &writer_args[i]) == 0);
+    }
+    for (int i = 0; i < 2; i++) {
+        pthread_join(writers[i], NULL);
+    }
+    for (int i = 0; i < READERS; i++) {
+        pthread_join(readers[i], NULL);
+        reads += reader_args[i].reads;
+        torn += reader_args[i].torn;
+    }
+    printf("%s: %llu reads, %llu torn\n", unsynchronised ? "state_bus_get per slot" : "state_bus_snapshot",
+           (unsigned long long)reads, (unsigned long long)torn);
+    CHECK(reads > 0);
+    return torn;
+}
+
+static void test_snapshot_never_torn(void)
+{
+    CHECK_EQ(run_stress(false), 0);
+}
+
+static void test_unsynchronised_reads_can_tear(void)
+{
+    // Informational: shows the invariant catches mixed views, not asserted
+    // because a single core host may never interleave the threads that way
+    run_stress(true);
+}
+
+typedef struct {
+    int calls;
+    state_bus_slot_t slot;
+    uint16_t value;
+} subscriber_log_t;
+
+static void record_change(void *ctx, state_bus_slot_t slot, uint16_t value)
+{
+    subscriber_log_t *log = ctx;
+    log->calls++;
+    log->slot = slot;
+    log->value = value;
+}
+
+static void test_subscribers_and_composite(void)
+{
+    state_bus_t bus;
+    subscriber_log_t log = { 0 };
+
+    state_bus_init(&bus, resolve_ota_first);
+    CHECK(state_bus_subscribe(&bus, record_change, &log));
+
+    CHECK(state_bus_publish(&bus, STATE_BUS_WIFI, 7));
+    CHECK_EQ(log.calls, 1);
+    CHECK_EQ(log.slot, STATE_BUS_WIFI);
+    CHECK_EQ(log.value, 7);
+    CHECK_EQ(state_bus_composite(&bus), 7);
+
+    // Unchanged values do not notify
+    CHECK(!state_bus_publish(&bus, STATE_BUS_WIFI, 7));
+    CHECK_EQ(log.calls, 1);
+
+    CHECK(state_bus_publish(&bus, STATE_BUS_OTA, 9));
+    CHECK_EQ(state_bus_composite(&bus), 9);
+    CHECK(state_bus_publish(&bus, STATE_BUS_OTA, STATE_BUS_NONE));
+    CHECK_EQ(state_bus_composite(&bus), 7);
+    CHECK_EQ(log.calls, 3);
+
+    for (int i = 1; i < STATE_BUS_MAX_SUBSCRIBERS; i++) {
+        CHECK(state_bus_subscribe(&bus, record_change, &log));
+    }
+    CHECK(!state_bus_subscribe(&bus, record_change, &log));
+}
+
+int main(void)
+{
+    TEST_RUN(test_subscribers_and_composite);
+    TEST_RUN(test_snapshot_never_torn);
+    TEST_RUN(test_unsynchronised_reads_can_tear);
+    return 0;
+}
@@ -0,0 +1,133 @@
+/*
+ * telemetry_batch against the records in vectors/telemetry.
+ *
+ * Each case builds a window with known samples and events and must encode
+ * to exactly the committed .bin. test_telemetry_decode.py checks that
+ * tools/telemetry_decode.py turns the same files into the committed .json,
+ * so firmware and decoder cannot drift apart unnoticed. Run with --update
+ * after an intended format change to rewrite the .bin files, then review
+ * the diff and the expected decode by hand.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "telemetry_batch.h"
+#include "test.h"
+
+#define VECTORS     "vectors/telemetry/"
+#define START_US    123456789000LL
+
+static bool update;
+static telemetry_batch_t batch;
+
+static void check_vector(const char *name)
+{
+    static uint8_t encoded[TELEMETRY_BATCH_MAX_SIZE], expected[TELEMETRY_BATCH_MAX_SIZE + 1];
+    char path[128];
+    size_t len = telemetry_batch_encode(&batch, encoded, sizeof(encoded));
+    CHECK(len > 0);
+
+    // One byte short is refused, not truncated
+    CHECK_EQ(telemetry_batch_encode(&batch, expected, len - 1), 0);
+
+    snprintf(path, sizeof(path), VECTORS "%s.bin", name);
+    if (update) {
+        FILE *f = fopen(path, "wb");
+        CHECK(f != NULL && fwrite(encoded, 1, len, f) == len);
+        fclose(f);
+        printf("wrote %s, %zu bytes\n", path, len);
+        return;
+    }
+    FILE *f = fopen(path, "rb");
+    CHECK(f != NULL);
+    size_t expected_len = fread(expected, 1, sizeof(expected), f);
+    fclose(f);
+    if (expected_len != len || memcmp(encoded, expected, len) != 0) {
+        fprintf(stderr, "%s: encoding differs from the committed vector (%zu vs %zu bytes)\n", path, len,
+                expected_len);
+        exit(1);
+    }
+}
+
+/* n_periods periods of ramps, channel c of period p peaks at 1000 * (c + 1) + p */
+static void fill_periods(int n_periods, int sets_per_period)
+{
+    uint16_t samples[TELEMETRY_MAX_CHANNELS];
+    for (int p = 0; p < n_periods; p++) {
+        for (int s = 0; s < sets_per_period; s++) {
+            for (int c = 0; c < batch.n_channels; c++) {
+                samples[c] = (uint16_t)((1000 * (c + 1) + p) * (s + 1) / sets_per_period);
+            }
+            telemetry_batch_add_samples(&batch, samples, 1);
+        }
+        telemetry_batch_close_period(&batch);
+    }
+}
+
+static void test_single_channel(void)
+{
+    telemetry_batch_init(&batch, 1000, 1u << 6);
+    batch.seq = 41;
+    telemetry_batch_begin(&batch, START_US);
+    fill_periods(3, 4);
+    telemetry_batch_add_event(&batch, 0, 6, START_US + 1250000, 0, 2900);
+    telemetry_batch_add_event(&batch, 1, 6, START_US + 2750000, 1500000, 3001);
+    telemetry_batch_add_overruns(&batch, 2);
+    check_vector("single_channel");
+}
+
+static void test_three_channels(void)
+{
+    telemetry_batch_init(&batch, 500, 0x0b);   // ADC1 channels 0, 1 and 3
+    batch.seq = 7;
+    telemetry_batch_begin(&batch, START_US);
+    fill_periods(2, 2);
+    telemetry_batch_add_event(&batch, 0, 3, START_US + 10000, 0, 4095);
+    check_vector("three_channels");
+}
+
+/* Events past TELEMETRY_MAX_EVENTS are counted, overruns saturate */
+static void test_event_overflow(void)
+{
+    telemetry_batch_init(&batch, 1000, 1u << 6);
+    batch.seq = 0xfffffffe;
+    telemetry_batch_begin(&batch, START_US);
+    fill_periods(1, 1);
+    for (int i = 0; i < TELEMETRY_MAX_EVENTS + 5; i++) {
+        telemetry_batch_add_event(&batch, i % 2, 6, START_US + i * 100000, i % 2 ? 50000 : 0, 2000 + i);
+    }
+    telemetry_batch_add_overruns(&batch, 70000);
+    CHECK_EQ(batch.n_events, TELEMETRY_MAX_EVENTS);
+    CHECK_EQ(batch.events_dropped, 5);
+    CHECK_EQ(batch.overruns, UINT16_MAX);
+    check_vector("event_overflow");
+
+    // The count saturates and a new window starts from zero
+    for (int i = 0; i < 70000; i++) {
+        telemetry_batch_add_event(&batch, 0, 6, START_US, 0, 0);
+    }
+    CHECK_EQ(batch.events_dropped, UINT16_MAX);
+    telemetry_batch_begin(&batch, START_US + 10000000);
+    CHECK_EQ(batch.events_dropped, 0);
+    CHECK_EQ(batch.n_events, 0);
+}
+
+static void test_empty_window(void)
+{
+    telemetry_batch_init(&batch, 1000, 1u << 6);
+    batch.seq = 3;
+    telemetry_batch_begin(&batch, 0);
+    check_vector("empty");
+}
+
+int main(int argc, char **argv)
+{
+    update = argc > 1 && strcmp(argv[1], "--update") == 0;
+
+    TEST_RUN(test_single_channel);
+    TEST_RUN(test_three_channels);
+    TEST_RUN(test_event_overflow);
+    TEST_RUN(test_empty_window);
+    return 0;
+}
@@ -0,0 +1,72 @@
+#!/usr/bin/env python3
+"""tools/telemetry_decode.py against the records in vectors/telemetry.
+
+Every NAME.bin must decode to NAME.json; the records are what
+test_telemetry_batch encodes. Malformed records must be refused with
+ValueError.
+
+Usage:
+    host/test/test_telemetry_decode.py
+"""
+
+import glob
+import importlib.util
+import json
+import os
+import sys
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+VECTORS = os.path.join(HERE, "vectors", "telemetry")
+TOOL = os.path.join(HERE, "..", "..", "tools", "telemetry_decode.py")
+
+
+def load_tool():
+    spec = importlib.util.spec_from_file_location("telemetry_decode", TOOL)
+    module = importlib.util.module_from_spec(spec)
+    spec.loader.exec_module(module)
+    return module
+
+
+def main():
+    tool = load_tool()
+    failed = False
+
+    names = sorted(glob.glob(os.path.join(VECTORS, "*.bin")))
+    if not names:
+        print("no vectors in %s" % VECTORS)
+        return 1
+    for name in names:
+        with open(name, "rb") as f:
+            data = f.read()
+        with open(name[:-len(".bin")] + ".json") as f:
+            expected = json.load(f)
+        decoded = json.loads(json.dumps(tool.decode(data)))
+        if decoded != expected:
+            print("%s: decode differs from the expected json" % os.path.basename(name))
+            failed = True
+        else:
+            print("ok %s" % os.path.basename(name))
+
+    with open(os.path.join(VECTORS, "single_channel.bin"), "rb") as f:
+        good = f.read()
+    bad = {
+        "short": good[:1],
+        "magic": b"X" + good[1:],
+        "version": good[:1] + b"\x09" + good[2:],
+        "version 3": good[:1] + b"\x03" + good[2:],
+        "truncated": good[:-1],
+        "trailing": good + b"\x00",
+    }
+    for what, data in bad.items():
+        try:
+            tool.decode(data)
+            print("%s record was accepted" % what)
+            failed = True
+        except ValueError:
+            pass
+
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
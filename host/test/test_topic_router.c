@@ -0,0 +1,248 @@
+/*
+ * topic_router: filter matching rules, and a benchmark over large synthetic
+ * route tables.
+ *
+ * Tables of 16 to 65536 exact filters plus 32 wildcard filters are looked up
+ * with hits, misses, prefixes of real filters (which must miss) and topics
+ * only a wildcard takes. The answers are compared with a linear scan that
+ * applies the same precedence (exact first, then wildcards in table order),
+ * which is also the baseline the timing is reported against.
+ */
+
+#include <string.h>
+
+#include "test.h"
+#include "topic_router.h"
+
+#define MAX_ROUTES      (65536 + 32)
+#define WILDCARDS       32
+#define PROBES          4096
+#define TOPIC_MAX       64
+
+static bool handler_ok(const char *topic, size_t topic_len, const char *data, size_t data_len, void *ctx)
+{
+    (*(int *)ctx)++;
+    return data_len > 0;
+}
+
+static void test_filter_matching(void)
+{
+    static const struct {
+        const char *filter;
+        const char *topic;
+        bool match;
+    } cases[] = {
+        { "/topic/intercom/open_state", "/topic/intercom/open_state", true },
+        { "/topic/intercom/open_state", "/topic/intercom/open", false },
+        { "/topic/intercom/open", "/topic/intercom/open_state", false },
+        { "a/+/c", "a/b/c", true },
+        { "a/+/c", "a//c", true },
+        { "a/+/c", "a/b/d", false },
+        { "a/+/c", "a/b/x/c", false },
+        { "a/+", "a/b", true },
+        { "a/+", "a", false },
+        { "a/#", "a/b/c", true },
+        { "a/#", "a", true },           // # also matches the parent level
+        { "a/#", "ab", false },
+        { "#", "a/b", true },
+        { "+/b", "$SYS/b", false },     // first level wildcards skip system topics
+        { "#", "$SYS/broker", false },
+        { "$SYS/#", "$SYS/broker", true },
+        { "+/+", "/x", true },
+    };
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        if (topic_filter_matches(cases[i].filter, cases[i].topic, strlen(cases[i].topic)) != cases[i].match) {
+            fprintf(stderr, "%s vs %s\n", cases[i].filter, cases[i].topic);
+            CHECK(false);
+        }
+    }
+}
+
+static void test_precedence_and_dispatch(void)
+{
+    int exact_calls = 0, wild_calls = 0, hash_calls = 0;
+    const topic_route_t routes[] = {
+        { "/dev/+/cmd", handler_ok, &wild_calls },
+        { "/dev/#", handler_ok, &hash_calls },
+        { "/dev/door/cmd", handler_ok, &exact_calls },
+    };
+    const topic_route_t *index[3];
+    topic_router_t router;
+
+    CHECK(topic_router_init(&router, routes, 3, index));
+    CHECK(topic_router_find(&router, "/dev/door/cmd", 13) == &routes[2]);
+    CHECK(topic_router_find(&router, "/dev/gate/cmd", 13) == &routes[0]);
+    CHECK(topic_router_find(&router, "/dev/gate/state", 15) == &routes[1]);
+    CHECK(topic_router_find(&router, "/other", 6) == NULL);
+
+    // The topic is length delimited: trailing bytes past topic_len are ignored
+    CHECK(topic_router_find(&router, "/dev/door/cmdXYZ", 13) == &routes[2]);
+
+    CHECK_EQ(topic_router_dispatch(&router, "/dev/door/cmd", 13, "1", 1), TOPIC_DISPATCH_OK);
+    CHECK_EQ(topic_router_dispatch(&router, "/dev/door/cmd", 13, "", 0), TOPIC_DISPATCH_REJECTED);
+    CHECK_EQ(topic_router_dispatch(&router, "/x", 2, "1", 1), TOPIC_DISPATCH_NO_ROUTE);
+    CHECK_EQ(exact_calls, 2);
+
+    const topic_route_t dup[] = {
+        { "/a", handler_ok, NULL },
+        { "/b", handler_ok, NULL },
+        { "/a", handler_ok, NULL },
+    };
+    CHECK(!topic_router_init(&router, dup, 3, index));
+}
+
+/* Synthetic fleet: /site/<s>/unit/<u>/<leaf> */
+static char filters[MAX_ROUTES][TOPIC_MAX];
+static topic_route_t routes[MAX_ROUTES];
+static const topic_route_t *index_storage[MAX_ROUTES];
+static char probes[PROBES][TOPIC_MAX];
+static size_t probe_len[PROBES];
+
+static const char *leaves[] = { "open_state", "ring", "config", "ota", "telemetry", "reboot", "led", "volume" };
+
+static void exact_filter(char *out, uint32_t i)
+{
+    snprintf(out, TOPIC_MAX, "/site/%u/unit/%u/%s", i / 64, (i / 8) % 8, leaves[i % 8]);
+}
+
+/* Same precedence as the router, by brute force */
+static const topic_route_t *linear_find(size_t n, const char *topic, size_t topic_len)
+{
+    for (size_t i = 0; i < n; i++) {
+        if (!topic_filter_is_wildcard(routes[i].filter) && strlen(routes[i].filter) == topic_len &&
+            memcmp(routes[i].filter, topic, topic_len) == 0) {
+            return &routes[i];
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (topic_filter_is_wildcard(routes[i].filter) && topic_filter_matches(routes[i].filter, topic, topic_len)) {
+            return &routes[i];
+        }
+    }
+    return NULL;
+}
+
+static uint32_t rng = 2463534242u;
+
+static uint32_t next_random(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+static void build_table(size_t n_exact)
+{
+    size_t n = 0;
+
+    // Wildcards first in the table, the router still has to prefer exact matches
+    for (int w = 0; w < WILDCARDS; w++) {
+        if (w % 2 == 0) {
+            snprintf(filters[n], TOPIC_MAX, "/site/%d/unit/+/alarm", w);
+        } else {
+            snprintf(filters[n], TOPIC_MAX, "/broadcast/%d/#", w);
+        }
+        routes[n] = (topic_route_t) { filters[n], handler_ok, NULL };
+        n++;
+    }
+    for (uint32_t i = 0; i < n_exact; i++) {
+        exact_filter(filters[n], i);
+        routes[n] = (topic_route_t) { filters[n], handler_ok, NULL };
+        n++;
+    }
+
+    // A quarter each: hits, misses, prefixes of a real filter, wildcard-only topics
+    for (int p = 0; p < PROBES; p++) {
+        uint32_t i = next_random() % n_exact;
+        switch (p % 4) {
+        case 0:
+            exact_filter(probes[p], i);
+            break;
+        case 1:
+            snprintf(probes[p], TOPIC_MAX, "/site/%u/unit/%u/unknown", i / 64, (i / 8) % 8);
+            break;
+        case 2:
+            exact_filter(probes[p], i);
+            probes[p][strlen(probes[p]) - 2] = '\0';
+            break;
+        default:
+            if (i % 2) {
+                snprintf(probes[p], TOPIC_MAX, "/site/%u/unit/%u/alarm", (i % WILDCARDS) & ~1u, i % 8);
+            } else {
+                snprintf(probes[p], TOPIC_MAX, "/broadcast/%u/all/now", (i % WILDCARDS) | 1u);
+            }
+            break;
+        }
+        probe_len[p] = strlen(probes[p]);
+    }
+}
+
+static void test_large_tables(void)
+{
+    static const size_t sizes[] = { 16, 256, 4096, 65536 };
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        size_t n = sizes[s] + WILDCARDS;
+        topic_router_t router;
+
+        build_table(sizes[s]);
+        int64_t start = test_now_ns();
+        CHECK(topic_router_init(&router, routes, n, index_storage));
+        int64_t init_ns = test_now_ns() - start;
+        CHECK_EQ(router.n_exact, sizes[s]);
+
+        // Every probe against the brute force answer, a sample of them on the biggest table
+        int hits = 0, checked = 0;
+        for (int p = 0; p < PROBES; p += n > 8192 ? 17 : 1) {
+            const topic_route_t *expected = linear_find(n, probes[p], probe_len[p]);
+            CHECK(topic_router_find(&router, probes[p], probe_len[p]) == expected);
+            hits += expected != NULL;
+            checked++;
+            if (p % 4 == 0 || p % 4 == 3) {
+                CHECK(expected != NULL);
+            } else if (p % 4 == 2) {
+                CHECK(expected == NULL);
+            }
+        }
+
+        // Router lookups
+        const int rounds = 200;
+        volatile uintptr_t sink = 0;
+        start = test_now_ns();
+        for (int r = 0; r < rounds; r++) {
+            for (int p = 0; p < PROBES; p++) {
+                sink += (uintptr_t)topic_router_find(&router, probes[p], probe_len[p]);
+            }
+        }
+        double router_ns = (double)(test_now_ns() - start) / (rounds * PROBES);
+
+        // Linear scan, fewer rounds on the big tables
+        int linear_probes = (int)(PROBES * 64 / n) + 64;
+        if (linear_probes > PROBES) {
+            linear_probes = PROBES;
+        }
+        start = test_now_ns();
+        for (int p = 0; p < linear_probes; p++) {
+            sink += (uintptr_t)linear_find(n, probes[p], probe_len[p]);
+        }
+        double linear_ns = (double)(test_now_ns() - start) / linear_probes;
+
+        printf("%6zu exact + %d wildcard routes: init %7.1f us, lookup %6.0f ns (linear %9.0f ns, %5.0fx), "
+               "%d/%d routed\n", sizes[s], WILDCARDS, init_ns / 1000.0, router_ns, linear_ns,
+               linear_ns / router_ns, hits, checked);
+
+        if (sizes[s] >= 4096) {
+            CHECK(router_ns * 10 < linear_ns);
+        }
+    }
+}
+
+int main(void)
+{
+    TEST_RUN(test_filter_matching);
+    TEST_RUN(test_precedence_and_dispatch);
+    TEST_RUN(test_large_tables);
+    return 0;
+}
@@ -0,0 +1,417 @@
+/*
+ * waveform_capture: window bounds and trigger index for triggers in the
+ * current or an earlier feed, clamping to the start of the capture,
+ * wrap-around of the circular buffer, triggers missed while a window is
+ * out, re-arming after a release, and the chunks the window encodes to.
+ *
+ * Every value encodes the number of its sample set and its channel, so a
+ * decoded window shows exactly which sets it holds. The vector cases also
+ * compare their chunks with the committed vectors/waveform/NAME.bin;
+ * test_waveform_decode.py checks that tools/waveform_decode.py turns those
+ * into the committed NAME.csv. Run with --update after an intended format
+ * change to rewrite the .bin files, then review the diff by hand.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "test.h"
+#include "waveform_capture.h"
+
+#define VECTORS     "vectors/waveform/"
+#define PERIOD_US   125
+#define RATE_HZ     (1000000 / PERIOD_US)
+#define T0_US       5000000LL
+#define MAX_SETS    64
+#define MAX_VALUES  (MAX_SETS * 3)
+#define MAX_CHUNK   (WAVEFORM_CHUNK_HEADER_SIZE + WAVEFORM_INFO_SIZE + 2 * MAX_VALUES)
+
+static bool update;
+static waveform_capture_t cap;
+static uint16_t buf[MAX_VALUES];
+static uint64_t fed;                // sample sets fed since init
+
+static void init(uint32_t pre, uint32_t post, uint16_t mask)
+{
+    waveform_capture_init(&cap, buf, pre, post, PERIOD_US, mask);
+    fed = 0;
+}
+
+static int64_t sample_us(uint64_t n)
+{
+    return T0_US + (int64_t)n * PERIOD_US;
+}
+
+/* Channel c of set n, unique per set and channel while n < 16384 */
+static uint16_t value_of(uint64_t n, uint8_t c)
+{
+    return (uint16_t)(n * 4 + c);
+}
+
+/* Feed the next count sets in one call, returns what feed returned */
+static bool feed(size_t count)
+{
+    static uint16_t sets[256 * 3];
+    CHECK(count <= 256);
+    for (size_t i = 0; i < count; i++) {
+        for (uint8_t c = 0; c < cap.channels; c++) {
+            sets[i * cap.channels + c] = value_of(fed + i, c);
+        }
+    }
+    bool froze = waveform_capture_feed(&cap, sets, count, sample_us(fed));
+    fed += count;
+    return froze;
+}
+
+/* Feed count sets in calls of at most per_feed, true if any froze the window */
+static bool feed_in(size_t count, size_t per_feed)
+{
+    bool froze = false;
+    while (count > 0) {
+        size_t n = count < per_feed ? count : per_feed;
+        froze |= feed(n);
+        count -= n;
+    }
+    return froze;
+}
+
+/* Trigger on sample set n, jitter within half a period still rounds to it */
+static bool trigger_at(uint64_t n, uint8_t channel)
+{
+    return waveform_capture_trigger(&cap, sample_us(n) + PERIOD_US / 3, channel);
+}
+
+static uint16_t get_u16(const uint8_t *p)
+{
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return get_u16(p) | (uint32_t)get_u16(p + 2) << 16;
+}
+
+/*
+ * The frozen window must hold sets first .. first + n - 1 with the trigger
+ * at set trigger. Decodes every chunk and checks header, info and values.
+ */
+static void check_window(uint64_t first, uint32_t n, uint64_t trigger, uint8_t channel, uint32_t chunk_samples)
+{
+    const waveform_window_t *window = waveform_capture_window(&cap);
+    CHECK(window != NULL);
+    CHECK_EQ(window->n_samples, n);
+    CHECK_EQ(window->trigger, trigger - first);
+    CHECK_EQ(window->start_us, sample_us(first));
+    CHECK_EQ(window->trigger_channel, channel);
+
+    uint16_t n_chunks = waveform_capture_chunks(&cap, chunk_samples);
+    CHECK_EQ(n_chunks, (n + chunk_samples - 1) / chunk_samples);
+    uint32_t seen = 0;
+    for (uint16_t chunk = 0; chunk < n_chunks; chunk++) {
+        uint8_t out[MAX_CHUNK];
+        size_t len = waveform_capture_encode_chunk(&cap, 99, chunk, chunk_samples, RATE_HZ, out, sizeof(out));
+        CHECK(len > 0);
+
+        CHECK_EQ(out[0], WAVEFORM_CHUNK_MAGIC);
+        CHECK_EQ(out[1], WAVEFORM_CHUNK_VERSION);
+        CHECK_EQ(get_u16(out + 2), 99);
+        CHECK_EQ(get_u16(out + 4), chunk);
+        CHECK_EQ(get_u16(out + 6), n_chunks);
+        uint32_t offset = get_u32(out + 8);
+        uint16_t count = get_u16(out + 12);
+        CHECK_EQ(offset, seen);
+        CHECK_EQ(count, n - offset < chunk_samples ? n - offset : chunk_samples);
+        CHECK_EQ(get_u16(out + 14), cap.channel_mask);
+
+        const uint8_t *p = out + WAVEFORM_CHUNK_HEADER_SIZE;
+        if (chunk == 0) {
+            CHECK_EQ(get_u32(p), RATE_HZ);
+            CHECK_EQ(get_u32(p + 4), n);
+            CHECK_EQ(get_u32(p + 8), trigger - first);
+            CHECK_EQ(get_u32(p + 12), waveform_capture_missed(&cap));
+            CHECK_EQ(get_u32(p + 16) | (int64_t)get_u32(p + 20) << 32, sample_us(first));
+            CHECK_EQ(p[24], channel);
+            CHECK(p[25] == 0 && p[26] == 0 && p[27] == 0);
+            p += WAVEFORM_INFO_SIZE;
+        }
+        for (uint32_t i = 0; i < count; i++) {
+            for (uint8_t c = 0; c < cap.channels; c++) {
+                CHECK_EQ(get_u16(p), value_of(first + offset + i, c));
+                p += 2;
+            }
+        }
+        CHECK_EQ(len, (size_t)(p - out));
+        seen += count;
+    }
+    CHECK_EQ(seen, n);
+}
+
+static void release(void)
+{
+    waveform_capture_release(&cap);
+    CHECK(waveform_capture_window(&cap) == NULL);
+}
+
+static void test_trigger_in_current_feed(void)
+{
+    init(8, 4, 1u << 6);
+    CHECK(!feed_in(30, 7));
+    CHECK(waveform_capture_window(&cap) == NULL);
+
+    // Set 29 is the last one fed, 3 post-trigger sets are still missing
+    CHECK(!trigger_at(29, 6));
+    CHECK(waveform_capture_window(&cap) == NULL);
+    CHECK(feed(7));
+    check_window(21, 12, 29, 6, 5);
+
+    // Sets after the post-trigger ones were not stored
+    CHECK(!feed(20));
+    check_window(21, 12, 29, 6, 5);
+}
+
+static void test_trigger_in_earlier_feed(void)
+{
+    // The edge lies two feeds back, the post-trigger sets are already there
+    init(8, 4, 1u << 6);
+    CHECK(!feed_in(30, 3));
+    CHECK(trigger_at(23, 6));
+    check_window(18, 12, 23, 6, 4);
+
+    // Far enough back that part of the pre-trigger history was overwritten
+    init(8, 4, 1u << 6);
+    CHECK(!feed_in(35, 7));
+    CHECK(trigger_at(24, 6));
+    check_window(23, 12, 24, 6, 12);
+
+    // Trigger in the middle of the previous feed, window still filling
+    init(8, 4, 1u << 6);
+    CHECK(!feed_in(20, 10));
+    CHECK(!trigger_at(18, 6));
+    CHECK(!feed(1));
+    CHECK(feed(1));
+    check_window(10, 12, 18, 6, 5);
+}
+
+/* A timestamp names the nearest set, before or after the latest feed */
+static void test_trigger_rounds_to_nearest_set(void)
+{
+    static const struct {
+        uint64_t set;
+        int64_t jitter_us;
+        uint64_t expected;
+    } cases[] = {
+        { 17, -PERIOD_US / 2, 17 }, { 17, -PERIOD_US / 2 - 1, 16 }, { 17, PERIOD_US / 2, 17 },
+        { 17, PERIOD_US / 2 + 1, 18 }, { 14, -PERIOD_US / 3, 14 }, { 13, PERIOD_US / 2 + 1, 14 },
+        { 14, -PERIOD_US / 2 - 1, 13 },
+    };
+
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        init(8, 4, 1u << 6);
+        CHECK(!feed_in(20, 5));
+        uint64_t end = cases[i].expected + 4;
+        CHECK_EQ(waveform_capture_trigger(&cap, sample_us(cases[i].set) + cases[i].jitter_us, 6), end <= fed);
+        if (end > fed) {
+            CHECK(feed_in(end - fed, 1));
+        }
+        uint64_t first = cases[i].expected - 8 > fed - 12 ? cases[i].expected - 8 : fed - 12;
+        check_window(first, (uint32_t)(fed - first), cases[i].expected, 6, 5);
+    }
+}
+
+static void test_trigger_clamped(void)
+{
+    // Before the first sample
+    init(8, 4, 1u << 6);
+    CHECK(!feed(2));
+    CHECK(!waveform_capture_trigger(&cap, T0_US - 1000000, 6));
+    CHECK(feed(2));
+    check_window(0, 4, 0, 6, 5);
+
+    // After the latest sample: the next one to arrive
+    init(8, 4, 1u << 6);
+    CHECK(!feed(10));
+    CHECK(!waveform_capture_trigger(&cap, sample_us(10) + 1000000, 6));
+    CHECK(!feed(3));
+    CHECK(feed(1));
+    check_window(2, 12, 10, 6, 5);
+
+    // Before the start of the current capture: its first set
+    release();
+    CHECK(!feed(3));        // re-arms at set 14
+    CHECK(!trigger_at(5, 6));
+    CHECK(feed(1));
+    check_window(14, 4, 14, 6, 5);
+}
+
+static void test_buffer_wraps(void)
+{
+    // Feeds that straddle the end of the buffer
+    for (size_t per_feed = 1; per_feed <= 13; per_feed++) {
+        init(7, 5, 1u << 6);
+        CHECK(!feed_in(40, per_feed));
+        CHECK(!trigger_at(38, 6));
+        CHECK(feed_in(3, per_feed));
+        check_window(31, 12, 38, 6, 5);
+    }
+
+    // A feed larger than the whole buffer keeps its newest sets
+    init(7, 5, 1u << 6);
+    CHECK(!feed(100));
+    CHECK(trigger_at(93, 6));
+    check_window(88, 12, 93, 6, 5);
+
+    // The same while collecting post-trigger sets
+    init(7, 5, 1u << 6);
+    CHECK(!feed(20));
+    CHECK(!trigger_at(19, 6));
+    CHECK(feed(100));
+    check_window(12, 12, 19, 6, 5);
+}
+
+static void test_missed_while_out(void)
+{
+    init(8, 4, 1u << 6);
+    CHECK(!feed(10));
+    CHECK(!trigger_at(9, 6));
+    // Collecting post-trigger sets counts as busy too
+    CHECK(!trigger_at(10, 7));
+    CHECK_EQ(waveform_capture_missed(&cap), 1);
+    CHECK(feed(3));
+    check_window(1, 12, 9, 6, 5);
+
+    for (int i = 0; i < 5; i++) {
+        CHECK(!trigger_at(12 + i, 7));
+        CHECK(!feed(7));
+    }
+    CHECK_EQ(waveform_capture_missed(&cap), 6);
+    // Neither the triggers nor the sets fed while frozen touch the window
+    check_window(1, 12, 9, 6, 5);
+}
+
+static void test_rearm_after_release(void)
+{
+    init(8, 4, 1u << 6);
+    CHECK(!feed(10));
+    CHECK(trigger_at(5, 6));
+    check_window(0, 10, 5, 6, 5);
+
+    // Sets fed while frozen are gone, release alone does not re-arm
+    CHECK(!feed(20));
+    release();
+    CHECK(!trigger_at(29, 6));
+    CHECK_EQ(waveform_capture_missed(&cap), 1);
+
+    // The next feed re-arms, the history starts with it
+    CHECK(!feed(6));
+    CHECK(!trigger_at(35, 7));
+    CHECK(feed(4));
+    check_window(30, 9, 35, 7, 5);
+
+    // And again with a full pre-trigger history
+    release();
+    CHECK(!feed_in(30, 4));
+    CHECK(!trigger_at(68, 6));
+    CHECK(feed_in(5, 4));
+    check_window(60, 12, 68, 6, 5);
+    CHECK_EQ(waveform_capture_missed(&cap), 1);
+}
+
+static void test_channels_and_chunks(void)
+{
+    init(10, 6, 0x0b);      // ADC1 channels 0, 1 and 3
+    CHECK_EQ(cap.channels, 3);
+    CHECK(!feed_in(50, 9));
+    CHECK(!trigger_at(45, 3));
+    CHECK(feed(5));
+    for (uint32_t chunk_samples = 1; chunk_samples <= 17; chunk_samples++) {
+        check_window(35, 16, 45, 3, chunk_samples);
+    }
+
+    // Chunks that do not exist or do not fit are refused
+    uint8_t out[MAX_CHUNK];
+    size_t need = WAVEFORM_CHUNK_HEADER_SIZE + WAVEFORM_INFO_SIZE + 2 * 5 * 3;
+    CHECK_EQ(waveform_capture_encode_chunk(&cap, 1, 4, 5, RATE_HZ, out, sizeof(out)), 0);
+    CHECK_EQ(waveform_capture_encode_chunk(&cap, 1, 0, 0, RATE_HZ, out, sizeof(out)), 0);
+    CHECK_EQ(waveform_capture_encode_chunk(&cap, 1, 0, 5, RATE_HZ, out, need - 1), 0);
+    CHECK_EQ(waveform_capture_encode_chunk(&cap, 1, 0, 5, RATE_HZ, out, need), need);
+    // The last chunk is short but needs room for a full one, like the others
+    CHECK_EQ(waveform_capture_encode_chunk(&cap, 1, 3, 5, RATE_HZ, out, need - 1), 0);
+    CHECK_EQ(waveform_capture_encode_chunk(&cap, 1, 3, 5, RATE_HZ, out, need),
+             WAVEFORM_CHUNK_HEADER_SIZE + 2 * 1 * 3);
+
+    release();
+    CHECK_EQ(waveform_capture_encode_chunk(&cap, 1, 0, 5, RATE_HZ, out, sizeof(out)), 0);
+}
+
+/* Encode the frozen window, chunks in the given order, and compare with vectors/waveform/name.bin */
+static void check_vector(const char *name, uint16_t capture_id, uint32_t chunk_samples, bool reverse)
+{
+    static uint8_t encoded[4096], expected[4096 + 1];
+    char path[128];
+    size_t len = 0;
+
+    uint16_t n_chunks = waveform_capture_chunks(&cap, chunk_samples);
+    for (uint16_t i = 0; i < n_chunks; i++) {
+        uint16_t chunk = reverse ? n_chunks - 1 - i : i;
+        size_t n = waveform_capture_encode_chunk(&cap, capture_id, chunk, chunk_samples, RATE_HZ, encoded + len,
+                                                 sizeof(encoded) - len);
+        CHECK(n > 0);
+        len += n;
+    }
+
+    snprintf(path, sizeof(path), VECTORS "%s.bin", name);
+    if (update) {
+        FILE *f = fopen(path, "wb");
+        CHECK(f != NULL && fwrite(encoded, 1, len, f) == len);
+        fclose(f);
+        printf("wrote %s, %zu bytes\n", path, len);
+        return;
+    }
+    FILE *f = fopen(path, "rb");
+    CHECK(f != NULL);
+    size_t expected_len = fread(expected, 1, sizeof(expected), f);
+    fclose(f);
+    if (expected_len != len || memcmp(encoded, expected, len) != 0) {
+        fprintf(stderr, "%s: encoding differs from the committed vector (%zu vs %zu bytes)\n", path, len,
+                expected_len);
+        exit(1);
+    }
+}
+
+static void test_vector_single_channel(void)
+{
+    init(6, 4, 1u << 6);
+    CHECK(!feed(12));
+    CHECK(!trigger_at(11, 6));
+    CHECK(!trigger_at(11, 6));      // one missed trigger
+    CHECK(feed(3));
+    check_window(5, 10, 11, 6, 4);
+    check_vector("single_channel", 3, 4, false);
+}
+
+/* Chunks in reverse order, as a retried upload may deliver them */
+static void test_vector_three_channels(void)
+{
+    init(5, 3, 0x0b);
+    CHECK(!feed_in(9, 4));
+    CHECK(trigger_at(4, 3));
+    check_window(1, 8, 4, 3, 4);
+    check_vector("three_channels", 7, 4, true);
+}
+
+int main(int argc, char **argv)
+{
+    update = argc > 1 && strcmp(argv[1], "--update") == 0;
+
+    TEST_RUN(test_trigger_in_current_feed);
+    TEST_RUN(test_trigger_in_earlier_feed);
+    TEST_RUN(test_trigger_rounds_to_nearest_set);
+    TEST_RUN(test_trigger_clamped);
+    TEST_RUN(test_buffer_wraps);
+    TEST_RUN(test_missed_while_out);
+    TEST_RUN(test_rearm_after_release);
+    TEST_RUN(test_channels_and_chunks);
+    TEST_RUN(test_vector_single_channel);
+    TEST_RUN(test_vector_three_channels);
+    return 0;
+}
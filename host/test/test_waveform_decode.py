@@ -0,0 +1,107 @@
+#!/usr/bin/env python3
+"""tools/waveform_decode.py against the chunks in vectors/waveform.
+
+Every NAME.bin holds the chunks test_waveform_capture encodes for one
+capture and must reassemble to NAME.csv, and to a WAV with a channel per
+ADC channel. All files concatenated, as mosquitto_sub -N writes them, must
+give every capture. Malformed chunks must be refused with ValueError.
+
+Usage:
+    host/test/test_waveform_decode.py
+"""
+
+import glob
+import importlib.util
+import os
+import sys
+import tempfile
+import wave
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+VECTORS = os.path.join(HERE, "vectors", "waveform")
+TOOL = os.path.join(HERE, "..", "..", "tools", "waveform_decode.py")
+
+
+def load_tool():
+    spec = importlib.util.spec_from_file_location("waveform_decode", TOOL)
+    module = importlib.util.module_from_spec(spec)
+    spec.loader.exec_module(module)
+    return module
+
+
+def main():
+    tool = load_tool()
+    failed = False
+
+    names = sorted(glob.glob(os.path.join(VECTORS, "*.bin")))
+    if not names:
+        print("no vectors in %s" % VECTORS)
+        return 1
+    blobs = []
+    with tempfile.TemporaryDirectory() as out:
+        for name in names:
+            base = os.path.basename(name)[:-len(".bin")]
+            with open(name, "rb") as f:
+                blobs.append(f.read())
+            captures, incomplete = tool.assemble(blobs[-1:])
+            if len(captures) != 1 or incomplete:
+                print("%s: %d captures, %d incomplete" % (base, len(captures), len(incomplete)))
+                failed = True
+                continue
+            capture = captures[0]
+
+            path = os.path.join(out, base + ".csv")
+            tool.write_csv(capture, path)
+            with open(path) as f:
+                decoded = f.read()
+            with open(os.path.join(VECTORS, base + ".csv")) as f:
+                expected = f.read()
+            if decoded != expected:
+                print("%s: decode differs from the expected csv" % base)
+                failed = True
+                continue
+
+            path = os.path.join(out, base + ".wav")
+            tool.write_wav(capture, path)
+            with wave.open(path) as w:
+                shape = (w.getnchannels(), w.getnframes(), w.getframerate())
+            if shape != (len(capture.channels), capture.info[1], capture.info[0]):
+                print("%s: wav has %d channels, %d frames at %d Hz" % ((base,) + shape))
+                failed = True
+                continue
+            print("ok %s" % base)
+
+    captures, incomplete = tool.assemble([b"".join(blobs)])
+    if len(captures) != len(blobs) or incomplete:
+        print("concatenated: %d captures, %d incomplete" % (len(captures), len(incomplete)))
+        failed = True
+
+    # A capture with a chunk missing is reported, not written. The last
+    # chunk of single_channel holds 2 samples
+    good = blobs[names.index(os.path.join(VECTORS, "single_channel.bin"))]
+    captures, incomplete = tool.assemble([good[:-(tool.HEADER.size + 2 * 2)]])
+    if captures or not incomplete:
+        print("capture with a missing chunk was completed")
+        failed = True
+
+    bad = {
+        "short": good[:5],
+        "magic": b"X" + good[1:],
+        "version": good[:1] + b"\x09" + good[2:],
+        "version 2": good[:1] + b"\x02" + good[2:],
+        "truncated info": good[:20],
+        "truncated samples": good[:-1],
+    }
+    for what, data in bad.items():
+        try:
+            tool.assemble([data])
+            print("%s chunk was accepted" % what)
+            failed = True
+        except ValueError:
+            pass
+
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
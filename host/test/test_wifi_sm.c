@@ -0,0 +1,291 @@
+/*
+ * wifi_sm against simulated event sequences.
+ *
+ * A small network model stands in for the driver: connects take a fixed time
+ * and succeed when the AP is up and, for fast connects, still where the
+ * cache says. The glue applies the actions the way wifi_run_action does,
+ * with one retry timer and the NVS cache kept in memory. Scripted cases
+ * check fast connect, the fallback to a full scan and time-to-IP. Random
+ * event sequences, including the stray ones the driver and a late timer
+ * produce, check that there is never more than one attempt in flight.
+ */
+
+#include <string.h>
+
+#include "wifi_sm.h"
+#include "test.h"
+
+/* wifi_task's configuration */
+static const backoff_config_t wifi_cfg = {
+    .min_ms = 200,
+    .base_ms = 1000,
+    .cap_ms = 30000,
+    .stable_ms = 30000,
+};
+
+#define FAST_CONNECT_MS     300     // cached BSSID/channel, no scan
+#define SCAN_CONNECT_MS     2500    // full scan of all channels first
+#define FAIL_MS             4000    // driver gives up after its own retries
+#define NEVER               INT64_MAX
+
+typedef struct {
+    wifi_sm_t sm;
+    int64_t now_ms;
+
+    // Network
+    bool ap_up;
+    int ap_channel;
+    int cache_channel;      // 0 when there is no cache in NVS
+
+    // Pending driver result and retry timer
+    int64_t connect_done_ms;
+    bool connect_ok;
+    int64_t retry_at_ms;
+
+    int connects;
+    int fast_connects;
+    int got_ip;
+} sim_t;
+
+static sim_t sim;
+
+static void apply(const wifi_sm_action_t *action)
+{
+    if (action->drop_cache) {
+        sim.cache_channel = 0;
+    }
+    if (action->save_ap) {
+        sim.cache_channel = sim.ap_channel;
+    }
+    if (action->connect) {
+        CHECK(sim.connect_done_ms == NEVER);        // one attempt at a time
+        CHECK(!action->fast_connect || sim.cache_channel != 0);
+        sim.connects++;
+        sim.fast_connects += action->fast_connect;
+        bool found = sim.ap_up && (!action->fast_connect || sim.cache_channel == sim.ap_channel);
+        sim.connect_ok = found;
+        sim.connect_done_ms = sim.now_ms + (!found ? FAIL_MS : action->fast_connect ? FAST_CONNECT_MS : SCAN_CONNECT_MS);
+    }
+    if (action->retry_delay_ms > 0) {
+        CHECK(action->retry_delay_ms >= wifi_cfg.min_ms && action->retry_delay_ms <= wifi_cfg.cap_ms);
+        sim.retry_at_ms = sim.now_ms + action->retry_delay_ms;   // esp_timer_stop + start_once
+    }
+}
+
+static void handle(wifi_sm_event_t event)
+{
+    wifi_sm_action_t action = wifi_sm_handle(&sim.sm, event, sim.now_ms);
+    apply(&action);
+}
+
+static void boot(bool ap_up, int ap_channel, int cache_channel)
+{
+    memset(&sim, 0, sizeof(sim));
+    sim.now_ms = 1000;
+    sim.ap_up = ap_up;
+    sim.ap_channel = ap_channel;
+    sim.cache_channel = cache_channel;
+    sim.connect_done_ms = NEVER;
+    sim.retry_at_ms = NEVER;
+    wifi_sm_init(&sim.sm, &wifi_cfg, 12345, cache_channel != 0);
+    handle(WIFI_SM_EV_START);
+}
+
+/* Run the driver and the timer until until_ms, or until an IP when stop_on_ip */
+static void run(int64_t until_ms, bool stop_on_ip)
+{
+    while (1) {
+        int64_t next = sim.connect_done_ms < sim.retry_at_ms ? sim.connect_done_ms : sim.retry_at_ms;
+        if (next > until_ms) {
+            break;
+        }
+        sim.now_ms = next;
+        if (next == sim.connect_done_ms) {
+            sim.connect_done_ms = NEVER;
+            if (sim.connect_ok) {
+                sim.got_ip++;
+                handle(WIFI_SM_EV_GOT_IP);
+                if (stop_on_ip) {
+                    return;
+                }
+            } else {
+                handle(WIFI_SM_EV_DISCONNECTED);
+            }
+        } else {
+            sim.retry_at_ms = NEVER;
+            handle(WIFI_SM_EV_RETRY);
+        }
+    }
+    sim.now_ms = until_ms;
+}
+
+static void test_fast_connect_at_boot(void)
+{
+    boot(true, 6, 6);
+    run(60000, true);
+    CHECK_EQ(sim.sm.state, WIFI_SM_CONNECTED);
+    CHECK_EQ(sim.connects, 1);
+    CHECK_EQ(sim.fast_connects, 1);
+    CHECK_EQ(sim.sm.time_to_ip_ms, FAST_CONNECT_MS);
+    CHECK_EQ(sim.cache_channel, 6);
+}
+
+static void test_no_cache_scans(void)
+{
+    boot(true, 11, 0);
+    run(60000, true);
+    CHECK_EQ(sim.connects, 1);
+    CHECK_EQ(sim.fast_connects, 0);
+    CHECK_EQ(sim.sm.time_to_ip_ms, SCAN_CONNECT_MS);
+    CHECK_EQ(sim.cache_channel, 11);        // the next boot connects fast
+
+    boot(true, 11, sim.cache_channel);
+    run(60000, true);
+    CHECK_EQ(sim.sm.time_to_ip_ms, FAST_CONNECT_MS);
+}
+
+/* The AP moved channel: the fast attempt fails once, then full scans */
+static void test_stale_cache(void)
+{
+    boot(true, 1, 6);
+    run(60000, true);
+    CHECK_EQ(sim.connects, 2);
+    CHECK_EQ(sim.fast_connects, 1);
+    CHECK_EQ(sim.sm.attempts, 2);
+    CHECK_EQ(sim.cache_channel, 1);
+    // Time to IP counts from the start, including the failed attempt and the backoff
+    CHECK(sim.sm.time_to_ip_ms >= FAIL_MS + wifi_cfg.min_ms + SCAN_CONNECT_MS);
+    CHECK(sim.sm.time_to_ip_ms <= FAIL_MS + wifi_cfg.base_ms + SCAN_CONNECT_MS);
+}
+
+/* AP down for a while: retries back off up to the cap, the cache survives a dropped link */
+static void test_outage(void)
+{
+    boot(true, 6, 6);
+    run(60000, true);
+    CHECK_EQ(sim.sm.time_to_ip_ms, FAST_CONNECT_MS);
+
+    // Link drops after 10 s up, the AP stays away for 5 minutes
+    sim.now_ms += 10000;
+    sim.ap_up = false;
+    int64_t dropped_at = sim.now_ms;
+    handle(WIFI_SM_EV_DISCONNECTED);
+    CHECK_EQ(sim.sm.state, WIFI_SM_BACKOFF);
+    CHECK(sim.retry_at_ms != NEVER);
+    CHECK_EQ(sim.cache_channel, 6);
+
+    run(dropped_at + 300000, false);
+    CHECK_EQ(sim.got_ip, 1);
+    CHECK_EQ(sim.fast_connects, 2);         // boot and the first attempt after the drop
+    CHECK_EQ(sim.cache_channel, 0);
+    // Capped backoff plus failing attempts: no more than one attempt per FAIL_MS + min, no fewer than per cap
+    CHECK(sim.connects - 1 <= (int)(300000 / (FAIL_MS + wifi_cfg.min_ms)) + 1);
+    CHECK(sim.connects - 1 >= (int)(300000 / (FAIL_MS + wifi_cfg.cap_ms)));
+
+    sim.ap_up = true;
+    run(sim.now_ms + 60000, true);
+    CHECK_EQ(sim.sm.state, WIFI_SM_CONNECTED);
+    CHECK(sim.sm.time_to_ip_ms > 300000);
+    CHECK(sim.sm.time_to_ip_ms <= sim.now_ms - dropped_at);
+    CHECK_EQ(sim.cache_channel, 6);
+}
+
+/* Events that do not fit the state are ignored */
+static void test_stray_events(void)
+{
+    wifi_sm_action_t action;
+
+    boot(true, 6, 6);
+    CHECK_EQ(sim.sm.state, WIFI_SM_CONNECTING);
+    action = wifi_sm_handle(&sim.sm, WIFI_SM_EV_START, sim.now_ms);
+    CHECK(!action.connect && action.retry_delay_ms == 0);
+    action = wifi_sm_handle(&sim.sm, WIFI_SM_EV_RETRY, sim.now_ms);     // late timer
+    CHECK(!action.connect);
+
+    run(60000, true);
+    action = wifi_sm_handle(&sim.sm, WIFI_SM_EV_GOT_IP, sim.now_ms);   // renewed lease
+    CHECK(!action.save_ap);
+    CHECK_EQ(sim.sm.time_to_ip_ms, FAST_CONNECT_MS);
+    action = wifi_sm_handle(&sim.sm, WIFI_SM_EV_RETRY, sim.now_ms);
+    CHECK(!action.connect);
+
+    handle(WIFI_SM_EV_DISCONNECTED);
+    CHECK_EQ(sim.sm.state, WIFI_SM_BACKOFF);
+    action = wifi_sm_handle(&sim.sm, WIFI_SM_EV_DISCONNECTED, sim.now_ms);  // repeated
+    CHECK(action.retry_delay_ms == 0 && !action.drop_cache);
+
+    // Before START nothing happens
+    wifi_sm_init(&sim.sm, &wifi_cfg, 1, true);
+    CHECK(wifi_sm_handle(&sim.sm, WIFI_SM_EV_DISCONNECTED, 0).retry_delay_ms == 0);
+    CHECK(!wifi_sm_handle(&sim.sm, WIFI_SM_EV_RETRY, 0).connect);
+    CHECK_EQ(sim.sm.state, WIFI_SM_IDLE);
+}
+
+static uint32_t rng = 0x9e3779b9;
+
+static uint32_t next_random(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+/* Random AP moves, outages, drops and stray events; apply() checks one attempt at a time */
+static void test_random_sequences(void)
+{
+    int rounds_connected = 0;
+
+    for (int round = 0; round < 200; round++) {
+        boot(next_random() % 4 != 0, 1 + next_random() % 13, next_random() % 2 ? 1 + next_random() % 13 : 0);
+        for (int step = 0; step < 200; step++) {
+            uint32_t op = next_random() % 12;
+            if (op < 6) {
+                run(sim.now_ms + next_random() % 10000, false);
+            } else if (op == 6) {
+                sim.ap_up = !sim.ap_up;
+            } else if (op == 7) {
+                sim.ap_channel = 1 + next_random() % 13;
+            } else if (op == 8 && sim.sm.state == WIFI_SM_CONNECTED) {
+                handle(WIFI_SM_EV_DISCONNECTED);                        // link lost
+            } else if (op == 9 && sim.sm.state != WIFI_SM_BACKOFF) {
+                // Timer callback that was already dispatched when the attempt started
+                CHECK(!wifi_sm_handle(&sim.sm, WIFI_SM_EV_RETRY, sim.now_ms).connect);
+            } else if (op == 10) {
+                CHECK(!wifi_sm_handle(&sim.sm, WIFI_SM_EV_START, sim.now_ms).connect);
+            }
+
+            // Waiting for exactly one thing, matching the state
+            switch (sim.sm.state) {
+            case WIFI_SM_CONNECTING:
+                CHECK(sim.connect_done_ms != NEVER && sim.retry_at_ms == NEVER);
+                break;
+            case WIFI_SM_BACKOFF:
+                CHECK(sim.connect_done_ms == NEVER && sim.retry_at_ms != NEVER);
+                break;
+            case WIFI_SM_CONNECTED:
+                CHECK(sim.connect_done_ms == NEVER && sim.retry_at_ms == NEVER);
+                break;
+            case WIFI_SM_IDLE:
+                CHECK(0);
+            }
+            CHECK(!sim.sm.cache_valid || sim.cache_channel != 0);
+        }
+        sim.ap_up = true;
+        run(sim.now_ms + 120000, true);
+        CHECK_EQ(sim.sm.state, WIFI_SM_CONNECTED);
+        rounds_connected++;
+    }
+    CHECK_EQ(rounds_connected, 200);
+}
+
+int main(void)
+{
+    TEST_RUN(test_fast_connect_at_boot);
+    TEST_RUN(test_no_cache_scans);
+    TEST_RUN(test_stale_cache);
+    TEST_RUN(test_outage);
+    TEST_RUN(test_stray_events);
+    TEST_RUN(test_random_sequences);
+    return 0;
+}
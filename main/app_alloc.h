@@ -0,0 +1,66 @@
+#pragma once
+
+/*
+ * Creation of the application's tasks and RTOS objects.
+ *
+ * With CONFIG_INTERCOM_STATIC_ALLOC the control blocks, stacks and queue
+ * storage are static arrays declared at the call site, so each macro use may
+ * run only once (or again after the previous object was deleted). Otherwise
+ * they come from the heap as before. Stack sizes are in bytes.
+ */
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+
+#if CONFIG_INTERCOM_STATIC_ALLOC
+
+#define APP_TASK_CREATE(fn, name, stack_size, arg, prio) ({                         \
+    static StackType_t app_stack_[(stack_size) / sizeof(StackType_t)];              \
+    static StaticTask_t app_tcb_;                                                   \
+    xTaskCreateStatic((fn), (name), (stack_size), (arg), (prio), app_stack_, &app_tcb_); \
+})
+
+#define APP_QUEUE_CREATE(length, item_size) ({                                      \
+    static uint8_t app_queue_storage_[(length) * (item_size)];                      \
+    static StaticQueue_t app_queue_;                                                \
+    xQueueCreateStatic((length), (item_size), app_queue_storage_, &app_queue_);     \
+})
+
+#define APP_MUTEX_CREATE() ({                                                       \
+    static StaticSemaphore_t app_mutex_;                                            \
+    xSemaphoreCreateMutexStatic(&app_mutex_);                                       \
+})
+
+#define APP_BINARY_SEMAPHORE_CREATE() ({                                            \
+    static StaticSemaphore_t app_semaphore_;                                        \
+    xSemaphoreCreateBinaryStatic(&app_semaphore_);                                  \
+})
+
+#define APP_COUNTING_SEMAPHORE_CREATE(max, initial) ({                              \
+    static StaticSemaphore_t app_semaphore_;                                        \
+    xSemaphoreCreateCountingStatic((max), (initial), &app_semaphore_);              \
+})
+
+#define APP_EVENT_GROUP_CREATE() ({                                                 \
+    static StaticEventGroup_t app_event_group_;                                     \
+    xEventGroupCreateStatic(&app_event_group_);                                     \
+})
+
+#else
+
+#define APP_TASK_CREATE(fn, name, stack_size, arg, prio) ({                         \
+    TaskHandle_t app_task_ = NULL;                                                  \
+    xTaskCreate((fn), (name), (stack_size), (arg), (prio), &app_task_);             \
+    app_task_;                                                                      \
+})
+
+#define APP_QUEUE_CREATE(length, item_size)             xQueueCreate((length), (item_size))
+#define APP_MUTEX_CREATE()                              xSemaphoreCreateMutex()
+#define APP_BINARY_SEMAPHORE_CREATE()                   xSemaphoreCreateBinary()
+#define APP_COUNTING_SEMAPHORE_CREATE(max, initial)     xSemaphoreCreateCounting((max), (initial))
+#define APP_EVENT_GROUP_CREATE()                        xEventGroupCreate()
+
+#endif
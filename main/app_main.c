@@ -1,63 +1,85 @@
 #include "esp_system.h"
+#include "esp_netif.h"
 #include "nvs_flash.h"
 #include "esp_log.h"
-#include "protocol_examples_common.h"
 
 #include "intercom_constants.h"
 #include "credentials.h"
 #include "color.h"
 
+#include "tasks/boot_task.h"
 #include "tasks/rgb_state_task.h"
 #include "tasks/wifi_task.h"
 #include "tasks/mqtt_task.h"
 #include "tasks/gpio_monitor_task.h"
+#include "tasks/door_task.h"
+#include "tasks/event_log_task.h"
+#include "tasks/metrics_task.h"
+#include "tasks/dlog_task.h"
+#include "tasks/power_task.h"
+#include "tasks/capture_task.h"
 #include "tasks/ota_task.h"
 
 
 const char *TAG = "intercom_app_main";
 
-void app_main(void)
+/* State bus, LED renderer and the event groups other stages rely on */
+static void stage_core(void)
 {
-    ESP_LOGI(TAG, "Startup..");
-    ESP_LOGI(TAG, "Free memory: %" PRIu32 " bytes", esp_get_free_heap_size());
-    ESP_LOGI(TAG, "IDF version: %s", esp_get_idf_version());
-
-    esp_err_t err = nvs_flash_init();
-    if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
-        nvs_flash_erase();
-        err = nvs_flash_init();
-    }
-
-    ota_check();
-    task_ota_start();
-
     rgb_state_init();
-    gpio_init_setup();
+    task_rgb_state_start();
     mqtt5_init();
+    gpio_init_setup();
+    door_init();
 
     set_intercom_state(ENUM_INTERCOM_STATE_IDLE);
 
+    // Verbose MQTT client and transport logging blocks every publish on the UART, see Debugging
     esp_log_level_set("*", ESP_LOG_INFO);
-    esp_log_level_set("mqtt_client", ESP_LOG_VERBOSE);
-    esp_log_level_set("mqtt_example", ESP_LOG_VERBOSE);
-    esp_log_level_set("transport_base", ESP_LOG_VERBOSE);
-    esp_log_level_set("esp-tls", ESP_LOG_VERBOSE);
-    esp_log_level_set("transport", ESP_LOG_VERBOSE);
-    esp_log_level_set("outbox", ESP_LOG_VERBOSE);
-    
-    task_rgb_state_start();
+}
+
+static void stage_nvs(void)
+{
+    esp_err_t err = nvs_flash_init();
+    if (err == ESP_ERR_NVS_NO_FREE_PAGES || err == ESP_ERR_NVS_NEW_VERSION_FOUND) {
+        nvs_flash_erase();
+        err = nvs_flash_init();
+    }
+}
 
-    /* This helper function configures Wi-Fi or Ethernet, as selected in menuconfig.
-     * Read "Establishing Wi-Fi or Ethernet Connection" section in
-     * examples/protocols/README.md for more information about this function.
-     */
+static void stage_netif(void)
+{
     // Init TCP/IP
     ESP_ERROR_CHECK(esp_netif_init());
+}
 
-    // Init Wifi and connect to AP
-    wifi_init_sta();
+/*
+ * Boot stages in preferred start order. Each one starts as soon as the
+ * milestones it needs are reached, so ADC sampling runs within milliseconds
+ * of reset no matter how long the AP or the broker take to answer.
+ */
+static const boot_stage_t boot_stages[] = {
+    { "dlog",        0,                                  0,                task_dlog_start },
+    { "power",       0,                                  0,                power_init },
+    { "core",        0,                                  BOOT_CORE,        stage_core },
+    { "event_log",   BOOT_CORE,                          0,                task_event_log_start },
+    { "metrics",     0,                                  0,                task_metrics_start },
+    { "capture",     0,                                  0,                task_capture_start },
+    { "monitor",     BOOT_CORE,                          0,                task_gpio_monitor_start },
+    { "nvs",         0,                                  BOOT_NVS,         stage_nvs },
+    { "netif",       0,                                  BOOT_NETIF,       stage_netif },
+    { "wifi",        BOOT_CORE | BOOT_NVS | BOOT_NETIF,  0,                wifi_init_sta },
+    { "ota_check",   BOOT_CORE | BOOT_NVS,               BOOT_OTA_CHECKED, ota_check },
+    { "mqtt",        BOOT_CORE | BOOT_WIFI_IP,           0,                task_mqtt5_start },
+    { "ota",         BOOT_OTA_CHECKED | BOOT_WIFI_IP,    0,                task_ota_start },
+    { "boot_report", BOOT_MQTT_CONNECTED,                0,                boot_publish_report },
+};
 
-    task_mqtt5_start();
+void app_main(void)
+{
+    ESP_LOGI(TAG, "Startup..");
+    ESP_LOGI(TAG, "Free memory: %" PRIu32 " bytes", esp_get_free_heap_size());
+    ESP_LOGI(TAG, "IDF version: %s", esp_get_idf_version());
 
-    task_gpio_monitor_start();
+    boot_run(boot_stages, sizeof(boot_stages) / sizeof(boot_stages[0]));
 }
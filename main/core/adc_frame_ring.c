@@ -0,0 +1,81 @@
+#include "adc_frame_ring.h"
+
+bool adc_frame_ring_init(adc_frame_ring_t *ring, adc_frame_t *frames, uint16_t *storage,
+                         size_t frame_count, size_t frame_capacity)
+{
+    if (ring == NULL || frames == NULL || storage == NULL || frame_count == 0 || frame_capacity == 0) {
+        return false;
+    }
+
+    ring->frames = frames;
+    ring->frame_count = frame_count;
+    ring->frame_capacity = frame_capacity;
+    ring->next_seq = 0;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->overruns, 0);
+
+    for (size_t i = 0; i < frame_count; i++) {
+        frames[i].samples = &storage[i * frame_capacity];
+        frames[i].count = 0;
+        frames[i].timestamp_us = 0;
+        frames[i].seq = 0;
+    }
+    return true;
+}
+
+adc_frame_t *adc_frame_ring_begin_write(adc_frame_ring_t *ring)
+{
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    if (head - tail >= ring->frame_count) {
+        return NULL;
+    }
+    return &ring->frames[head % ring->frame_count];
+}
+
+void adc_frame_ring_commit(adc_frame_ring_t *ring, size_t count, int64_t timestamp_us)
+{
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    adc_frame_t *frame = &ring->frames[head % ring->frame_count];
+
+    frame->count = count;
+    frame->timestamp_us = timestamp_us;
+    frame->seq = ring->next_seq++;
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+void adc_frame_ring_drop(adc_frame_ring_t *ring)
+{
+    ring->next_seq++;
+    atomic_fetch_add_explicit(&ring->overruns, 1, memory_order_relaxed);
+}
+
+adc_frame_t *adc_frame_ring_peek(adc_frame_ring_t *ring)
+{
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&ring->head, memory_order_acquire);
+
+    if (head == tail) {
+        return NULL;
+    }
+    return &ring->frames[tail % ring->frame_count];
+}
+
+void adc_frame_ring_release(adc_frame_ring_t *ring)
+{
+    unsigned tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+size_t adc_frame_ring_pending(adc_frame_ring_t *ring)
+{
+    return atomic_load_explicit(&ring->head, memory_order_acquire) -
+           atomic_load_explicit(&ring->tail, memory_order_acquire);
+}
+
+uint32_t adc_frame_ring_overruns(adc_frame_ring_t *ring)
+{
+    return atomic_load_explicit(&ring->overruns, memory_order_relaxed);
+}
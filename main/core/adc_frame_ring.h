@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Single-producer / single-consumer ring of ADC sample frames.
+ *
+ * The producer (ADC sampler) fills a frame in place and commits it, the
+ * consumer (monitor task) borrows the oldest committed frame by pointer and
+ * releases it when done. No sample data is copied between the two.
+ * This file has no ESP-IDF dependencies so it can be built on the host.
+ */
+
+typedef struct {
+    uint16_t *samples;      // points into the ring storage
+    size_t count;           // valid samples in this frame
+    int64_t timestamp_us;   // time of the first sample
+    uint32_t seq;           // frame sequence number, gaps mean overruns
+} adc_frame_t;
+
+typedef struct {
+    adc_frame_t *frames;
+    size_t frame_count;
+    size_t frame_capacity;  // samples per frame
+    atomic_uint head;       // frames committed by the producer
+    atomic_uint tail;       // frames released by the consumer
+    atomic_uint overruns;   // frames dropped because the ring was full
+    uint32_t next_seq;
+} adc_frame_ring_t;
+
+/* storage must hold frame_count * frame_capacity samples */
+bool adc_frame_ring_init(adc_frame_ring_t *ring, adc_frame_t *frames, uint16_t *storage,
+                         size_t frame_count, size_t frame_capacity);
+
+/* Producer side: call once per frame, before its first sample. Returns the frame
+ * to fill, or NULL if the consumer is behind and the frame has to be dropped */
+adc_frame_t *adc_frame_ring_begin_write(adc_frame_ring_t *ring);
+void adc_frame_ring_commit(adc_frame_ring_t *ring, size_t count, int64_t timestamp_us);
+/* Producer side: account a frame that had to be thrown away */
+void adc_frame_ring_drop(adc_frame_ring_t *ring);
+
+/* Consumer side: returns the oldest committed frame, or NULL if none */
+adc_frame_t *adc_frame_ring_peek(adc_frame_ring_t *ring);
+void adc_frame_ring_release(adc_frame_ring_t *ring);
+
+size_t adc_frame_ring_pending(adc_frame_ring_t *ring);
+uint32_t adc_frame_ring_overruns(adc_frame_ring_t *ring);
@@ -0,0 +1,45 @@
+#include "adc_trace.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+size_t adc_trace_read(FILE *trace, uint16_t *samples, size_t max)
+{
+    char line[32];
+    size_t count = 0;
+
+    while (count < max && fgets(line, sizeof(line), trace) != NULL) {
+        if (strchr(line, '\n') == NULL) {
+            // Longer than the buffer, e.g. a comment: drop the rest of the line
+            int c;
+            while ((c = fgetc(trace)) != EOF && c != '\n') {
+            }
+        }
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r') {
+            continue;
+        }
+        long value = strtol(line, NULL, 10);
+        if (value < 0) {
+            value = 0;
+        } else if (value > UINT16_MAX) {
+            value = UINT16_MAX;
+        }
+        samples[count++] = (uint16_t)value;
+    }
+    return count;
+}
+
+bool adc_trace_fill_frame(FILE *trace, adc_frame_ring_t *ring, int64_t timestamp_us)
+{
+    adc_frame_t *frame = adc_frame_ring_begin_write(ring);
+    if (frame == NULL) {
+        return false;
+    }
+
+    size_t count = adc_trace_read(trace, frame->samples, ring->frame_capacity);
+    if (count == 0) {
+        return false;
+    }
+    adc_frame_ring_commit(ring, count, timestamp_us);
+    return true;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "adc_frame_ring.h"
+
+/*
+ * Recorded ADC traces for feeding the frame consumer off-target.
+ *
+ * A trace is a text file with one raw ADC reading per line, lines starting
+ * with '#' are comments. `idf.py monitor` output filtered down to the
+ * numbers is enough to produce one.
+ */
+
+/* Read up to max samples from the trace, returns the number read (0 at EOF) */
+size_t adc_trace_read(FILE *trace, uint16_t *samples, size_t max);
+
+/* Fill the next free ring frame from the trace and commit it.
+ * Returns false when the trace is exhausted or the ring is full. */
+bool adc_trace_fill_frame(FILE *trace, adc_frame_ring_t *ring, int64_t timestamp_us);
@@ -0,0 +1,34 @@
+#include "arena.h"
+
+void arena_init(arena_t *arena, void *storage, size_t size)
+{
+    arena->base = storage;
+    arena->size = size;
+    arena->used = 0;
+    arena->high_water = 0;
+    arena->failures = 0;
+}
+
+void *arena_alloc(arena_t *arena, size_t size)
+{
+    uintptr_t start = (uintptr_t)arena->base + arena->used;
+    size_t pad = (ARENA_ALIGN - start % ARENA_ALIGN) % ARENA_ALIGN;
+
+    if (arena->base == NULL || size > arena->size - arena->used || pad > arena->size - arena->used - size) {
+        arena->failures++;
+        return NULL;
+    }
+    void *ptr = arena->base + arena->used + pad;
+    arena->used += pad + size;
+    if (arena->used > arena->high_water) {
+        arena->high_water = arena->used;
+    }
+    return ptr;
+}
+
+void arena_release(arena_t *arena, size_t mark)
+{
+    if (mark < arena->used) {
+        arena->used = mark;
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Bump allocator over caller supplied storage.
+ *
+ * Scratch memory for one job is carved out of a single block and given back
+ * all at once by releasing to a mark, so repeated jobs never fragment the
+ * heap. Allocations are ARENA_ALIGN aligned. Pure C, not thread safe.
+ */
+
+#define ARENA_ALIGN     8
+
+typedef struct {
+    uint8_t *base;
+    size_t size;
+    size_t used;
+    size_t high_water;
+    uint32_t failures;      // allocations that did not fit
+} arena_t;
+
+/* Worst case space for n allocations of total bytes */
+#define ARENA_SIZE_FOR(total, n)    ((total) + (n) * (ARENA_ALIGN - 1))
+
+void arena_init(arena_t *arena, void *storage, size_t size);
+
+/* NULL if the arena is exhausted */
+void *arena_alloc(arena_t *arena, size_t size);
+
+/* Free everything allocated after mark was taken */
+void arena_release(arena_t *arena, size_t mark);
+
+static inline size_t arena_mark(const arena_t *arena)
+{
+    return arena->used;
+}
+
+static inline void arena_reset(arena_t *arena)
+{
+    arena_release(arena, 0);
+}
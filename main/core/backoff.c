@@ -0,0 +1,54 @@
+#include "backoff.h"
+
+void backoff_init(backoff_t *backoff, const backoff_config_t *cfg, uint32_t seed)
+{
+    backoff->cfg = *cfg;
+    backoff->attempt = 0;
+    backoff->rng = seed ? seed : 0x9e3779b9;
+    backoff->connected_at_ms = -1;
+}
+
+static uint32_t backoff_random(backoff_t *backoff)
+{
+    /* xorshift32 */
+    uint32_t x = backoff->rng;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    backoff->rng = x;
+    return x;
+}
+
+uint32_t backoff_next_delay_ms(backoff_t *backoff)
+{
+    uint64_t ceiling = backoff->cfg.base_ms;
+    for (uint32_t i = 0; i < backoff->attempt && ceiling < backoff->cfg.cap_ms; i++) {
+        ceiling <<= 1;
+    }
+    if (ceiling > backoff->cfg.cap_ms) {
+        ceiling = backoff->cfg.cap_ms;
+    }
+    if (ceiling < backoff->cfg.min_ms) {
+        ceiling = backoff->cfg.min_ms;
+    }
+
+    if (backoff->attempt < UINT32_MAX) {
+        backoff->attempt++;
+    }
+
+    uint32_t span = ceiling - backoff->cfg.min_ms;
+    return backoff->cfg.min_ms + (span ? backoff_random(backoff) % (span + 1) : 0);
+}
+
+void backoff_on_connected(backoff_t *backoff, int64_t now_ms)
+{
+    backoff->connected_at_ms = now_ms;
+}
+
+void backoff_on_disconnected(backoff_t *backoff, int64_t now_ms)
+{
+    if (backoff->connected_at_ms >= 0 && now_ms - backoff->connected_at_ms >= backoff->cfg.stable_ms) {
+        backoff->attempt = 0;
+    }
+    backoff->connected_at_ms = -1;
+}
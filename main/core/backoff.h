@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Exponential backoff with full jitter for reconnect scheduling.
+ *
+ * Each delay is drawn uniformly from [min_ms, min(cap_ms, base_ms * 2^attempt)]
+ * so a fleet of devices that lost the same broker spreads its reconnects out
+ * instead of retrying in lockstep. The attempt counter is reset only after a
+ * connection stayed up for stable_ms, so a flapping link keeps backing off.
+ * Pure C, the caller supplies the clock.
+ */
+
+typedef struct {
+    uint32_t min_ms;
+    uint32_t base_ms;
+    uint32_t cap_ms;
+    uint32_t stable_ms;
+} backoff_config_t;
+
+typedef struct {
+    backoff_config_t cfg;
+    uint32_t attempt;
+    uint32_t rng;
+    int64_t connected_at_ms;    // -1 while disconnected
+} backoff_t;
+
+void backoff_init(backoff_t *backoff, const backoff_config_t *cfg, uint32_t seed);
+
+/* Delay before the next connection attempt, advances the attempt counter */
+uint32_t backoff_next_delay_ms(backoff_t *backoff);
+
+void backoff_on_connected(backoff_t *backoff, int64_t now_ms);
+void backoff_on_disconnected(backoff_t *backoff, int64_t now_ms);
+
+static inline uint32_t backoff_attempt(const backoff_t *backoff)
+{
+    return backoff->attempt;
+}
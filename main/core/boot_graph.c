@@ -0,0 +1,79 @@
+#include "boot_graph.h"
+
+#include <string.h>
+
+bool boot_graph_init(boot_graph_t *graph, const boot_stage_t *stages, size_t n_stages, boot_clock_t clock)
+{
+    if (n_stages > BOOT_GRAPH_MAX_STAGES) {
+        return false;
+    }
+    memset(graph, 0, sizeof(*graph));
+    graph->stages = stages;
+    graph->n_stages = n_stages;
+    graph->clock = clock;
+    for (int i = 0; i < BOOT_GRAPH_MAX_MILESTONES; i++) {
+        graph->reached_us[i] = -1;
+    }
+    for (size_t i = 0; i < BOOT_GRAPH_MAX_STAGES; i++) {
+        graph->start_us[i] = -1;
+        graph->done_us[i] = -1;
+    }
+    return true;
+}
+
+static void boot_graph_reach(boot_graph_t *graph, uint32_t milestones, int64_t now_us)
+{
+    uint32_t fresh = milestones & ~graph->reached;
+    for (int i = 0; i < BOOT_GRAPH_MAX_MILESTONES; i++) {
+        if (fresh & (1u << i)) {
+            graph->reached_us[i] = now_us;
+        }
+    }
+    graph->reached |= milestones;
+}
+
+size_t boot_graph_signal(boot_graph_t *graph, uint32_t milestones)
+{
+    size_t started = 0;
+    bool progress = true;
+
+    boot_graph_reach(graph, milestones, graph->clock());
+
+    while (progress) {
+        progress = false;
+        for (size_t i = 0; i < graph->n_stages; i++) {
+            const boot_stage_t *stage = &graph->stages[i];
+            if ((graph->started & (1u << i)) || (stage->needs & ~graph->reached)) {
+                continue;
+            }
+
+            graph->started |= 1u << i;
+            graph->start_us[i] = graph->clock();
+            if (stage->start != NULL) {
+                stage->start();
+            }
+            graph->done_us[i] = graph->clock();
+            boot_graph_reach(graph, stage->provides, graph->done_us[i]);
+
+            started++;
+            progress = true;
+        }
+    }
+    return started;
+}
+
+bool boot_graph_done(const boot_graph_t *graph)
+{
+    return graph->started == (graph->n_stages >= 32 ? UINT32_MAX : (1u << graph->n_stages) - 1);
+}
+
+uint32_t boot_graph_waiting_for(const boot_graph_t *graph)
+{
+    uint32_t waiting = 0;
+    for (size_t i = 0; i < graph->n_stages; i++) {
+        if (!(graph->started & (1u << i))) {
+            waiting |= graph->stages[i].needs & ~graph->reached;
+        }
+    }
+    return waiting;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Dependency driven boot sequencing.
+ *
+ * Each stage declares the milestones it needs (bit mask) and the milestones
+ * it provides once its start function returns. Milestones that happen later,
+ * such as getting an IP, are signalled from outside. A stage starts as soon
+ * as all of its needs are reached; start and milestone times are recorded.
+ * Pure C, the caller supplies the clock and serializes calls.
+ */
+
+#define BOOT_GRAPH_MAX_STAGES       16
+#define BOOT_GRAPH_MAX_MILESTONES   32
+
+typedef struct {
+    const char *name;
+    uint32_t needs;
+    uint32_t provides;
+    void (*start)(void);
+} boot_stage_t;
+
+typedef int64_t (*boot_clock_t)(void);
+
+typedef struct {
+    const boot_stage_t *stages;
+    size_t n_stages;
+    boot_clock_t clock;
+    uint32_t reached;
+    uint32_t started;                               // bit per stage
+    int64_t reached_us[BOOT_GRAPH_MAX_MILESTONES];
+    int64_t start_us[BOOT_GRAPH_MAX_STAGES];
+    int64_t done_us[BOOT_GRAPH_MAX_STAGES];
+} boot_graph_t;
+
+bool boot_graph_init(boot_graph_t *graph, const boot_stage_t *stages, size_t n_stages, boot_clock_t clock);
+
+/* Mark milestones as reached and start every stage that became ready,
+ * including stages unlocked by what those stages provide.
+ * Returns the number of stages started. */
+size_t boot_graph_signal(boot_graph_t *graph, uint32_t milestones);
+
+bool boot_graph_done(const boot_graph_t *graph);
+
+/* Milestones that not yet started stages are still waiting for */
+uint32_t boot_graph_waiting_for(const boot_graph_t *graph);
@@ -0,0 +1,108 @@
+#include "delta_patch.h"
+
+#include <string.h>
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+void delta_patch_init(delta_patch_t *patch, uint32_t base_size, delta_read_base_t read_base,
+                      delta_write_t write, void *ctx)
+{
+    memset(patch, 0, sizeof(*patch));
+    patch->state = DELTA_STATE_OP;
+    patch->base_size = base_size;
+    patch->read_base = read_base;
+    patch->write = write;
+    patch->ctx = ctx;
+}
+
+static delta_patch_err_t delta_patch_copy(delta_patch_t *patch, uint32_t offset, uint32_t length)
+{
+    if (offset > patch->base_size || length > patch->base_size - offset) {
+        return DELTA_PATCH_ERR_RANGE;
+    }
+    while (length > 0) {
+        size_t n = length < sizeof(patch->scratch) ? length : sizeof(patch->scratch);
+        if (patch->read_base(patch->ctx, offset, patch->scratch, n) != 0 ||
+            patch->write(patch->ctx, patch->scratch, n) != 0) {
+            return DELTA_PATCH_ERR_IO;
+        }
+        offset += n;
+        length -= n;
+        patch->written += n;
+    }
+    return DELTA_PATCH_OK;
+}
+
+delta_patch_err_t delta_patch_feed(delta_patch_t *patch, const uint8_t *data, size_t len)
+{
+    size_t pos = 0;
+
+    while (pos < len) {
+        switch (patch->state) {
+        case DELTA_STATE_OP:
+            patch->op = data[pos++];
+            patch->args_fill = 0;
+            if (patch->op == DELTA_OP_END) {
+                patch->state = DELTA_STATE_DONE;
+            } else if (patch->op == DELTA_OP_COPY) {
+                patch->args_needed = 8;
+                patch->state = DELTA_STATE_ARGS;
+            } else if (patch->op == DELTA_OP_INSERT) {
+                patch->args_needed = 4;
+                patch->state = DELTA_STATE_ARGS;
+            } else {
+                return DELTA_PATCH_ERR_FORMAT;
+            }
+            break;
+
+        case DELTA_STATE_ARGS: {
+            size_t n = patch->args_needed - patch->args_fill;
+            if (n > len - pos) {
+                n = len - pos;
+            }
+            memcpy(&patch->args[patch->args_fill], &data[pos], n);
+            patch->args_fill += n;
+            pos += n;
+            if (patch->args_fill < patch->args_needed) {
+                break;
+            }
+
+            if (patch->op == DELTA_OP_COPY) {
+                delta_patch_err_t err = delta_patch_copy(patch, get_u32(&patch->args[0]), get_u32(&patch->args[4]));
+                if (err != DELTA_PATCH_OK) {
+                    return err;
+                }
+                patch->state = DELTA_STATE_OP;
+            } else {
+                patch->literal_left = get_u32(&patch->args[0]);
+                patch->state = patch->literal_left ? DELTA_STATE_LITERAL : DELTA_STATE_OP;
+            }
+            break;
+        }
+
+        case DELTA_STATE_LITERAL: {
+            size_t n = patch->literal_left;
+            if (n > len - pos) {
+                n = len - pos;
+            }
+            if (patch->write(patch->ctx, &data[pos], n) != 0) {
+                return DELTA_PATCH_ERR_IO;
+            }
+            pos += n;
+            patch->literal_left -= n;
+            patch->written += n;
+            if (patch->literal_left == 0) {
+                patch->state = DELTA_STATE_OP;
+            }
+            break;
+        }
+
+        case DELTA_STATE_DONE:
+            return DELTA_PATCH_ERR_FORMAT;
+        }
+    }
+    return DELTA_PATCH_OK;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Streaming binary delta applier.
+ *
+ * The patch is a sequence of ops against a base image (the running
+ * firmware), all integers little-endian:
+ *
+ *   0x00                        end of patch
+ *   0x01 u32 offset u32 length  copy length bytes of the base from offset
+ *   0x02 u32 length <bytes>     insert length literal bytes
+ *
+ * Input may arrive in chunks of any size. Base reads go through a small
+ * scratch buffer, so RAM use does not depend on the image size.
+ */
+
+#define DELTA_PATCH_SCRATCH_SIZE    512
+
+#define DELTA_OP_END                0x00
+#define DELTA_OP_COPY               0x01
+#define DELTA_OP_INSERT             0x02
+
+typedef enum {
+    DELTA_PATCH_OK,
+    DELTA_PATCH_ERR_FORMAT,     // unknown op or data after the end op
+    DELTA_PATCH_ERR_RANGE,      // copy outside the base image
+    DELTA_PATCH_ERR_IO,         // a callback failed
+} delta_patch_err_t;
+
+/* Both callbacks return 0 on success */
+typedef int (*delta_read_base_t)(void *ctx, uint32_t offset, uint8_t *buf, size_t len);
+typedef int (*delta_write_t)(void *ctx, const uint8_t *data, size_t len);
+
+typedef enum {
+    DELTA_STATE_OP,
+    DELTA_STATE_ARGS,
+    DELTA_STATE_LITERAL,
+    DELTA_STATE_DONE,
+} delta_state_t;
+
+typedef struct {
+    delta_state_t state;
+    uint8_t op;
+    uint8_t args[8];
+    size_t args_fill;
+    size_t args_needed;
+    uint32_t literal_left;
+
+    uint32_t base_size;
+    uint32_t written;
+    delta_read_base_t read_base;
+    delta_write_t write;
+    void *ctx;
+    uint8_t scratch[DELTA_PATCH_SCRATCH_SIZE];
+} delta_patch_t;
+
+void delta_patch_init(delta_patch_t *patch, uint32_t base_size, delta_read_base_t read_base,
+                      delta_write_t write, void *ctx);
+
+delta_patch_err_t delta_patch_feed(delta_patch_t *patch, const uint8_t *data, size_t len);
+
+static inline bool delta_patch_done(const delta_patch_t *patch)
+{
+    return patch->state == DELTA_STATE_DONE;
+}
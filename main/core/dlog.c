@@ -0,0 +1,266 @@
+#include "dlog.h"
+
+#include <stdio.h>
+
+/*
+ * A slot at index i is free for position pos when seq == pos and holds the
+ * record of pos when seq == pos + 1; the consumer hands it to the next lap
+ * by setting seq = pos + count.
+ */
+void dlog_ring_init(dlog_ring_t *ring, dlog_slot_t *slots, uint32_t count)
+{
+    ring->slots = slots;
+    ring->mask = count - 1;
+    for (uint32_t i = 0; i < count; i++) {
+        atomic_init(&slots[i].seq, i);
+    }
+    atomic_init(&ring->head, 0);
+    ring->tail = 0;
+    atomic_init(&ring->dropped, 0);
+}
+
+bool dlog_ring_push(dlog_ring_t *ring, uint8_t level, uint8_t core, const char *tag, const char *fmt,
+                    int64_t timestamp_us, const uint32_t *words, size_t n_words)
+{
+    unsigned pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    dlog_slot_t *slot;
+
+    while (1) {
+        slot = &ring->slots[pos & ring->mask];
+        unsigned seq = atomic_load_explicit(&slot->seq, memory_order_acquire);
+        int32_t diff = (int32_t)(seq - pos);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&ring->head, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // The consumer has not released this slot from the previous lap
+            atomic_fetch_add_explicit(&ring->dropped, 1, memory_order_relaxed);
+            return false;
+        } else {
+            pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+        }
+    }
+
+    if (n_words > DLOG_MAX_WORDS) {
+        n_words = DLOG_MAX_WORDS;
+    }
+    slot->fmt = fmt;
+    slot->tag = tag;
+    slot->timestamp_us = timestamp_us;
+    slot->level = level;
+    slot->core = core;
+    slot->n_words = (uint8_t)n_words;
+    memcpy(slot->words, words, n_words * sizeof(words[0]));
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_release);
+    return true;
+}
+
+const dlog_slot_t *dlog_ring_peek(dlog_ring_t *ring)
+{
+    dlog_slot_t *slot = &ring->slots[ring->tail & ring->mask];
+    if (atomic_load_explicit(&slot->seq, memory_order_acquire) != ring->tail + 1) {
+        return NULL;
+    }
+    return slot;
+}
+
+void dlog_ring_release(dlog_ring_t *ring)
+{
+    dlog_slot_t *slot = &ring->slots[ring->tail & ring->mask];
+    atomic_store_explicit(&slot->seq, ring->tail + ring->mask + 1, memory_order_release);
+    ring->tail++;
+}
+
+/* Reads argument words in order, missing words read as zero */
+typedef struct {
+    const uint32_t *words;
+    size_t n_words;
+    size_t next;
+} dlog_args_t;
+
+static uint64_t dlog_take(dlog_args_t *args, size_t size)
+{
+    uint64_t value = 0;
+    size_t n = (size + 3) / 4;
+    for (size_t i = 0; i < n && args->next < args->n_words; i++) {
+        value |= (uint64_t)args->words[args->next++] << (32 * i);
+    }
+    return value;
+}
+
+static size_t dlog_append(char *out, size_t size, size_t len, const char *text, size_t text_len)
+{
+    while (text_len-- > 0 && len + 1 < size) {
+        out[len++] = *text++;
+    }
+    return len;
+}
+
+size_t dlog_format(char *out, size_t size, const char *fmt, const uint32_t *words, size_t n_words,
+                   dlog_str_fn resolve, void *ctx)
+{
+    dlog_args_t args = { words, n_words, 0 };
+    size_t len = 0;
+    char spec[24];
+    char item[64];
+
+    if (size == 0) {
+        return 0;
+    }
+
+    while (*fmt != '\0' && len + 1 < size) {
+        if (*fmt != '%') {
+            out[len++] = *fmt++;
+            continue;
+        }
+        if (fmt[1] == '%') {
+            out[len++] = '%';
+            fmt += 2;
+            continue;
+        }
+
+        // Copy the conversion into spec, turning * into the width/precision argument
+        size_t spec_len = 0;
+        spec[spec_len++] = *fmt++;
+        while (*fmt != '\0' && strchr("-+ #0123456789.*", *fmt) != NULL && spec_len < sizeof(spec) - 12) {
+            if (*fmt == '*') {
+                spec_len += snprintf(spec + spec_len, sizeof(spec) - spec_len, "%d", (int)dlog_take(&args, sizeof(int)));
+            } else {
+                spec[spec_len++] = *fmt;
+            }
+            fmt++;
+        }
+
+        size_t size_arg = sizeof(int);
+        unsigned short_bits = 0;    // h and hh arguments were promoted to int
+        while (*fmt != '\0' && strchr("hlLjzt", *fmt) != NULL) {
+            if (*fmt == 'h') {
+                short_bits = short_bits == 16 ? 8 : 16;
+            } else if (*fmt == 'l') {
+                size_arg = size_arg == sizeof(long) ? sizeof(long long) : sizeof(long);
+            } else if (*fmt == 'j' || *fmt == 'L') {
+                size_arg = 8;
+            } else {
+                size_arg = sizeof(size_t);
+            }
+            fmt++;
+        }
+        char conv = *fmt;
+        if (conv == '\0') {
+            break;
+        }
+        fmt++;
+
+        int n = 0;
+        switch (conv) {
+        case 'c':
+            spec[spec_len++] = 'c';
+            spec[spec_len] = '\0';
+            n = snprintf(item, sizeof(item), spec, (int)dlog_take(&args, sizeof(int)));
+            break;
+        case 'd':
+        case 'i':
+        case 'u':
+        case 'x':
+        case 'X':
+        case 'o': {
+            uint64_t value = dlog_take(&args, size_arg);
+            bool is_signed = conv == 'd' || conv == 'i';
+            unsigned bits = short_bits != 0 ? short_bits : 8 * (unsigned)size_arg;
+            if (bits < 64) {
+                uint64_t sign = 1ull << (bits - 1);
+                value &= (sign << 1) - 1;
+                if (is_signed && (value & sign)) {
+                    value |= ~((sign << 1) - 1);
+                }
+            }
+            spec[spec_len++] = 'l';
+            spec[spec_len++] = 'l';
+            spec[spec_len++] = conv;
+            spec[spec_len] = '\0';
+            n = snprintf(item, sizeof(item), spec, (long long)value);
+            break;
+        }
+        case 'f':
+        case 'F':
+        case 'e':
+        case 'E':
+        case 'g':
+        case 'G':
+        case 'a':
+        case 'A': {
+            uint64_t bits = dlog_take(&args, sizeof(double));
+            double value;
+            memcpy(&value, &bits, sizeof(value));
+            spec[spec_len++] = conv;
+            spec[spec_len] = '\0';
+            n = snprintf(item, sizeof(item), spec, value);
+            break;
+        }
+        case 's': {
+            uintptr_t addr = (uintptr_t)dlog_take(&args, sizeof(void *));
+            const char *text = resolve != NULL ? resolve(ctx, addr) : NULL;
+            spec[spec_len++] = 's';
+            spec[spec_len] = '\0';
+            if (text != NULL) {
+                n = snprintf(item, sizeof(item), spec, text);
+            } else {
+                n = snprintf(item, sizeof(item), "<str 0x%llx>", (unsigned long long)addr);
+            }
+            break;
+        }
+        case 'p':
+            n = snprintf(item, sizeof(item), "0x%llx", (unsigned long long)dlog_take(&args, sizeof(void *)));
+            break;
+        default:
+            // Unknown conversion, print it as written
+            n = snprintf(item, sizeof(item), "%.*s%c", (int)spec_len, spec, conv);
+            break;
+        }
+        if (n > 0) {
+            len = dlog_append(out, size, len, item, (size_t)n < sizeof(item) ? (size_t)n : sizeof(item) - 1);
+        }
+    }
+    out[len] = '\0';
+    return len;
+}
+
+static void dlog_put_u32(uint8_t *buf, uint32_t value)
+{
+    for (int i = 0; i < 4; i++) {
+        buf[i] = (uint8_t)(value >> (8 * i));
+    }
+}
+
+size_t dlog_encode_header(uint8_t *buf, uint16_t n_records, uint32_t anchor, uint32_t dropped)
+{
+    buf[0] = DLOG_BATCH_MAGIC;
+    buf[1] = DLOG_BATCH_VERSION;
+    buf[2] = (uint8_t)n_records;
+    buf[3] = (uint8_t)(n_records >> 8);
+    dlog_put_u32(buf + 4, anchor);
+    dlog_put_u32(buf + 8, dropped);
+    return DLOG_BATCH_HEADER_SIZE;
+}
+
+size_t dlog_encode_record(const dlog_slot_t *slot, uint8_t *buf, size_t len)
+{
+    size_t size = DLOG_RECORD_HEADER_SIZE + slot->n_words * 4;
+    if (len < size) {
+        return 0;
+    }
+    dlog_put_u32(buf, (uint32_t)(uintptr_t)slot->fmt);
+    dlog_put_u32(buf + 4, (uint32_t)(uintptr_t)slot->tag);
+    dlog_put_u32(buf + 8, (uint32_t)slot->timestamp_us);
+    dlog_put_u32(buf + 12, (uint32_t)((uint64_t)slot->timestamp_us >> 32));
+    buf[16] = slot->level;
+    buf[17] = slot->core;
+    buf[18] = slot->n_words;
+    buf[19] = 0;
+    for (uint8_t i = 0; i < slot->n_words; i++) {
+        dlog_put_u32(buf + DLOG_RECORD_HEADER_SIZE + 4 * i, slot->words[i]);
+    }
+    return size;
+}
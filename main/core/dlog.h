@@ -0,0 +1,142 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Deferred binary logging.
+ *
+ * A log call stores the address of its format string, the address of its
+ * tag, a timestamp and the raw argument words in a ring slot; formatting
+ * happens later on a low priority task, or on the host from the ELF image.
+ * Producers claim slots with a CAS on the head (bounded MPMC ring with a
+ * sequence number per slot), so tasks and ISRs on any core can log without
+ * a lock. A full ring drops the record and counts it. Pure C.
+ *
+ * Arguments are packed by size after the default promotions: 4 byte values
+ * take one word, 8 byte values (long long, double) two. %s arguments are
+ * kept as pointers and only printed when they point into the firmware
+ * image, use them for constants (tags, topics), never for buffers.
+ *
+ * MQTT batch layout, all fields little-endian:
+ *
+ *   u8  magic               'L'
+ *   u8  version             DLOG_BATCH_VERSION
+ *   u16 n_records
+ *   u32 anchor              run time address of dlog_anchor, gives the load bias
+ *   u32 dropped             records lost to a full ring since boot
+ *   n_records x {
+ *       u32 fmt, u32 tag    string addresses in the ELF
+ *       i64 timestamp_us
+ *       u8 level, u8 core, u8 n_words, u8 reserved
+ *       n_words x u32
+ *   }
+ *
+ * tools/dlog_decode.py rebuilds the text from the batch and the ELF.
+ */
+
+#define DLOG_MAX_WORDS          8
+#define DLOG_BATCH_MAGIC        'L'
+#define DLOG_BATCH_VERSION      1
+#define DLOG_BATCH_HEADER_SIZE  12
+#define DLOG_RECORD_HEADER_SIZE 20
+#define DLOG_RECORD_MAX_SIZE    (DLOG_RECORD_HEADER_SIZE + DLOG_MAX_WORDS * 4)
+
+typedef enum {
+    DLOG_LEVEL_ERROR = 1,   // same values as esp_log_level_t
+    DLOG_LEVEL_WARN,
+    DLOG_LEVEL_INFO,
+    DLOG_LEVEL_DEBUG,
+} dlog_level_t;
+
+typedef struct {
+    atomic_uint seq;        // position the slot is ready for, see dlog.c
+    const char *fmt;
+    const char *tag;
+    int64_t timestamp_us;
+    uint8_t level;
+    uint8_t core;
+    uint8_t n_words;
+    uint32_t words[DLOG_MAX_WORDS];
+} dlog_slot_t;
+
+typedef struct {
+    dlog_slot_t *slots;
+    uint32_t mask;
+    atomic_uint head;       // next position producers claim
+    uint32_t tail;          // next position the consumer reads
+    atomic_uint dropped;
+} dlog_ring_t;
+
+/* Returns a printable string for the pointer argument of a %s, or NULL */
+typedef const char *(*dlog_str_fn)(void *ctx, uintptr_t addr);
+
+/* count must be a power of two */
+void dlog_ring_init(dlog_ring_t *ring, dlog_slot_t *slots, uint32_t count);
+
+/* Any task or ISR, false if the ring was full */
+bool dlog_ring_push(dlog_ring_t *ring, uint8_t level, uint8_t core, const char *tag, const char *fmt,
+                    int64_t timestamp_us, const uint32_t *words, size_t n_words);
+
+/* Single consumer: oldest complete record or NULL, valid until dlog_ring_release */
+const dlog_slot_t *dlog_ring_peek(dlog_ring_t *ring);
+void dlog_ring_release(dlog_ring_t *ring);
+
+/* Render a record's message, returns the length written (truncated to size - 1) */
+size_t dlog_format(char *out, size_t size, const char *fmt, const uint32_t *words, size_t n_words,
+                   dlog_str_fn resolve, void *ctx);
+
+size_t dlog_encode_header(uint8_t *buf, uint16_t n_records, uint32_t anchor, uint32_t dropped);
+
+/* Returns the encoded length, 0 if buf is too small */
+size_t dlog_encode_record(const dlog_slot_t *slot, uint8_t *buf, size_t len);
+
+/*
+ * Argument packing for the log macros: DLOG_PACK(words, n, ...) copies up to
+ * eight arguments into words and sets n to the number of words used. The
+ * word count is checked at compile time.
+ */
+#define DLOG_ARG_WORDS(a)       ((sizeof((a) + 0) + 3) / 4)
+#define DLOG_PACK_ONE(w, n, a)  do { __typeof__((a) + 0) _dlog_v = (a); \
+                                     memcpy(&(w)[n], &_dlog_v, sizeof(_dlog_v)); \
+                                     (n) += DLOG_ARG_WORDS(a); } while (0)
+
+#define DLOG_NARGS(...)         DLOG_NARGS_(_, ##__VA_ARGS__, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define DLOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, n, ...) n
+#define DLOG_CAT(a, b)          DLOG_CAT_(a, b)
+#define DLOG_CAT_(a, b)         a##b
+
+#define DLOG_WORDS_0()          0
+#define DLOG_WORDS_1(a)         DLOG_ARG_WORDS(a)
+#define DLOG_WORDS_2(a, ...)    (DLOG_ARG_WORDS(a) + DLOG_WORDS_1(__VA_ARGS__))
+#define DLOG_WORDS_3(a, ...)    (DLOG_ARG_WORDS(a) + DLOG_WORDS_2(__VA_ARGS__))
+#define DLOG_WORDS_4(a, ...)    (DLOG_ARG_WORDS(a) + DLOG_WORDS_3(__VA_ARGS__))
+#define DLOG_WORDS_5(a, ...)    (DLOG_ARG_WORDS(a) + DLOG_WORDS_4(__VA_ARGS__))
+#define DLOG_WORDS_6(a, ...)    (DLOG_ARG_WORDS(a) + DLOG_WORDS_5(__VA_ARGS__))
+#define DLOG_WORDS_7(a, ...)    (DLOG_ARG_WORDS(a) + DLOG_WORDS_6(__VA_ARGS__))
+#define DLOG_WORDS_8(a, ...)    (DLOG_ARG_WORDS(a) + DLOG_WORDS_7(__VA_ARGS__))
+
+#define DLOG_PACK_0(w, n)
+#define DLOG_PACK_1(w, n, a)        DLOG_PACK_ONE(w, n, a)
+#define DLOG_PACK_2(w, n, a, ...)   DLOG_PACK_ONE(w, n, a); DLOG_PACK_1(w, n, __VA_ARGS__)
+#define DLOG_PACK_3(w, n, a, ...)   DLOG_PACK_ONE(w, n, a); DLOG_PACK_2(w, n, __VA_ARGS__)
+#define DLOG_PACK_4(w, n, a, ...)   DLOG_PACK_ONE(w, n, a); DLOG_PACK_3(w, n, __VA_ARGS__)
+#define DLOG_PACK_5(w, n, a, ...)   DLOG_PACK_ONE(w, n, a); DLOG_PACK_4(w, n, __VA_ARGS__)
+#define DLOG_PACK_6(w, n, a, ...)   DLOG_PACK_ONE(w, n, a); DLOG_PACK_5(w, n, __VA_ARGS__)
+#define DLOG_PACK_7(w, n, a, ...)   DLOG_PACK_ONE(w, n, a); DLOG_PACK_6(w, n, __VA_ARGS__)
+#define DLOG_PACK_8(w, n, a, ...)   DLOG_PACK_ONE(w, n, a); DLOG_PACK_7(w, n, __VA_ARGS__)
+
+#define DLOG_PACK(w, n, ...) do { \
+        _Static_assert(DLOG_CAT(DLOG_WORDS_, DLOG_NARGS(__VA_ARGS__))(__VA_ARGS__) <= DLOG_MAX_WORDS, \
+                       "too many log argument words"); \
+        DLOG_CAT(DLOG_PACK_, DLOG_NARGS(__VA_ARGS__))(w, n, ##__VA_ARGS__); \
+    } while (0)
+
+/* Never called, lets the compiler check format strings against their arguments */
+static inline __attribute__((format(printf, 1, 2))) void dlog_check_format(const char *fmt, ...)
+{
+    (void)fmt;
+}
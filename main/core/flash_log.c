@@ -0,0 +1,277 @@
+#include "flash_log.h"
+
+#include <string.h>
+
+#define SECTOR_MAGIC        0x474f4c46  // "FLOG"
+#define SECTOR_HEADER_SIZE  12
+#define RECORD_HEADER_SIZE  4
+#define STATE_PENDING       0xff
+#define STATE_DRAINED       0x00
+#define LEN_ERASED          0xff        // length byte of unwritten flash, so records stay below it
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t seq_check;     // ~seq, an interrupted erase can set bits of seq but never clear them here
+} sector_header_t;
+
+static uint16_t crc16(uint16_t crc, const uint8_t *data, size_t len)
+{
+    while (len--) {
+        crc ^= (uint16_t)*data++ << 8;
+        for (int i = 0; i < 8; i++) {
+            crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+        }
+    }
+    return crc;
+}
+
+static uint32_t sector_addr(const flash_log_t *log, uint32_t sector)
+{
+    return sector * log->ops.sector_size;
+}
+
+static bool read_sector_header(flash_log_t *log, uint32_t sector, uint32_t *seq)
+{
+    sector_header_t header;
+    if (log->ops.read(log->ops.ctx, sector_addr(log, sector), &header, sizeof(header)) != 0) {
+        return false;
+    }
+    *seq = header.seq;
+    return header.magic == SECTOR_MAGIC && header.seq_check == ~header.seq;
+}
+
+/*
+ * The sequence number goes in before the magic, so a header cut by a reset
+ * never has a valid magic with a half written sequence number. Such a sector
+ * would look newest and hide the whole log on the next mount.
+ */
+static bool start_sector(flash_log_t *log, uint32_t sector, uint32_t seq)
+{
+    sector_header_t header = { .magic = SECTOR_MAGIC, .seq = seq, .seq_check = ~seq };
+    uint32_t addr = sector_addr(log, sector);
+    _Static_assert(sizeof(header) == SECTOR_HEADER_SIZE, "sector header layout");
+    if (log->ops.erase_sector(log->ops.ctx, addr) != 0 ||
+        log->ops.write(log->ops.ctx, addr + offsetof(sector_header_t, seq), &header.seq, 2 * sizeof(uint32_t)) != 0 ||
+        log->ops.write(log->ops.ctx, addr + offsetof(sector_header_t, magic), &header.magic, sizeof(header.magic)) != 0) {
+        return false;
+    }
+    log->head_sector = sector;
+    log->head_offset = SECTOR_HEADER_SIZE;
+    log->head_seq = seq;
+    return true;
+}
+
+/*
+ * Read the record at offset. Returns its total size, 0 at the end of the
+ * sector's valid records. buf may be NULL to only validate it.
+ */
+static size_t read_record(flash_log_t *log, uint32_t sector, uint32_t offset, uint8_t *state,
+                          uint8_t *buf, size_t max)
+{
+    uint8_t header[RECORD_HEADER_SIZE];
+    uint8_t payload[FLASH_LOG_MAX_RECORD];
+
+    if (offset + RECORD_HEADER_SIZE > log->ops.sector_size ||
+        log->ops.read(log->ops.ctx, sector_addr(log, sector) + offset, header, sizeof(header)) != 0) {
+        return 0;
+    }
+    size_t len = header[0];
+    if (len == LEN_ERASED || offset + RECORD_HEADER_SIZE + len > log->ops.sector_size) {
+        return 0;
+    }
+    if (log->ops.read(log->ops.ctx, sector_addr(log, sector) + offset + RECORD_HEADER_SIZE, payload, len) != 0) {
+        return 0;
+    }
+    uint16_t crc = crc16(crc16(0xffff, header, 1), payload, len);
+    if (crc != (uint16_t)(header[2] | header[3] << 8)) {
+        return 0;   // torn write
+    }
+
+    *state = header[1];
+    if (buf != NULL) {
+        memcpy(buf, payload, len < max ? len : max);
+    }
+    return RECORD_HEADER_SIZE + len;
+}
+
+/* Count pending records of a sector from offset, used on mount and before dropping a sector */
+static uint32_t count_pending(flash_log_t *log, uint32_t sector, uint32_t offset)
+{
+    uint32_t count = 0;
+    uint8_t state;
+    size_t size;
+    while ((size = read_record(log, sector, offset, &state, NULL, 0)) > 0) {
+        count += state == STATE_PENDING;
+        offset += size;
+    }
+    return count;
+}
+
+/* Move the read position to the next pending record, stopping at the append position */
+static void skip_drained(flash_log_t *log)
+{
+    while (1) {
+        if (log->read_sector == log->head_sector && log->read_offset >= log->head_offset) {
+            return;
+        }
+        uint8_t state;
+        size_t size = read_record(log, log->read_sector, log->read_offset, &state, NULL, 0);
+        if (size == 0) {
+            if (log->read_sector == log->head_sector) {
+                return;
+            }
+            log->read_sector = (log->read_sector + 1) % log->n_sectors;
+            log->read_offset = SECTOR_HEADER_SIZE;
+            continue;
+        }
+        if (state == STATE_PENDING) {
+            return;
+        }
+        log->read_offset += size;
+    }
+}
+
+bool flash_log_mount(flash_log_t *log, const flash_ops_t *ops)
+{
+    memset(log, 0, sizeof(*log));
+    log->ops = *ops;
+    log->n_sectors = ops->size / ops->sector_size;
+    if (log->n_sectors < 2) {
+        return false;
+    }
+
+    // Newest sector has the highest sequence number, the oldest follows the newest run backwards
+    bool found = false;
+    uint32_t newest = 0;
+    uint32_t newest_seq = 0;
+    for (uint32_t i = 0; i < log->n_sectors; i++) {
+        uint32_t seq;
+        if (read_sector_header(log, i, &seq) && (!found || seq > newest_seq)) {
+            found = true;
+            newest = i;
+            newest_seq = seq;
+        }
+    }
+    if (!found) {
+        return start_sector(log, 0, 1);
+    }
+
+    uint32_t oldest = newest;
+    for (uint32_t i = 1; i < log->n_sectors; i++) {
+        uint32_t sector = (newest + log->n_sectors - i) % log->n_sectors;
+        uint32_t seq;
+        if (!read_sector_header(log, sector, &seq) || seq != newest_seq - i) {
+            break;
+        }
+        oldest = sector;
+    }
+
+    log->head_sector = newest;
+    log->head_seq = newest_seq;
+    log->head_offset = SECTOR_HEADER_SIZE;
+    uint8_t state;
+    size_t size;
+    while ((size = read_record(log, newest, log->head_offset, &state, NULL, 0)) > 0) {
+        log->head_offset += size;
+    }
+    // Anything after the last valid record may be half written, never append behind it
+    uint8_t len;
+    if (log->head_offset + 1 <= log->ops.sector_size &&
+        (log->ops.read(log->ops.ctx, sector_addr(log, newest) + log->head_offset, &len, 1) != 0 || len != LEN_ERASED)) {
+        log->head_offset = log->ops.sector_size;
+    }
+
+    for (uint32_t sector = oldest;; sector = (sector + 1) % log->n_sectors) {
+        log->pending += count_pending(log, sector, SECTOR_HEADER_SIZE);
+        if (sector == newest) {
+            break;
+        }
+    }
+    log->read_sector = oldest;
+    log->read_offset = SECTOR_HEADER_SIZE;
+    skip_drained(log);
+    return true;
+}
+
+bool flash_log_append(flash_log_t *log, const void *data, size_t len)
+{
+    uint8_t record[RECORD_HEADER_SIZE + FLASH_LOG_MAX_RECORD];
+
+    if (len >= LEN_ERASED || SECTOR_HEADER_SIZE + RECORD_HEADER_SIZE + len > log->ops.sector_size) {
+        return false;
+    }
+
+    if (log->head_offset + RECORD_HEADER_SIZE + len > log->ops.sector_size) {
+        uint32_t next = (log->head_sector + 1) % log->n_sectors;
+        if (next == log->read_sector && log->pending > 0) {
+            // Ring is full, the oldest sector goes
+            uint32_t lost = count_pending(log, next, log->read_offset);
+            log->dropped += lost;
+            log->pending -= lost;
+            log->read_sector = (next + 1) % log->n_sectors;
+            log->read_offset = SECTOR_HEADER_SIZE;
+        }
+        if (!start_sector(log, next, log->head_seq + 1)) {
+            return false;
+        }
+        if (log->pending == 0) {
+            log->read_sector = log->head_sector;
+            log->read_offset = log->head_offset;
+        }
+    }
+
+    record[0] = len;
+    record[1] = STATE_PENDING;
+    uint16_t crc = crc16(crc16(0xffff, record, 1), data, len);
+    record[2] = crc & 0xff;
+    record[3] = crc >> 8;
+    memcpy(&record[RECORD_HEADER_SIZE], data, len);
+
+    uint32_t offset = log->head_offset;
+    log->head_offset += RECORD_HEADER_SIZE + len;
+    if (log->ops.write(log->ops.ctx, sector_addr(log, log->head_sector) + offset, record, RECORD_HEADER_SIZE + len) != 0) {
+        log->head_offset = log->ops.sector_size;    // leave the damaged tail alone
+        return false;
+    }
+    log->pending++;
+    if (log->pending == 1) {
+        log->read_sector = log->head_sector;
+        log->read_offset = offset;
+    }
+    return true;
+}
+
+int flash_log_peek(flash_log_t *log, void *buf, size_t max)
+{
+    if (log->pending == 0) {
+        return -1;
+    }
+    skip_drained(log);
+
+    uint8_t state;
+    size_t size = read_record(log, log->read_sector, log->read_offset, &state, buf, max);
+    if (size == 0) {
+        log->pending = 0;   // pending count disagrees with flash, resync as drained
+        return -1;
+    }
+    return size - RECORD_HEADER_SIZE;
+}
+
+bool flash_log_consume(flash_log_t *log)
+{
+    uint8_t state;
+    size_t size = read_record(log, log->read_sector, log->read_offset, &state, NULL, 0);
+    if (log->pending == 0 || size == 0) {
+        return false;
+    }
+
+    uint8_t drained = STATE_DRAINED;
+    if (log->ops.write(log->ops.ctx, sector_addr(log, log->read_sector) + log->read_offset + 1, &drained, 1) != 0) {
+        return false;
+    }
+    log->read_offset += size;
+    log->pending--;
+    skip_drained(log);
+    return true;
+}
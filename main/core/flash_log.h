@@ -0,0 +1,66 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Append-only record log on raw NOR flash.
+ *
+ * The region is used as a ring of sectors. Each sector starts with a header
+ * holding a sequence number, so the newest and oldest sectors are found by a
+ * scan on mount and erases rotate through the whole region. The header is
+ * written magic last and carries the sequence number twice, plain and
+ * inverted, so neither a header cut by a reset nor a sector whose erase was
+ * cut can pass as the newest one. Records are
+ *
+ *   u8 len, u8 state, u16 crc16(len, payload), payload[len]
+ *
+ * and never span sectors. A record is drained by clearing its state byte in
+ * place (1 -> 0 bits only, no erase). A record torn by a reset fails its CRC
+ * and ends its sector, the next append starts a fresh one. When the ring is
+ * full the oldest sector is erased and its undrained records are counted as
+ * dropped. RAM use is this struct plus one record buffer.
+ *
+ * Flash access goes through callbacks, so the log also runs on a file or RAM
+ * image off target. The caller serialises calls.
+ */
+
+#define FLASH_LOG_MAX_RECORD    255
+
+typedef struct {
+    int (*read)(void *ctx, uint32_t addr, void *buf, size_t len);
+    int (*write)(void *ctx, uint32_t addr, const void *buf, size_t len);
+    int (*erase_sector)(void *ctx, uint32_t addr);
+    uint32_t size;              // multiple of sector_size, at least two sectors
+    uint32_t sector_size;
+    void *ctx;
+} flash_ops_t;
+
+typedef struct {
+    flash_ops_t ops;
+    uint32_t n_sectors;
+    uint32_t head_sector;       // sector appended to
+    uint32_t head_offset;
+    uint32_t head_seq;
+    uint32_t read_sector;       // next record to drain
+    uint32_t read_offset;
+    uint32_t pending;           // records appended and not drained
+    uint32_t dropped;           // records erased before they were drained
+} flash_log_t;
+
+/* Scan the region and recover the log, formats it if nothing valid is found */
+bool flash_log_mount(flash_log_t *log, const flash_ops_t *ops);
+
+bool flash_log_append(flash_log_t *log, const void *data, size_t len);
+
+/* Copy the oldest pending record, returns its length or -1 if the log is drained */
+int flash_log_peek(flash_log_t *log, void *buf, size_t max);
+
+/* Mark the record returned by flash_log_peek as drained */
+bool flash_log_consume(flash_log_t *log);
+
+static inline uint32_t flash_log_pending(const flash_log_t *log)
+{
+    return log->pending;
+}
@@ -0,0 +1,63 @@
+#include "latency_hist.h"
+
+static unsigned latency_bucket(uint64_t us)
+{
+    unsigned bucket = 0;
+    while (us > 0 && bucket < LATENCY_HIST_BUCKETS - 1) {
+        us >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+void latency_hist_init(latency_hist_t *hist)
+{
+    for (unsigned i = 0; i < LATENCY_HIST_BUCKETS; i++) {
+        atomic_init(&hist->buckets[i], 0);
+    }
+    atomic_init(&hist->max_us, 0);
+}
+
+void latency_hist_record(latency_hist_t *hist, int64_t latency_us)
+{
+    uint64_t us = latency_us > 0 ? (uint64_t)latency_us : 0;
+    uint32_t clamped = us > UINT32_MAX ? UINT32_MAX : (uint32_t)us;
+
+    atomic_fetch_add_explicit(&hist->buckets[latency_bucket(us)], 1, memory_order_relaxed);
+    unsigned max = atomic_load_explicit(&hist->max_us, memory_order_relaxed);
+    while (clamped > max &&
+           !atomic_compare_exchange_weak_explicit(&hist->max_us, &max, clamped, memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+void latency_hist_take(latency_hist_t *hist, latency_snapshot_t *snapshot)
+{
+    snapshot->count = 0;
+    for (unsigned i = 0; i < LATENCY_HIST_BUCKETS; i++) {
+        snapshot->buckets[i] = atomic_exchange_explicit(&hist->buckets[i], 0, memory_order_relaxed);
+        snapshot->count += snapshot->buckets[i];
+    }
+    snapshot->max_us = atomic_exchange_explicit(&hist->max_us, 0, memory_order_relaxed);
+}
+
+uint32_t latency_snapshot_percentile(const latency_snapshot_t *snapshot, uint32_t pct)
+{
+    if (snapshot->count == 0) {
+        return 0;
+    }
+    // Rank of the percentile sample, 1-based and rounded up
+    uint64_t rank = ((uint64_t)snapshot->count * pct + 99) / 100;
+    if (rank == 0) {
+        rank = 1;
+    }
+
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < LATENCY_HIST_BUCKETS - 1; i++) {
+        seen += snapshot->buckets[i];
+        if (seen >= rank) {
+            uint32_t upper = i == 0 ? 1 : 1u << i;
+            return upper < snapshot->max_us ? upper : snapshot->max_us;
+        }
+    }
+    return snapshot->max_us;
+}
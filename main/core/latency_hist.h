@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/*
+ * Fixed-bucket latency histogram.
+ *
+ * Bucket 0 counts values below 1 us, bucket i >= 1 counts [2^(i-1), 2^i) us,
+ * the last bucket everything above. Recording is a few relaxed atomic adds,
+ * so one task can record while another takes a snapshot. Percentiles are
+ * reported as the upper edge of their bucket, at most 2x off. Pure C.
+ */
+
+#define LATENCY_HIST_BUCKETS    24      // last regular bucket ends at 2^22 us, about 4 s
+
+typedef struct {
+    atomic_uint buckets[LATENCY_HIST_BUCKETS];
+    atomic_uint max_us;
+} latency_hist_t;
+
+typedef struct {
+    uint32_t buckets[LATENCY_HIST_BUCKETS];
+    uint32_t count;
+    uint32_t max_us;
+} latency_snapshot_t;
+
+void latency_hist_init(latency_hist_t *hist);
+
+void latency_hist_record(latency_hist_t *hist, int64_t latency_us);
+
+/* Copy the counts and start a new interval */
+void latency_hist_take(latency_hist_t *hist, latency_snapshot_t *snapshot);
+
+/* Upper bound of the pct percentile (0-100) in us, 0 for an empty snapshot */
+uint32_t latency_snapshot_percentile(const latency_snapshot_t *snapshot, uint32_t pct);
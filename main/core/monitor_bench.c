@@ -0,0 +1,37 @@
+#include "monitor_bench.h"
+
+void monitor_bench_init(monitor_bench_t *bench, uint16_t *samples, uint32_t frame_sets)
+{
+    bench->samples = samples;
+    bench->frame_sets = frame_sets;
+}
+
+int64_t monitor_bench_run(monitor_bench_t *bench, const ring_detector_config_t *cfg, uint16_t period_ms,
+                          uint8_t n_channels, uint32_t n_sets, monitor_bench_clock_fn now, size_t *n_events)
+{
+    uint32_t noise = 1;
+    int64_t elapsed = 0;
+
+    ring_detector_init(&bench->detector, cfg, n_channels);
+    telemetry_batch_init(&bench->telemetry, period_ms, (uint8_t)((1u << n_channels) - 1));
+    telemetry_batch_begin(&bench->telemetry, 0);
+    *n_events = 0;
+
+    for (uint32_t set = 0; set < n_sets; set += bench->frame_sets) {
+        uint32_t frame = n_sets - set < bench->frame_sets ? n_sets - set : bench->frame_sets;
+        for (uint32_t i = 0; i < frame; i++) {
+            uint32_t ms = (uint32_t)((uint64_t)(set + i) * cfg->sample_period_us / 1000);
+            for (uint8_t c = 0; c < n_channels; c++) {
+                noise = noise * 1103515245 + 12345;
+                bench->samples[i * n_channels + c] = ((ms + c * 600) % 5000 < 1500 ? 60 : 2) + ((noise >> 16) & 3);
+            }
+        }
+        int64_t start = now();
+        telemetry_batch_add_samples(&bench->telemetry, bench->samples, frame);
+        *n_events += ring_detector_process(&bench->detector, bench->samples, frame,
+                                           (int64_t)set * cfg->sample_period_us, bench->events,
+                                           4 * n_channels);
+        elapsed += now() - start;
+    }
+    return elapsed;
+}
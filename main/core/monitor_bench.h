@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ring_detector.h"
+#include "telemetry_batch.h"
+
+/*
+ * Benchmark of the monitor loop: ring detection plus telemetry aggregation
+ * over synthetic frames. Each channel rings for 1.5 s out of 5 s, staggered,
+ * with some noise, so both the idle path and the edges are exercised. Only
+ * the processing is timed, not the generation of the frames.
+ *
+ * gpio_monitor_task runs it on the target (INTERCOM_MONITOR_BENCHMARK),
+ * test_ring_detector on the host. Pure C, the caller supplies the clock.
+ */
+
+/* Monotonic clock, any unit: esp_timer_get_time on the target, test_now_ns on the host */
+typedef int64_t (*monitor_bench_clock_fn)(void);
+
+typedef struct {
+    ring_detector_t detector;
+    telemetry_batch_t telemetry;
+    ring_event_t events[4 * RING_DETECTOR_MAX_CHANNELS];
+    uint16_t *samples;
+    uint32_t frame_sets;
+} monitor_bench_t;
+
+/* samples must hold frame_sets * RING_DETECTOR_MAX_CHANNELS values */
+void monitor_bench_init(monitor_bench_t *bench, uint16_t *samples, uint32_t frame_sets);
+
+/*
+ * Feed n_sets sample sets of n_channels channels, a frame at a time, at the
+ * rate of cfg->sample_period_us. Returns the clock ticks spent processing,
+ * *n_events gets the number of ring events detected.
+ */
+int64_t monitor_bench_run(monitor_bench_t *bench, const ring_detector_config_t *cfg, uint16_t period_ms,
+                          uint8_t n_channels, uint32_t n_sets, monitor_bench_clock_fn now, size_t *n_events);
@@ -0,0 +1,89 @@
+#include "mqtt_payload.h"
+
+#include <string.h>
+#include <strings.h>
+
+static bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static void trim(const char **data, size_t *len)
+{
+    while (*len > 0 && is_space(**data)) {
+        (*data)++;
+        (*len)--;
+    }
+    while (*len > 0 && is_space((*data)[*len - 1])) {
+        (*len)--;
+    }
+}
+
+static bool equals(const char *data, size_t len, const char *word)
+{
+    return strlen(word) == len && strncasecmp(data, word, len) == 0;
+}
+
+bool mqtt_payload_bool(const char *data, size_t len, bool *out)
+{
+    trim(&data, &len);
+    if (equals(data, len, "true") || equals(data, len, "on") || equals(data, len, "1")) {
+        *out = true;
+        return true;
+    }
+    if (equals(data, len, "false") || equals(data, len, "off") || equals(data, len, "0")) {
+        *out = false;
+        return true;
+    }
+    return false;
+}
+
+bool mqtt_payload_uint(const char *data, size_t len, uint32_t *out)
+{
+    uint64_t value = 0;
+
+    trim(&data, &len);
+    if (len == 0) {
+        return false;
+    }
+    for (size_t i = 0; i < len; i++) {
+        if (data[i] < '0' || data[i] > '9') {
+            return false;
+        }
+        value = value * 10 + (data[i] - '0');
+        if (value > UINT32_MAX) {
+            return false;
+        }
+    }
+    *out = (uint32_t)value;
+    return true;
+}
+
+static bool is_separator(char c)
+{
+    return c == '&' || c == ',' || c == ';' || is_space(c);
+}
+
+bool mqtt_payload_field(const char *data, size_t len, const char *key, const char **value, size_t *value_len)
+{
+    size_t key_len = strlen(key);
+    size_t pos = 0;
+
+    while (pos < len) {
+        while (pos < len && is_separator(data[pos])) {
+            pos++;
+        }
+        size_t start = pos;
+        while (pos < len && !is_separator(data[pos])) {
+            pos++;
+        }
+
+        // data[start, pos) is one "key=value" pair
+        if (pos - start > key_len && memcmp(&data[start], key, key_len) == 0 && data[start + key_len] == '=') {
+            *value = &data[start + key_len + 1];
+            *value_len = pos - start - key_len - 1;
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Typed parsing of MQTT payloads, which are not NUL-terminated.
+ *
+ * Values must match completely (surrounding whitespace is ignored), so
+ * "10abc" is not a number and "truex" is not a boolean. Pure C.
+ */
+
+/* true/false, on/off, 1/0, case-insensitive */
+bool mqtt_payload_bool(const char *data, size_t len, bool *out);
+
+/* Decimal unsigned integer that fits in 32 bits */
+bool mqtt_payload_uint(const char *data, size_t len, uint32_t *out);
+
+/*
+ * Find key in "key=value" pairs separated by '&', ',', ';' or whitespace.
+ * value points into data and is not NUL-terminated.
+ */
+bool mqtt_payload_field(const char *data, size_t len, const char *key, const char **value, size_t *value_len);
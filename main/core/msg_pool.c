@@ -0,0 +1,57 @@
+#include "msg_pool.h"
+
+void msg_pool_init(msg_pool_t *pool, void *storage, size_t slot_size, uint32_t count)
+{
+    pool->storage = storage;
+    pool->slot_size = slot_size;
+    pool->count = count > MSG_POOL_MAX_SLOTS ? MSG_POOL_MAX_SLOTS : count;
+    atomic_init(&pool->used, 0);
+    atomic_init(&pool->in_use, 0);
+    atomic_init(&pool->high_water, 0);
+    atomic_init(&pool->allocated, 0);
+    atomic_init(&pool->drops, 0);
+}
+
+void *msg_pool_alloc(msg_pool_t *pool)
+{
+    unsigned all = pool->count == 32 ? UINT32_MAX : (1u << pool->count) - 1;
+    unsigned used = atomic_load_explicit(&pool->used, memory_order_relaxed);
+
+    while ((used & all) != all) {
+        unsigned bit = __builtin_ctz(~used);
+        if (atomic_compare_exchange_weak_explicit(&pool->used, &used, used | (1u << bit),
+                                                  memory_order_acquire, memory_order_relaxed)) {
+            unsigned in_use = atomic_fetch_add_explicit(&pool->in_use, 1, memory_order_relaxed) + 1;
+            unsigned high = atomic_load_explicit(&pool->high_water, memory_order_relaxed);
+            while (in_use > high &&
+                   !atomic_compare_exchange_weak_explicit(&pool->high_water, &high, in_use,
+                                                          memory_order_relaxed, memory_order_relaxed)) {
+            }
+            atomic_fetch_add_explicit(&pool->allocated, 1, memory_order_relaxed);
+            return pool->storage + bit * pool->slot_size;
+        }
+    }
+
+    atomic_fetch_add_explicit(&pool->drops, 1, memory_order_relaxed);
+    return NULL;
+}
+
+void msg_pool_free(msg_pool_t *pool, void *slot)
+{
+    unsigned bit = ((uint8_t *)slot - pool->storage) / pool->slot_size;
+    atomic_fetch_sub_explicit(&pool->in_use, 1, memory_order_relaxed);
+    atomic_fetch_and_explicit(&pool->used, ~(1u << bit), memory_order_release);
+}
+
+void msg_pool_count_drop(msg_pool_t *pool)
+{
+    atomic_fetch_add_explicit(&pool->drops, 1, memory_order_relaxed);
+}
+
+void msg_pool_stats(msg_pool_t *pool, msg_pool_stats_t *stats)
+{
+    stats->in_use = atomic_load_explicit(&pool->in_use, memory_order_relaxed);
+    stats->high_water = atomic_load_explicit(&pool->high_water, memory_order_relaxed);
+    stats->allocated = atomic_load_explicit(&pool->allocated, memory_order_relaxed);
+    stats->drops = atomic_load_explicit(&pool->drops, memory_order_relaxed);
+}
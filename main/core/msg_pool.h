@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Fixed-size message slot pool.
+ *
+ * Slots live in caller supplied storage and are claimed from an atomic
+ * bitmap, so a producer on one task and a consumer on another can allocate
+ * and free without a lock or heap use. When every slot is taken the message
+ * is dropped and counted. Tracks the in-use high-water mark, which equals the
+ * deepest backlog of a queue that carries the slots. Pure C.
+ */
+
+#define MSG_POOL_MAX_SLOTS  32
+
+typedef struct {
+    uint32_t in_use;
+    uint32_t high_water;
+    uint32_t allocated;     // successful allocations since init
+    uint32_t drops;         // allocations that found no free slot
+} msg_pool_stats_t;
+
+typedef struct {
+    uint8_t *storage;
+    size_t slot_size;
+    uint32_t count;
+    atomic_uint used;       // bit per slot
+    atomic_uint in_use;
+    atomic_uint high_water;
+    atomic_uint allocated;
+    atomic_uint drops;
+} msg_pool_t;
+
+/* storage holds count slots of slot_size bytes, count <= MSG_POOL_MAX_SLOTS */
+void msg_pool_init(msg_pool_t *pool, void *storage, size_t slot_size, uint32_t count);
+
+/* NULL if the pool is exhausted */
+void *msg_pool_alloc(msg_pool_t *pool);
+
+void msg_pool_free(msg_pool_t *pool, void *slot);
+
+/* Count a message dropped for another reason (too large, queue full) */
+void msg_pool_count_drop(msg_pool_t *pool);
+
+void msg_pool_stats(msg_pool_t *pool, msg_pool_stats_t *stats);
@@ -0,0 +1,33 @@
+#include "ota_artifact.h"
+
+#include <string.h>
+
+static uint32_t get_u32(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+bool ota_artifact_detect(const uint8_t *data, size_t len)
+{
+    return len >= 4 && get_u32(data) == OTA_ARTIFACT_MAGIC;
+}
+
+bool ota_artifact_parse(const uint8_t *data, size_t len, ota_artifact_header_t *header)
+{
+    if (len < OTA_ARTIFACT_HEADER_SIZE || !ota_artifact_detect(data, len)) {
+        return false;
+    }
+    if (data[4] != OTA_ARTIFACT_VERSION) {
+        return false;
+    }
+
+    header->flags = data[5];
+    if (header->flags & ~(OTA_ARTIFACT_COMPRESSED | OTA_ARTIFACT_DELTA)) {
+        return false;
+    }
+    header->image_size = get_u32(&data[8]);
+    header->source_size = get_u32(&data[12]);
+    memcpy(header->source_sha256, &data[16], 32);
+    memcpy(header->image_sha256, &data[48], 32);
+    return true;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * OTA artifact container for compressed and delta images.
+ *
+ * A plain firmware.bin is served as is. Compressed and delta artifacts start
+ * with this header (little-endian), followed by the payload:
+ *
+ *   u32 magic           OTA_ARTIFACT_MAGIC ("IOTA")
+ *   u8  version         OTA_ARTIFACT_VERSION
+ *   u8  flags           OTA_ARTIFACT_COMPRESSED | OTA_ARTIFACT_DELTA
+ *   u16 reserved
+ *   u32 image_size      size of the reconstructed firmware image
+ *   u32 source_size     delta only: bytes of the running image the patch reads
+ *   u8  source_sha256[32]  delta only: hash of those bytes
+ *   u8  image_sha256[32]   hash of the reconstructed image
+ *
+ * The payload is the image or a delta_patch op stream, zlib-deflated when
+ * OTA_ARTIFACT_COMPRESSED is set. tools/ota_artifact.py builds artifacts.
+ */
+
+#define OTA_ARTIFACT_MAGIC          0x41544f49  // "IOTA"
+#define OTA_ARTIFACT_VERSION        1
+#define OTA_ARTIFACT_HEADER_SIZE    80
+
+#define OTA_ARTIFACT_COMPRESSED     (1 << 0)
+#define OTA_ARTIFACT_DELTA          (1 << 1)
+
+typedef struct {
+    uint8_t flags;
+    uint32_t image_size;
+    uint32_t source_size;
+    uint8_t source_sha256[32];
+    uint8_t image_sha256[32];
+} ota_artifact_header_t;
+
+/* True if data starts with an artifact header rather than a raw image */
+bool ota_artifact_detect(const uint8_t *data, size_t len);
+
+/* Parse the header, returns false if it is truncated or unsupported */
+bool ota_artifact_parse(const uint8_t *data, size_t len, ota_artifact_header_t *header);
@@ -0,0 +1,181 @@
+#include "ota_decoder.h"
+
+#include <string.h>
+
+void ota_decoder_init(ota_decoder_t *decoder, const ota_decoder_ops_t *ops, void *ctx, arena_t *arena,
+                      size_t head_size, bool resumed)
+{
+    memset(decoder, 0, sizeof(*decoder));
+    decoder->ops = ops;
+    decoder->ctx = ctx;
+    decoder->arena = arena;
+    decoder->head_size = head_size < OTA_DECODER_HEAD_MAX ? head_size : OTA_DECODER_HEAD_MAX;
+    // A resumed download continues a raw image, anything else starts at the header
+    decoder->started = resumed;
+    decoder->head_checked = resumed;
+}
+
+/* Image bytes in order, the head is held back until check_head accepts it */
+static ota_decoder_err_t ota_decoder_write(ota_decoder_t *dec, const uint8_t *data, size_t len)
+{
+    if (!dec->head_checked) {
+        size_t n = dec->head_size - dec->head_len;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(&dec->head[dec->head_len], data, n);
+        dec->head_len += n;
+        data += n;
+        len -= n;
+        if (dec->head_len < dec->head_size) {
+            return OTA_DECODER_OK;
+        }
+        if (!dec->ops->check_head(dec->ctx, dec->head, dec->head_len)) {
+            return OTA_DECODER_ERR_VERSION;
+        }
+        dec->head_checked = true;
+        if (dec->ops->write(dec->ctx, dec->head, dec->head_len) != 0) {
+            return OTA_DECODER_ERR_WRITE;
+        }
+        dec->written += dec->head_len;
+    }
+    if (len == 0) {
+        return OTA_DECODER_OK;
+    }
+    if (dec->ops->write(dec->ctx, data, len) != 0) {
+        return OTA_DECODER_ERR_WRITE;
+    }
+    dec->written += len;
+    return OTA_DECODER_OK;
+}
+
+static int ota_decoder_patch_read(void *ctx, uint32_t offset, uint8_t *buf, size_t len)
+{
+    ota_decoder_t *dec = ctx;
+    return dec->ops->read_base(dec->ctx, offset, buf, len);
+}
+
+static int ota_decoder_patch_write(void *ctx, const uint8_t *data, size_t len)
+{
+    ota_decoder_t *dec = ctx;
+    dec->patch_write_err = ota_decoder_write(dec, data, len);
+    return dec->patch_write_err == OTA_DECODER_OK ? 0 : -1;
+}
+
+/* Set up decoding of a compressed or delta artifact from its header */
+static ota_decoder_err_t ota_decoder_begin(ota_decoder_t *dec, const uint8_t *data, size_t len)
+{
+    ota_artifact_header_t *header = &dec->header;
+
+    if (!ota_artifact_parse(data, len, header)) {
+        return OTA_DECODER_ERR_ARTIFACT;
+    }
+    if (header->flags & OTA_ARTIFACT_DELTA) {
+        dec->patch = arena_alloc(dec->arena, sizeof(delta_patch_t));
+        if (dec->patch == NULL) {
+            return OTA_DECODER_ERR_NO_MEM;
+        }
+        delta_patch_init(dec->patch, header->source_size, ota_decoder_patch_read, ota_decoder_patch_write, dec);
+    }
+    if (header->flags & OTA_ARTIFACT_COMPRESSED) {
+        dec->inflator = arena_alloc(dec->arena, sizeof(tinfl_decompressor));
+        if (dec->inflator == NULL) {
+            return OTA_DECODER_ERR_NO_MEM;
+        }
+        tinfl_init(dec->inflator);
+        dec->dict = arena_alloc(dec->arena, TINFL_LZ_DICT_SIZE);
+        if (dec->dict == NULL) {
+            return OTA_DECODER_ERR_NO_MEM;
+        }
+    }
+    return dec->ops->begin(dec->ctx, dec) ? OTA_DECODER_OK : OTA_DECODER_ERR_BEGIN;
+}
+
+/* Payload after decompression: a delta op stream or image bytes */
+static ota_decoder_err_t ota_decoder_unpack(ota_decoder_t *dec, const uint8_t *data, size_t len)
+{
+    if (dec->patch == NULL) {
+        return ota_decoder_write(dec, data, len);
+    }
+    dec->patch_err = delta_patch_feed(dec->patch, data, len);
+    if (dec->patch_err == DELTA_PATCH_OK) {
+        return OTA_DECODER_OK;
+    }
+    if (dec->patch_err == DELTA_PATCH_ERR_IO) {
+        return dec->patch_write_err != OTA_DECODER_OK ? dec->patch_write_err : OTA_DECODER_ERR_WRITE;
+    }
+    return OTA_DECODER_ERR_PATCH;
+}
+
+/* Stream inflate into the dictionary window, passing each produced run on */
+static ota_decoder_err_t ota_decoder_inflate(ota_decoder_t *dec, const uint8_t *data, size_t len)
+{
+    while (!dec->inflate_done) {
+        size_t in_bytes = len;
+        size_t out_bytes = TINFL_LZ_DICT_SIZE - dec->dict_ofs;
+        tinfl_status status = tinfl_decompress(dec->inflator, data, &in_bytes, dec->dict, dec->dict + dec->dict_ofs,
+                                               &out_bytes, TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_HAS_MORE_INPUT);
+        data += in_bytes;
+        len -= in_bytes;
+
+        if (out_bytes > 0) {
+            ota_decoder_err_t err = ota_decoder_unpack(dec, dec->dict + dec->dict_ofs, out_bytes);
+            if (err != OTA_DECODER_OK) {
+                return err;
+            }
+            dec->dict_ofs = (dec->dict_ofs + out_bytes) & (TINFL_LZ_DICT_SIZE - 1);
+        }
+
+        if (status < TINFL_STATUS_DONE) {
+            return OTA_DECODER_ERR_INFLATE;
+        }
+        if (status == TINFL_STATUS_DONE) {
+            dec->inflate_done = true;
+        } else if (status == TINFL_STATUS_NEEDS_MORE_INPUT && len == 0) {
+            break;
+        }
+    }
+    return OTA_DECODER_OK;
+}
+
+ota_decoder_err_t ota_decoder_feed(ota_decoder_t *decoder, const uint8_t *data, size_t len)
+{
+    if (!decoder->started) {
+        decoder->started = true;
+        if (ota_artifact_detect(data, len)) {
+            ota_decoder_err_t err = ota_decoder_begin(decoder, data, len);
+            if (err != OTA_DECODER_OK) {
+                return err;
+            }
+            data += OTA_ARTIFACT_HEADER_SIZE;
+            len -= OTA_ARTIFACT_HEADER_SIZE;
+        }
+    }
+
+    if (decoder->inflator != NULL) {
+        return ota_decoder_inflate(decoder, data, len);
+    }
+    return ota_decoder_unpack(decoder, data, len);
+}
+
+void ota_decoder_end(ota_decoder_t *decoder)
+{
+#ifdef TINFL_HAS_END
+    if (decoder->inflator != NULL) {
+        tinfl_end(decoder->inflator);
+    }
+#endif
+}
+
+bool ota_decoder_complete(const ota_decoder_t *decoder)
+{
+    if (!decoder->head_checked) {
+        return false;
+    }
+    if (decoder->header.flags == 0) {
+        return true;
+    }
+    return (decoder->inflator == NULL || decoder->inflate_done) &&
+           (decoder->patch == NULL || delta_patch_done(decoder->patch)) &&
+           decoder->written == decoder->header.image_size;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+#include "delta_patch.h"
+#include "ota_artifact.h"
+#include "rom/miniz.h"
+
+/*
+ * Turns downloaded OTA bytes into image bytes.
+ *
+ * A raw firmware.bin passes through. An artifact (see ota_artifact.h) is
+ * inflated into a 32 KB window and/or applied as a delta against the base
+ * image, in chunks of any size. The first head_size image bytes are held
+ * back until check_head accepts them, so nothing is written for an image
+ * that will be refused. Inflate window and patch state come from the arena.
+ * Pure C, the caller supplies flash access through the ops.
+ */
+
+#define OTA_DECODER_HEAD_MAX    320
+
+typedef enum {
+    OTA_DECODER_OK,
+    OTA_DECODER_ERR_ARTIFACT,   // unsupported artifact header
+    OTA_DECODER_ERR_NO_MEM,     // arena too small for the inflate window or patch
+    OTA_DECODER_ERR_BEGIN,      // begin refused the artifact
+    OTA_DECODER_ERR_VERSION,    // check_head refused the image
+    OTA_DECODER_ERR_INFLATE,    // corrupt compressed stream
+    OTA_DECODER_ERR_PATCH,      // corrupt delta, patch_err has the detail
+    OTA_DECODER_ERR_WRITE,      // write or read_base failed
+} ota_decoder_err_t;
+
+typedef struct ota_decoder ota_decoder_t;
+
+/* Callbacks returning int return 0 on success, bool ones true to go on */
+typedef struct {
+    // Artifact header parsed and stage memory allocated, before any payload
+    bool (*begin)(void *ctx, const ota_decoder_t *decoder);
+    bool (*check_head)(void *ctx, const uint8_t *head, size_t len);
+    int (*write)(void *ctx, const uint8_t *data, size_t len);
+    int (*read_base)(void *ctx, uint32_t offset, uint8_t *buf, size_t len);
+} ota_decoder_ops_t;
+
+struct ota_decoder {
+    const ota_decoder_ops_t *ops;
+    void *ctx;
+    arena_t *arena;
+    bool started;
+    ota_artifact_header_t header;   // flags are 0 for a raw image
+    tinfl_decompressor *inflator;
+    uint8_t *dict;                  // TINFL_LZ_DICT_SIZE output window
+    size_t dict_ofs;
+    bool inflate_done;
+    delta_patch_t *patch;
+    delta_patch_err_t patch_err;
+    ota_decoder_err_t patch_write_err;  // of the last delta output write
+    bool head_checked;
+    uint8_t head[OTA_DECODER_HEAD_MAX];
+    size_t head_size;
+    size_t head_len;
+    uint32_t written;               // image bytes passed to write
+};
+
+/* resumed continues a raw image whose head was checked by an earlier download */
+void ota_decoder_init(ota_decoder_t *decoder, const ota_decoder_ops_t *ops, void *ctx, arena_t *arena,
+                      size_t head_size, bool resumed);
+
+ota_decoder_err_t ota_decoder_feed(ota_decoder_t *decoder, const uint8_t *data, size_t len);
+
+/* Ends the session, complete or not; releases what the inflater holds */
+void ota_decoder_end(ota_decoder_t *decoder);
+
+/* True once the whole image came out of the decoder */
+bool ota_decoder_complete(const ota_decoder_t *decoder);
+
+static inline bool ota_decoder_head_checked(const ota_decoder_t *decoder)
+{
+    return decoder->head_checked;
+}
@@ -0,0 +1,190 @@
+#include "ota_manifest.h"
+
+#include <string.h>
+
+typedef struct {
+    const char *pos;
+    const char *end;
+} json_cursor_t;
+
+static void skip_space(json_cursor_t *c)
+{
+    while (c->pos < c->end && (*c->pos == ' ' || *c->pos == '\t' || *c->pos == '\r' || *c->pos == '\n')) {
+        c->pos++;
+    }
+}
+
+static bool expect(json_cursor_t *c, char ch)
+{
+    skip_space(c);
+    if (c->pos < c->end && *c->pos == ch) {
+        c->pos++;
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Read a string into out, out may be NULL to skip it. A string that does not
+ * fit fails the read, unless truncated is given: then it is cut to
+ * out_len - 1 and *truncated is set.
+ */
+static bool read_string(json_cursor_t *c, char *out, size_t out_len, bool *truncated)
+{
+    size_t n = 0;
+
+    if (truncated != NULL) {
+        *truncated = false;
+    }
+    if (!expect(c, '"')) {
+        return false;
+    }
+    while (c->pos < c->end && *c->pos != '"') {
+        char ch = *c->pos++;
+        if (ch == '\\') {
+            if (c->pos >= c->end) {
+                return false;
+            }
+            ch = *c->pos++;
+            if (ch == 'n') {
+                ch = '\n';
+            } else if (ch == 't') {
+                ch = '\t';
+            } else if (ch == 'u') {
+                return false;   // not needed for versions, hashes and URLs
+            }
+        }
+        if (out == NULL) {
+            continue;
+        }
+        if (n + 1 < out_len) {
+            out[n++] = ch;
+        } else if (truncated != NULL) {
+            *truncated = true;
+        } else {
+            return false;
+        }
+    }
+    if (out != NULL && out_len > 0) {
+        out[n] = '\0';
+    }
+    return expect(c, '"');
+}
+
+static bool read_uint(json_cursor_t *c, uint32_t *out)
+{
+    uint64_t value = 0;
+    bool digits = false;
+
+    skip_space(c);
+    while (c->pos < c->end && *c->pos >= '0' && *c->pos <= '9') {
+        value = value * 10 + (*c->pos++ - '0');
+        if (value > UINT32_MAX) {
+            return false;
+        }
+        digits = true;
+    }
+    *out = (uint32_t)value;
+    return digits;
+}
+
+/* Skip the value of a key this parser does not know, objects and arrays included */
+static bool skip_value(json_cursor_t *c)
+{
+    int depth = 0;
+
+    skip_space(c);
+    const char *start = c->pos;
+    while (c->pos < c->end) {
+        char ch = *c->pos;
+        if (ch == '"') {
+            if (!read_string(c, NULL, 0, NULL)) {
+                return false;
+            }
+            continue;
+        }
+        if (depth == 0 && (ch == ',' || ch == '}' || ch == ']')) {
+            break;
+        }
+        if (ch == '{' || ch == '[') {
+            depth++;
+        } else if (ch == '}' || ch == ']') {
+            depth--;
+        }
+        c->pos++;
+    }
+    return c->pos > start && c->pos < c->end && depth == 0;
+}
+
+/* A sha256 is 64 hex digits, or absent */
+static bool valid_sha256(const char *hex)
+{
+    size_t n = 0;
+
+    for (; hex[n] != '\0'; n++) {
+        char ch = hex[n];
+        if (!((ch >= '0' && ch <= '9') || (ch >= 'a' && ch <= 'f') || (ch >= 'A' && ch <= 'F'))) {
+            return false;
+        }
+    }
+    return n == 0 || n == 64;
+}
+
+bool ota_manifest_parse(const char *json, size_t len, ota_manifest_t *manifest)
+{
+    json_cursor_t c = { .pos = json, .end = json + len };
+
+    memset(manifest, 0, sizeof(*manifest));
+    if (!expect(&c, '{')) {
+        return false;
+    }
+    if (!expect(&c, '}')) {
+        do {
+            char key[16];
+            bool long_key;
+            if (!read_string(&c, key, sizeof(key), &long_key) || !expect(&c, ':')) {
+                return false;
+            }
+            if (long_key) {
+                key[0] = '\0';     // longer than any known key
+            }
+
+            bool ok;
+            if (strcmp(key, "version") == 0) {
+                ok = read_string(&c, manifest->version, sizeof(manifest->version), NULL);
+            } else if (strcmp(key, "size") == 0) {
+                ok = read_uint(&c, &manifest->size);
+            } else if (strcmp(key, "sha256") == 0) {
+                ok = read_string(&c, manifest->sha256, sizeof(manifest->sha256), NULL);
+            } else if (strcmp(key, "url") == 0) {
+                ok = read_string(&c, manifest->url, sizeof(manifest->url), NULL);
+            } else {
+                ok = skip_value(&c);
+            }
+            if (!ok) {
+                return false;
+            }
+        } while (expect(&c, ','));
+
+        if (!expect(&c, '}')) {
+            return false;
+        }
+    }
+    skip_space(&c);
+    if (c.pos != c.end) {
+        return false;   // anything after the object
+    }
+    return manifest->version[0] != '\0' && valid_sha256(manifest->sha256);
+}
+
+ota_manifest_action_t ota_manifest_check(const ota_manifest_t *manifest, const char *running_version,
+                                         const char *invalid_version)
+{
+    if (invalid_version != NULL && strncmp(manifest->version, invalid_version, OTA_MANIFEST_VERSION_LEN) == 0) {
+        return OTA_MANIFEST_REJECTED;
+    }
+    if (strncmp(manifest->version, running_version, OTA_MANIFEST_VERSION_LEN) == 0) {
+        return OTA_MANIFEST_CURRENT;
+    }
+    return OTA_MANIFEST_UPDATE;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * OTA version manifest, a small JSON object served next to the image:
+ *
+ *   {"version": "1.4.2", "size": 912384, "sha256": "<hex>", "url": "http://..."}
+ *
+ * Only version is required. size and sha256 describe the firmware image,
+ * url overrides the configured download URL. The parser handles an object of
+ * string and integer values, unknown keys are skipped whatever their value.
+ * A string longer than its field or a sha256 that is not 64 hex digits fails
+ * the parse rather than being cut.
+ */
+
+#define OTA_MANIFEST_VERSION_LEN    32      // same as esp_app_desc_t.version
+#define OTA_MANIFEST_URL_LEN        256
+
+typedef struct {
+    char version[OTA_MANIFEST_VERSION_LEN];
+    uint32_t size;                  // 0 if not given
+    char sha256[65];                // empty if not given
+    char url[OTA_MANIFEST_URL_LEN]; // empty if not given
+} ota_manifest_t;
+
+typedef enum {
+    OTA_MANIFEST_UPDATE,            // a different version is offered
+    OTA_MANIFEST_CURRENT,           // the offered version is already running
+    OTA_MANIFEST_REJECTED,          // the offered version was rolled back before
+} ota_manifest_action_t;
+
+bool ota_manifest_parse(const char *json, size_t len, ota_manifest_t *manifest);
+
+/* invalid_version may be NULL when there is no rolled back app */
+ota_manifest_action_t ota_manifest_check(const ota_manifest_t *manifest, const char *running_version,
+                                         const char *invalid_version);
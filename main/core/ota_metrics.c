@@ -0,0 +1,47 @@
+#include "ota_metrics.h"
+
+#include <string.h>
+
+void ota_metrics_start(ota_metrics_t *metrics, int64_t now_us)
+{
+    memset(metrics, 0, sizeof(*metrics));
+    metrics->start_us = now_us;
+    metrics->end_us = now_us;
+}
+
+void ota_metrics_finish(ota_metrics_t *metrics, int64_t now_us)
+{
+    metrics->end_us = now_us;
+}
+
+void ota_metrics_fetch_wait(ota_metrics_t *metrics, int64_t waited_us)
+{
+    metrics->fetch_wait_us += waited_us;
+    if (waited_us >= OTA_METRICS_STALL_US) {
+        metrics->fetch_stalls++;
+    }
+}
+
+void ota_metrics_write_wait(ota_metrics_t *metrics, int64_t waited_us)
+{
+    metrics->write_wait_us += waited_us;
+    if (waited_us >= OTA_METRICS_STALL_US) {
+        metrics->write_stalls++;
+    }
+}
+
+void ota_metrics_chunk_written(ota_metrics_t *metrics, uint32_t len, int64_t busy_us)
+{
+    metrics->bytes += len;
+    metrics->chunks++;
+    metrics->write_busy_us += busy_us;
+}
+
+uint32_t ota_metrics_throughput(const ota_metrics_t *metrics)
+{
+    int64_t elapsed_us = metrics->end_us - metrics->start_us;
+    if (elapsed_us <= 0) {
+        return 0;
+    }
+    return metrics->bytes * 1000000 / elapsed_us;
+}
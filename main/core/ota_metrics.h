@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Throughput and stall accounting for the OTA download pipeline.
+ *
+ * A fetch stall is the downloader waiting for a free buffer (flash is the
+ * bottleneck), a write stall is the flash writer waiting for data (the
+ * network is the bottleneck). Pure C, times are passed in by the caller.
+ */
+
+#define OTA_METRICS_STALL_US    1000    // waits shorter than this are not counted as stalls
+
+typedef struct {
+    int64_t start_us;
+    int64_t end_us;
+    uint64_t bytes;
+    uint32_t chunks;
+    int64_t fetch_wait_us;
+    int64_t write_wait_us;
+    int64_t write_busy_us;
+    uint32_t fetch_stalls;
+    uint32_t write_stalls;
+} ota_metrics_t;
+
+void ota_metrics_start(ota_metrics_t *metrics, int64_t now_us);
+void ota_metrics_finish(ota_metrics_t *metrics, int64_t now_us);
+
+void ota_metrics_fetch_wait(ota_metrics_t *metrics, int64_t waited_us);
+void ota_metrics_write_wait(ota_metrics_t *metrics, int64_t waited_us);
+void ota_metrics_chunk_written(ota_metrics_t *metrics, uint32_t len, int64_t busy_us);
+
+/* Average throughput in bytes per second over the whole transfer */
+uint32_t ota_metrics_throughput(const ota_metrics_t *metrics);
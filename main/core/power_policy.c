@@ -0,0 +1,119 @@
+#include "power_policy.h"
+
+#include <string.h>
+
+static int64_t power_now(power_policy_t *policy)
+{
+    return policy->ops.now_us(policy->ops.ctx);
+}
+
+/* Highest level any running activity needs */
+static power_level_t power_required(const power_policy_t *policy)
+{
+    power_level_t level = POWER_LEVEL_IDLE;
+    for (uint8_t i = 0; i < policy->n_activities; i++) {
+        if (policy->running[i] > 0 && policy->needs[i] > level) {
+            level = policy->needs[i];
+        }
+    }
+    return level;
+}
+
+static void power_apply(power_policy_t *policy, power_level_t level, int64_t now)
+{
+    if (level == policy->level) {
+        return;
+    }
+    policy->stats.level_us[policy->level] += now - policy->level_since_us;
+    policy->stats.transitions++;
+    policy->ops.apply(policy->ops.ctx, policy->level, level);
+    policy->level = level;
+    policy->level_since_us = now;
+}
+
+void power_policy_init(power_policy_t *policy, const power_ops_t *ops, const uint8_t *needs,
+                       uint8_t n_activities, uint64_t linger_us)
+{
+    memset(policy, 0, sizeof(*policy));
+    policy->ops = *ops;
+    policy->n_activities = n_activities < POWER_MAX_ACTIVITIES ? n_activities : POWER_MAX_ACTIVITIES;
+    memcpy(policy->needs, needs, policy->n_activities);
+    policy->linger_us = linger_us;
+    policy->level = POWER_LEVEL_IDLE;
+    policy->level_since_us = power_now(policy);
+    policy->stats_since_us = policy->level_since_us;
+}
+
+void power_policy_begin(power_policy_t *policy, uint8_t activity)
+{
+    if (activity >= policy->n_activities) {
+        return;
+    }
+    int64_t now = power_now(policy);
+    if (policy->running[activity]++ == 0) {
+        policy->busy_since_us[activity] = now;
+    }
+    policy->stats.begins[activity]++;
+
+    power_level_t required = power_required(policy);
+    if (required >= policy->level) {
+        // Going up, or staying at a level that was about to drop
+        policy->lower_at_us = 0;
+        power_apply(policy, required, now);
+    }
+}
+
+void power_policy_end(power_policy_t *policy, uint8_t activity)
+{
+    if (activity >= policy->n_activities || policy->running[activity] == 0) {
+        return;
+    }
+    int64_t now = power_now(policy);
+    if (--policy->running[activity] == 0) {
+        policy->stats.busy_us[activity] += now - policy->busy_since_us[activity];
+    }
+
+    if (power_required(policy) < policy->level) {
+        if (policy->linger_us == 0) {
+            power_apply(policy, power_required(policy), now);
+            return;
+        }
+        policy->lower_at_us = now + policy->linger_us;
+        policy->ops.arm_timer(policy->ops.ctx, policy->linger_us);
+    }
+}
+
+void power_policy_expire(power_policy_t *policy)
+{
+    if (policy->lower_at_us == 0) {
+        return;
+    }
+    int64_t now = power_now(policy);
+    if (now < policy->lower_at_us) {
+        // An activity ended again after the timer was armed
+        policy->ops.arm_timer(policy->ops.ctx, policy->lower_at_us - now);
+        return;
+    }
+    policy->lower_at_us = 0;
+    power_apply(policy, power_required(policy), now);
+}
+
+void power_policy_take_stats(power_policy_t *policy, power_stats_t *stats, int64_t *period_us)
+{
+    int64_t now = power_now(policy);
+
+    // Close the open intervals at now so they count in this period
+    policy->stats.level_us[policy->level] += now - policy->level_since_us;
+    policy->level_since_us = now;
+    for (uint8_t i = 0; i < policy->n_activities; i++) {
+        if (policy->running[i] > 0) {
+            policy->stats.busy_us[i] += now - policy->busy_since_us[i];
+            policy->busy_since_us[i] = now;
+        }
+    }
+
+    *stats = policy->stats;
+    *period_us = now - policy->stats_since_us;
+    memset(&policy->stats, 0, sizeof(policy->stats));
+    policy->stats_since_us = now;
+}
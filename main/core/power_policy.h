@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Power level arbitration for power management locks.
+ *
+ * Each activity (frame processing, publish, OTA, ...) needs a level while it
+ * runs. The applied level is the highest one any running activity needs. It
+ * goes up at once when an activity begins, and only goes down linger_us after
+ * the last activity needing it ended, so bursts of short activities do not
+ * toggle the CPU clock on every call. Time spent at each level and per
+ * activity busy time are accumulated for reporting.
+ *
+ * Clock, lock and timer are callbacks so the policy runs against a virtual
+ * clock off target. The caller serialises calls into one policy.
+ */
+
+#define POWER_MAX_ACTIVITIES    8
+
+typedef enum {
+    POWER_LEVEL_IDLE,       // DFS minimum, automatic light sleep allowed
+    POWER_LEVEL_AWAKE,      // no light sleep, CPU clock may still drop
+    POWER_LEVEL_FULL,       // maximum CPU clock
+    POWER_LEVEL_COUNT,
+} power_level_t;
+
+typedef struct {
+    int64_t (*now_us)(void *ctx);
+    void (*apply)(void *ctx, power_level_t from, power_level_t to);
+    void (*arm_timer)(void *ctx, uint64_t delay_us);    // one-shot, re-arming replaces the previous one
+    void *ctx;
+} power_ops_t;
+
+typedef struct {
+    uint64_t level_us[POWER_LEVEL_COUNT];   // time spent at each applied level
+    uint32_t begins[POWER_MAX_ACTIVITIES];
+    uint64_t busy_us[POWER_MAX_ACTIVITIES];  // time with at least one instance running
+    uint32_t transitions;
+} power_stats_t;
+
+typedef struct {
+    power_ops_t ops;
+    uint8_t needs[POWER_MAX_ACTIVITIES];    // power_level_t per activity
+    uint8_t n_activities;
+    uint64_t linger_us;
+
+    uint16_t running[POWER_MAX_ACTIVITIES];
+    int64_t busy_since_us[POWER_MAX_ACTIVITIES];
+    power_level_t level;
+    int64_t level_since_us;
+    int64_t lower_at_us;                    // when the applied level may drop, 0 if no drop pending
+    int64_t stats_since_us;
+    power_stats_t stats;
+} power_policy_t;
+
+/* needs holds the level of each of n_activities (at most POWER_MAX_ACTIVITIES) */
+void power_policy_init(power_policy_t *policy, const power_ops_t *ops, const uint8_t *needs,
+                       uint8_t n_activities, uint64_t linger_us);
+
+void power_policy_begin(power_policy_t *policy, uint8_t activity);
+void power_policy_end(power_policy_t *policy, uint8_t activity);
+
+/* Timer callback, drops the level if the linger time passed */
+void power_policy_expire(power_policy_t *policy);
+
+/* Statistics since the previous call, sets *period_us to the covered time */
+void power_policy_take_stats(power_policy_t *policy, power_stats_t *stats, int64_t *period_us);
+
+static inline power_level_t power_policy_level(const power_policy_t *policy)
+{
+    return policy->level;
+}
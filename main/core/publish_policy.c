@@ -0,0 +1,259 @@
+#include "publish_policy.h"
+
+#include <string.h>
+
+void publish_policy_init(publish_policy_t *policy, const publish_ops_t *ops, publish_slot_t *slots,
+                         size_t n_slots, const char *const *bulk_topics, size_t n_bulk_topics,
+                         const publish_caps_t caps[PUBLISH_CLASS_COUNT], int64_t ack_timeout_us)
+{
+    memset(policy, 0, sizeof(*policy));
+    policy->ops = *ops;
+    policy->slots = slots;
+    policy->n_slots = n_slots;
+    policy->bulk_topics = bulk_topics;
+    policy->n_bulk_topics = n_bulk_topics;
+    memcpy(policy->caps, caps, sizeof(policy->caps));
+    policy->ack_timeout_us = ack_timeout_us;
+
+    for (size_t i = 0; i < n_slots; i++) {
+        slots[i].len = 0;
+        slots[i].waiting = false;
+        slots[i].inflight_id = 0;
+    }
+}
+
+static int publish_find_slot(const publish_policy_t *policy, const char *topic)
+{
+    for (size_t i = 0; i < policy->n_slots; i++) {
+        if (strcmp(policy->slots[i].topic, topic) == 0) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+static bool publish_is_bulk(const publish_policy_t *policy, const char *topic)
+{
+    for (size_t i = 0; i < policy->n_bulk_topics; i++) {
+        if (strcmp(policy->bulk_topics[i], topic) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool publish_fits(const publish_policy_t *policy, publish_class_t cls, size_t len)
+{
+    const publish_stats_t *stats = &policy->stats[cls];
+    return stats->count < policy->caps[cls].max_count && stats->bytes + len <= policy->caps[cls].max_bytes;
+}
+
+static void publish_hold(publish_policy_t *policy, publish_class_t cls, size_t len)
+{
+    publish_stats_t *stats = &policy->stats[cls];
+    stats->count++;
+    stats->bytes += (uint32_t)len;
+    if (stats->bytes > stats->peak_bytes) {
+        stats->peak_bytes = stats->bytes;
+    }
+}
+
+static void publish_release(publish_policy_t *policy, publish_class_t cls, size_t len)
+{
+    policy->stats[cls].count--;
+    policy->stats[cls].bytes -= (uint32_t)len;
+}
+
+/* Hands a message to the client and tracks it until acknowledged, QoS 0 is not tracked */
+static int publish_send(publish_policy_t *policy, publish_class_t cls, int slot, const char *topic,
+                        const uint8_t *data, size_t len, int qos, int retain)
+{
+    if (qos > 0 && policy->n_inflight == PUBLISH_MAX_INFLIGHT) {
+        return -1;
+    }
+    int msg_id = policy->ops.send(policy->ops.ctx, topic, data, len, qos, retain);
+    if (msg_id < 0) {
+        return -1;
+    }
+    policy->stats[cls].sent++;
+
+    if (qos > 0) {
+        publish_inflight_t *entry = &policy->inflight[policy->n_inflight++];
+        entry->msg_id = msg_id;
+        entry->len = (uint32_t)len;
+        entry->sent_us = policy->ops.now_us(policy->ops.ctx);
+        entry->cls = (uint8_t)cls;
+        entry->slot = (int8_t)slot;
+        publish_hold(policy, cls, len);
+        if (slot >= 0) {
+            policy->slots[slot].inflight_id = msg_id;
+        }
+    }
+    return msg_id;
+}
+
+/* Sends a state topic's waiting value once nothing of that topic is ahead of it */
+static void publish_flush(publish_policy_t *policy, int index)
+{
+    publish_slot_t *slot = &policy->slots[index];
+    if (!policy->connected || !slot->waiting || slot->inflight_id != 0) {
+        return;
+    }
+
+    // The bytes move from the slot to the unacknowledged message
+    publish_release(policy, PUBLISH_CLASS_STATE, slot->len);
+    if (publish_send(policy, PUBLISH_CLASS_STATE, index, slot->topic, slot->buf, slot->len,
+                     slot->qos, slot->retain) < 0) {
+        // Retried on the next acknowledgement or reconnect
+        publish_hold(policy, PUBLISH_CLASS_STATE, slot->len);
+        return;
+    }
+    slot->waiting = false;
+
+    int64_t waited_us = policy->ops.now_us(policy->ops.ctx) - slot->waiting_since_us;
+    publish_stats_t *stats = &policy->stats[PUBLISH_CLASS_STATE];
+    if (waited_us > (int64_t)stats->max_wait_us) {
+        stats->max_wait_us = waited_us > UINT32_MAX ? UINT32_MAX : (uint32_t)waited_us;
+    }
+}
+
+static int publish_state(publish_policy_t *policy, int index, const uint8_t *data, size_t len, int qos, int retain)
+{
+    publish_slot_t *slot = &policy->slots[index];
+    publish_stats_t *stats = &policy->stats[PUBLISH_CLASS_STATE];
+
+    if (slot->waiting) {
+        // Only the newest value is worth sending
+        publish_release(policy, PUBLISH_CLASS_STATE, slot->len);
+        slot->waiting = false;
+        stats->coalesced++;
+    }
+
+    if (policy->connected && slot->inflight_id == 0) {
+        if (qos > 0 && !publish_fits(policy, PUBLISH_CLASS_STATE, len)) {
+            stats->dropped++;
+            return -1;
+        }
+        int msg_id = publish_send(policy, PUBLISH_CLASS_STATE, index, slot->topic, data, len, qos, retain);
+        if (msg_id < 0) {
+            stats->dropped++;
+            return -1;
+        }
+        stats->accepted++;
+        return msg_id;
+    }
+
+    if (len > slot->size || !publish_fits(policy, PUBLISH_CLASS_STATE, len)) {
+        stats->dropped++;
+        return -1;
+    }
+    memcpy(slot->buf, data, len);
+    slot->len = len;
+    slot->qos = (uint8_t)qos;
+    slot->retain = (uint8_t)retain;
+    slot->waiting = true;
+    slot->waiting_since_us = policy->ops.now_us(policy->ops.ctx);
+    publish_hold(policy, PUBLISH_CLASS_STATE, len);
+    stats->accepted++;
+    return 0;
+}
+
+/* Events and bulk messages, each class against its own caps */
+static int publish_event(publish_policy_t *policy, publish_class_t cls, const char *topic, const uint8_t *data,
+                         size_t len, int qos, int retain)
+{
+    publish_stats_t *stats = &policy->stats[cls];
+
+    if (!policy->connected || (qos > 0 && !publish_fits(policy, cls, len))) {
+        stats->dropped++;
+        return -1;
+    }
+    int msg_id = publish_send(policy, cls, -1, topic, data, len, qos, retain);
+    if (msg_id < 0) {
+        stats->dropped++;
+        return -1;
+    }
+    stats->accepted++;
+    return msg_id;
+}
+
+int publish_policy_publish(publish_policy_t *policy, const char *topic, const uint8_t *data, size_t len,
+                           int qos, int retain)
+{
+    int index = publish_find_slot(policy, topic);
+    if (index >= 0) {
+        return publish_state(policy, index, data, len, qos, retain);
+    }
+    publish_class_t cls = publish_is_bulk(policy, topic) ? PUBLISH_CLASS_BULK : PUBLISH_CLASS_EVENT;
+    return publish_event(policy, cls, topic, data, len, qos, retain);
+}
+
+/* Forgets the unacknowledged message at i and lets its topic send again */
+static void publish_finish(publish_policy_t *policy, size_t i, bool delivered)
+{
+    publish_inflight_t entry = policy->inflight[i];
+    policy->inflight[i] = policy->inflight[--policy->n_inflight];
+
+    publish_release(policy, entry.cls, entry.len);
+    if (delivered) {
+        policy->stats[entry.cls].acked++;
+    } else {
+        policy->stats[entry.cls].expired++;
+    }
+
+    if (entry.slot >= 0 && policy->slots[entry.slot].inflight_id == entry.msg_id) {
+        policy->slots[entry.slot].inflight_id = 0;
+        publish_flush(policy, entry.slot);
+    }
+}
+
+void publish_policy_done(publish_policy_t *policy, int msg_id, bool delivered)
+{
+    for (size_t i = 0; i < policy->n_inflight; i++) {
+        if (policy->inflight[i].msg_id == msg_id) {
+            publish_finish(policy, i, delivered);
+            return;
+        }
+    }
+}
+
+void publish_policy_set_connected(publish_policy_t *policy, bool connected)
+{
+    bool was_connected = policy->connected;
+    policy->connected = connected;
+    if (connected && !was_connected) {
+        for (size_t i = 0; i < policy->n_slots; i++) {
+            publish_flush(policy, (int)i);
+        }
+    }
+}
+
+void publish_policy_expire(publish_policy_t *policy)
+{
+    int64_t now_us = policy->ops.now_us(policy->ops.ctx);
+    size_t i = 0;
+    while (i < policy->n_inflight) {
+        if (now_us - policy->inflight[i].sent_us > policy->ack_timeout_us) {
+            // The last entry moves into i, look at i again
+            publish_finish(policy, i, false);
+        } else {
+            i++;
+        }
+    }
+}
+
+void publish_policy_take_stats(publish_policy_t *policy, publish_stats_t stats[PUBLISH_CLASS_COUNT])
+{
+    for (int cls = 0; cls < PUBLISH_CLASS_COUNT; cls++) {
+        publish_stats_t *current = &policy->stats[cls];
+        stats[cls] = *current;
+        current->accepted = 0;
+        current->sent = 0;
+        current->acked = 0;
+        current->coalesced = 0;
+        current->dropped = 0;
+        current->expired = 0;
+        current->peak_bytes = current->bytes;
+        current->max_wait_us = 0;
+    }
+}
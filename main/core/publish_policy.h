@@ -0,0 +1,126 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Bounded outbox policy in front of the MQTT client.
+ *
+ * Topics are "state", "event" or "bulk". A state topic (telemetry, reports)
+ * only matters for its latest value: while one of its messages is still
+ * unacknowledged, or while disconnected, a new value replaces the one
+ * waiting in the topic's slot instead of queueing behind it, and goes out
+ * as soon as the previous one is acknowledged or the link is back. Event
+ * topics keep every message; they are handed to the client right away and
+ * refused while disconnected or when the class is over its caps, so the
+ * caller can fall back (the ring events go to the flash log). Bulk topics
+ * (waveform captures) are handled like events but count against caps of
+ * their own, so a long upload waits for its budget instead of using up the
+ * one live events need.
+ *
+ * Each class has a count and a byte cap over the messages it holds, waiting
+ * or unacknowledged. QoS 0 messages are never acknowledged and are not held.
+ * Unacknowledged messages are released by the client's PUBACK or outbox
+ * expiry, or after ack_timeout_us if neither ever arrives.
+ *
+ * Pure C, the client and the clock are callbacks. The caller serialises
+ * calls into one policy.
+ */
+
+#define PUBLISH_MAX_INFLIGHT    32
+
+typedef enum {
+    PUBLISH_CLASS_STATE,
+    PUBLISH_CLASS_EVENT,
+    PUBLISH_CLASS_BULK,
+    PUBLISH_CLASS_COUNT,
+} publish_class_t;
+
+typedef struct {
+    uint32_t max_count;
+    uint32_t max_bytes;
+} publish_caps_t;
+
+/* Latest value slot of a state topic, buf is supplied by the caller */
+typedef struct {
+    const char *topic;
+    uint8_t *buf;
+    size_t size;
+
+    size_t len;
+    uint8_t qos;
+    uint8_t retain;
+    bool waiting;           // buf holds a value not handed to the client yet
+    int64_t waiting_since_us;
+    int inflight_id;        // unacknowledged message of this topic, 0 if none
+} publish_slot_t;
+
+typedef struct {
+    int (*send)(void *ctx, const char *topic, const uint8_t *data, size_t len, int qos, int retain);
+    int64_t (*now_us)(void *ctx);
+    void *ctx;
+} publish_ops_t;
+
+typedef struct {
+    uint32_t accepted;      // publish calls that did not fail
+    uint32_t sent;          // handed to the client
+    uint32_t acked;
+    uint32_t coalesced;     // waiting values replaced by a newer one
+    uint32_t dropped;       // refused: caps, disconnected event or client error
+    uint32_t expired;       // unacknowledged messages given up on
+    uint32_t count;         // held right now, waiting or unacknowledged
+    uint32_t bytes;
+    uint32_t peak_bytes;    // largest bytes since the previous take
+    uint32_t max_wait_us;   // longest a state value waited to be sent, since the previous take
+} publish_stats_t;
+
+typedef struct {
+    int msg_id;
+    uint32_t len;
+    int64_t sent_us;
+    uint8_t cls;
+    int8_t slot;            // state slot index, -1 for events
+} publish_inflight_t;
+
+typedef struct {
+    publish_ops_t ops;
+    publish_slot_t *slots;
+    size_t n_slots;
+    const char *const *bulk_topics;
+    size_t n_bulk_topics;
+    publish_caps_t caps[PUBLISH_CLASS_COUNT];
+    int64_t ack_timeout_us;
+    bool connected;
+
+    publish_inflight_t inflight[PUBLISH_MAX_INFLIGHT];
+    size_t n_inflight;
+    publish_stats_t stats[PUBLISH_CLASS_COUNT];
+} publish_policy_t;
+
+/*
+ * slots name the state topics and bulk_topics the bulk ones, every other
+ * topic is an event topic. bulk_topics must outlive the policy.
+ */
+void publish_policy_init(publish_policy_t *policy, const publish_ops_t *ops, publish_slot_t *slots,
+                         size_t n_slots, const char *const *bulk_topics, size_t n_bulk_topics,
+                         const publish_caps_t caps[PUBLISH_CLASS_COUNT], int64_t ack_timeout_us);
+
+/*
+ * Returns the client's msg_id when sent, 0 when a state value is waiting in
+ * its slot, -1 when refused.
+ */
+int publish_policy_publish(publish_policy_t *policy, const char *topic, const uint8_t *data, size_t len,
+                           int qos, int retain);
+
+/* The client acknowledged (delivered) or expired (!delivered) msg_id */
+void publish_policy_done(publish_policy_t *policy, int msg_id, bool delivered);
+
+/* Sends the waiting state values when the link comes back */
+void publish_policy_set_connected(publish_policy_t *policy, bool connected);
+
+/* Gives up on messages unacknowledged for longer than the timeout */
+void publish_policy_expire(publish_policy_t *policy);
+
+/* Statistics since the previous call, the held counters are current values */
+void publish_policy_take_stats(publish_policy_t *policy, publish_stats_t stats[PUBLISH_CLASS_COUNT]);
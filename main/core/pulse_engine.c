@@ -0,0 +1,73 @@
+#include "pulse_engine.h"
+
+#include <string.h>
+
+void pulse_engine_init(pulse_engine_t *engine, const pulse_ops_t *ops, uint32_t max_hold_ms)
+{
+    memset(engine, 0, sizeof(*engine));
+    engine->ops = *ops;
+    engine->max_hold_ms = max_hold_ms;
+    engine->ops.set_output(engine->ops.ctx, false);
+}
+
+uint32_t pulse_engine_start(pulse_engine_t *engine, uint32_t duration_ms)
+{
+    uint32_t granted_ms = duration_ms < engine->max_hold_ms ? duration_ms : engine->max_hold_ms;
+
+    if (!engine->active) {
+        engine->current = (pulse_result_t) { .seq = engine->current.seq + 1 };
+        engine->ops.set_output(engine->ops.ctx, true);
+        engine->on_at_us = engine->ops.now_us(engine->ops.ctx);
+        engine->active = true;
+    }
+
+    // An extension still may not hold the output longer than the cap in total
+    int64_t now_us = engine->ops.now_us(engine->ops.ctx);
+    int64_t off_at_us = now_us + (int64_t)granted_ms * 1000;
+    int64_t latest_us = engine->on_at_us + (int64_t)engine->max_hold_ms * 1000;
+    if (off_at_us > latest_us) {
+        off_at_us = latest_us;
+    }
+
+    engine->off_at_us = off_at_us;
+    engine->current.requested_ms = duration_ms;
+    engine->current.granted_ms = (uint32_t)((off_at_us - engine->on_at_us) / 1000);
+    engine->current.capped = granted_ms < duration_ms || off_at_us < now_us + (int64_t)granted_ms * 1000;
+    engine->ops.arm_timer(engine->ops.ctx, off_at_us > now_us ? off_at_us - now_us : 0);
+    return engine->current.seq;
+}
+
+static void pulse_engine_end(pulse_engine_t *engine, pulse_result_t *result)
+{
+    engine->ops.set_output(engine->ops.ctx, false);
+    int64_t off_us = engine->ops.now_us(engine->ops.ctx);
+    engine->active = false;
+
+    engine->current.on_time_us = off_us - engine->on_at_us;
+    *result = engine->current;
+}
+
+bool pulse_engine_expire(pulse_engine_t *engine, pulse_result_t *result)
+{
+    if (!engine->active) {
+        return false;
+    }
+    int64_t now_us = engine->ops.now_us(engine->ops.ctx);
+    if (now_us < engine->off_at_us) {
+        engine->ops.arm_timer(engine->ops.ctx, engine->off_at_us - now_us);
+        return false;
+    }
+    pulse_engine_end(engine, result);
+    return true;
+}
+
+bool pulse_engine_stop(pulse_engine_t *engine, pulse_result_t *result)
+{
+    if (!engine->active) {
+        return false;
+    }
+    engine->ops.cancel_timer(engine->ops.ctx);
+    engine->current.stopped = true;
+    pulse_engine_end(engine, result);
+    return true;
+}
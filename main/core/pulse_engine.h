@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * One-shot output pulse scheduler for the door release.
+ *
+ * A pulse switches the output on, arms a one-shot timer and switches it off
+ * when the timer fires. Durations are clamped to a maximum hold time, so a
+ * lost "close" can never leave the output on. A new request while a pulse is
+ * running moves the deadline instead of starting a second pulse. The on-time
+ * reported when the pulse ends is measured with the supplied clock between
+ * the two output writes.
+ *
+ * Clock, output and timer are callbacks so the scheduler runs against a
+ * virtual clock off target. The caller serialises calls into one engine.
+ */
+
+typedef struct {
+    int64_t (*now_us)(void *ctx);
+    void (*set_output)(void *ctx, bool on);
+    void (*arm_timer)(void *ctx, uint64_t delay_us);   // one-shot, re-arming replaces the previous one
+    void (*cancel_timer)(void *ctx);
+    void *ctx;
+} pulse_ops_t;
+
+typedef struct {
+    uint32_t seq;               // pulse number, starts at 1
+    uint32_t requested_ms;
+    uint32_t granted_ms;        // after the max hold cap
+    int64_t on_time_us;         // measured time the output was on
+    bool capped;
+    bool stopped;               // ended by pulse_engine_stop before its deadline
+} pulse_result_t;
+
+typedef struct {
+    pulse_ops_t ops;
+    uint32_t max_hold_ms;
+    bool active;
+    int64_t on_at_us;
+    int64_t off_at_us;
+    pulse_result_t current;
+} pulse_engine_t;
+
+void pulse_engine_init(pulse_engine_t *engine, const pulse_ops_t *ops, uint32_t max_hold_ms);
+
+/* Start a pulse or move the deadline of the running one, returns its seq */
+uint32_t pulse_engine_start(pulse_engine_t *engine, uint32_t duration_ms);
+
+/*
+ * Timer callback. Ends the pulse and fills result if its deadline passed,
+ * re-arms for the remainder if the deadline was moved meanwhile.
+ */
+bool pulse_engine_expire(pulse_engine_t *engine, pulse_result_t *result);
+
+/* End the running pulse early, returns false if none was running */
+bool pulse_engine_stop(pulse_engine_t *engine, pulse_result_t *result);
+
+static inline bool pulse_engine_active(const pulse_engine_t *engine)
+{
+    return engine->active;
+}
@@ -0,0 +1,67 @@
+#include "rgb_pattern.h"
+
+static const rgb_color_t rgb_off = { 0, 0, 0 };
+
+static rgb_pattern_step_t rgb_pattern_blink(const rgb_pattern_t *pattern, uint32_t elapsed_ms, uint32_t half_ms)
+{
+    uint32_t phase = elapsed_ms % (2 * half_ms);
+    bool on = phase < half_ms;
+
+    return (rgb_pattern_step_t) {
+        .color = on ? pattern->color : rgb_off,
+        .fade_ms = 0,
+        .next_ms = half_ms - phase % half_ms,
+    };
+}
+
+static uint8_t rgb_scale(uint8_t level, uint32_t num, uint32_t den)
+{
+    return (uint32_t)level * num / den;
+}
+
+static rgb_pattern_step_t rgb_pattern_breathe(const rgb_pattern_t *pattern, uint32_t elapsed_ms, bool hw_fade)
+{
+    uint32_t phase = elapsed_ms % (2 * RGB_PATTERN_BREATHE_MS);
+    bool rising = phase < RGB_PATTERN_BREATHE_MS;
+
+    if (hw_fade) {
+        /* one fade per half period, the LEDC fade engine does the ramp */
+        uint32_t remaining = RGB_PATTERN_BREATHE_MS - phase % RGB_PATTERN_BREATHE_MS;
+        return (rgb_pattern_step_t) {
+            .color = rising ? pattern->color : rgb_off,
+            .fade_ms = remaining,
+            .next_ms = remaining,
+        };
+    }
+
+    uint32_t level = rising ? phase : 2 * RGB_PATTERN_BREATHE_MS - phase;
+    rgb_color_t color = {
+        .r = rgb_scale(pattern->color.r, level, RGB_PATTERN_BREATHE_MS),
+        .g = rgb_scale(pattern->color.g, level, RGB_PATTERN_BREATHE_MS),
+        .b = rgb_scale(pattern->color.b, level, RGB_PATTERN_BREATHE_MS),
+    };
+    return (rgb_pattern_step_t) {
+        .color = color,
+        .fade_ms = 0,
+        .next_ms = RGB_PATTERN_BREATHE_STEP_MS - phase % RGB_PATTERN_BREATHE_STEP_MS,
+    };
+}
+
+rgb_pattern_step_t rgb_pattern_eval(const rgb_pattern_t *pattern, uint32_t elapsed_ms, bool hw_fade)
+{
+    switch (pattern->kind) {
+    case RGB_PATTERN_BLINK:
+        return rgb_pattern_blink(pattern, elapsed_ms, RGB_PATTERN_BLINK_MS);
+    case RGB_PATTERN_FAST_BLINK:
+        return rgb_pattern_blink(pattern, elapsed_ms, RGB_PATTERN_FAST_BLINK_MS);
+    case RGB_PATTERN_BREATHE:
+        return rgb_pattern_breathe(pattern, elapsed_ms, hw_fade);
+    case RGB_PATTERN_SOLID:
+    default:
+        return (rgb_pattern_step_t) {
+            .color = pattern->color,
+            .fade_ms = 0,
+            .next_ms = RGB_PATTERN_FOREVER,
+        };
+    }
+}
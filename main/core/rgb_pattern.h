@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Table-driven RGB status patterns.
+ *
+ * rgb_pattern_eval() is a pure function of the pattern and the time since it
+ * started: it returns the color to show now and how long that stays valid, so
+ * the renderer can sleep until the next change instead of polling.
+ */
+
+#define RGB_PATTERN_FOREVER         UINT32_MAX
+
+#define RGB_PATTERN_BLINK_MS        500     // half period of a normal blink
+#define RGB_PATTERN_FAST_BLINK_MS   100     // half period of a fast blink
+#define RGB_PATTERN_BREATHE_MS      1000    // half period of a breathe cycle
+#define RGB_PATTERN_BREATHE_STEP_MS 50      // software breathe step
+
+typedef enum {
+    RGB_PATTERN_SOLID,
+    RGB_PATTERN_BLINK,
+    RGB_PATTERN_FAST_BLINK,
+    RGB_PATTERN_BREATHE,
+} rgb_pattern_kind_t;
+
+/* Channel levels in the 0-100 range used by color.h */
+typedef struct {
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+} rgb_color_t;
+
+typedef struct {
+    rgb_pattern_kind_t kind;
+    rgb_color_t color;
+} rgb_pattern_t;
+
+typedef struct {
+    rgb_color_t color;      // color to show, or to fade towards
+    uint32_t fade_ms;       // hardware fade time towards color, 0 to set it at once
+    uint32_t next_ms;       // time until the next step, RGB_PATTERN_FOREVER if none
+} rgb_pattern_step_t;
+
+/* hw_fade selects long hardware fades for RGB_PATTERN_BREATHE instead of
+ * software steps */
+rgb_pattern_step_t rgb_pattern_eval(const rgb_pattern_t *pattern, uint32_t elapsed_ms, bool hw_fade);
+
+static inline bool rgb_color_equal(rgb_color_t a, rgb_color_t b)
+{
+    return a.r == b.r && a.g == b.g && a.b == b.b;
+}
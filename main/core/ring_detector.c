@@ -0,0 +1,102 @@
+#include "ring_detector.h"
+
+#include <string.h>
+
+void ring_detector_init(ring_detector_t *det, const ring_detector_config_t *cfg, uint8_t n_channels)
+{
+    memset(det, 0, sizeof(*det));
+    det->cfg = *cfg;
+    det->n_channels = n_channels > RING_DETECTOR_MAX_CHANNELS ? RING_DETECTOR_MAX_CHANNELS : n_channels;
+    for (uint8_t c = 0; c < det->n_channels; c++) {
+        det->threshold_on[c] = cfg->threshold_on;
+        det->threshold_off[c] = cfg->threshold_off;
+    }
+}
+
+void ring_detector_set_thresholds(ring_detector_t *det, uint8_t channel, uint16_t threshold_on,
+                                  uint16_t threshold_off)
+{
+    if (channel < det->n_channels) {
+        det->threshold_on[channel] = threshold_on;
+        det->threshold_off[channel] = threshold_off;
+    }
+}
+
+/* Debounce check, only reached while the Schmitt output differs from the ring state */
+static size_t ring_detector_debounce(ring_detector_t *det, uint8_t c, int64_t now_us,
+                                     ring_event_t *events, size_t n_events, size_t max_events)
+{
+    int64_t held_us = now_us - det->level_since_us[c];
+
+    if (det->level_high[c] && held_us >= det->cfg.min_on_us) {
+        det->ringing[c] = 1;
+        if (n_events < max_events) {
+            events[n_events++] = (ring_event_t) {
+                .type = RING_EVENT_START,
+                .channel = c,
+                .timestamp_us = det->level_since_us[c],
+                .peak = det->peak[c],
+            };
+        }
+        det->ring_start_us[c] = det->level_since_us[c];
+    } else if (!det->level_high[c] && held_us >= det->cfg.min_off_us) {
+        det->ringing[c] = 0;
+        if (n_events < max_events) {
+            events[n_events++] = (ring_event_t) {
+                .type = RING_EVENT_STOP,
+                .channel = c,
+                .timestamp_us = det->level_since_us[c],
+                .duration_us = det->level_since_us[c] - det->ring_start_us[c],
+                .peak = det->peak[c],
+            };
+        }
+    }
+    return n_events;
+}
+
+size_t ring_detector_process(ring_detector_t *det, const uint16_t *samples, size_t n_sets,
+                             int64_t t0_us, ring_event_t *events, size_t max_events)
+{
+    const uint8_t n = det->n_channels;
+    const uint8_t shift = det->cfg.smoothing_shift;
+    size_t n_events = 0;
+
+    if (!det->primed && n_sets > 0) {
+        // The first set seeds the filters, the update below then leaves them at that value
+        for (uint8_t c = 0; c < n; c++) {
+            det->filter_acc[c] = (uint32_t)samples[c] << shift;
+        }
+        det->primed = true;
+    }
+
+    for (size_t i = 0; i < n_sets; i++, samples += n) {
+        int64_t now_us = t0_us + (int64_t)i * det->cfg.sample_period_us;
+
+        for (uint8_t c = 0; c < n; c++) {
+            uint32_t acc = det->filter_acc[c] - (det->filter_acc[c] >> shift) + samples[c];
+            det->filter_acc[c] = acc;
+            uint16_t value = acc >> shift;
+
+            if (det->level_high[c]) {
+                if (value <= det->threshold_off[c]) {
+                    det->level_high[c] = 0;
+                    det->level_since_us[c] = now_us;
+                } else if (value > det->peak[c]) {
+                    det->peak[c] = value;
+                }
+            } else if (value >= det->threshold_on[c]) {
+                det->level_high[c] = 1;
+                det->level_since_us[c] = now_us;
+                if (!det->ringing[c] || value > det->peak[c]) {
+                    det->peak[c] = value;
+                }
+            }
+
+            // Idle and steadily ringing lines stop here
+            if (det->level_high[c] != det->ringing[c]) {
+                n_events = ring_detector_debounce(det, c, now_us, events, n_events, max_events);
+            }
+        }
+    }
+    return n_events;
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Streaming ring detector for the handset LED lines.
+ *
+ * Samples go through a first order IIR low-pass, a Schmitt trigger with
+ * separate on/off thresholds and a minimum-duration debounce. Only debounced
+ * transitions are reported, as ring start/stop events.
+ *
+ * One detector watches up to RING_DETECTOR_MAX_CHANNELS lines fed as
+ * interleaved sample sets, one value per channel. The per-channel state is
+ * kept as parallel arrays so a set touches a few adjacent words per field
+ * instead of one scattered struct per line.
+ * Pure C, no ESP-IDF dependencies.
+ */
+
+#define RING_DETECTOR_MAX_CHANNELS  8
+
+typedef enum {
+    RING_EVENT_START,
+    RING_EVENT_STOP,
+} ring_event_type_t;
+
+typedef struct {
+    ring_event_type_t type;
+    uint8_t channel;        // index of the channel in the sample set, callers may relabel it
+    int64_t timestamp_us;   // time of the edge that started / ended the ring
+    int64_t duration_us;    // ring length, only set for RING_EVENT_STOP
+    uint16_t peak;          // highest filtered value seen during the ring
+} ring_event_t;
+
+typedef struct {
+    uint16_t threshold_on;      // filtered value at or above which the line is high
+    uint16_t threshold_off;     // filtered value at or below which the line is low
+    uint32_t sample_period_us;
+    uint32_t min_on_us;         // line must stay high this long to start a ring
+    uint32_t min_off_us;        // line must stay low this long to end a ring
+    uint8_t smoothing_shift;    // IIR weight is 1 / 2^shift, 0 disables smoothing
+} ring_detector_config_t;
+
+typedef struct {
+    ring_detector_config_t cfg;
+    uint8_t n_channels;
+    bool primed;
+
+    // Per channel, indexed by position in the sample set
+    uint16_t threshold_on[RING_DETECTOR_MAX_CHANNELS];
+    uint16_t threshold_off[RING_DETECTOR_MAX_CHANNELS];
+    uint32_t filter_acc[RING_DETECTOR_MAX_CHANNELS];        // filtered value scaled by 2^shift
+    uint16_t peak[RING_DETECTOR_MAX_CHANNELS];
+    uint8_t level_high[RING_DETECTOR_MAX_CHANNELS];         // Schmitt trigger output
+    uint8_t ringing[RING_DETECTOR_MAX_CHANNELS];            // debounced state
+    int64_t level_since_us[RING_DETECTOR_MAX_CHANNELS];     // time of the last Schmitt trigger edge
+    int64_t ring_start_us[RING_DETECTOR_MAX_CHANNELS];
+} ring_detector_t;
+
+/* All n_channels start with the thresholds of cfg */
+void ring_detector_init(ring_detector_t *det, const ring_detector_config_t *cfg, uint8_t n_channels);
+
+/* Thresholds for a single line, e.g. one with a dimmer handset LED */
+void ring_detector_set_thresholds(ring_detector_t *det, uint8_t channel, uint16_t threshold_on,
+                                  uint16_t threshold_off);
+
+/* Feed n_sets consecutive sample sets of n_channels values each, the first
+ * taken at t0_us. Writes up to max_events events and returns how many were
+ * written. */
+size_t ring_detector_process(ring_detector_t *det, const uint16_t *samples, size_t n_sets,
+                             int64_t t0_us, ring_event_t *events, size_t max_events);
+
+static inline bool ring_detector_is_ringing(const ring_detector_t *det, uint8_t channel)
+{
+    return det->ringing[channel];
+}
@@ -0,0 +1,81 @@
+#include "rpc_tracker.h"
+
+#include <string.h>
+
+void rpc_tracker_init(rpc_tracker_t *tracker, uint32_t timeout_ms)
+{
+    memset(tracker, 0, sizeof(*tracker));
+    tracker->next_id = 1;
+    tracker->timeout_us = (int64_t)timeout_ms * 1000;
+}
+
+uint32_t rpc_tracker_begin(rpc_tracker_t *tracker, const char *response_topic, size_t topic_len,
+                           const uint8_t *correlation, size_t correlation_len, int64_t received_us)
+{
+    if (topic_len == 0 || topic_len >= RPC_TOPIC_MAX || correlation_len > RPC_CORRELATION_MAX) {
+        tracker->rejected++;
+        return 0;
+    }
+
+    for (int i = 0; i < RPC_MAX_INFLIGHT; i++) {
+        rpc_request_t *request = &tracker->slots[i];
+        if (request->id != 0) {
+            continue;
+        }
+        request->id = tracker->next_id++;
+        if (tracker->next_id == 0) {
+            tracker->next_id = 1;
+        }
+        memcpy(request->response_topic, response_topic, topic_len);
+        request->response_topic[topic_len] = '\0';
+        memcpy(request->correlation, correlation, correlation_len);
+        request->correlation_len = correlation_len;
+        request->received_us = received_us;
+        request->deadline_us = received_us + tracker->timeout_us;
+        tracker->started++;
+        return request->id;
+    }
+
+    tracker->rejected++;
+    return 0;
+}
+
+bool rpc_tracker_complete(rpc_tracker_t *tracker, uint32_t id, rpc_request_t *request)
+{
+    if (id == 0) {
+        return false;
+    }
+    for (int i = 0; i < RPC_MAX_INFLIGHT; i++) {
+        if (tracker->slots[i].id == id) {
+            *request = tracker->slots[i];
+            tracker->slots[i].id = 0;
+            tracker->completed++;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool rpc_tracker_expire(rpc_tracker_t *tracker, int64_t now_us, rpc_request_t *request)
+{
+    for (int i = 0; i < RPC_MAX_INFLIGHT; i++) {
+        if (tracker->slots[i].id != 0 && tracker->slots[i].deadline_us <= now_us) {
+            *request = tracker->slots[i];
+            tracker->slots[i].id = 0;
+            tracker->timed_out++;
+            return true;
+        }
+    }
+    return false;
+}
+
+int64_t rpc_tracker_next_deadline(const rpc_tracker_t *tracker)
+{
+    int64_t next = INT64_MAX;
+    for (int i = 0; i < RPC_MAX_INFLIGHT; i++) {
+        if (tracker->slots[i].id != 0 && tracker->slots[i].deadline_us < next) {
+            next = tracker->slots[i].deadline_us;
+        }
+    }
+    return next;
+}
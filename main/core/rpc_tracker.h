@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * In-flight table for MQTT 5 request/response.
+ *
+ * A request that carries a response topic gets an id and a deadline. It
+ * leaves the table either when its handler completes it or when the deadline
+ * passes, whichever comes first, so every request is answered exactly once.
+ * Pure C, the caller supplies time and serialises access.
+ */
+
+#define RPC_MAX_INFLIGHT        8
+#define RPC_TOPIC_MAX           64
+#define RPC_CORRELATION_MAX     32
+
+typedef struct {
+    uint32_t id;                        // 0 marks a free slot
+    char response_topic[RPC_TOPIC_MAX];
+    uint8_t correlation[RPC_CORRELATION_MAX];
+    uint8_t correlation_len;
+    int64_t received_us;
+    int64_t deadline_us;
+} rpc_request_t;
+
+typedef struct {
+    rpc_request_t slots[RPC_MAX_INFLIGHT];
+    uint32_t next_id;
+    int64_t timeout_us;
+    uint32_t started;
+    uint32_t completed;
+    uint32_t timed_out;
+    uint32_t rejected;                  // table full or properties too long
+} rpc_tracker_t;
+
+void rpc_tracker_init(rpc_tracker_t *tracker, uint32_t timeout_ms);
+
+/* Returns the request id, 0 if the request cannot be tracked */
+uint32_t rpc_tracker_begin(rpc_tracker_t *tracker, const char *response_topic, size_t topic_len,
+                           const uint8_t *correlation, size_t correlation_len, int64_t received_us);
+
+/* Remove a request, false if it is unknown or already timed out */
+bool rpc_tracker_complete(rpc_tracker_t *tracker, uint32_t id, rpc_request_t *request);
+
+/* Remove one request whose deadline passed, false if there is none */
+bool rpc_tracker_expire(rpc_tracker_t *tracker, int64_t now_us, rpc_request_t *request);
+
+/* Earliest deadline, INT64_MAX if nothing is in flight */
+int64_t rpc_tracker_next_deadline(const rpc_tracker_t *tracker);
@@ -0,0 +1,74 @@
+#include "state_bus.h"
+
+#include <string.h>
+
+void state_bus_init(state_bus_t *bus, state_bus_resolver_t resolver)
+{
+    memset(bus, 0, sizeof(*bus));
+    for (int i = 0; i < STATE_BUS_SLOT_COUNT; i++) {
+        atomic_init(&bus->slots[i], STATE_BUS_NONE);
+    }
+    atomic_init(&bus->version, 0);
+    atomic_init(&bus->n_subscribers, 0);
+    bus->resolver = resolver;
+}
+
+bool state_bus_subscribe(state_bus_t *bus, state_bus_subscriber_t subscriber, void *ctx)
+{
+    unsigned n = atomic_load(&bus->n_subscribers);
+    if (n >= STATE_BUS_MAX_SUBSCRIBERS) {
+        return false;
+    }
+    bus->subscribers[n] = subscriber;
+    bus->subscriber_ctx[n] = ctx;
+    atomic_store_explicit(&bus->n_subscribers, n + 1, memory_order_release);
+    return true;
+}
+
+bool state_bus_publish(state_bus_t *bus, state_bus_slot_t slot, uint16_t value)
+{
+    /* The version is bumped on both sides of the slot write, so a reader that
+     * sees the same version before and after copying the slots knows no write
+     * completed or started in between. Readers never wait on a writer, which
+     * matters when a preempted low priority task is the writer. */
+    atomic_fetch_add_explicit(&bus->version, 1, memory_order_acq_rel);
+    unsigned previous = atomic_exchange_explicit(&bus->slots[slot], value, memory_order_acq_rel);
+    atomic_fetch_add_explicit(&bus->version, 1, memory_order_acq_rel);
+
+    if (previous == value) {
+        return false;
+    }
+
+    unsigned n = atomic_load_explicit(&bus->n_subscribers, memory_order_acquire);
+    for (unsigned i = 0; i < n; i++) {
+        bus->subscribers[i](bus->subscriber_ctx[i], slot, value);
+    }
+    return true;
+}
+
+uint16_t state_bus_get(state_bus_t *bus, state_bus_slot_t slot)
+{
+    return atomic_load_explicit(&bus->slots[slot], memory_order_acquire);
+}
+
+void state_bus_snapshot(state_bus_t *bus, state_bus_snapshot_t *snapshot)
+{
+    while (1) {
+        unsigned before = atomic_load_explicit(&bus->version, memory_order_acquire);
+        for (int i = 0; i < STATE_BUS_SLOT_COUNT; i++) {
+            snapshot->slots[i] = atomic_load_explicit(&bus->slots[i], memory_order_acquire);
+        }
+        unsigned after = atomic_load_explicit(&bus->version, memory_order_acquire);
+        if (before == after) {
+            snapshot->version = after;
+            return;
+        }
+    }
+}
+
+uint16_t state_bus_composite(state_bus_t *bus)
+{
+    state_bus_snapshot_t snapshot;
+    state_bus_snapshot(bus, &snapshot);
+    return bus->resolver(&snapshot);
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Lock-free state bus.
+ *
+ * Every subsystem owns one slot and is its only writer. Slots are single
+ * atomic words, and a global version counter lets readers take a consistent
+ * snapshot of all slots without a mutex (retry if a write landed meanwhile).
+ * Which slot wins in the composite view is decided by a resolver supplied by
+ * the application. Pure C, no ESP-IDF dependencies.
+ */
+
+#define STATE_BUS_NONE              0   // slot has nothing to report
+#define STATE_BUS_MAX_SUBSCRIBERS   4
+
+typedef enum {
+    STATE_BUS_WIFI,
+    STATE_BUS_MQTT,
+    STATE_BUS_ACTIVITY,     // short-lived states such as sending / receiving
+    STATE_BUS_OTA,
+    STATE_BUS_SLOT_COUNT,
+} state_bus_slot_t;
+
+typedef struct {
+    uint16_t slots[STATE_BUS_SLOT_COUNT];
+    uint32_t version;
+} state_bus_snapshot_t;
+
+/* Returns the composite state for a snapshot */
+typedef uint16_t (*state_bus_resolver_t)(const state_bus_snapshot_t *snapshot);
+
+/* Called from the writer's context after a slot changed, must not block */
+typedef void (*state_bus_subscriber_t)(void *ctx, state_bus_slot_t slot, uint16_t value);
+
+typedef struct {
+    atomic_uint slots[STATE_BUS_SLOT_COUNT];
+    atomic_uint version;        // bumped before and after every slot write
+    state_bus_resolver_t resolver;
+    state_bus_subscriber_t subscribers[STATE_BUS_MAX_SUBSCRIBERS];
+    void *subscriber_ctx[STATE_BUS_MAX_SUBSCRIBERS];
+    atomic_uint n_subscribers;
+} state_bus_t;
+
+void state_bus_init(state_bus_t *bus, state_bus_resolver_t resolver);
+
+/* Register a subscriber, meant to be called during init before writers run */
+bool state_bus_subscribe(state_bus_t *bus, state_bus_subscriber_t subscriber, void *ctx);
+
+/* Store a value in the slot, returns false if it did not change */
+bool state_bus_publish(state_bus_t *bus, state_bus_slot_t slot, uint16_t value);
+
+uint16_t state_bus_get(state_bus_t *bus, state_bus_slot_t slot);
+void state_bus_snapshot(state_bus_t *bus, state_bus_snapshot_t *snapshot);
+uint16_t state_bus_composite(state_bus_t *bus);
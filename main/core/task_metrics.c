@@ -0,0 +1,37 @@
+#include "task_metrics.h"
+
+#include <string.h>
+
+void task_metrics_init(task_metrics_t *metrics)
+{
+    memset(metrics, 0, sizeof(*metrics));
+}
+
+static uint32_t task_metrics_previous(const task_metrics_t *metrics, uint32_t id)
+{
+    for (size_t i = 0; i < metrics->n_prev; i++) {
+        if (metrics->prev[i].id == id) {
+            return metrics->prev[i].runtime;
+        }
+    }
+    return 0;
+}
+
+void task_metrics_update(task_metrics_t *metrics, const task_runtime_t *tasks, size_t n,
+                         uint32_t total, uint32_t cores, uint16_t *permille)
+{
+    if (n > TASK_METRICS_MAX_TASKS) {
+        n = TASK_METRICS_MAX_TASKS;
+    }
+    uint64_t capacity = (uint64_t)(uint32_t)(total - metrics->prev_total) * (cores > 0 ? cores : 1);
+
+    for (size_t i = 0; i < n; i++) {
+        uint32_t delta = tasks[i].runtime - task_metrics_previous(metrics, tasks[i].id);
+        uint64_t share = capacity > 0 ? (uint64_t)delta * 1000 / capacity : 0;
+        permille[i] = share > 1000 ? 1000 : (uint16_t)share;
+    }
+
+    memcpy(metrics->prev, tasks, n * sizeof(tasks[0]));
+    metrics->n_prev = n;
+    metrics->prev_total = total;
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Per-task CPU share from FreeRTOS run time counters.
+ *
+ * Counters are 32 bit and wrap, so only deltas between two consecutive
+ * samples are used; the sample period has to stay below one wrap (about
+ * 71 minutes with the 1 MHz esp_timer counter). A task not seen in the
+ * previous sample is charged its whole counter. Pure C.
+ */
+
+#define TASK_METRICS_MAX_TASKS  24
+
+typedef struct {
+    uint32_t id;            // xTaskNumber, unique for the lifetime of a task
+    uint32_t runtime;
+} task_runtime_t;
+
+typedef struct {
+    task_runtime_t prev[TASK_METRICS_MAX_TASKS];
+    size_t n_prev;
+    uint32_t prev_total;
+} task_metrics_t;
+
+void task_metrics_init(task_metrics_t *metrics);
+
+/*
+ * Take a new sample of n tasks (at most TASK_METRICS_MAX_TASKS) and the total
+ * counter, and write each task's share of the elapsed CPU time in permille.
+ * cores is the number of CPUs the counters are spread over.
+ */
+void task_metrics_update(task_metrics_t *metrics, const task_runtime_t *tasks, size_t n,
+                         uint32_t total, uint32_t cores, uint16_t *permille);
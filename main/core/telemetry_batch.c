@@ -0,0 +1,135 @@
+#include "telemetry_batch.h"
+
+#include <string.h>
+
+void telemetry_batch_init(telemetry_batch_t *batch, uint16_t period_ms, uint8_t channel_mask)
+{
+    memset(batch, 0, sizeof(*batch));
+    batch->period_ms = period_ms;
+    batch->channel_mask = channel_mask;
+    batch->n_channels = __builtin_popcount(channel_mask);
+}
+
+static void telemetry_batch_reset_period(telemetry_batch_t *batch)
+{
+    memset(batch->acc_sum, 0, sizeof(batch->acc_sum));
+    memset(batch->acc_peak, 0, sizeof(batch->acc_peak));
+    batch->acc_count = 0;
+}
+
+void telemetry_batch_begin(telemetry_batch_t *batch, int64_t window_start_us)
+{
+    batch->window_start_us = window_start_us;
+    batch->overruns = 0;
+    batch->n_periods = 0;
+    batch->n_events = 0;
+    batch->events_dropped = 0;
+    telemetry_batch_reset_period(batch);
+}
+
+void telemetry_batch_add_samples(telemetry_batch_t *batch, const uint16_t *samples, size_t n_sets)
+{
+    const uint8_t n = batch->n_channels;
+
+    for (size_t i = 0; i < n_sets; i++, samples += n) {
+        for (uint8_t c = 0; c < n; c++) {
+            batch->acc_sum[c] += samples[c];
+            if (samples[c] > batch->acc_peak[c]) {
+                batch->acc_peak[c] = samples[c];
+            }
+        }
+    }
+    batch->acc_count += n_sets;
+}
+
+uint8_t telemetry_batch_close_period(telemetry_batch_t *batch)
+{
+    if (batch->n_periods < TELEMETRY_MAX_PERIODS) {
+        telemetry_period_t *period = &batch->periods[batch->n_periods++ * batch->n_channels];
+        for (uint8_t c = 0; c < batch->n_channels; c++) {
+            period[c].peak = batch->acc_peak[c];
+            period[c].mean = batch->acc_count ? batch->acc_sum[c] / batch->acc_count : 0;
+        }
+    }
+    telemetry_batch_reset_period(batch);
+    return batch->n_periods;
+}
+
+void telemetry_batch_add_event(telemetry_batch_t *batch, uint8_t type, uint8_t channel, int64_t timestamp_us,
+                               int64_t duration_us, uint16_t peak)
+{
+    if (batch->n_events >= TELEMETRY_MAX_EVENTS) {
+        if (batch->events_dropped < UINT16_MAX) {
+            batch->events_dropped++;
+        }
+        return;
+    }
+    int64_t offset_us = timestamp_us - batch->window_start_us;
+    batch->events[batch->n_events++] = (telemetry_event_t) {
+        .type = type,
+        .channel = channel,
+        .offset_ms = offset_us > 0 ? offset_us / 1000 : 0,
+        .duration_ms = duration_us / 1000,
+        .peak = peak,
+    };
+}
+
+void telemetry_batch_add_overruns(telemetry_batch_t *batch, uint32_t overruns)
+{
+    uint32_t total = batch->overruns + overruns;
+    batch->overruns = total > UINT16_MAX ? UINT16_MAX : total;
+}
+
+static uint8_t *put_u16(uint8_t *p, uint16_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    return p + 2;
+}
+
+static uint8_t *put_u32(uint8_t *p, uint32_t v)
+{
+    p = put_u16(p, v);
+    return put_u16(p, v >> 16);
+}
+
+static uint8_t *put_u64(uint8_t *p, uint64_t v)
+{
+    p = put_u32(p, v);
+    return put_u32(p, v >> 32);
+}
+
+size_t telemetry_batch_encode(const telemetry_batch_t *batch, uint8_t *buf, size_t len)
+{
+    size_t n_values = batch->n_periods * batch->n_channels;
+    size_t needed = TELEMETRY_HEADER_SIZE + n_values * TELEMETRY_PERIOD_SIZE +
+                    batch->n_events * TELEMETRY_EVENT_SIZE;
+    if (len < needed) {
+        return 0;
+    }
+
+    uint8_t *p = buf;
+    *p++ = TELEMETRY_BATCH_MAGIC;
+    *p++ = TELEMETRY_BATCH_VERSION;
+    p = put_u16(p, batch->period_ms);
+    p = put_u32(p, batch->seq);
+    p = put_u64(p, (uint64_t)batch->window_start_us);
+    p = put_u16(p, batch->overruns);
+    *p++ = batch->n_periods;
+    *p++ = batch->n_events;
+    *p++ = batch->channel_mask;
+    p = put_u16(p, batch->events_dropped);
+
+    for (size_t i = 0; i < n_values; i++) {
+        p = put_u16(p, batch->periods[i].peak);
+        p = put_u16(p, batch->periods[i].mean);
+    }
+    for (uint8_t i = 0; i < batch->n_events; i++) {
+        *p++ = batch->events[i].type;
+        *p++ = batch->events[i].channel;
+        p = put_u32(p, batch->events[i].offset_ms);
+        p = put_u32(p, batch->events[i].duration_ms);
+        p = put_u16(p, batch->events[i].peak);
+    }
+    return p - buf;
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Telemetry aggregation into one packed binary record per window.
+ *
+ * All monitored channels share one record, so the number of publishes does
+ * not grow with the channel count. Record layout, all fields little-endian:
+ *
+ *   u8  magic               'T'
+ *   u8  version             TELEMETRY_BATCH_VERSION
+ *   u16 period_ms           length of one period
+ *   u32 seq                 batch sequence number, gaps mean lost batches
+ *   i64 window_start_us     uptime at the start of the first period
+ *   u16 overruns            ADC frames dropped during the window
+ *   u8  n_periods
+ *   u8  n_events
+ *   u8  channel_mask        bit n set for ADC1 channel n, n_channels bits set
+ *   u16 events_dropped      events past TELEMETRY_MAX_EVENTS in the window, saturates
+ *   n_periods x n_channels x { u16 peak, u16 mean }   ascending channel order
+ *   n_events  x { u8 type, u8 channel, u32 offset_ms, u32 duration_ms, u16 peak }
+ *
+ * tools/telemetry_decode.py decodes them on the host; host/test/vectors/telemetry
+ * holds sample records with their expected decode.
+ */
+
+#define TELEMETRY_BATCH_MAGIC       'T'
+#define TELEMETRY_BATCH_VERSION     1
+#define TELEMETRY_MAX_PERIODS       60
+#define TELEMETRY_MAX_EVENTS        16
+#define TELEMETRY_MAX_CHANNELS      8
+
+#define TELEMETRY_HEADER_SIZE       23
+#define TELEMETRY_PERIOD_SIZE       4
+#define TELEMETRY_EVENT_SIZE        12
+/* Largest record for the given channel and period count */
+#define TELEMETRY_BATCH_SIZE(channels, periods) \
+    (TELEMETRY_HEADER_SIZE + (periods) * (channels) * TELEMETRY_PERIOD_SIZE + \
+     TELEMETRY_MAX_EVENTS * TELEMETRY_EVENT_SIZE)
+#define TELEMETRY_BATCH_MAX_SIZE    TELEMETRY_BATCH_SIZE(TELEMETRY_MAX_CHANNELS, TELEMETRY_MAX_PERIODS)
+
+typedef struct {
+    uint16_t peak;
+    uint16_t mean;
+} telemetry_period_t;
+
+typedef struct {
+    uint8_t type;
+    uint8_t channel;        // ADC1 channel number
+    uint32_t offset_ms;     // from window_start_us
+    uint32_t duration_ms;
+    uint16_t peak;
+} telemetry_event_t;
+
+typedef struct {
+    uint32_t seq;
+    uint16_t period_ms;
+    int64_t window_start_us;
+    uint16_t overruns;
+    uint8_t channel_mask;
+    uint8_t n_channels;
+
+    telemetry_period_t periods[TELEMETRY_MAX_PERIODS * TELEMETRY_MAX_CHANNELS];    // period major
+    uint8_t n_periods;
+    telemetry_event_t events[TELEMETRY_MAX_EVENTS];
+    uint8_t n_events;
+    uint16_t events_dropped;
+
+    /* accumulators of the period in progress, per channel */
+    uint32_t acc_sum[TELEMETRY_MAX_CHANNELS];
+    uint16_t acc_peak[TELEMETRY_MAX_CHANNELS];
+    uint32_t acc_count;     // sample sets
+} telemetry_batch_t;
+
+/* Samples come in sets of one value per channel of channel_mask, at most TELEMETRY_MAX_CHANNELS */
+void telemetry_batch_init(telemetry_batch_t *batch, uint16_t period_ms, uint8_t channel_mask);
+
+/* Start a new window, the sequence number keeps counting */
+void telemetry_batch_begin(telemetry_batch_t *batch, int64_t window_start_us);
+
+void telemetry_batch_add_samples(telemetry_batch_t *batch, const uint16_t *samples, size_t n_sets);
+/* Close the period in progress, returns the number of periods in the window */
+uint8_t telemetry_batch_close_period(telemetry_batch_t *batch);
+/* Events past TELEMETRY_MAX_EVENTS are only counted */
+void telemetry_batch_add_event(telemetry_batch_t *batch, uint8_t type, uint8_t channel, int64_t timestamp_us,
+                               int64_t duration_us, uint16_t peak);
+void telemetry_batch_add_overruns(telemetry_batch_t *batch, uint32_t overruns);
+
+/* Encode the window into buf, returns the encoded length or 0 if buf is too small */
+size_t telemetry_batch_encode(const telemetry_batch_t *batch, uint8_t *buf, size_t len);
@@ -0,0 +1,119 @@
+#include "topic_router.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/* strcmp between a NUL-terminated filter and a length-delimited topic */
+static int compare_topic(const char *filter, const char *topic, size_t topic_len)
+{
+    size_t filter_len = strlen(filter);
+    int cmp = memcmp(filter, topic, filter_len < topic_len ? filter_len : topic_len);
+    if (cmp != 0) {
+        return cmp;
+    }
+    return filter_len < topic_len ? -1 : filter_len > topic_len;
+}
+
+static int compare_routes(const void *a, const void *b)
+{
+    const topic_route_t *ra = *(const topic_route_t *const *)a;
+    const topic_route_t *rb = *(const topic_route_t *const *)b;
+    return strcmp(ra->filter, rb->filter);
+}
+
+bool topic_router_init(topic_router_t *router, const topic_route_t *routes, size_t n,
+                       const topic_route_t **index)
+{
+    size_t n_exact = 0;
+    size_t n_wild = 0;
+
+    // Exact filters fill the index from the front, wildcards keep table order behind them
+    for (size_t i = 0; i < n; i++) {
+        if (!topic_filter_is_wildcard(routes[i].filter)) {
+            index[n_exact++] = &routes[i];
+        }
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (topic_filter_is_wildcard(routes[i].filter)) {
+            index[n_exact + n_wild++] = &routes[i];
+        }
+    }
+    qsort(index, n_exact, sizeof(index[0]), compare_routes);
+
+    router->index = index;
+    router->n_exact = n_exact;
+    router->n_routes = n;
+
+    for (size_t i = 1; i < n_exact; i++) {
+        if (strcmp(index[i - 1]->filter, index[i]->filter) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool topic_filter_matches(const char *filter, const char *topic, size_t topic_len)
+{
+    size_t pos = 0;
+
+    // Wildcards at the first level do not match system topics
+    if (topic_len > 0 && topic[0] == '$' && (filter[0] == '+' || filter[0] == '#')) {
+        return false;
+    }
+
+    while (*filter != '\0') {
+        if (*filter == '#') {
+            return true;
+        }
+        if (*filter == '+') {
+            while (pos < topic_len && topic[pos] != '/') {
+                pos++;
+            }
+            filter++;
+        } else {
+            if (pos >= topic_len || *filter != topic[pos]) {
+                // "a/#" also matches the parent level "a"
+                return pos == topic_len && filter[0] == '/' && filter[1] == '#' && filter[2] == '\0';
+            }
+            filter++;
+            pos++;
+        }
+    }
+    return pos == topic_len;
+}
+
+const topic_route_t *topic_router_find(const topic_router_t *router, const char *topic, size_t topic_len)
+{
+    size_t lo = 0;
+    size_t hi = router->n_exact;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int cmp = compare_topic(router->index[mid]->filter, topic, topic_len);
+        if (cmp == 0) {
+            return router->index[mid];
+        }
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    for (size_t i = router->n_exact; i < router->n_routes; i++) {
+        if (topic_filter_matches(router->index[i]->filter, topic, topic_len)) {
+            return router->index[i];
+        }
+    }
+    return NULL;
+}
+
+topic_dispatch_t topic_router_dispatch(const topic_router_t *router, const char *topic, size_t topic_len,
+                                       const char *data, size_t data_len)
+{
+    const topic_route_t *route = topic_router_find(router, topic, topic_len);
+    if (route == NULL) {
+        return TOPIC_DISPATCH_NO_ROUTE;
+    }
+    return route->handler(topic, topic_len, data, data_len, route->ctx) ? TOPIC_DISPATCH_OK : TOPIC_DISPATCH_REJECTED;
+}
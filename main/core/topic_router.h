@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * MQTT topic router over a table of routes fixed at compile time.
+ *
+ * Exact topic filters are sorted once and looked up by binary search on the
+ * received (not NUL-terminated) topic, so a topic that is only a prefix of a
+ * filter never matches. Filters containing the MQTT wildcards '+' and '#' are
+ * tried in table order when no exact filter matches. Pure C.
+ */
+
+/* Returns false if the payload was rejected */
+typedef bool (*topic_handler_t)(const char *topic, size_t topic_len,
+                                const char *data, size_t data_len, void *ctx);
+
+typedef enum {
+    TOPIC_DISPATCH_OK,
+    TOPIC_DISPATCH_REJECTED,    // the handler refused the payload
+    TOPIC_DISPATCH_NO_ROUTE,
+} topic_dispatch_t;
+
+typedef struct {
+    const char *filter;
+    topic_handler_t handler;
+    void *ctx;
+} topic_route_t;
+
+typedef struct {
+    const topic_route_t **index;    // exact routes sorted, then wildcard routes
+    size_t n_exact;
+    size_t n_routes;
+} topic_router_t;
+
+/* index must hold n pointers. Returns false on duplicate exact filters */
+bool topic_router_init(topic_router_t *router, const topic_route_t *routes, size_t n,
+                       const topic_route_t **index);
+
+const topic_route_t *topic_router_find(const topic_router_t *router, const char *topic, size_t topic_len);
+
+/* Call the handler of the matching route */
+topic_dispatch_t topic_router_dispatch(const topic_router_t *router, const char *topic, size_t topic_len,
+                           const char *data, size_t data_len);
+
+/* MQTT topic filter matching with '+' and '#' */
+bool topic_filter_matches(const char *filter, const char *topic, size_t topic_len);
+
+static inline bool topic_filter_is_wildcard(const char *filter)
+{
+    for (; *filter != '\0'; filter++) {
+        if (*filter == '+' || *filter == '#') {
+            return true;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,197 @@
+#include "waveform_capture.h"
+
+#include <string.h>
+
+void waveform_capture_init(waveform_capture_t *cap, uint16_t *buf, uint32_t pre_samples, uint32_t post_samples,
+                           uint32_t sample_period_us, uint16_t channel_mask)
+{
+    memset(cap, 0, sizeof(*cap));
+    cap->buf = buf;
+    cap->channel_mask = channel_mask;
+    cap->channels = channel_mask ? __builtin_popcount(channel_mask) : 1;
+    cap->pre_samples = pre_samples;
+    cap->post_samples = post_samples > 0 ? post_samples : 1;
+    cap->capacity = pre_samples + cap->post_samples;
+    cap->sample_period_us = sample_period_us > 0 ? sample_period_us : 1;
+    atomic_init(&cap->missed, 0);
+    atomic_init(&cap->state, WAVEFORM_ARMED);
+}
+
+/* Copy sample sets into the circular buffer, only the newest capacity sets are kept */
+static void waveform_store(waveform_capture_t *cap, const uint16_t *samples, size_t count)
+{
+    if (count > cap->capacity) {
+        cap->written += count - cap->capacity;
+        samples += (count - cap->capacity) * cap->channels;
+        count = cap->capacity;
+    }
+    uint32_t pos = (uint32_t)(cap->written % cap->capacity);
+    size_t first = cap->capacity - pos < count ? cap->capacity - pos : count;
+    size_t set_bytes = cap->channels * sizeof(samples[0]);
+    memcpy(cap->buf + pos * cap->channels, samples, first * set_bytes);
+    memcpy(cap->buf, samples + first * cap->channels, (count - first) * set_bytes);
+    cap->written += count;
+}
+
+/* Window = trigger - pre .. written, limited to what is still buffered and to the current capture */
+static void waveform_freeze(waveform_capture_t *cap)
+{
+    uint64_t start = cap->trigger_at > cap->pre_samples ? cap->trigger_at - cap->pre_samples : 0;
+    if (cap->written > cap->capacity && start < cap->written - cap->capacity) {
+        start = cap->written - cap->capacity;
+    }
+    if (start < cap->armed_at) {
+        start = cap->armed_at;
+    }
+
+    cap->start_at = start;
+    cap->window.n_samples = (uint32_t)(cap->written - start);
+    cap->window.trigger = cap->trigger_at > start ? (uint32_t)(cap->trigger_at - start) : 0;
+    cap->window.start_us = cap->feed_us + ((int64_t)start - (int64_t)cap->feed_at) * cap->sample_period_us;
+    cap->window.trigger_channel = cap->trigger_channel;
+    atomic_store_explicit(&cap->state, WAVEFORM_FROZEN, memory_order_release);
+}
+
+bool waveform_capture_feed(waveform_capture_t *cap, const uint16_t *samples, size_t count, int64_t t0_us)
+{
+    int state = atomic_load_explicit(&cap->state, memory_order_acquire);
+    cap->feed_at = cap->written;
+    cap->feed_us = t0_us;
+
+    if (state == WAVEFORM_RELEASED) {
+        // Older samples belong to the capture just uploaded, or were never stored
+        cap->armed_at = cap->written;
+        state = WAVEFORM_ARMED;
+        atomic_store_explicit(&cap->state, state, memory_order_relaxed);
+    }
+    if (state == WAVEFORM_FROZEN) {
+        cap->written += count;
+        return false;
+    }
+
+    size_t stored = count;
+    if (state == WAVEFORM_TRIGGERED && cap->end_at - cap->written < stored) {
+        stored = (size_t)(cap->end_at - cap->written);
+    }
+    waveform_store(cap, samples, stored);
+
+    bool froze = false;
+    if (state == WAVEFORM_TRIGGERED && cap->written == cap->end_at) {
+        waveform_freeze(cap);
+        froze = true;
+    }
+    cap->written += count - stored;
+    return froze;
+}
+
+bool waveform_capture_trigger(waveform_capture_t *cap, int64_t timestamp_us, uint8_t channel)
+{
+    if (atomic_load_explicit(&cap->state, memory_order_relaxed) != WAVEFORM_ARMED) {
+        atomic_fetch_add_explicit(&cap->missed, 1, memory_order_relaxed);
+        return false;
+    }
+
+    // Rounded sample number of the timestamp, relative to the latest feed
+    int64_t delta_us = timestamp_us - cap->feed_us;
+    int64_t half = cap->sample_period_us / 2;
+    int64_t offset = (delta_us >= 0 ? delta_us + half : delta_us - half) / cap->sample_period_us;
+    int64_t at = (int64_t)cap->feed_at + offset;
+    uint64_t trigger_at = at > 0 ? (uint64_t)at : 0;
+    if (trigger_at < cap->armed_at) {
+        trigger_at = cap->armed_at;
+    }
+    if (trigger_at > cap->written) {
+        trigger_at = cap->written;
+    }
+
+    cap->trigger_at = trigger_at;
+    cap->trigger_channel = channel;
+    cap->end_at = trigger_at + cap->post_samples;
+    if (cap->written >= cap->end_at) {
+        waveform_freeze(cap);
+        return true;
+    }
+    atomic_store_explicit(&cap->state, WAVEFORM_TRIGGERED, memory_order_relaxed);
+    return false;
+}
+
+const waveform_window_t *waveform_capture_window(waveform_capture_t *cap)
+{
+    if (atomic_load_explicit(&cap->state, memory_order_acquire) != WAVEFORM_FROZEN) {
+        return NULL;
+    }
+    return &cap->window;
+}
+
+uint16_t waveform_capture_chunks(const waveform_capture_t *cap, uint32_t chunk_samples)
+{
+    return (uint16_t)((cap->window.n_samples + chunk_samples - 1) / chunk_samples);
+}
+
+static void waveform_put_u16(uint8_t *buf, uint16_t value)
+{
+    buf[0] = (uint8_t)value;
+    buf[1] = (uint8_t)(value >> 8);
+}
+
+static void waveform_put_u32(uint8_t *buf, uint32_t value)
+{
+    waveform_put_u16(buf, (uint16_t)value);
+    waveform_put_u16(buf + 2, (uint16_t)(value >> 16));
+}
+
+size_t waveform_capture_encode_chunk(waveform_capture_t *cap, uint16_t capture_id, uint16_t chunk,
+                                     uint32_t chunk_samples, uint32_t sample_rate_hz, uint8_t *buf, size_t size)
+{
+    const waveform_window_t *window = waveform_capture_window(cap);
+    if (window == NULL || chunk_samples == 0) {
+        return 0;
+    }
+    uint16_t n_chunks = waveform_capture_chunks(cap, chunk_samples);
+    if (chunk >= n_chunks || size < WAVEFORM_CHUNK_HEADER_SIZE + WAVEFORM_INFO_SIZE + 2 * chunk_samples * cap->channels) {
+        return 0;
+    }
+
+    uint32_t offset = chunk * chunk_samples;
+    uint32_t count = window->n_samples - offset < chunk_samples ? window->n_samples - offset : chunk_samples;
+
+    buf[0] = WAVEFORM_CHUNK_MAGIC;
+    buf[1] = WAVEFORM_CHUNK_VERSION;
+    waveform_put_u16(buf + 2, capture_id);
+    waveform_put_u16(buf + 4, chunk);
+    waveform_put_u16(buf + 6, n_chunks);
+    waveform_put_u32(buf + 8, offset);
+    waveform_put_u16(buf + 12, (uint16_t)count);
+    waveform_put_u16(buf + 14, cap->channel_mask);
+    size_t len = WAVEFORM_CHUNK_HEADER_SIZE;
+
+    if (chunk == 0) {
+        waveform_put_u32(buf + len, sample_rate_hz);
+        waveform_put_u32(buf + len + 4, window->n_samples);
+        waveform_put_u32(buf + len + 8, window->trigger);
+        waveform_put_u32(buf + len + 12, waveform_capture_missed(cap));
+        waveform_put_u32(buf + len + 16, (uint32_t)window->start_us);
+        waveform_put_u32(buf + len + 20, (uint32_t)((uint64_t)window->start_us >> 32));
+        buf[len + 24] = window->trigger_channel;
+        memset(buf + len + 25, 0, 3);
+        len += WAVEFORM_INFO_SIZE;
+    }
+
+    uint32_t pos = (uint32_t)((cap->start_at + offset) % cap->capacity);
+    for (uint32_t i = 0; i < count; i++) {
+        const uint16_t *set = cap->buf + pos * cap->channels;
+        for (uint8_t c = 0; c < cap->channels; c++) {
+            waveform_put_u16(buf + len, set[c]);
+            len += 2;
+        }
+        if (++pos == cap->capacity) {
+            pos = 0;
+        }
+    }
+    return len;
+}
+
+void waveform_capture_release(waveform_capture_t *cap)
+{
+    atomic_store_explicit(&cap->state, WAVEFORM_RELEASED, memory_order_release);
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Oscilloscope style capture of the raw ADC samples around a ring.
+ *
+ * Every sample set (one value per monitored channel) goes into a circular
+ * buffer of pre + post sets. A trigger (the start edge of a ring on any
+ * channel) marks its set; once post samples after it
+ * have arrived the buffer is frozen and holds the window around the edge.
+ * The producer (monitor task) never waits: while a frozen window is being
+ * uploaded new samples are not stored and triggers are counted as missed.
+ * The consumer (upload task) reads the frozen window and releases it, and
+ * the next capture starts filling its pre-trigger history from there.
+ * Sample positions and counts below are in sets.
+ * Pure C, one producer and one consumer.
+ *
+ * A window is uploaded as chunks, all fields little-endian:
+ *
+ *   u8  magic               'W'
+ *   u8  version             WAVEFORM_CHUNK_VERSION
+ *   u16 capture_id
+ *   u16 chunk               0 based
+ *   u16 n_chunks
+ *   u32 offset              window index of the chunk's first sample
+ *   u16 count               samples in this chunk
+ *   u16 channel_mask        bit n set for ADC1 channel n, one value per channel and sample
+ *   chunk 0 only {
+ *       u32 sample_rate_hz
+ *       u32 n_samples       in the whole window
+ *       u32 trigger         window index of the trigger sample
+ *       u32 missed          triggers missed since boot
+ *       i64 start_us        uptime of the first sample
+ *       u8  trigger_channel ADC1 channel that rang
+ *       u8  reserved[3]
+ *   }
+ *   count x channels values, u16 each, ascending channel order within a sample
+ *
+ * tools/waveform_decode.py reassembles the chunks into CSV or WAV.
+ */
+
+#define WAVEFORM_CHUNK_MAGIC        'W'
+#define WAVEFORM_CHUNK_VERSION      1
+#define WAVEFORM_CHUNK_HEADER_SIZE  16
+#define WAVEFORM_INFO_SIZE          28
+
+typedef enum {
+    WAVEFORM_ARMED,         // filling the pre-trigger history
+    WAVEFORM_TRIGGERED,     // collecting the post-trigger samples
+    WAVEFORM_FROZEN,        // window complete, owned by the consumer
+    WAVEFORM_RELEASED,      // consumer done, the producer re-arms
+} waveform_state_t;
+
+typedef struct {
+    uint32_t n_samples;
+    uint32_t trigger;       // index of the trigger sample in the window
+    int64_t start_us;       // time of the first sample
+    uint8_t trigger_channel;
+} waveform_window_t;
+
+typedef struct {
+    uint16_t *buf;
+    uint16_t channel_mask;
+    uint8_t channels;       // values per sample set
+    uint32_t capacity;      // pre + post samples
+    uint32_t pre_samples;
+    uint32_t post_samples;
+    uint32_t sample_period_us;
+
+    // Absolute sample numbers since init, producer only
+    uint64_t written;
+    uint64_t armed_at;      // oldest sample belonging to the current capture
+    uint64_t trigger_at;
+    uint8_t trigger_channel;
+    uint64_t end_at;
+    uint64_t feed_at;       // number and time of the first sample of the latest feed
+    int64_t feed_us;
+
+    uint64_t start_at;      // window of the frozen capture
+    waveform_window_t window;
+    atomic_uint missed;
+    atomic_int state;       // waveform_state_t, hands the window between the two sides
+} waveform_capture_t;
+
+/* buf must hold (pre_samples + post_samples) * channels values, channels being the bits set in channel_mask */
+void waveform_capture_init(waveform_capture_t *cap, uint16_t *buf, uint32_t pre_samples, uint32_t post_samples,
+                           uint32_t sample_period_us, uint16_t channel_mask);
+
+/* Producer: count consecutive sample sets, the first taken at t0_us. Returns true when the window just froze */
+bool waveform_capture_feed(waveform_capture_t *cap, const uint16_t *samples, size_t count, int64_t t0_us);
+
+/*
+ * Producer: mark the sample taken at timestamp_us on channel, which may lie in an
+ * earlier feed. Returns true when the window froze right away (post-trigger
+ * samples already stored), false when it was missed or is still filling.
+ */
+bool waveform_capture_trigger(waveform_capture_t *cap, int64_t timestamp_us, uint8_t channel);
+
+/* Consumer: the frozen window, or NULL */
+const waveform_window_t *waveform_capture_window(waveform_capture_t *cap);
+
+/* Consumer: chunks needed for the frozen window at chunk_samples per chunk */
+uint16_t waveform_capture_chunks(const waveform_capture_t *cap, uint32_t chunk_samples);
+
+/*
+ * Consumer: encode chunk `chunk` of the frozen window. Returns the length,
+ * 0 if buf is too small for WAVEFORM_CHUNK_HEADER_SIZE + WAVEFORM_INFO_SIZE
+ * + 2 * chunk_samples * channels or the chunk does not exist.
+ */
+size_t waveform_capture_encode_chunk(waveform_capture_t *cap, uint16_t capture_id, uint16_t chunk,
+                                     uint32_t chunk_samples, uint32_t sample_rate_hz, uint8_t *buf, size_t size);
+
+/* Consumer: done with the window, the next capture may start */
+void waveform_capture_release(waveform_capture_t *cap);
+
+static inline uint32_t waveform_capture_missed(waveform_capture_t *cap)
+{
+    return atomic_load_explicit(&cap->missed, memory_order_relaxed);
+}
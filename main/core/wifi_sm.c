@@ -0,0 +1,75 @@
+#include "wifi_sm.h"
+
+#include <string.h>
+
+void wifi_sm_init(wifi_sm_t *sm, const backoff_config_t *backoff_cfg, uint32_t seed, bool cache_valid)
+{
+    memset(sm, 0, sizeof(*sm));
+    sm->state = WIFI_SM_IDLE;
+    sm->cache_valid = cache_valid;
+    sm->time_to_ip_ms = -1;
+    backoff_init(&sm->backoff, backoff_cfg, seed);
+}
+
+static wifi_sm_action_t wifi_sm_connect(wifi_sm_t *sm)
+{
+    sm->state = WIFI_SM_CONNECTING;
+    sm->attempt_fast = sm->cache_valid;
+    sm->attempts++;
+    return (wifi_sm_action_t) {
+        .connect = true,
+        .fast_connect = sm->attempt_fast,
+    };
+}
+
+wifi_sm_action_t wifi_sm_handle(wifi_sm_t *sm, wifi_sm_event_t event, int64_t now_ms)
+{
+    wifi_sm_action_t action = { 0 };
+
+    switch (event) {
+    case WIFI_SM_EV_START:
+        if (sm->state != WIFI_SM_IDLE) {
+            break;
+        }
+        sm->connect_started_ms = now_ms;
+        sm->attempts = 0;
+        action = wifi_sm_connect(sm);
+        break;
+
+    case WIFI_SM_EV_DISCONNECTED:
+        if (sm->state == WIFI_SM_CONNECTED) {
+            backoff_on_disconnected(&sm->backoff, now_ms);
+            sm->connect_started_ms = now_ms;
+            sm->attempts = 0;
+        } else if (sm->state != WIFI_SM_CONNECTING) {
+            break;
+        }
+        if (sm->attempt_fast) {
+            sm->cache_valid = false;
+            sm->attempt_fast = false;
+            action.drop_cache = true;
+        }
+        sm->state = WIFI_SM_BACKOFF;
+        action.retry_delay_ms = backoff_next_delay_ms(&sm->backoff);
+        break;
+
+    case WIFI_SM_EV_RETRY:
+        if (sm->state == WIFI_SM_BACKOFF) {
+            action = wifi_sm_connect(sm);
+        }
+        break;
+
+    case WIFI_SM_EV_GOT_IP:
+        if (sm->state == WIFI_SM_CONNECTED) {
+            break;
+        }
+        sm->state = WIFI_SM_CONNECTED;
+        sm->time_to_ip_ms = now_ms - sm->connect_started_ms;
+        sm->cache_valid = true;
+        sm->attempt_fast = false;
+        backoff_on_connected(&sm->backoff, now_ms);
+        action.save_ap = true;
+        break;
+    }
+    return action;
+}
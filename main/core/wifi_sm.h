@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "backoff.h"
+
+/*
+ * Wi-Fi station reconnection state machine.
+ *
+ * Driver events go in, the actions to perform come out; timers, NVS and the
+ * Wi-Fi driver stay with the caller so the logic runs against simulated
+ * event sequences off-target.
+ *
+ * The first attempt after boot or after a drop uses the cached BSSID/channel
+ * if there is one (fast connect). A fast attempt that fails invalidates the
+ * cache and the following attempts do a full scan.
+ */
+
+typedef enum {
+    WIFI_SM_IDLE,
+    WIFI_SM_CONNECTING,
+    WIFI_SM_BACKOFF,        // waiting for the retry timer
+    WIFI_SM_CONNECTED,      // got an IP address
+} wifi_sm_state_t;
+
+typedef enum {
+    WIFI_SM_EV_START,
+    WIFI_SM_EV_DISCONNECTED,
+    WIFI_SM_EV_GOT_IP,
+    WIFI_SM_EV_RETRY,       // retry timer fired
+} wifi_sm_event_t;
+
+typedef struct {
+    bool connect;               // call esp_wifi_connect()
+    bool fast_connect;          // with the cached BSSID/channel
+    bool save_ap;               // store the current AP as the fast connect cache
+    bool drop_cache;            // the cached AP did not work, forget it
+    uint32_t retry_delay_ms;    // arm the retry timer, 0 for none
+} wifi_sm_action_t;
+
+typedef struct {
+    wifi_sm_state_t state;
+    backoff_t backoff;
+    bool cache_valid;
+    bool attempt_fast;
+    int64_t connect_started_ms;
+    int64_t time_to_ip_ms;      // -1 until the first IP
+    uint32_t attempts;          // attempts since the last IP
+} wifi_sm_t;
+
+void wifi_sm_init(wifi_sm_t *sm, const backoff_config_t *backoff_cfg, uint32_t seed, bool cache_valid);
+wifi_sm_action_t wifi_sm_handle(wifi_sm_t *sm, wifi_sm_event_t event, int64_t now_ms);
@@ -5,4 +5,5 @@
 #define MQTT_USERNAME   "username"
 #define MQTT_PASSWORD   "password"
 
-#define OTA_FIRMWARE_UPG_URL "http://intercom.local:8001/firmware.bin"
\ No newline at end of file
+#define OTA_FIRMWARE_UPG_URL "http://intercom.local:8001/firmware.bin"
+#define OTA_MANIFEST_URL     "http://intercom.local:8001/firmware.bin.json"
\ No newline at end of file
@@ -8,13 +8,24 @@
 #define RGB_LEDC_CHANNEL_1 LEDC_CHANNEL_1
 #define RGB_LEDC_CHANNEL_2 LEDC_CHANNEL_2
 
-#define MONITOR_ADC_CHANNEL ADC1_CHANNEL_6
-#define MONITOR_THRESHOLD 10
+#define MONITOR_ADC_CHANNELS CONFIG_INTERCOM_MONITOR_ADC1_CHANNELS     // bit n selects ADC1 channel n, one line each
+#define MONITOR_CHANNEL_COUNT __builtin_popcount(MONITOR_ADC_CHANNELS)
+#define MONITOR_THRESHOLD 10        // filtered value that starts a ring
+#define MONITOR_THRESHOLD_OFF 5     // filtered value that ends a ring
+#define MONITOR_MIN_ON_MS 20        // line must stay high this long to count as a ring
+#define MONITOR_MIN_OFF_MS 300      // gaps shorter than this belong to the same ring
+#define MONITOR_SMOOTHING_SHIFT 3   // IIR smoothing weight 1/8
+#define MONITOR_PUBLISH_PERIOD_MS 1000                              // length of one telemetry period
+#define MONITOR_TELEMETRY_PERIODS CONFIG_INTERCOM_TELEMETRY_PERIODS  // periods per telemetry batch
 
 
 #define MQTT_OPEN_STATE_TOPIC "/topic/intercom/open_state"
 #define MQTT_DIAL_VALUE_TOPIC "/topic/intercom/dial_value"
-#define MQTT_DIAL_RAW_VALUE_TOPIC "/topic/intercom/dial_raw_value"
-#define MQTT_UPTIME_TOPIC "/topic/intercom/uptime"
+#define MQTT_TELEMETRY_TOPIC "/topic/intercom/telemetry"
+#define MQTT_BOOT_TOPIC "/topic/intercom/boot"
+#define MQTT_DOOR_ACK_TOPIC "/topic/intercom/door_ack"
+#define MQTT_DIAGNOSTICS_TOPIC "/topic/intercom/diagnostics"
+#define MQTT_LOG_TOPIC "/topic/intercom/log"
+#define MQTT_CAPTURE_TOPIC "/topic/intercom/capture"
 
 #define OTA_FIRMWARE_RECV_TIMEOUT 10000
\ No newline at end of file
@@ -0,0 +1,187 @@
+#include "adc_sampler_task.h"
+#include "intercom_constants.h"
+#include "app_alloc.h"
+#include "power_task.h"
+#include "core/ring_detector.h"
+
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_adc/adc_continuous.h"
+#include "freertos/semphr.h"
+
+const char *TAG_ADC = "intercom_adc";
+
+/*
+ * The ADC DMA engine has a lower bound on its conversion rate
+ * (20 kHz on the original ESP32), so the hardware always runs at least that
+ * fast and consecutive results are averaged down to the configured rate.
+ * The pattern table converts the channels round robin, each channel gets
+ * 1 / ADC_SAMPLER_CHANNELS of the conversions.
+ */
+#define ADC_SAMPLER_SET_RATE_HZ (ADC_SAMPLER_RATE_HZ * ADC_SAMPLER_CHANNELS)
+#define ADC_SAMPLER_DECIMATION  ((SOC_ADC_SAMPLE_FREQ_THRES_LOW + ADC_SAMPLER_SET_RATE_HZ - 1) / ADC_SAMPLER_SET_RATE_HZ)
+#define ADC_SAMPLER_HW_RATE_HZ  (ADC_SAMPLER_SET_RATE_HZ * ADC_SAMPLER_DECIMATION)
+#define ADC_SAMPLER_ALL_CHANNELS ((1u << ADC_SAMPLER_CHANNELS) - 1)
+
+_Static_assert(ADC_SAMPLER_CHANNELS <= RING_DETECTOR_MAX_CHANNELS, "more ADC channels than the detector handles");
+#ifdef SOC_ADC_SAMPLE_FREQ_THRES_HIGH
+_Static_assert(ADC_SAMPLER_HW_RATE_HZ <= SOC_ADC_SAMPLE_FREQ_THRES_HIGH, "sample rate too high for the channel count");
+#endif
+#define ADC_SAMPLER_CONV_BYTES  (256 * SOC_ADC_DIGI_RESULT_BYTES)
+
+#if CONFIG_IDF_TARGET_ESP32 || CONFIG_IDF_TARGET_ESP32S2
+#define ADC_SAMPLER_OUTPUT_FORMAT   ADC_DIGI_OUTPUT_FORMAT_TYPE1
+#define ADC_SAMPLER_GET_CHANNEL(p)  ((p)->type1.channel)
+#define ADC_SAMPLER_GET_DATA(p)     ((p)->type1.data)
+#else
+#define ADC_SAMPLER_OUTPUT_FORMAT   ADC_DIGI_OUTPUT_FORMAT_TYPE2
+#define ADC_SAMPLER_GET_CHANNEL(p)  ((p)->type2.channel)
+#define ADC_SAMPLER_GET_DATA(p)     ((p)->type2.data)
+#endif
+
+static adc_continuous_handle_t adc_handle = NULL;
+static SemaphoreHandle_t frames_ready = NULL;
+
+static adc_frame_ring_t frame_ring;
+static adc_frame_t frames[ADC_SAMPLER_FRAME_COUNT];
+static uint16_t frame_storage[ADC_SAMPLER_FRAME_COUNT * ADC_SAMPLER_FRAME_SAMPLES * ADC_SAMPLER_CHANNELS];
+static uint8_t conv_buffer[ADC_SAMPLER_CONV_BYTES];
+
+static void adc_sampler_setup()
+{
+    adc_continuous_handle_cfg_t handle_cfg = {
+        .max_store_buf_size = ADC_SAMPLER_CONV_BYTES * 4,
+        .conv_frame_size = ADC_SAMPLER_CONV_BYTES,
+    };
+    ESP_ERROR_CHECK(adc_continuous_new_handle(&handle_cfg, &adc_handle));
+
+    adc_digi_pattern_config_t patterns[ADC_SAMPLER_CHANNELS];
+    for (size_t i = 0; i < ADC_SAMPLER_CHANNELS; i++) {
+        patterns[i] = (adc_digi_pattern_config_t) {
+            .atten = ADC_ATTEN_DB_12,
+            .channel = adc_sampler_channel(i),
+            .unit = ADC_UNIT_1,
+            .bit_width = SOC_ADC_DIGI_MAX_BITWIDTH,
+        };
+    }
+    adc_continuous_config_t dig_cfg = {
+        .pattern_num = ADC_SAMPLER_CHANNELS,
+        .adc_pattern = patterns,
+        .sample_freq_hz = ADC_SAMPLER_HW_RATE_HZ,
+        .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+        .format = ADC_SAMPLER_OUTPUT_FORMAT,
+    };
+    ESP_ERROR_CHECK(adc_continuous_config(adc_handle, &dig_cfg));
+
+    ESP_LOGI(TAG_ADC, "Sampling %d channels (mask 0x%02x) at %d Hz (hardware %d Hz, decimation %d), "
+             "%d samples per frame", ADC_SAMPLER_CHANNELS, MONITOR_ADC_CHANNELS, ADC_SAMPLER_RATE_HZ,
+             ADC_SAMPLER_HW_RATE_HZ, ADC_SAMPLER_DECIMATION, ADC_SAMPLER_FRAME_SAMPLES);
+}
+
+uint8_t adc_sampler_channel(size_t index)
+{
+    uint32_t mask = MONITOR_ADC_CHANNELS;
+    for (size_t i = 0; i < index; i++) {
+        mask &= mask - 1;
+    }
+    return __builtin_ctz(mask);
+}
+
+/* Task draining the ADC DMA pool into ring frames */
+static void adc_sampler_task(void *pvParameters)
+{
+    const int64_t sample_period_us = 1000000 / ADC_SAMPLER_RATE_HZ;
+    adc_frame_t *frame = NULL;
+    size_t frame_fill = 0;
+    // Per channel, by position in the sample set
+    uint32_t acc[ADC_SAMPLER_CHANNELS] = { 0 };
+    uint32_t acc_count[ADC_SAMPLER_CHANNELS] = { 0 };
+    uint16_t set[ADC_SAMPLER_CHANNELS];
+    uint32_t set_ready = 0;
+
+    ESP_ERROR_CHECK(adc_continuous_start(adc_handle));
+
+    while (1) {
+        uint32_t bytes_read = 0;
+        esp_err_t err = adc_continuous_read(adc_handle, conv_buffer, sizeof(conv_buffer), &bytes_read, ADC_MAX_DELAY);
+        power_woke(POWER_TASK_ADC);
+        if (err != ESP_OK) {
+            ESP_LOGW(TAG_ADC, "adc_continuous_read failed (%s)", esp_err_to_name(err));
+            continue;
+        }
+
+        for (uint32_t i = 0; i < bytes_read; i += SOC_ADC_DIGI_RESULT_BYTES) {
+            adc_digi_output_data_t *result = (adc_digi_output_data_t *)&conv_buffer[i];
+            unsigned channel = ADC_SAMPLER_GET_CHANNEL(result);
+            if (channel >= 32 || !(MONITOR_ADC_CHANNELS & (1u << channel))) {
+                continue;
+            }
+            // Position in the set = monitored channels below this one
+            unsigned index = __builtin_popcount(MONITOR_ADC_CHANNELS & ((1u << channel) - 1));
+            acc[index] += ADC_SAMPLER_GET_DATA(result);
+            if (++acc_count[index] < ADC_SAMPLER_DECIMATION) {
+                continue;
+            }
+
+            set[index] = acc[index] / acc_count[index];
+            acc[index] = 0;
+            acc_count[index] = 0;
+            set_ready |= 1u << index;
+            if (set_ready != ADC_SAMPLER_ALL_CHANNELS) {
+                continue;
+            }
+            set_ready = 0;
+
+            // Slots are only claimed at a frame boundary, a frame that starts
+            // without one is dropped whole rather than committed with a stale start
+            if (frame_fill == 0) {
+                frame = adc_frame_ring_begin_write(&frame_ring);
+            }
+            if (frame != NULL) {
+                memcpy(&frame->samples[frame_fill * ADC_SAMPLER_CHANNELS], set, sizeof(set));
+            }
+            if (++frame_fill < ADC_SAMPLER_FRAME_SAMPLES) {
+                continue;
+            }
+
+            if (frame != NULL) {
+                int64_t first_sample_us = esp_timer_get_time() - ADC_SAMPLER_FRAME_SAMPLES * sample_period_us;
+                adc_frame_ring_commit(&frame_ring, frame_fill * ADC_SAMPLER_CHANNELS, first_sample_us);
+                xSemaphoreGive(frames_ready);
+            } else {
+                adc_frame_ring_drop(&frame_ring);
+            }
+            frame = NULL;
+            frame_fill = 0;
+        }
+    }
+}
+
+adc_frame_t *adc_sampler_wait_frame(TickType_t timeout)
+{
+    if (xSemaphoreTake(frames_ready, timeout) != pdTRUE) {
+        return NULL;
+    }
+    return adc_frame_ring_peek(&frame_ring);
+}
+
+void adc_sampler_release_frame()
+{
+    adc_frame_ring_release(&frame_ring);
+}
+
+uint32_t adc_sampler_overruns()
+{
+    return adc_frame_ring_overruns(&frame_ring);
+}
+
+void task_adc_sampler_start()
+{
+    adc_frame_ring_init(&frame_ring, frames, frame_storage, ADC_SAMPLER_FRAME_COUNT,
+                        ADC_SAMPLER_FRAME_SAMPLES * ADC_SAMPLER_CHANNELS);
+    frames_ready = APP_COUNTING_SEMAPHORE_CREATE(ADC_SAMPLER_FRAME_COUNT, 0);
+    adc_sampler_setup();
+    APP_TASK_CREATE(adc_sampler_task, "adc_sampler_task", 3072, NULL, 6);
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+#include "core/adc_frame_ring.h"
+#include "intercom_constants.h"
+
+/* Effective rate of the samples handed out in frames, per channel */
+#define ADC_SAMPLER_RATE_HZ         CONFIG_INTERCOM_ADC_SAMPLE_RATE_HZ
+#define ADC_SAMPLER_FRAME_SAMPLES   CONFIG_INTERCOM_ADC_FRAME_SAMPLES
+#define ADC_SAMPLER_FRAME_COUNT     CONFIG_INTERCOM_ADC_FRAME_COUNT
+#define ADC_SAMPLER_CHANNELS        MONITOR_CHANNEL_COUNT
+
+void task_adc_sampler_start();
+
+/* ADC1 channel number of the value at index in each sample set */
+uint8_t adc_sampler_channel(size_t index);
+
+/* Block until a completed frame is available. Frames hold sets of
+ * ADC_SAMPLER_CHANNELS values, one per channel in ascending channel order,
+ * and count is in values. The frame stays owned by the caller until
+ * adc_sampler_release_frame() is called. */
+adc_frame_t *adc_sampler_wait_frame(TickType_t timeout);
+void adc_sampler_release_frame();
+
+uint32_t adc_sampler_overruns();
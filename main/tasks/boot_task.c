@@ -0,0 +1,111 @@
+#include "boot_task.h"
+#include "mqtt_task.h"
+#include "wifi_task.h"
+#include "intercom_constants.h"
+#include "app_alloc.h"
+
+#include <stdio.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/queue.h"
+
+const char *TAG_BOOT = "intercom_boot";
+
+#if CONFIG_INTERCOM_STATIC_ALLOC
+#define BOOT_STATIC_ALLOC   "true"
+#else
+#define BOOT_STATIC_ALLOC   "false"
+#endif
+
+static boot_graph_t boot_graph;
+static QueueHandle_t boot_queue = NULL;
+static volatile bool boot_finished = false;
+
+static int64_t boot_clock(void)
+{
+    return esp_timer_get_time();
+}
+
+void boot_signal(uint32_t milestones)
+{
+    if (boot_queue == NULL || boot_finished) {
+        return;
+    }
+    xQueueSend(boot_queue, &milestones, 0);
+}
+
+static void boot_log_started(uint32_t previously_started)
+{
+    uint32_t fresh = boot_graph.started & ~previously_started;
+    for (size_t i = 0; i < boot_graph.n_stages; i++) {
+        if (fresh & (1u << i)) {
+            ESP_LOGI(TAG_BOOT, "Stage %s started at %" PRId64 " ms, took %" PRId64 " ms", boot_graph.stages[i].name,
+                     boot_graph.start_us[i] / 1000, (boot_graph.done_us[i] - boot_graph.start_us[i]) / 1000);
+        }
+    }
+}
+
+void boot_run(const boot_stage_t *stages, size_t n_stages)
+{
+    boot_queue = APP_QUEUE_CREATE(8, sizeof(uint32_t));
+    if (!boot_graph_init(&boot_graph, stages, n_stages, boot_clock)) {
+        ESP_LOGE(TAG_BOOT, "Too many boot stages: %d", (int)n_stages);
+        return;
+    }
+
+    uint32_t started = 0;
+    boot_graph_signal(&boot_graph, 0);
+    boot_log_started(started);
+
+    while (!boot_graph_done(&boot_graph)) {
+        uint32_t milestones = 0;
+        if (xQueueReceive(boot_queue, &milestones, pdMS_TO_TICKS(BOOT_STALL_LOG_MS)) != pdTRUE) {
+            ESP_LOGI(TAG_BOOT, "Waiting for milestones 0x%02" PRIx32, boot_graph_waiting_for(&boot_graph));
+            continue;
+        }
+        started = boot_graph.started;
+        boot_graph_signal(&boot_graph, milestones);
+        boot_log_started(started);
+    }
+
+    boot_finished = true;
+    ESP_LOGI(TAG_BOOT, "All boot stages started, heap free %u, minimum %u, largest block %u",
+             (unsigned)heap_caps_get_free_size(MALLOC_CAP_8BIT),
+             (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT),
+             (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+}
+
+void boot_publish_report()
+{
+    char payload[768];
+    int len = snprintf(payload, sizeof(payload), "{\"wifi_time_to_ip_ms\":%" PRId64, wifi_time_to_ip_ms());
+
+    for (size_t i = 0; i < boot_graph.n_stages && len < sizeof(payload); i++) {
+        if (boot_graph.done_us[i] < 0) {
+            continue;
+        }
+        len += snprintf(payload + len, sizeof(payload) - len, ",\"%s\":{\"start_ms\":%" PRId64 ",\"took_ms\":%" PRId64 "}",
+                        boot_graph.stages[i].name, boot_graph.start_us[i] / 1000,
+                        (boot_graph.done_us[i] - boot_graph.start_us[i]) / 1000);
+    }
+    if (len < sizeof(payload)) {
+        // Compare builds with and without CONFIG_INTERCOM_STATIC_ALLOC
+        len += snprintf(payload + len, sizeof(payload) - len,
+                        ",\"heap\":{\"static_alloc\":" BOOT_STATIC_ALLOC ",\"free\":%u,\"min_free\":%u,\"largest\":%u}",
+                        (unsigned)heap_caps_get_free_size(MALLOC_CAP_8BIT),
+                        (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT),
+                        (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+    }
+    if (len < sizeof(payload) - 1) {
+        payload[len++] = '}';
+        payload[len] = '\0';
+    }
+
+    if (len < sizeof(payload)) {
+        int msg_id = mqtt_publish(MQTT_BOOT_TOPIC, payload, len, 1, 0);
+        ESP_LOGI(TAG_BOOT, "Published boot report, msg_id=%d", msg_id);
+    }
+}
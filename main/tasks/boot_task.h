@@ -0,0 +1,25 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "core/boot_graph.h"
+
+/* Boot milestones, stages list the ones they need in boot_stage_t.needs */
+#define BOOT_CORE               (1u << 0)   // state bus, RGB renderer, event groups
+#define BOOT_NVS                (1u << 1)
+#define BOOT_NETIF              (1u << 2)
+#define BOOT_OTA_CHECKED        (1u << 3)   // pending OTA image verified
+#define BOOT_WIFI_IP            (1u << 4)
+#define BOOT_MQTT_CONNECTED     (1u << 5)
+
+#define BOOT_STALL_LOG_MS       5000    // log what boot is waiting for at this interval
+
+/* Report a milestone, callable from any task or event handler */
+void boot_signal(uint32_t milestones);
+
+/* Run the stages on the calling task, returns once every stage has started */
+void boot_run(const boot_stage_t *stages, size_t n_stages);
+
+/* Publish the stage timings on MQTT_BOOT_TOPIC */
+void boot_publish_report();
@@ -0,0 +1,111 @@
+#include "capture_task.h"
+#include "adc_sampler_task.h"
+#include "mqtt_task.h"
+#include "power_task.h"
+#include "intercom_constants.h"
+#include "app_alloc.h"
+#include "core/waveform_capture.h"
+
+#include <inttypes.h>
+
+#include "esp_log.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/task.h"
+
+const char *TAG_CAPTURE = "intercom_capture";
+
+#if CONFIG_INTERCOM_CAPTURE
+
+#define CAPTURE_PRE_SAMPLES     (CAPTURE_PRE_MS * ADC_SAMPLER_RATE_HZ / 1000)
+#define CAPTURE_POST_SAMPLES    (CAPTURE_POST_MS * ADC_SAMPLER_RATE_HZ / 1000)
+#define CAPTURE_CHUNK_SETS      (CAPTURE_CHUNK_SAMPLES / ADC_SAMPLER_CHANNELS)
+
+#define CAPTURE_CHUNK_BYTES     (WAVEFORM_CHUNK_HEADER_SIZE + WAVEFORM_INFO_SIZE + 2 * CAPTURE_CHUNK_SAMPLES)
+
+_Static_assert(CAPTURE_CHUNK_BYTES <= MQTT_BULK_MAX_BYTES, "INTERCOM_MQTT_BULK_MAX_BYTES below one capture chunk");
+
+static uint16_t capture_samples[(CAPTURE_PRE_SAMPLES + CAPTURE_POST_SAMPLES) * ADC_SAMPLER_CHANNELS];
+static waveform_capture_t capture;
+static TaskHandle_t capture_task_handle = NULL;
+
+void capture_feed(const uint16_t *samples, size_t n_sets, int64_t t0_us)
+{
+    if (capture_task_handle != NULL && waveform_capture_feed(&capture, samples, n_sets, t0_us)) {
+        xTaskNotifyGive(capture_task_handle);
+    }
+}
+
+void capture_trigger(int64_t timestamp_us, uint8_t channel)
+{
+    if (capture_task_handle != NULL && waveform_capture_trigger(&capture, timestamp_us, channel)) {
+        xTaskNotifyGive(capture_task_handle);
+    }
+}
+
+/*
+ * Publish every chunk of the frozen window, waiting out disconnects and a
+ * full outbox. Chunks count against the bulk caps, not the event ones, so
+ * ring events still go out during an upload.
+ */
+static void capture_upload(uint16_t capture_id)
+{
+    static uint8_t chunk[CAPTURE_CHUNK_BYTES];
+    uint16_t n_chunks = waveform_capture_chunks(&capture, CAPTURE_CHUNK_SETS);
+
+    for (uint16_t i = 0; i < n_chunks; i++) {
+        size_t len = waveform_capture_encode_chunk(&capture, capture_id, i, CAPTURE_CHUNK_SETS,
+                                                   ADC_SAMPLER_RATE_HZ, chunk, sizeof(chunk));
+        // The window stays frozen until it is out, rings in the meantime are counted as missed
+        while (mqtt_publish(MQTT_CAPTURE_TOPIC, (const char *)chunk, len, 1, 0) < 0) {
+            xEventGroupWaitBits(get_mqtt_event_group(), MQTT_CONNECTED_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+            vTaskDelay(pdMS_TO_TICKS(CAPTURE_RETRY_MS));
+            power_woke(POWER_TASK_CAPTURE);
+        }
+    }
+}
+
+/* Uploads each frozen window at low priority, sampling and detection never wait for it */
+static void capture_task(void *pvParameters)
+{
+    uint16_t capture_id = 0;
+
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        power_woke(POWER_TASK_CAPTURE);
+        const waveform_window_t *window = waveform_capture_window(&capture);
+        if (window == NULL) {
+            continue;
+        }
+
+        ESP_LOGI(TAG_CAPTURE, "Uploading capture %u: %" PRIu32 " samples, trigger at sample %" PRIu32
+                 " on channel %u, %u missed", capture_id, window->n_samples, window->trigger,
+                 window->trigger_channel, (unsigned)waveform_capture_missed(&capture));
+        capture_upload(capture_id);
+        capture_id++;
+        waveform_capture_release(&capture);
+    }
+}
+
+void task_capture_start()
+{
+    waveform_capture_init(&capture, capture_samples, CAPTURE_PRE_SAMPLES, CAPTURE_POST_SAMPLES,
+                          1000000 / ADC_SAMPLER_RATE_HZ, MONITOR_ADC_CHANNELS);
+    capture_task_handle = APP_TASK_CREATE(capture_task, "capture_task", 3072, NULL, 2);
+}
+
+#else
+
+void capture_feed(const uint16_t *samples, size_t n_sets, int64_t t0_us)
+{
+}
+
+void capture_trigger(int64_t timestamp_us, uint8_t channel)
+{
+}
+
+void task_capture_start()
+{
+}
+
+#endif
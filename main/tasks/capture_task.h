@@ -0,0 +1,17 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#define CAPTURE_PRE_MS          CONFIG_INTERCOM_CAPTURE_PRE_MS      // history kept before the ring edge
+#define CAPTURE_POST_MS         CONFIG_INTERCOM_CAPTURE_POST_MS     // samples recorded after it
+#define CAPTURE_CHUNK_SAMPLES   448     // values of all channels per chunk, keeps a chunk under 1 KB
+#define CAPTURE_RETRY_MS        200     // wait before retrying a refused chunk
+
+/* Monitor task: n_sets consecutive sample sets as in the sampler's frames, the first taken at t0_us */
+void capture_feed(const uint16_t *samples, size_t n_sets, int64_t t0_us);
+
+/* Monitor task: freeze the window around the sample taken at timestamp_us once it is complete,
+ * channel is the ADC1 channel that rang */
+void capture_trigger(int64_t timestamp_us, uint8_t channel);
+
+/* Start the task uploading frozen windows to MQTT_CAPTURE_TOPIC */
+void task_capture_start();
@@ -0,0 +1,173 @@
+#include "dlog_task.h"
+#include "mqtt_task.h"
+#include "intercom_constants.h"
+#include "app_alloc.h"
+#include "power_task.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/task.h"
+#if !CONFIG_IDF_TARGET_LINUX
+#include "esp_memory_utils.h"
+#endif
+
+const char *TAG_DLOG = "intercom_dlog";
+
+_Static_assert((DLOG_RING_RECORDS & (DLOG_RING_RECORDS - 1)) == 0, "DLOG_RING_RECORDS must be a power of two");
+
+/* Its run time address in each MQTT batch lets the decoder undo a load bias */
+static const char dlog_anchor[] __attribute__((used)) = "dlog_anchor";
+
+static dlog_slot_t dlog_slots[portNUM_PROCESSORS][DLOG_RING_RECORDS];
+static dlog_ring_t dlog_rings[portNUM_PROCESSORS];
+static volatile bool dlog_ready = false;
+
+void dlog_write(uint8_t level, const char *tag, const char *fmt, const uint32_t *words, size_t n_words)
+{
+    if (!dlog_ready) {
+        return;
+    }
+#if portNUM_PROCESSORS > 1
+    // Only keeps the cores off each other's ring, a task moved mid-call is still safe
+    uint8_t core = (uint8_t)xPortGetCoreID();
+#else
+    uint8_t core = 0;
+#endif
+    dlog_ring_push(&dlog_rings[core], level, core, tag, fmt, esp_timer_get_time(), words, n_words);
+}
+
+uint32_t dlog_dropped()
+{
+    uint32_t dropped = 0;
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+        dropped += atomic_load_explicit(&dlog_rings[i].dropped, memory_order_relaxed);
+    }
+    return dropped;
+}
+
+/* Only dereference strings inside the firmware image, a %s pointer may be stale by now */
+static const char *dlog_resolve(void *ctx, uintptr_t addr)
+{
+#if CONFIG_IDF_TARGET_LINUX
+    extern const char __executable_start[], edata[];
+    bool in_image = addr >= (uintptr_t)__executable_start && addr < (uintptr_t)edata;
+#else
+    bool in_image = esp_ptr_in_drom((const void *)addr);
+#endif
+    return in_image ? (const char *)addr : NULL;
+}
+
+/* Oldest record over all cores, NULL when every ring is empty */
+static const dlog_slot_t *dlog_next(int *ring)
+{
+    const dlog_slot_t *oldest = NULL;
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+        const dlog_slot_t *slot = dlog_ring_peek(&dlog_rings[i]);
+        if (slot != NULL && (oldest == NULL || slot->timestamp_us < oldest->timestamp_us)) {
+            oldest = slot;
+            *ring = i;
+        }
+    }
+    return oldest;
+}
+
+static void dlog_drain_console()
+{
+    static const char levels[] = "?EWID";
+    char line[DLOG_LINE_SIZE];
+    const dlog_slot_t *slot;
+    int ring;
+
+    while ((slot = dlog_next(&ring)) != NULL) {
+        const char *tag = dlog_resolve(NULL, (uintptr_t)slot->tag);
+        dlog_format(line, sizeof(line), slot->fmt, slot->words, slot->n_words, dlog_resolve, NULL);
+        esp_log_write((esp_log_level_t)slot->level, tag != NULL ? tag : TAG_DLOG, "%c (%" PRId64 ") %s: %s\n",
+                      levels[slot->level < sizeof(levels) - 1 ? slot->level : 0], slot->timestamp_us / 1000,
+                      tag != NULL ? tag : "?", line);
+        dlog_ring_release(&dlog_rings[ring]);
+    }
+}
+
+#if CONFIG_INTERCOM_DLOG_MQTT
+static void dlog_drain_mqtt()
+{
+    static uint8_t batch[DLOG_MQTT_BATCH_SIZE];
+    const dlog_slot_t *slot;
+    int ring;
+
+    while ((slot = dlog_next(&ring)) != NULL) {
+        size_t len = DLOG_BATCH_HEADER_SIZE;
+        uint16_t n_records = 0;
+        do {
+            size_t size = dlog_encode_record(slot, batch + len, sizeof(batch) - len);
+            if (size == 0) {
+                break;
+            }
+            len += size;
+            n_records++;
+            dlog_ring_release(&dlog_rings[ring]);
+        } while ((slot = dlog_next(&ring)) != NULL);
+
+        dlog_encode_header(batch, n_records, (uint32_t)(uintptr_t)dlog_anchor, dlog_dropped());
+        if (mqtt_publish(MQTT_LOG_TOPIC, (const char *)batch, len, 0, 0) < 0) {
+            // Disconnected since the check, these records are lost
+            ESP_LOGW(TAG_DLOG, "Lost %u deferred log records", n_records);
+            return;
+        }
+    }
+}
+#endif
+
+#if CONFIG_INTERCOM_DLOG_BENCHMARK
+/* Cost per call of the deferred log and of ESP_LOGI with the same message */
+static void dlog_benchmark()
+{
+    int64_t start = esp_timer_get_time();
+    for (int i = 0; i < DLOG_BENCH_CALLS; i++) {
+        DLOGI(TAG_DLOG, "Benchmark call %d of %d, uptime %" PRId64 " us", i, DLOG_BENCH_CALLS, start);
+    }
+    int64_t dlog_us = esp_timer_get_time() - start;
+
+    start = esp_timer_get_time();
+    for (int i = 0; i < DLOG_BENCH_CALLS; i++) {
+        ESP_LOGI(TAG_DLOG, "Benchmark call %d of %d, uptime %" PRId64 " us", i, DLOG_BENCH_CALLS, start);
+    }
+    int64_t esp_log_us = esp_timer_get_time() - start;
+
+    ESP_LOGI(TAG_DLOG, "Per call: deferred %" PRId64 " ns, ESP_LOGI %" PRId64 " ns (%d calls each)",
+             dlog_us * 1000 / DLOG_BENCH_CALLS, esp_log_us * 1000 / DLOG_BENCH_CALLS, DLOG_BENCH_CALLS);
+}
+#endif
+
+static void dlog_task(void *pvParameter)
+{
+#if CONFIG_INTERCOM_DLOG_BENCHMARK
+    dlog_benchmark();
+#endif
+    while (1) {
+        vTaskDelay(pdMS_TO_TICKS(DLOG_DRAIN_PERIOD_MS));
+        power_woke(POWER_TASK_DLOG);
+#if CONFIG_INTERCOM_DLOG_MQTT
+        EventGroupHandle_t mqtt_events = get_mqtt_event_group();
+        if (mqtt_events != NULL && (xEventGroupGetBits(mqtt_events) & MQTT_CONNECTED_BIT)) {
+            dlog_drain_mqtt();
+            continue;
+        }
+#endif
+        dlog_drain_console();
+    }
+}
+
+void task_dlog_start()
+{
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+        dlog_ring_init(&dlog_rings[i], dlog_slots[i], DLOG_RING_RECORDS);
+    }
+    dlog_ready = true;
+    APP_TASK_CREATE(dlog_task, "dlog_task", 3072, NULL, 1);
+}
@@ -0,0 +1,37 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#include "core/dlog.h"
+
+#define DLOG_RING_RECORDS       CONFIG_INTERCOM_DLOG_RING_RECORDS       // per core, power of two
+#define DLOG_DRAIN_PERIOD_MS    CONFIG_INTERCOM_DLOG_DRAIN_PERIOD_MS
+#define DLOG_MQTT_BATCH_SIZE    1024
+#define DLOG_LINE_SIZE          160
+#define DLOG_BENCH_CALLS        32
+
+/*
+ * Deferred replacements for ESP_LOGx on hot paths. Arguments must fit
+ * DLOG_MAX_WORDS words, %s only for string constants (see core/dlog.h).
+ */
+#define DLOG(level, tag, fmt, ...) do { \
+        if (0) { \
+            dlog_check_format(fmt, ##__VA_ARGS__); \
+        } \
+        uint32_t _dlog_words[DLOG_MAX_WORDS]; \
+        size_t _dlog_n = 0; \
+        DLOG_PACK(_dlog_words, _dlog_n, ##__VA_ARGS__); \
+        dlog_write(level, tag, fmt, _dlog_words, _dlog_n); \
+    } while (0)
+
+#define DLOGE(tag, fmt, ...)    DLOG(DLOG_LEVEL_ERROR, tag, fmt, ##__VA_ARGS__)
+#define DLOGW(tag, fmt, ...)    DLOG(DLOG_LEVEL_WARN, tag, fmt, ##__VA_ARGS__)
+#define DLOGI(tag, fmt, ...)    DLOG(DLOG_LEVEL_INFO, tag, fmt, ##__VA_ARGS__)
+
+/* Any task or ISR, records before task_dlog_start are discarded */
+void dlog_write(uint8_t level, const char *tag, const char *fmt, const uint32_t *words, size_t n_words);
+
+/* Records lost to full rings since boot */
+uint32_t dlog_dropped();
+
+/* Set up the per-core rings and start the low priority drain task */
+void task_dlog_start();
@@ -0,0 +1,186 @@
+#include "door_task.h"
+#include "mqtt_task.h"
+#include "intercom_constants.h"
+#include "app_alloc.h"
+#include "core/pulse_engine.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "driver/gpio.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+const char *TAG_DOOR = "intercom_door";
+
+static pulse_engine_t door_pulse;
+static esp_timer_handle_t door_timer = NULL;
+static SemaphoreHandle_t door_lock = NULL;     // MQTT worker and esp_timer task both drive the engine
+static uint32_t door_rpc[DOOR_RPC_WAITERS];
+static int door_rpc_count = 0;
+
+/* Ended pulse waiting for the MQTT worker to publish its ack */
+typedef struct {
+    pulse_result_t result;
+    uint32_t rpc[DOOR_RPC_WAITERS];
+    int rpc_count;
+} door_ack_t;
+
+static door_ack_t door_acks[DOOR_ACKS_PENDING];    // door_lock
+static int door_ack_head = 0;
+static int door_ack_count = 0;
+
+static int64_t door_now_us(void *ctx)
+{
+    return esp_timer_get_time();
+}
+
+static void door_set_output(void *ctx, bool on)
+{
+    gpio_set_level(GPIO_OUTPUT_PIN_2, on);
+}
+
+static void door_arm_timer(void *ctx, uint64_t delay_us)
+{
+    esp_timer_stop(door_timer);
+    esp_timer_start_once(door_timer, delay_us);
+}
+
+static void door_cancel_timer(void *ctx)
+{
+    esp_timer_stop(door_timer);
+}
+
+/* Report the measured on-time of a finished pulse to the ack topic and its requesters */
+static void door_publish_ack(const pulse_result_t *result, const uint32_t *rpc, int rpc_count)
+{
+    char payload[160];
+    snprintf(payload, sizeof(payload),
+             "{\"pulse\":%" PRIu32 ",\"requested_ms\":%" PRIu32 ",\"granted_ms\":%" PRIu32
+             ",\"on_us\":%" PRId64 ",\"capped\":%s,\"stopped\":%s}",
+             result->seq, result->requested_ms, result->granted_ms, result->on_time_us,
+             result->capped ? "true" : "false", result->stopped ? "true" : "false");
+    ESP_LOGI(TAG_DOOR, "Door pulse %" PRIu32 " on for %" PRId64 " us", result->seq, result->on_time_us);
+
+    mqtt_publish(MQTT_DOOR_ACK_TOPIC, payload, 0, 1, 0);
+    for (int i = 0; i < rpc_count; i++) {
+        mqtt_rpc_reply(rpc[i], "ok", payload);
+    }
+}
+
+/* Queue the ack of the pulse that just ended with its waiting requests, call with door_lock held */
+static void door_queue_ack(const pulse_result_t *result)
+{
+    if (door_ack_count == DOOR_ACKS_PENDING) {
+        // Worker stalled for several pulses, the oldest requests are left to the RPC timeout
+        ESP_LOGW(TAG_DOOR, "Door ack for pulse %" PRIu32 " dropped", door_acks[door_ack_head].result.seq);
+        door_ack_head = (door_ack_head + 1) % DOOR_ACKS_PENDING;
+        door_ack_count--;
+    }
+    door_ack_t *ack = &door_acks[(door_ack_head + door_ack_count) % DOOR_ACKS_PENDING];
+    ack->result = *result;
+    ack->rpc_count = door_rpc_count;
+    memcpy(ack->rpc, door_rpc, door_rpc_count * sizeof(door_rpc[0]));
+    door_rpc_count = 0;
+    door_ack_count++;
+}
+
+void door_publish_acks()
+{
+    while (1) {
+        door_ack_t ack;
+        xSemaphoreTake(door_lock, portMAX_DELAY);
+        bool any = door_ack_count > 0;
+        if (any) {
+            ack = door_acks[door_ack_head];
+            door_ack_head = (door_ack_head + 1) % DOOR_ACKS_PENDING;
+            door_ack_count--;
+        }
+        xSemaphoreGive(door_lock);
+
+        if (!any) {
+            return;
+        }
+        door_publish_ack(&ack.result, ack.rpc, ack.rpc_count);
+    }
+}
+
+/*
+ * esp_timer task: switch the output off on time and leave the publishing,
+ * which can wait on the outbox lock, to the MQTT worker.
+ */
+static void door_timer_cb(void *arg)
+{
+    pulse_result_t result;
+
+    xSemaphoreTake(door_lock, portMAX_DELAY);
+    bool ended = pulse_engine_expire(&door_pulse, &result);
+    if (ended) {
+        door_queue_ack(&result);
+    }
+    xSemaphoreGive(door_lock);
+
+    if (ended) {
+        mqtt_worker_wake();
+    }
+}
+
+uint32_t door_open_for(uint32_t duration_ms, uint32_t rpc)
+{
+    bool queued = false;
+
+    xSemaphoreTake(door_lock, portMAX_DELAY);
+    uint32_t seq = pulse_engine_start(&door_pulse, duration_ms);
+    if (rpc != 0 && door_rpc_count < DOOR_RPC_WAITERS) {
+        door_rpc[door_rpc_count++] = rpc;
+        queued = true;
+    }
+    xSemaphoreGive(door_lock);
+
+    ESP_LOGI(TAG_DOOR, "Door pulse %" PRIu32 " for %" PRIu32 " ms", seq, duration_ms);
+    if (rpc != 0 && !queued) {
+        // Too many requesters on one pulse, confirm the start instead of the end
+        char result[32];
+        snprintf(result, sizeof(result), "{\"pulse\":%" PRIu32 "}", seq);
+        mqtt_rpc_reply(rpc, "ok", result);
+    }
+    return seq;
+}
+
+void door_close()
+{
+    pulse_result_t result;
+
+    xSemaphoreTake(door_lock, portMAX_DELAY);
+    if (pulse_engine_stop(&door_pulse, &result)) {
+        door_queue_ack(&result);
+    }
+    xSemaphoreGive(door_lock);
+
+    // Runs on the MQTT worker, acks of earlier pulses still queued go out first
+    door_publish_acks();
+}
+
+/* Needs the door GPIO configured as output (gpio_init_setup) */
+void door_init()
+{
+    door_lock = APP_MUTEX_CREATE();
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = door_timer_cb,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "door_pulse",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &door_timer));
+
+    const pulse_ops_t ops = {
+        .now_us = door_now_us,
+        .set_output = door_set_output,
+        .arm_timer = door_arm_timer,
+        .cancel_timer = door_cancel_timer,
+    };
+    pulse_engine_init(&door_pulse, &ops, DOOR_MAX_HOLD_MS);
+}
@@ -0,0 +1,18 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#define DOOR_DEFAULT_OPEN_MS    CONFIG_INTERCOM_DOOR_DEFAULT_OPEN_MS    // pulse for a plain "true"
+#define DOOR_MAX_HOLD_MS        CONFIG_INTERCOM_DOOR_MAX_HOLD_MS        // longest the release stays on
+#define DOOR_RPC_WAITERS        4       // requests answered when the running pulse ends
+#define DOOR_ACKS_PENDING       4       // ended pulses waiting for the MQTT worker to publish their ack
+
+void door_init();
+
+/* Pulse the door release, returns the pulse number. rpc (0 for none) is answered when the pulse ends */
+uint32_t door_open_for(uint32_t duration_ms, uint32_t rpc);
+
+/* End a running pulse early */
+void door_close();
+
+/* Publish the acks of ended pulses, called on the MQTT worker after mqtt_worker_wake() */
+void door_publish_acks();
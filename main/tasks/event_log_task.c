@@ -0,0 +1,199 @@
+#include "event_log_task.h"
+#include "mqtt_task.h"
+#include "intercom_constants.h"
+#include "app_alloc.h"
+#include "power_task.h"
+#include "core/flash_log.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "esp_partition.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+const char *TAG_EVENT_LOG = "intercom_event_log";
+
+/* On-flash form of a ring event, 20 bytes */
+typedef struct __attribute__((packed)) {
+    uint8_t type;
+    uint8_t channel;        // ADC1 channel
+    uint32_t boot_id;       // random per boot, uptimes of different boots are not comparable
+    int64_t timestamp_us;
+    uint32_t duration_ms;
+    uint16_t peak;
+} event_log_record_t;
+
+static flash_log_t event_log;
+static SemaphoreHandle_t event_log_lock = NULL;
+static TaskHandle_t event_log_task_handle = NULL;
+static uint32_t event_log_boot_id;
+
+static int partition_read(void *ctx, uint32_t addr, void *buf, size_t len)
+{
+    return esp_partition_read(ctx, addr, buf, len) == ESP_OK ? 0 : -1;
+}
+
+static int partition_write(void *ctx, uint32_t addr, const void *buf, size_t len)
+{
+    return esp_partition_write(ctx, addr, buf, len) == ESP_OK ? 0 : -1;
+}
+
+static int partition_erase_sector(void *ctx, uint32_t addr)
+{
+    const esp_partition_t *partition = ctx;
+    return esp_partition_erase_range(partition, addr, partition->erase_size) == ESP_OK ? 0 : -1;
+}
+
+bool event_log_append(const ring_event_t *event)
+{
+    if (event_log_lock == NULL) {
+        return false;
+    }
+    event_log_record_t record = {
+        .type = event->type,
+        .channel = event->channel,
+        .boot_id = event_log_boot_id,
+        .timestamp_us = event->timestamp_us,
+        .duration_ms = event->duration_us / 1000,
+        .peak = event->peak,
+    };
+
+    xSemaphoreTake(event_log_lock, portMAX_DELAY);
+    uint32_t dropped = event_log.dropped;
+    bool stored = flash_log_append(&event_log, &record, sizeof(record));
+    uint32_t pending = flash_log_pending(&event_log);
+    dropped = event_log.dropped - dropped;
+    xSemaphoreGive(event_log_lock);
+
+    if (!stored) {
+        ESP_LOGE(TAG_EVENT_LOG, "Failed to store ring event");
+    } else if (dropped > 0) {
+        ESP_LOGW(TAG_EVENT_LOG, "Event log full, dropped %" PRIu32 " oldest events", dropped);
+    }
+    ESP_LOGD(TAG_EVENT_LOG, "Stored ring event, %" PRIu32 " pending", pending);
+    if (event_log_task_handle != NULL) {
+        xTaskNotifyGive(event_log_task_handle);
+    }
+    return stored;
+}
+
+uint32_t event_log_pending()
+{
+    if (event_log_lock == NULL) {
+        return 0;
+    }
+    xSemaphoreTake(event_log_lock, portMAX_DELAY);
+    uint32_t pending = flash_log_pending(&event_log);
+    xSemaphoreGive(event_log_lock);
+    return pending;
+}
+
+static int format_record(const event_log_record_t *record, char *payload, size_t size)
+{
+    // age_ms lets the backend place events of this boot on its own clock
+    char age[32] = "";
+    if (record->boot_id == event_log_boot_id) {
+        snprintf(age, sizeof(age), ",\"age_ms\":%" PRId64, (esp_timer_get_time() - record->timestamp_us) / 1000);
+    }
+    if (record->type == RING_EVENT_START) {
+        return snprintf(payload, size, "{\"event\":\"start\",\"channel\":%u,\"uptime_us\":%" PRId64 ",\"peak\":%u,"
+                        "\"replayed\":true,\"boot\":\"%08" PRIx32 "\"%s}",
+                        record->channel, record->timestamp_us, record->peak, record->boot_id, age);
+    }
+    return snprintf(payload, size, "{\"event\":\"stop\",\"channel\":%u,\"uptime_us\":%" PRId64 ",\"duration_ms\":%" PRIu32
+                    ",\"peak\":%u,\"replayed\":true,\"boot\":\"%08" PRIx32 "\"%s}",
+                    record->channel, record->timestamp_us, record->duration_ms, record->peak, record->boot_id, age);
+}
+
+/* Publish up to EVENT_LOG_BATCH stored events, returns false once publishing fails */
+static bool event_log_drain_batch()
+{
+    for (int i = 0; i < EVENT_LOG_BATCH; i++) {
+        event_log_record_t record;
+        char payload[160];
+
+        xSemaphoreTake(event_log_lock, portMAX_DELAY);
+        int len = flash_log_peek(&event_log, &record, sizeof(record));
+        xSemaphoreGive(event_log_lock);
+        if (len < 0) {
+            return true;
+        }
+        if (len != sizeof(record)) {
+            ESP_LOGW(TAG_EVENT_LOG, "Skipping stored record of %d bytes", len);
+        } else {
+            format_record(&record, payload, sizeof(payload));
+            if (mqtt_publish(MQTT_DIAL_VALUE_TOPIC, payload, 0, 1, 0) < 0) {
+                return false;
+            }
+        }
+
+        // Only the drain task consumes, the record peeked above is still the oldest
+        xSemaphoreTake(event_log_lock, portMAX_DELAY);
+        flash_log_consume(&event_log);
+        xSemaphoreGive(event_log_lock);
+    }
+    return true;
+}
+
+/* Replays stored events in order, rate limited so a long backlog does not flood the broker */
+static void event_log_task(void *pvParameters)
+{
+    while (1) {
+        xEventGroupWaitBits(get_mqtt_event_group(), MQTT_CONNECTED_BIT, pdFALSE, pdTRUE, portMAX_DELAY);
+        power_woke(POWER_TASK_EVENT_LOG);
+
+        uint32_t pending = event_log_pending();
+        if (pending == 0) {
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            power_woke(POWER_TASK_EVENT_LOG);
+            continue;
+        }
+        ESP_LOGI(TAG_EVENT_LOG, "Replaying %" PRIu32 " stored events", pending);
+        while (event_log_drain_batch() && event_log_pending() > 0) {
+            vTaskDelay(pdMS_TO_TICKS(EVENT_LOG_BATCH_INTERVAL_MS));
+            power_woke(POWER_TASK_EVENT_LOG);
+        }
+        if (event_log_pending() > 0) {
+            // Disconnected, or the outbox is full of unacknowledged events
+            ESP_LOGW(TAG_EVENT_LOG, "Replay stopped with %" PRIu32 " events left", event_log_pending());
+            vTaskDelay(pdMS_TO_TICKS(EVENT_LOG_BATCH_INTERVAL_MS));
+        } else {
+            ESP_LOGI(TAG_EVENT_LOG, "Event log drained, %" PRIu32 " events lost to overflow", event_log.dropped);
+        }
+    }
+}
+
+void task_event_log_start()
+{
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                                                                EVENT_LOG_PARTITION_SUBTYPE,
+                                                                EVENT_LOG_PARTITION_LABEL);
+    if (partition == NULL) {
+        ESP_LOGW(TAG_EVENT_LOG, "No \"" EVENT_LOG_PARTITION_LABEL "\" partition, offline events are not kept");
+        return;
+    }
+
+    const flash_ops_t ops = {
+        .read = partition_read,
+        .write = partition_write,
+        .erase_sector = partition_erase_sector,
+        .size = partition->size - partition->size % partition->erase_size,
+        .sector_size = partition->erase_size,
+        .ctx = (void *)partition,
+    };
+    if (!flash_log_mount(&event_log, &ops)) {
+        ESP_LOGE(TAG_EVENT_LOG, "Failed to mount the event log");
+        return;
+    }
+    event_log_boot_id = esp_random();
+    ESP_LOGI(TAG_EVENT_LOG, "Event log mounted, %" PRIu32 " events pending replay", flash_log_pending(&event_log));
+
+    event_log_lock = APP_MUTEX_CREATE();
+    event_log_task_handle = APP_TASK_CREATE(event_log_task, "event_log_task", 3072, NULL, 4);
+}
@@ -0,0 +1,19 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "core/ring_detector.h"
+
+#define EVENT_LOG_PARTITION_LABEL   "evlog"
+#define EVENT_LOG_PARTITION_SUBTYPE 0x40    // custom data subtype in partitions.csv
+#define EVENT_LOG_BATCH             CONFIG_INTERCOM_EVENT_LOG_BATCH         // records published per drain step
+#define EVENT_LOG_BATCH_INTERVAL_MS CONFIG_INTERCOM_EVENT_LOG_BATCH_INTERVAL_MS
+
+/* Store a ring event that could not be published, its channel being the ADC1 channel.
+ * False if the log is unavailable */
+bool event_log_append(const ring_event_t *event);
+
+/* Stored events not yet replayed, live events must queue behind them to keep order */
+uint32_t event_log_pending();
+
+/* Mount the log partition and start the task replaying it while MQTT is connected */
+void task_event_log_start();
@@ -3,14 +3,26 @@
 #include "esp_log.h"
 #include "esp_timer.h"
 #include "driver/gpio.h"
-#include "driver/adc.h"
+#include "adc_sampler_task.h"
+#include "event_log_task.h"
+#include "metrics_task.h"
+#include "dlog_task.h"
+#include "power_task.h"
+#include "capture_task.h"
+#include "core/ring_detector.h"
+#include "core/monitor_bench.h"
+#include "core/telemetry_batch.h"
 #include "wifi_task.h"
 #include "mqtt_task.h"
 #include "intercom_constants.h"
+#include "app_alloc.h"
 #include "credentials.h"
 
 const char* TAG_MONITOR_GPIO = "intercom_gpio_monitor";
 
+#define MONITOR_EVENTS_PER_FRAME    (4 * ADC_SAMPLER_CHANNELS)
+#define MONITOR_TELEMETRY_SIZE      TELEMETRY_BATCH_SIZE(ADC_SAMPLER_CHANNELS, MONITOR_TELEMETRY_PERIODS)
+
 
 /* Initialize GPIO2 as output */
 void gpio_init_setup()
@@ -27,60 +39,152 @@ void gpio_init_setup()
     ESP_LOGI(TAG_MONITOR_GPIO, "GPIO2 initialized as output, set to LOW");
 }
 
-/* Initialize ADC for reading; adjust settings and channel as needed */
-void adc_init_setup()
+static void publish_ring_event(const ring_event_t *event)
+{
+    char payload[112];
+    if (event->type == RING_EVENT_START) {
+        snprintf(payload, sizeof(payload), "{\"event\":\"start\",\"channel\":%u,\"uptime_us\":%" PRId64 ",\"peak\":%u}",
+                 event->channel, event->timestamp_us, event->peak);
+    } else {
+        snprintf(payload, sizeof(payload),
+                 "{\"event\":\"stop\",\"channel\":%u,\"uptime_us\":%" PRId64 ",\"duration_ms\":%" PRId64 ",\"peak\":%u}",
+                 event->channel, event->timestamp_us, event->duration_us / 1000, event->peak);
+    }
+    DLOGI(TAG_MONITOR_GPIO, "Ring event %s on channel %u at %" PRId64 " us, %" PRId64 " ms, peak %u",
+          event->type == RING_EVENT_START ? "start" : "stop", event->channel, event->timestamp_us,
+          event->duration_us / 1000, event->peak);
+
+    // While older events wait in the flash log, new ones queue behind them
+    int msg_id = -1;
+    if (event_log_pending() == 0) {
+        msg_id = mqtt_publish(MQTT_DIAL_VALUE_TOPIC, payload, 0, 1, 0);
+    }
+    if (msg_id >= 0) {
+        metrics_record_latency(METRICS_LATENCY_ADC_PUBLISH, esp_timer_get_time() - event->timestamp_us);
+        DLOGI(TAG_MONITOR_GPIO, "Published MQTT message to " MQTT_DIAL_VALUE_TOPIC ", msg_id=%d", msg_id);
+    } else {
+        event_log_append(event);
+    }
+}
+
+static void publish_telemetry_batch(const telemetry_batch_t *batch)
+{
+    static uint8_t payload[MONITOR_TELEMETRY_SIZE];
+    size_t len = telemetry_batch_encode(batch, payload, sizeof(payload));
+
+    if (len == 0) {
+        return;
+    }
+    int msg_id = mqtt_publish(MQTT_TELEMETRY_TOPIC, (const char *)payload, len, 1, 0);
+    if (msg_id >= 0) {
+        DLOGI(TAG_MONITOR_GPIO, "Published telemetry batch seq=%" PRIu32 " (%u bytes), msg_id=%d",
+              batch->seq, (unsigned)len, msg_id);
+    }
+}
+
+static const ring_detector_config_t detector_cfg = {
+    .threshold_on = MONITOR_THRESHOLD,
+    .threshold_off = MONITOR_THRESHOLD_OFF,
+    .sample_period_us = 1000000 / ADC_SAMPLER_RATE_HZ,
+    .min_on_us = MONITOR_MIN_ON_MS * 1000,
+    .min_off_us = MONITOR_MIN_OFF_MS * 1000,
+    .smoothing_shift = MONITOR_SMOOTHING_SHIFT,
+};
+
+#if CONFIG_INTERCOM_MONITOR_BENCHMARK
+#define MONITOR_BENCH_SETS  20480   // sample sets per channel count, about 10 s of signal at 2 kHz
+
+/*
+ * Cost of detection and telemetry aggregation per sample as the channel
+ * count grows, the loop test_ring_detector runs on the host. This one
+ * measures the target's core, caches and clock, which decide the CPU budget.
+ */
+static void monitor_benchmark()
 {
-     adc1_config_width(ADC_WIDTH_BIT_12);
-     adc1_config_channel_atten(MONITOR_ADC_CHANNEL, ADC_ATTEN_DB_12);
+    static uint16_t samples[ADC_SAMPLER_FRAME_SAMPLES * RING_DETECTOR_MAX_CHANNELS];
+    static monitor_bench_t bench;
+
+    monitor_bench_init(&bench, samples, ADC_SAMPLER_FRAME_SAMPLES);
+    for (uint8_t n = 1; n <= RING_DETECTOR_MAX_CHANNELS; n++) {
+        size_t n_events;
+        int64_t elapsed_us = monitor_bench_run(&bench, &detector_cfg, MONITOR_PUBLISH_PERIOD_MS, n,
+                                               MONITOR_BENCH_SETS, esp_timer_get_time, &n_events);
+        ESP_LOGI(TAG_MONITOR_GPIO, "Benchmark %u channels: %" PRId64 " ns per sample, %" PRId64 " ns per set, %u events",
+                 n, elapsed_us * 1000 / ((int64_t)MONITOR_BENCH_SETS * n), elapsed_us * 1000 / MONITOR_BENCH_SETS,
+                 (unsigned)n_events);
+    }
 }
+#endif
 
-/* Task to monitor ADC value and publish via MQTT when value exceeds a threshold */
+/* Task consuming ADC frames, running ring detection and publishing via MQTT */
 void gpio_monitor_task(void *pvParameters)
 {
-    // Configure ADC 
-    adc1_config_width(ADC_WIDTH_BIT_12);
-    adc1_config_channel_atten(MONITOR_ADC_CHANNEL, ADC_ATTEN_DB_12);
+#if CONFIG_INTERCOM_MONITOR_BENCHMARK
+    monitor_benchmark();
+#endif
+    // Map detector indices to ADC1 channel numbers once
+    uint8_t channels[ADC_SAMPLER_CHANNELS];
+    for (size_t i = 0; i < ADC_SAMPLER_CHANNELS; i++) {
+        channels[i] = adc_sampler_channel(i);
+    }
+
+    static ring_detector_t detector;
+    ring_detector_init(&detector, &detector_cfg, ADC_SAMPLER_CHANNELS);
+
+    static telemetry_batch_t telemetry;
+    telemetry_batch_init(&telemetry, MONITOR_PUBLISH_PERIOD_MS, MONITOR_ADC_CHANNELS);
+    int64_t period_start_us = esp_timer_get_time();
+    telemetry_batch_begin(&telemetry, period_start_us);
+    uint32_t last_overruns = adc_sampler_overruns();
 
     while (1) {
-        EventGroupHandle_t mqtt_events = get_mqtt_event_group();
-        EventBits_t bits = xEventGroupWaitBits(mqtt_events,
-                                                MQTT_CONNECTED_BIT | MQTT_FAIL_BIT,
-                                                pdFALSE,
-                                                pdFALSE,
-                                                100 / portTICK_PERIOD_MS);
-        
-        
-
-        int adc_val = adc1_get_raw(MONITOR_ADC_CHANNEL);
-        ESP_LOGI(TAG_MONITOR_GPIO, "ADC reading: %d", adc_val);
-
-        esp_mqtt_client_handle_t global_mqtt_client = get_mqtt_global_client();
-
-        if ((bits & MQTT_CONNECTED_BIT) && global_mqtt_client != NULL) {
-            char uptime_payload[32];
-            snprintf(uptime_payload, sizeof(uptime_payload), "%llu", esp_timer_get_time());
-            int msg_id = esp_mqtt_client_publish(global_mqtt_client, MQTT_UPTIME_TOPIC, uptime_payload, 0, 0, 0);
-            ESP_LOGI(TAG_MONITOR_GPIO, "Published MQTT message to " MQTT_UPTIME_TOPIC", msg_id=%d", msg_id);
-
-            char payload[32];
-            snprintf(payload, sizeof(payload), "%d", adc_val);
-
-            msg_id = esp_mqtt_client_publish(global_mqtt_client, MQTT_DIAL_RAW_VALUE_TOPIC, payload, 0, 1, 0);
-            ESP_LOGI(TAG_MONITOR_GPIO, "Published MQTT message to " MQTT_DIAL_RAW_VALUE_TOPIC", msg_id=%d", msg_id);
-
-            if (adc_val > MONITOR_THRESHOLD) {
-                int msg_id = esp_mqtt_client_publish(global_mqtt_client, MQTT_DIAL_VALUE_TOPIC, payload, 0, 1, 0);
-                ESP_LOGI(TAG_MONITOR_GPIO, "Published MQTT message to " MQTT_DIAL_VALUE_TOPIC", msg_id=%d", msg_id);
+        // Frames pace the task, no timeout wakeups in between
+        adc_frame_t *frame = adc_sampler_wait_frame(portMAX_DELAY);
+        power_woke(POWER_TASK_MONITOR);
+        if (frame == NULL) {
+            continue;
+        }
+        power_begin(POWER_ACTIVITY_FRAME);
+
+        size_t n_sets = frame->count / ADC_SAMPLER_CHANNELS;
+        telemetry_batch_add_samples(&telemetry, frame->samples, n_sets);
+        capture_feed(frame->samples, n_sets, frame->timestamp_us);
+
+        ring_event_t events[MONITOR_EVENTS_PER_FRAME];
+        size_t n_events = ring_detector_process(&detector, frame->samples, n_sets,
+                                                frame->timestamp_us, events, MONITOR_EVENTS_PER_FRAME);
+        int64_t frame_time_us = frame->timestamp_us;
+        adc_sampler_release_frame();
+
+        for (size_t i = 0; i < n_events; i++) {
+            events[i].channel = channels[events[i].channel];
+            if (events[i].type == RING_EVENT_START) {
+                capture_trigger(events[i].timestamp_us, events[i].channel);
             }
+            publish_ring_event(&events[i]);
+            telemetry_batch_add_event(&telemetry, events[i].type, events[i].channel, events[i].timestamp_us,
+                                      events[i].duration_us, events[i].peak);
         }
 
-        vTaskDelay(pdMS_TO_TICKS(1000));
+        if (frame_time_us - period_start_us >= MONITOR_PUBLISH_PERIOD_MS * 1000LL) {
+            period_start_us = frame_time_us;
+            if (telemetry_batch_close_period(&telemetry) >= MONITOR_TELEMETRY_PERIODS) {
+                uint32_t overruns = adc_sampler_overruns();
+                telemetry_batch_add_overruns(&telemetry, overruns - last_overruns);
+                last_overruns = overruns;
+
+                publish_telemetry_batch(&telemetry);
+                telemetry.seq++;
+                telemetry_batch_begin(&telemetry, frame_time_us);
+            }
+        }
+        power_end(POWER_ACTIVITY_FRAME);
     }
 }
 
-/* Start ADC and create the monitoring task */
+/* Start ADC sampling and create the monitoring task */
 void task_gpio_monitor_start()
 {
-     adc_init_setup();
-     xTaskCreate(gpio_monitor_task, "gpio_monitor_task", 4096, NULL, 5, NULL);
+     task_adc_sampler_start();
+     APP_TASK_CREATE(gpio_monitor_task, "gpio_monitor_task", 4096, NULL, 5);
 }
\ No newline at end of file
@@ -1,6 +1,3 @@
-
 void gpio_init_setup();
 
-void adc_init_setup();
-
 void task_gpio_monitor_start();
\ No newline at end of file
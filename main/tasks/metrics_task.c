@@ -0,0 +1,146 @@
+#include "metrics_task.h"
+#include "mqtt_task.h"
+#include "intercom_constants.h"
+#include "app_alloc.h"
+#include "power_task.h"
+#include "core/latency_hist.h"
+#include "core/task_metrics.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+const char *TAG_METRICS = "intercom_metrics";
+
+static const char *metrics_latency_names[METRICS_LATENCY_COUNT] = {
+    [METRICS_LATENCY_ADC_PUBLISH] = "adc_publish",
+    [METRICS_LATENCY_CMD_GPIO] = "cmd_gpio",
+};
+
+static latency_hist_t metrics_latency[METRICS_LATENCY_COUNT];
+static bool metrics_started = false;
+
+void metrics_record_latency(metrics_latency_t latency, int64_t latency_us)
+{
+    if (metrics_started && latency < METRICS_LATENCY_COUNT) {
+        latency_hist_record(&metrics_latency[latency], latency_us);
+    }
+}
+
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+static TaskStatus_t metrics_status[TASK_METRICS_MAX_TASKS];
+static task_runtime_t metrics_runtime[TASK_METRICS_MAX_TASKS];
+static uint16_t metrics_permille[TASK_METRICS_MAX_TASKS];
+static task_metrics_t metrics_tasks;
+
+/* Append ["name",cpu_permille,stack_free_bytes] per task */
+static int metrics_append_tasks(char *payload, int len, size_t size)
+{
+    configRUN_TIME_COUNTER_TYPE total = 0;
+    UBaseType_t n = uxTaskGetSystemState(metrics_status, TASK_METRICS_MAX_TASKS, &total);
+    if (n == 0) {
+        ESP_LOGW(TAG_METRICS, "More than %d tasks, task list skipped", TASK_METRICS_MAX_TASKS);
+        return len;
+    }
+
+    for (UBaseType_t i = 0; i < n; i++) {
+        metrics_runtime[i].id = metrics_status[i].xTaskNumber;
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+        metrics_runtime[i].runtime = (uint32_t)metrics_status[i].ulRunTimeCounter;
+#else
+        metrics_runtime[i].runtime = 0;
+#endif
+    }
+    task_metrics_update(&metrics_tasks, metrics_runtime, n, (uint32_t)total, portNUM_PROCESSORS, metrics_permille);
+
+    len += snprintf(payload + len, size - len, ",\"tasks\":[");
+    for (UBaseType_t i = 0; i < n && len < size; i++) {
+        // The high water mark is in bytes on ESP-IDF
+        len += snprintf(payload + len, size - len, "%s[\"%s\",%u,%u]", i > 0 ? "," : "",
+                        metrics_status[i].pcTaskName, metrics_permille[i],
+                        (unsigned)metrics_status[i].usStackHighWaterMark);
+    }
+    if (len < size) {
+        len += snprintf(payload + len, size - len, "]");
+    }
+    return len;
+}
+#endif
+
+/* Append "name":[count,p50,p90,p99,max] per latency, in us */
+static int metrics_append_latencies(char *payload, int len, size_t size)
+{
+    latency_snapshot_t snapshot;
+
+    len += snprintf(payload + len, size - len, ",\"latency_us\":{");
+    for (int i = 0; i < METRICS_LATENCY_COUNT && len < size; i++) {
+        latency_hist_take(&metrics_latency[i], &snapshot);
+        len += snprintf(payload + len, size - len, "%s\"%s\":[%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 "]",
+                        i > 0 ? "," : "", metrics_latency_names[i], snapshot.count,
+                        latency_snapshot_percentile(&snapshot, 50), latency_snapshot_percentile(&snapshot, 90),
+                        latency_snapshot_percentile(&snapshot, 99), snapshot.max_us);
+    }
+    if (len < size) {
+        len += snprintf(payload + len, size - len, "}");
+    }
+    return len;
+}
+
+static void metrics_publish()
+{
+    static char payload[METRICS_PAYLOAD_SIZE];
+    int len = snprintf(payload, sizeof(payload), "{\"uptime_s\":%" PRId64 ",\"heap_min\":%u",
+                       esp_timer_get_time() / 1000000,
+                       (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT));
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+    len = metrics_append_tasks(payload, len, sizeof(payload));
+#endif
+    if (len < sizeof(payload)) {
+        len = metrics_append_latencies(payload, len, sizeof(payload));
+    }
+    if (len < sizeof(payload)) {
+        len = power_append_report(payload, len, sizeof(payload));
+    }
+    if (len < sizeof(payload)) {
+        len = mqtt_append_outbox_report(payload, len, sizeof(payload));
+    }
+    if (len >= sizeof(payload) - 1) {
+        ESP_LOGW(TAG_METRICS, "Diagnostics report does not fit %d bytes", METRICS_PAYLOAD_SIZE);
+        return;
+    }
+    payload[len++] = '}';
+    payload[len] = '\0';
+
+    // Dropped while offline, the next period reports fresh numbers anyway
+    int msg_id = mqtt_publish(MQTT_DIAGNOSTICS_TOPIC, payload, len, 0, 0);
+    ESP_LOGD(TAG_METRICS, "Published diagnostics, msg_id=%d", msg_id);
+}
+
+static void metrics_task(void *pvParameter)
+{
+    TickType_t last_wake = xTaskGetTickCount();
+    while (1) {
+        vTaskDelayUntil(&last_wake, pdMS_TO_TICKS(METRICS_PERIOD_S * 1000));
+        power_woke(POWER_TASK_METRICS);
+        metrics_publish();
+    }
+}
+
+void task_metrics_start()
+{
+    for (int i = 0; i < METRICS_LATENCY_COUNT; i++) {
+        latency_hist_init(&metrics_latency[i]);
+    }
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+    task_metrics_init(&metrics_tasks);
+#else
+    ESP_LOGW(TAG_METRICS, "CONFIG_FREERTOS_USE_TRACE_FACILITY is off, task list not reported");
+#endif
+    metrics_started = true;
+    APP_TASK_CREATE(metrics_task, "metrics_task", 3072, NULL, 2);
+}
@@ -0,0 +1,17 @@
+#include <stdint.h>
+
+#define METRICS_PERIOD_S        CONFIG_INTERCOM_METRICS_PERIOD_S    // below one wrap of the 32 bit run time counter
+#define METRICS_PAYLOAD_SIZE    2048
+
+/* Latencies kept as histograms and published with the task report */
+typedef enum {
+    METRICS_LATENCY_ADC_PUBLISH,    // ring edge sample to its MQTT publish, debounce included
+    METRICS_LATENCY_CMD_GPIO,       // open_state message received to door output switched
+    METRICS_LATENCY_COUNT,
+} metrics_latency_t;
+
+/* Safe from any task, a few atomic adds */
+void metrics_record_latency(metrics_latency_t latency, int64_t latency_us);
+
+/* Start the task publishing CPU use, stack headroom and latencies to the diagnostics topic */
+void task_metrics_start();
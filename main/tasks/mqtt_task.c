@@ -2,12 +2,34 @@
 #include "color.h"
 #include "intercom_constants.h"
 #include "credentials.h"
+#include "app_alloc.h"
 #include "rgb_state_task.h"
+#include "boot_task.h"
+#include "door_task.h"
+#include "metrics_task.h"
+#include "dlog_task.h"
+#include "power_task.h"
+#include "core/backoff.h"
+#include "core/topic_router.h"
+#include "core/mqtt_payload.h"
+#include "core/msg_pool.h"
+#include "core/rpc_tracker.h"
+#include "core/publish_policy.h"
+#include "core/telemetry_batch.h"
 #include "esp_log.h"
-#include "driver/gpio.h"
+#include "esp_random.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include <stdatomic.h>
+#include <string.h>
 
 const char *TAG_MQTT = "intercom_mqtt";
 
+static esp_mqtt_client_handle_t global_mqtt_client = NULL;
+static EventGroupHandle_t mqtt_event_group = NULL;
+
 void log_error_if_nonzero(const char *message, int error_code)
 {
     if (error_code != 0) {
@@ -28,25 +50,390 @@ esp_mqtt5_disconnect_property_config_t disconnect_property = {
     .disconnect_reason = 0,
 };
 
+/* Called from the MQTT client task only */
 void print_user_property(mqtt5_user_property_handle_t user_property)
 {
-    if (user_property) {
-        uint8_t count = esp_mqtt5_client_get_user_property_count(user_property);
-        if (count) {
-            esp_mqtt5_user_property_item_t *item = malloc(count * sizeof(esp_mqtt5_user_property_item_t));
-            if (esp_mqtt5_client_get_user_property(user_property, item, &count) == ESP_OK) {
-                for (int i = 0; i < count; i ++) {
-                    esp_mqtt5_user_property_item_t *t = &item[i];
-                    ESP_LOGI(TAG_MQTT, "key is %s, value is %s", t->key, t->value);
-                    free((char *)t->key);
-                    free((char *)t->value);
-                }
+    if (user_property == NULL) {
+        return;
+    }
+    uint8_t count = esp_mqtt5_client_get_user_property_count(user_property);
+    if (count == 0) {
+        return;
+    }
+    ESP_LOGI(TAG_MQTT, "%u user properties", count);
+
+#if !CONFIG_INTERCOM_STATIC_ALLOC
+    // The client hands out heap copies of every key and value, only pay for that when debugging
+    static esp_mqtt5_user_property_item_t items[MQTT_USER_PROPERTY_MAX];
+    if (esp_log_level_get(TAG_MQTT) < ESP_LOG_DEBUG) {
+        return;
+    }
+    count = count < MQTT_USER_PROPERTY_MAX ? count : MQTT_USER_PROPERTY_MAX;
+    if (esp_mqtt5_client_get_user_property(user_property, items, &count) == ESP_OK) {
+        for (int i = 0; i < count; i++) {
+            ESP_LOGD(TAG_MQTT, "key is %s, value is %s", items[i].key, items[i].value);
+            free((char *)items[i].key);
+            free((char *)items[i].value);
+        }
+    }
+#endif
+}
+
+
+static rpc_tracker_t rpc_tracker;
+static SemaphoreHandle_t rpc_lock = NULL;       // the worker and the door timer both complete requests
+static SemaphoreHandle_t publish_lock = NULL;   // publish properties apply to every publish of the client
+static uint32_t rpc_current = 0;                // request of the message being handled, worker task only
+static int64_t received_current_us = 0;         // arrival time of the message being handled, worker task only
+
+static const esp_mqtt5_publish_property_config_t no_publish_property = { 0 };
+
+/* Topics where only the latest value matters, every other topic keeps all its messages */
+static uint8_t publish_telemetry_buf[TELEMETRY_BATCH_SIZE(MONITOR_CHANNEL_COUNT, MONITOR_TELEMETRY_PERIODS)];
+_Static_assert(sizeof(publish_telemetry_buf) <= MQTT_STATE_MAX_BYTES, "INTERCOM_MQTT_STATE_MAX_BYTES below one telemetry batch");
+static publish_slot_t publish_slots[] = {
+    { .topic = MQTT_TELEMETRY_TOPIC, .buf = publish_telemetry_buf, .size = sizeof(publish_telemetry_buf) },
+};
+
+#define PUBLISH_SLOT_COUNT  (sizeof(publish_slots) / sizeof(publish_slots[0]))
+
+/* Topics with their own caps, so an upload does not crowd out the events */
+static const char *const publish_bulk_topics[] = { MQTT_CAPTURE_TOPIC };
+
+#define PUBLISH_BULK_TOPIC_COUNT    (sizeof(publish_bulk_topics) / sizeof(publish_bulk_topics[0]))
+
+/* Acknowledgement or outbox expiry reported by the client task */
+typedef struct {
+    int msg_id;
+    bool delivered;
+} publish_done_t;
+
+static publish_policy_t publish_policy;         // publish_lock
+static QueueHandle_t publish_done_queue = NULL; // client task to worker, the client never takes publish_lock
+static atomic_bool worker_wake_pending;          // a NULL wake is in mqtt_msg_queue
+
+static bool mqtt_connected(void)
+{
+    return (xEventGroupGetBits(mqtt_event_group) & MQTT_CONNECTED_BIT) != 0;
+}
+
+/* "open_for_ms=<n>" pulses the door release, "true" pulses for the default time, "false" ends a pulse */
+static bool handle_open_state(const char *topic, size_t topic_len, const char *data, size_t data_len, void *ctx)
+{
+    const char *value;
+    size_t value_len;
+    uint32_t duration_ms;
+    bool open;
+
+    if (mqtt_payload_field(data, data_len, "open_for_ms", &value, &value_len)) {
+        if (!mqtt_payload_uint(value, value_len, &duration_ms) || duration_ms == 0) {
+            ESP_LOGW(TAG_MQTT, "Invalid open_for_ms \"%.*s\"", (int)value_len, value);
+            return false;
+        }
+        door_open_for(duration_ms, mqtt_rpc_defer());
+        metrics_record_latency(METRICS_LATENCY_CMD_GPIO, esp_timer_get_time() - received_current_us);
+    } else if (mqtt_payload_bool(data, data_len, &open)) {
+        if (open) {
+            door_open_for(DOOR_DEFAULT_OPEN_MS, mqtt_rpc_defer());
+            metrics_record_latency(METRICS_LATENCY_CMD_GPIO, esp_timer_get_time() - received_current_us);
+        } else {
+            door_close();
+        }
+    } else {
+        ESP_LOGW(TAG_MQTT, "Ignoring open_state payload \"%.*s\"", (int)data_len, data);
+        return false;
+    }
+    return true;
+}
+
+/* Every topic the device subscribes to and its handler */
+static const topic_route_t mqtt_routes[] = {
+    { MQTT_OPEN_STATE_TOPIC, handle_open_state, NULL },
+};
+
+#define MQTT_ROUTE_COUNT    (sizeof(mqtt_routes) / sizeof(mqtt_routes[0]))
+
+static const topic_route_t *mqtt_route_index[MQTT_ROUTE_COUNT];
+static topic_router_t mqtt_router;
+
+/* Incoming message copied out of the client's buffers */
+typedef struct {
+    char topic[MQTT_MSG_TOPIC_MAX];
+    uint16_t topic_len;
+    char data[MQTT_MSG_DATA_MAX];
+    uint16_t data_len;
+    char response_topic[RPC_TOPIC_MAX];     // empty unless the sender expects a reply
+    uint16_t response_topic_len;
+    uint8_t correlation[RPC_CORRELATION_MAX];
+    uint16_t correlation_len;
+    int64_t received_us;
+} mqtt_msg_t;
+
+static mqtt_msg_t mqtt_msg_storage[MQTT_MSG_POOL_SIZE];
+static msg_pool_t mqtt_msg_pool;
+static QueueHandle_t mqtt_msg_queue = NULL;
+
+/* Copy a received message into a pool slot and queue it for the worker */
+static void mqtt_enqueue_message(esp_mqtt_event_handle_t event)
+{
+    if (event->current_data_offset > 0) {
+        return;     // later fragment of a message that was already dropped
+    }
+    if (event->topic_len > MQTT_MSG_TOPIC_MAX || event->total_data_len > MQTT_MSG_DATA_MAX) {
+        msg_pool_count_drop(&mqtt_msg_pool);
+        ESP_LOGW(TAG_MQTT, "Dropped %d byte message on %.*s, too large",
+                 event->total_data_len, event->topic_len, event->topic);
+        return;
+    }
+    // Topic and payload did not fit the client's receive buffer, the rest comes in later events
+    if (event->data_len != event->total_data_len) {
+        msg_pool_count_drop(&mqtt_msg_pool);
+        ESP_LOGW(TAG_MQTT, "Dropped %d byte message on %.*s, split by the client (%d bytes in the first part)",
+                 event->total_data_len, event->topic_len, event->topic, event->data_len);
+        return;
+    }
+
+    mqtt_msg_t *msg = msg_pool_alloc(&mqtt_msg_pool);
+    if (msg == NULL) {
+        msg_pool_stats_t stats;
+        msg_pool_stats(&mqtt_msg_pool, &stats);
+        ESP_LOGW(TAG_MQTT, "Message pool exhausted, %" PRIu32 " messages dropped", stats.drops);
+        return;
+    }
+    memcpy(msg->topic, event->topic, event->topic_len);
+    msg->topic_len = event->topic_len;
+    memcpy(msg->data, event->data, event->data_len);
+    msg->data_len = event->data_len;
+    msg->received_us = esp_timer_get_time();
+
+    msg->response_topic_len = 0;
+    int topic_len = event->property->response_topic_len;
+    int correlation_len = event->property->correlation_data_len;
+    if (topic_len > 0 && topic_len < RPC_TOPIC_MAX && correlation_len <= RPC_CORRELATION_MAX) {
+        memcpy(msg->response_topic, event->property->response_topic, topic_len);
+        msg->response_topic_len = topic_len;
+        memcpy(msg->correlation, event->property->correlation_data, correlation_len);
+        msg->correlation_len = correlation_len;
+    } else if (topic_len > 0) {
+        ESP_LOGW(TAG_MQTT, "Response topic or correlation data too long, request gets no reply");
+    }
+
+    // The queue has room for every slot, so this never waits
+    xQueueSend(mqtt_msg_queue, &msg, 0);
+}
+
+/* Publish a reply with the request's correlation data */
+static void mqtt_rpc_send(const rpc_request_t *request, const char *status, const char *result)
+{
+    char payload[256];
+    int64_t latency_us = esp_timer_get_time() - request->received_us;
+    if (result != NULL) {
+        snprintf(payload, sizeof(payload), "{\"status\":\"%s\",\"latency_us\":%" PRId64 ",\"result\":%s}",
+                 status, latency_us, result);
+    } else {
+        snprintf(payload, sizeof(payload), "{\"status\":\"%s\",\"latency_us\":%" PRId64 "}", status, latency_us);
+    }
+
+    esp_mqtt5_publish_property_config_t property = {
+        .correlation_data = (const char *)request->correlation,
+        .correlation_data_len = request->correlation_len,
+    };
+
+    xSemaphoreTake(publish_lock, portMAX_DELAY);
+    // A reconnect or an expiry noticed here flushes waiting state values, they must not carry the property
+    publish_policy_set_connected(&publish_policy, mqtt_connected());
+    publish_policy_expire(&publish_policy);
+    // The client keeps a pointer to the property for all following publishes, reset it right away
+    esp_mqtt5_client_set_publish_property(global_mqtt_client, &property);
+    int msg_id = publish_policy_publish(&publish_policy, request->response_topic, (const uint8_t *)payload,
+                                        strlen(payload), 1, 0);
+    esp_mqtt5_client_set_publish_property(global_mqtt_client, &no_publish_property);
+    xSemaphoreGive(publish_lock);
+
+    ESP_LOGI(TAG_MQTT, "RPC %" PRIu32 " %s after %" PRId64 " us, msg_id=%d", request->id, status, latency_us, msg_id);
+}
+
+uint32_t mqtt_rpc_defer(void)
+{
+    uint32_t id = rpc_current;
+    rpc_current = 0;
+    return id;
+}
+
+void mqtt_rpc_reply(uint32_t id, const char *status, const char *result)
+{
+    rpc_request_t request;
+
+    xSemaphoreTake(rpc_lock, portMAX_DELAY);
+    bool found = rpc_tracker_complete(&rpc_tracker, id, &request);
+    xSemaphoreGive(rpc_lock);
+
+    if (found) {
+        mqtt_rpc_send(&request, status, result);
+    } else if (id != 0) {
+        ESP_LOGW(TAG_MQTT, "RPC %" PRIu32 " was already answered with a timeout", id);
+    }
+}
+
+/* Answer requests past their deadline, returns the wait until the next deadline */
+static TickType_t mqtt_rpc_expire(void)
+{
+    while (1) {
+        rpc_request_t request;
+
+        xSemaphoreTake(rpc_lock, portMAX_DELAY);
+        bool expired = rpc_tracker_expire(&rpc_tracker, esp_timer_get_time(), &request);
+        int64_t next_us = rpc_tracker_next_deadline(&rpc_tracker);
+        xSemaphoreGive(rpc_lock);
+
+        if (!expired) {
+            if (next_us == INT64_MAX) {
+                return portMAX_DELAY;
             }
-            free(item);
+            int64_t wait_us = next_us - esp_timer_get_time();
+            return wait_us > 0 ? pdMS_TO_TICKS(wait_us / 1000) + 1 : 0;
         }
+        mqtt_rpc_send(&request, "timeout", NULL);
     }
 }
 
+static const char *mqtt_dispatch_status(topic_dispatch_t result)
+{
+    switch (result) {
+    case TOPIC_DISPATCH_OK:
+        return "ok";
+    case TOPIC_DISPATCH_REJECTED:
+        return "rejected";
+    default:
+        return "no_route";
+    }
+}
+
+static int mqtt_policy_send(void *ctx, const char *topic, const uint8_t *data, size_t len, int qos, int retain)
+{
+    return esp_mqtt_client_enqueue(global_mqtt_client, topic, (const char *)data, len, qos, retain, true);
+}
+
+static int64_t mqtt_policy_now_us(void *ctx)
+{
+    return esp_timer_get_time();
+}
+
+/* Wakes before the worker gets to the first one collapse, so the queue's spare entry is enough */
+void mqtt_worker_wake(void)
+{
+    if (mqtt_msg_queue != NULL && !atomic_exchange(&worker_wake_pending, true)) {
+        mqtt_msg_t *wake = NULL;
+        xQueueSend(mqtt_msg_queue, &wake, 0);
+    }
+}
+
+/*
+ * Client task: hand acknowledgements and link changes to the worker. A task
+ * holding publish_lock may be waiting for the client, so never take it here.
+ */
+static void mqtt_publish_notify(int msg_id, bool delivered)
+{
+    if (msg_id > 0) {
+        publish_done_t done = { msg_id, delivered };
+        // If the queue is full the message is released by the ack timeout
+        xQueueSend(publish_done_queue, &done, 0);
+    }
+    mqtt_worker_wake();
+}
+
+/* Worker: release acknowledged messages, waiting state values go out behind them */
+static void mqtt_publish_update(void)
+{
+    publish_done_t done;
+
+    power_begin(POWER_ACTIVITY_PUBLISH);
+    xSemaphoreTake(publish_lock, portMAX_DELAY);
+    while (xQueueReceive(publish_done_queue, &done, 0) == pdTRUE) {
+        publish_policy_done(&publish_policy, done.msg_id, done.delivered);
+    }
+    publish_policy_expire(&publish_policy);
+    publish_policy_set_connected(&publish_policy, mqtt_connected());
+    xSemaphoreGive(publish_lock);
+    power_end(POWER_ACTIVITY_PUBLISH);
+}
+
+/* Runs message handlers so the client task only copies and returns */
+static void mqtt_worker_task(void *pvParameter)
+{
+    while (1) {
+        mqtt_msg_t *msg;
+        // Wake up for RPC deadlines too
+        BaseType_t received = xQueueReceive(mqtt_msg_queue, &msg, mqtt_rpc_expire());
+        power_woke(POWER_TASK_MQTT);
+        if (received != pdTRUE) {
+            continue;
+        }
+        if (msg == NULL) {
+            atomic_store(&worker_wake_pending, false);
+            mqtt_publish_update();
+            door_publish_acks();
+            continue;
+        }
+        power_begin(POWER_ACTIVITY_COMMAND);
+
+        rgb_display(RGB_STATUS_ACTIVE);
+        // Topic and data live in the slot, too short-lived for the deferred log
+        DLOGI(TAG_MQTT, "Message of %d bytes, %" PRId64 " us in the queue", msg->data_len,
+              esp_timer_get_time() - msg->received_us);
+        ESP_LOGD(TAG_MQTT, "TOPIC=%.*s", msg->topic_len, msg->topic);
+        ESP_LOGD(TAG_MQTT, "DATA=%.*s", msg->data_len, msg->data);
+
+        rpc_current = 0;
+        received_current_us = msg->received_us;
+        if (msg->response_topic_len > 0) {
+            xSemaphoreTake(rpc_lock, portMAX_DELAY);
+            rpc_current = rpc_tracker_begin(&rpc_tracker, msg->response_topic, msg->response_topic_len,
+                                            msg->correlation, msg->correlation_len, msg->received_us);
+            xSemaphoreGive(rpc_lock);
+            if (rpc_current == 0) {
+                ESP_LOGW(TAG_MQTT, "Too many requests in flight, request gets no reply");
+            }
+        }
+
+        topic_dispatch_t result = topic_router_dispatch(&mqtt_router, msg->topic, msg->topic_len, msg->data, msg->data_len);
+        if (result == TOPIC_DISPATCH_NO_ROUTE) {
+            ESP_LOGW(TAG_MQTT, "No handler for topic %.*s", msg->topic_len, msg->topic);
+        }
+
+        // Handlers that answer later took the request with mqtt_rpc_defer()
+        if (rpc_current != 0) {
+            mqtt_rpc_reply(rpc_current, mqtt_dispatch_status(result), NULL);
+            rpc_current = 0;
+        }
+        msg_pool_free(&mqtt_msg_pool, msg);
+        power_end(POWER_ACTIVITY_COMMAND);
+    }
+}
+
+static backoff_t reconnect_backoff;
+static esp_timer_handle_t reconnect_timer = NULL;
+
+static void mqtt_reconnect_timer_cb(void *arg)
+{
+    set_intercom_state(ENUM_INTERCOM_STATE_MQTT_CONNECTING);
+    rgb_display(RGB_STATUS_CONNECTING);
+    esp_mqtt_client_reconnect(global_mqtt_client);
+}
+
+/* Arm the one-shot reconnect timer, the event loop is never blocked waiting */
+static void mqtt_schedule_reconnect(void)
+{
+    backoff_on_disconnected(&reconnect_backoff, esp_timer_get_time() / 1000);
+    if (esp_timer_is_active(reconnect_timer)) {
+        return;
+    }
+
+    uint32_t delay_ms = backoff_next_delay_ms(&reconnect_backoff);
+    ESP_LOGI(TAG_MQTT, "MQTT reconnect attempt %" PRIu32 " in %" PRIu32 " ms",
+             backoff_attempt(&reconnect_backoff), delay_ms);
+    esp_timer_start_once(reconnect_timer, (uint64_t)delay_ms * 1000);
+}
 
 /*
  * @brief Event handler registered to receive MQTT events
@@ -71,13 +458,16 @@ void mqtt5_event_handler(void *handler_args, esp_event_base_t base, int32_t even
     switch ((esp_mqtt_event_id_t)event_id) {
     case MQTT_EVENT_CONNECTED:
         ESP_LOGI(TAG_MQTT, "MQTT_EVENT_CONNECTED");
+        backoff_on_connected(&reconnect_backoff, esp_timer_get_time() / 1000);
         set_intercom_state(ENUM_INTERCOM_STATE_MQTT_CONNECTED);
         xEventGroupSetBits(mqtt_event_group, MQTT_CONNECTED_BIT);
-        
-        // Subscribe to intercom state topic
-        msg_id = esp_mqtt_client_subscribe(client, MQTT_OPEN_STATE_TOPIC, 1);
-        ESP_LOGI(TAG_MQTT, "Subscribed to "MQTT_OPEN_STATE_TOPIC", msg_id=%d", msg_id);
-        
+        boot_signal(BOOT_MQTT_CONNECTED);
+        mqtt_publish_notify(0, false);
+
+        for (size_t i = 0; i < MQTT_ROUTE_COUNT; i++) {
+            msg_id = esp_mqtt_client_subscribe(client, mqtt_routes[i].filter, 1);
+            ESP_LOGI(TAG_MQTT, "Subscribed to %s, msg_id=%d", mqtt_routes[i].filter, msg_id);
+        }
         break;
     case MQTT_EVENT_DISCONNECTED:
         set_intercom_state(ENUM_INTERCOM_STATE_MQTT_DISCONNECTED);
@@ -85,13 +475,8 @@ void mqtt5_event_handler(void *handler_args, esp_event_base_t base, int32_t even
         ESP_LOGI(TAG_MQTT, "MQTT_EVENT_DISCONNECTED");
         print_user_property(event->property->user_property);
         xEventGroupClearBits(mqtt_event_group, MQTT_CONNECTED_BIT);
-        
-        ESP_LOGI(TAG_MQTT, "MQTT reconnect attempt in %d ms", MQTT_RECONNECT_DELAY_MS);
-        vTaskDelay(pdMS_TO_TICKS(MQTT_RECONNECT_DELAY_MS));
-        set_intercom_state(ENUM_INTERCOM_STATE_MQTT_CONNECTING);
-        rgb_display(RGB_STATUS_CONNECTING);
-        esp_mqtt_client_reconnect(global_mqtt_client);
-        
+        mqtt_publish_notify(0, false);
+        mqtt_schedule_reconnect();
         break;
     case MQTT_EVENT_SUBSCRIBED:
         ESP_LOGI(TAG_MQTT, "MQTT_EVENT_SUBSCRIBED, msg_id=%d", event->msg_id);
@@ -99,41 +484,25 @@ void mqtt5_event_handler(void *handler_args, esp_event_base_t base, int32_t even
     case MQTT_EVENT_UNSUBSCRIBED:
         ESP_LOGI(TAG_MQTT, "MQTT_EVENT_UNSUBSCRIBED, msg_id=%d", event->msg_id);
         print_user_property(event->property->user_property);
-        esp_mqtt5_client_set_user_property(&disconnect_property.user_property, user_property_arr, USE_PROPERTY_ARR_SIZE);
-        esp_mqtt5_client_set_disconnect_property(client, &disconnect_property);
-        esp_mqtt5_client_delete_user_property(disconnect_property.user_property);
-        disconnect_property.user_property = NULL;
         esp_mqtt_client_disconnect(client);
         break;
     case MQTT_EVENT_PUBLISHED:
-        ESP_LOGI(TAG_MQTT, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
+        DLOGI(TAG_MQTT, "MQTT_EVENT_PUBLISHED, msg_id=%d", event->msg_id);
         // set_intercom_state(ENUM_INTERCOM_STATE_MQTT_SENDING);
         print_user_property(event->property->user_property);
+        mqtt_publish_notify(event->msg_id, true);
+        break;
+    case MQTT_EVENT_DELETED:
+        DLOGW(TAG_MQTT, "MQTT_EVENT_DELETED, msg_id=%d expired in the outbox", event->msg_id);
+        mqtt_publish_notify(event->msg_id, false);
         break;
     case MQTT_EVENT_DATA:
-        ESP_LOGI(TAG_MQTT, "MQTT_EVENT_DATA");
-        // set_intercom_state(ENUM_INTERCOM_STATE_MQTT_RECEIVING);
-        rgb_display(RGB_STATUS_ACTIVE);
-        print_user_property(event->property->user_property);
-        ESP_LOGI(TAG_MQTT, "payload_format_indicator is %d", event->property->payload_format_indicator);
-        ESP_LOGI(TAG_MQTT, "response_topic is %.*s", event->property->response_topic_len, event->property->response_topic);
-        ESP_LOGI(TAG_MQTT, "correlation_data is %.*s", event->property->correlation_data_len, event->property->correlation_data);
-        ESP_LOGI(TAG_MQTT, "content_type is %.*s", event->property->content_type_len, event->property->content_type);
-        ESP_LOGI(TAG_MQTT, "TOPIC=%.*s", event->topic_len, event->topic);
-        ESP_LOGI(TAG_MQTT, "DATA=%.*s", event->data_len, event->data);
-        
-        // Handle intercom open_state topic
-        if (strncmp(event->topic, MQTT_OPEN_STATE_TOPIC, event->topic_len) == 0) {
-            if (event->data_len > 0) {
-                if (strncmp(event->data, "true", 4) == 0 || strncmp(event->data, "1", 1) == 0) {
-                    gpio_set_level(GPIO_OUTPUT_PIN_2, 1);
-                    ESP_LOGI(TAG_MQTT, "GPIO2 set to HIGH");
-                } else {
-                    gpio_set_level(GPIO_OUTPUT_PIN_2, 0);
-                    ESP_LOGI(TAG_MQTT, "GPIO2 set to LOW");
-                }
-            }
-        }
+        ESP_LOGD(TAG_MQTT, "MQTT_EVENT_DATA");
+        ESP_LOGD(TAG_MQTT, "payload_format_indicator is %d", event->property->payload_format_indicator);
+        ESP_LOGD(TAG_MQTT, "response_topic is %.*s", event->property->response_topic_len, event->property->response_topic);
+        ESP_LOGD(TAG_MQTT, "correlation_data is %.*s", event->property->correlation_data_len, event->property->correlation_data);
+        ESP_LOGD(TAG_MQTT, "content_type is %.*s", event->property->content_type_len, event->property->content_type);
+        mqtt_enqueue_message(event);
         break;
     case MQTT_EVENT_ERROR:
         ESP_LOGI(TAG_MQTT, "MQTT_EVENT_ERROR");
@@ -160,8 +529,99 @@ esp_mqtt_client_handle_t get_mqtt_global_client(void) {
     return global_mqtt_client;
 }
 
+void mqtt_msg_stats(msg_pool_stats_t *stats) {
+    msg_pool_stats(&mqtt_msg_pool, stats);
+}
+
+int mqtt_append_outbox_report(char *payload, int len, size_t size)
+{
+    static const char *class_names[PUBLISH_CLASS_COUNT] = { "state", "event", "bulk" };
+    publish_stats_t stats[PUBLISH_CLASS_COUNT] = { 0 };
+
+    if (publish_lock != NULL) {
+        xSemaphoreTake(publish_lock, portMAX_DELAY);
+        publish_policy_take_stats(&publish_policy, stats);
+        xSemaphoreGive(publish_lock);
+    }
+
+    // Per class [accepted, sent, acked, coalesced, dropped, expired, held, held_bytes, peak_bytes, max_wait_ms]
+    for (int i = 0; i < PUBLISH_CLASS_COUNT && len < size; i++) {
+        const publish_stats_t *s = &stats[i];
+        len += snprintf(payload + len, size - len,
+                        "%s\"%s\":[%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32
+                        ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 "]",
+                        i == 0 ? ",\"outbox\":{" : ",", class_names[i], s->accepted, s->sent, s->acked,
+                        s->coalesced, s->dropped, s->expired, s->count, s->bytes, s->peak_bytes,
+                        s->max_wait_us / 1000);
+    }
+    if (len < size) {
+        len += snprintf(payload + len, size - len, "}");
+    }
+    return len;
+}
+
+int mqtt_publish(const char *topic, const char *data, int len, int qos, int retain)
+{
+    if (global_mqtt_client == NULL) {
+        return -1;
+    }
+    if (len <= 0) {
+        len = strlen(data);
+    }
+    power_begin(POWER_ACTIVITY_PUBLISH);
+    xSemaphoreTake(publish_lock, portMAX_DELAY);
+    // The worker may not have seen the latest connect or disconnect yet
+    publish_policy_set_connected(&publish_policy, mqtt_connected());
+    publish_policy_expire(&publish_policy);
+    int msg_id = publish_policy_publish(&publish_policy, topic, (const uint8_t *)data, len, qos, retain);
+    xSemaphoreGive(publish_lock);
+    power_end(POWER_ACTIVITY_PUBLISH);
+    return msg_id;
+}
+
 void mqtt5_init() {
-    mqtt_event_group = xEventGroupCreate();
+    mqtt_event_group = APP_EVENT_GROUP_CREATE();
+
+    if (!topic_router_init(&mqtt_router, mqtt_routes, MQTT_ROUTE_COUNT, mqtt_route_index)) {
+        ESP_LOGE(TAG_MQTT, "Duplicate topic in the MQTT route table");
+    }
+
+    rpc_tracker_init(&rpc_tracker, MQTT_RPC_TIMEOUT_MS);
+    rpc_lock = APP_MUTEX_CREATE();
+    publish_lock = APP_MUTEX_CREATE();
+
+    const publish_ops_t publish_ops = {
+        .send = mqtt_policy_send,
+        .now_us = mqtt_policy_now_us,
+    };
+    const publish_caps_t publish_caps[PUBLISH_CLASS_COUNT] = {
+        [PUBLISH_CLASS_STATE] = { MQTT_STATE_MAX_COUNT, MQTT_STATE_MAX_BYTES },
+        [PUBLISH_CLASS_EVENT] = { MQTT_EVENT_MAX_COUNT, MQTT_EVENT_MAX_BYTES },
+        [PUBLISH_CLASS_BULK] = { MQTT_BULK_MAX_COUNT, MQTT_BULK_MAX_BYTES },
+    };
+    publish_policy_init(&publish_policy, &publish_ops, publish_slots, PUBLISH_SLOT_COUNT, publish_bulk_topics,
+                        PUBLISH_BULK_TOPIC_COUNT, publish_caps, MQTT_ACK_TIMEOUT_S * 1000000LL);
+    publish_done_queue = APP_QUEUE_CREATE(PUBLISH_MAX_INFLIGHT, sizeof(publish_done_t));
+    atomic_init(&worker_wake_pending, false);
+
+    msg_pool_init(&mqtt_msg_pool, mqtt_msg_storage, sizeof(mqtt_msg_t), MQTT_MSG_POOL_SIZE);
+    // One more entry for the publish wakeup
+    mqtt_msg_queue = APP_QUEUE_CREATE(MQTT_MSG_POOL_SIZE + 1, sizeof(mqtt_msg_t *));
+    APP_TASK_CREATE(&mqtt_worker_task, "mqtt_worker_task", 4096, NULL, 5);
+
+    const backoff_config_t backoff_cfg = {
+        .min_ms = MQTT_RECONNECT_MIN_MS,
+        .base_ms = MQTT_RECONNECT_BASE_MS,
+        .cap_ms = MQTT_RECONNECT_CAP_MS,
+        .stable_ms = MQTT_RECONNECT_STABLE_MS,
+    };
+    backoff_init(&reconnect_backoff, &backoff_cfg, esp_random());
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = mqtt_reconnect_timer_cb,
+        .name = "mqtt_reconnect",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &reconnect_timer));
 }
 
 void task_mqtt5_start(void)
@@ -176,9 +636,6 @@ void task_mqtt5_start(void)
         .will_delay_interval = 10,
         .payload_format_indicator = true,
         .message_expiry_interval = 10,
-        .response_topic = "/test/response",
-        .correlation_data = "123456",
-        .correlation_data_len = 6,
     };
 
     esp_mqtt_client_config_t mqtt5_cfg = {
@@ -201,11 +658,17 @@ void task_mqtt5_start(void)
     esp_mqtt5_client_set_user_property(&connect_property.will_user_property, user_property_arr, USE_PROPERTY_ARR_SIZE);
     esp_mqtt5_client_set_connect_property(client, &connect_property);
 
+    /* The disconnect properties are copied once here rather than on every unsubscribe */
+    esp_mqtt5_client_set_user_property(&disconnect_property.user_property, user_property_arr, USE_PROPERTY_ARR_SIZE);
+    esp_mqtt5_client_set_disconnect_property(client, &disconnect_property);
+
     /* If you call esp_mqtt5_client_set_user_property to set user properties, DO NOT forget to delete them.
      * esp_mqtt5_client_set_connect_property will malloc buffer to store the user_property and you can delete it after
      */
     esp_mqtt5_client_delete_user_property(connect_property.user_property);
     esp_mqtt5_client_delete_user_property(connect_property.will_user_property);
+    esp_mqtt5_client_delete_user_property(disconnect_property.user_property);
+    disconnect_property.user_property = NULL;
 
     /* The last argument may be used to pass data to the event handler, in this example mqtt_event_handler */
     esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt5_event_handler, NULL);
@@ -1,15 +1,57 @@
 
 #include "mqtt_client.h"
 #include "esp_event.h"
+#include "core/msg_pool.h"
 
 #define MQTT_CONNECTED_BIT BIT0
 #define MQTT_FAIL_BIT      BIT1
-#define MQTT_RECONNECT_DELAY_MS     3000
+#define MQTT_RECONNECT_MIN_MS       250     // shortest reconnect delay
+#define MQTT_RECONNECT_BASE_MS      1000    // ceiling of the first delay, doubles per attempt
+#define MQTT_RECONNECT_CAP_MS       60000   // largest reconnect delay
+#define MQTT_RECONNECT_STABLE_MS    30000   // connection uptime that resets the backoff
 
-static esp_mqtt_client_handle_t global_mqtt_client = NULL;
-static EventGroupHandle_t mqtt_event_group = NULL;
+#define MQTT_MSG_POOL_SIZE          CONFIG_INTERCOM_MQTT_MSG_POOL_SIZE  // incoming messages in flight
+#define MQTT_MSG_TOPIC_MAX          64
+#define MQTT_MSG_DATA_MAX           CONFIG_INTERCOM_MQTT_MSG_DATA_MAX   // larger payloads are dropped
+#define MQTT_RPC_TIMEOUT_MS         CONFIG_INTERCOM_MQTT_RPC_TIMEOUT_MS // requests unanswered by then get "timeout"
+#define MQTT_USER_PROPERTY_MAX      8       // user properties logged per event
+#define MQTT_STATE_MAX_COUNT        CONFIG_INTERCOM_MQTT_STATE_MAX_COUNT    // state messages held, waiting or unacknowledged
+#define MQTT_STATE_MAX_BYTES        CONFIG_INTERCOM_MQTT_STATE_MAX_BYTES
+#define MQTT_EVENT_MAX_COUNT        CONFIG_INTERCOM_MQTT_EVENT_MAX_COUNT    // unacknowledged event messages
+#define MQTT_EVENT_MAX_BYTES        CONFIG_INTERCOM_MQTT_EVENT_MAX_BYTES
+#define MQTT_BULK_MAX_COUNT         CONFIG_INTERCOM_MQTT_BULK_MAX_COUNT     // unacknowledged capture chunks
+#define MQTT_BULK_MAX_BYTES         CONFIG_INTERCOM_MQTT_BULK_MAX_BYTES
+#define MQTT_ACK_TIMEOUT_S          CONFIG_INTERCOM_MQTT_ACK_TIMEOUT_S      // unacknowledged messages are given up after this
 
 EventGroupHandle_t get_mqtt_event_group();
 esp_mqtt_client_handle_t get_mqtt_global_client();
+void mqtt_msg_stats(msg_pool_stats_t *stats);
+
+/*
+ * Enqueue a message for the client task through the outbox policy. len 0
+ * sends data as a string. Returns the msg_id, 0 when a telemetry value waits
+ * for the previous one or for the link, -1 when refused: event topics while
+ * disconnected or over their caps.
+ */
+int mqtt_publish(const char *topic, const char *data, int len, int qos, int retain);
+
+/* Appends ",\"outbox\":{...}" with the publish counters since the previous call */
+int mqtt_append_outbox_report(char *payload, int len, size_t size);
+
+/*
+ * Called by a topic handler that answers its request later. Returns the
+ * request id (0 if the message expects no reply) for mqtt_rpc_reply.
+ */
+uint32_t mqtt_rpc_defer(void);
+
+/* status is a short word such as "ok", result a JSON value or NULL */
+void mqtt_rpc_reply(uint32_t id, const char *status, const char *result);
+
+/*
+ * Wake the worker task from a timer or another task. On waking it releases
+ * acknowledged publishes and sends what door_task has waiting, so callers
+ * that must not block hand their publishing to it.
+ */
+void mqtt_worker_wake(void);
 void mqtt5_init();
 void task_mqtt5_start();
\ No newline at end of file
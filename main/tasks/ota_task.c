@@ -2,15 +2,118 @@
 #include "rgb_state_task.h"
 #include "intercom_constants.h"
 #include "credentials.h"
+#include "app_alloc.h"
+#include "power_task.h"
+#include "core/arena.h"
+#include "core/backoff.h"
+#include "core/ota_metrics.h"
+#include "core/ota_artifact.h"
+#include "core/delta_patch.h"
+#include "core/ota_decoder.h"
+#include "core/ota_manifest.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
 
 #include "esp_log.h"
 #include "esp_ota_ops.h"
 #include "esp_app_format.h"
 #include "esp_http_client.h"
+#include "esp_partition.h"
+#include "esp_random.h"
+#include "esp_system.h"
+#include "spi_flash_mmap.h"
+#include "esp_timer.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "mbedtls/sha256.h"
+#include "nvs.h"
+#include "rom/miniz.h"
 
+#ifndef OTA_MANIFEST_URL
+#define OTA_MANIFEST_URL OTA_FIRMWARE_UPG_URL ".json"
+#endif
 
 const char *TAG_OTA = "intercom_ota";
 
+/* Buffer handed between the download task and the flash writer task,
+ * a zero length marks the end of the image */
+typedef struct {
+    uint8_t index;
+    int len;
+} ota_chunk_t;
+
+/* Download progress kept in NVS so an interrupted transfer resumes where it stopped */
+typedef struct {
+    uint32_t partition_addr;    // update partition the bytes were written to
+    uint32_t offset;            // bytes written and flushed to flash
+    uint32_t total;             // full image size, 0 if unknown
+    char etag[OTA_ETAG_MAX_LEN];
+    char sha256[65];            // expected image hash (hex), empty if the server sent none
+    uint8_t artifact_flags;     // OTA_ARTIFACT_* of the download, only raw images resume
+} ota_progress_t;
+
+/* Response headers captured by the HTTP event handler */
+typedef struct {
+    char etag[OTA_ETAG_MAX_LEN];
+    char sha256[65];
+} ota_http_headers_t;
+
+/* Smallest image prefix that holds the app description for the version check */
+#define OTA_IMAGE_HEAD_SIZE (sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t) + 1)
+
+_Static_assert(OTA_IMAGE_HEAD_SIZE <= OTA_DECODER_HEAD_MAX, "image head does not fit the decoder");
+
+/* Download / flash write pipeline */
+typedef struct {
+    uint8_t *buffers[OTA_BUF_COUNT];
+    QueueHandle_t free_queue;       // buffers the downloader may fill
+    QueueHandle_t full_queue;       // buffers waiting to be written to flash
+    SemaphoreHandle_t writer_done;
+    TaskHandle_t writer;
+    const esp_partition_t *partition;
+    const esp_partition_t *running;     // base image for delta artifacts
+    ota_decoder_t decoder;
+    esp_err_t decoder_err;          // flash or setup error behind the last decoder failure
+    uint32_t erased_until;          // partition is erased up to this offset
+    uint32_t saved_offset;          // offset last stored in NVS
+    volatile esp_err_t write_err;
+    ota_metrics_t metrics;
+} ota_pipeline_t;
+
+/* Manifest ETag and the version that was running when it was fetched */
+typedef struct {
+    char etag[OTA_ETAG_MAX_LEN];
+    char running_version[OTA_MANIFEST_VERSION_LEN];
+} ota_manifest_cache_t;
+
+typedef enum {
+    OTA_CHECK_NONE,         // nothing to install
+    OTA_CHECK_UPDATE,
+    OTA_CHECK_FAILED,       // manifest could not be fetched or parsed
+} ota_check_result_t;
+
+typedef enum {
+    OTA_SESSION_DONE,
+    OTA_SESSION_RETRY,      // transfer interrupted, progress is kept
+    OTA_SESSION_FATAL,
+} ota_session_result_t;
+
+static ota_progress_t ota_progress;
+
+/* Scratch of one update: pipeline buffers, inflate state and window, delta applier */
+#define OTA_ARENA_SIZE  ARENA_SIZE_FOR(OTA_BUF_COUNT * OTA_BUF_SIZE + sizeof(tinfl_decompressor) + \
+                                       TINFL_LZ_DICT_SIZE + sizeof(delta_patch_t), OTA_BUF_COUNT + 3)
+
+static arena_t ota_arena;
+#if CONFIG_INTERCOM_STATIC_ALLOC
+static uint8_t ota_arena_storage[OTA_ARENA_SIZE];
+#endif
+
 static bool ota_post_diagnostic() {
     // Todo: write diagnostic checks
     bool diagnostic_is_ok = true;
@@ -22,191 +125,817 @@ static void http_cleanup(esp_http_client_handle_t client) {
     esp_http_client_cleanup(client);
 }
 
-static void __attribute__((noreturn)) task_fatal_error(){
-    ESP_LOGE(TAG_OTA, "Exiting task due to fatal error...");
-    (void)vTaskDelete(NULL);
+static void ota_progress_load(void)
+{
+    nvs_handle_t nvs;
+    memset(&ota_progress, 0, sizeof(ota_progress));
+    if (nvs_open(OTA_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return;
+    }
+    size_t len = sizeof(ota_progress);
+    if (nvs_get_blob(nvs, "progress", &ota_progress, &len) != ESP_OK || len != sizeof(ota_progress)) {
+        memset(&ota_progress, 0, sizeof(ota_progress));
+    }
+    nvs_close(nvs);
+}
 
-    while (1) {
-        ;
+static void ota_progress_save(void)
+{
+    nvs_handle_t nvs;
+    if (nvs_open(OTA_NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
+        return;
     }
+    nvs_set_blob(nvs, "progress", &ota_progress, sizeof(ota_progress));
+    nvs_commit(nvs);
+    nvs_close(nvs);
 }
 
+static void ota_progress_clear(void)
+{
+    nvs_handle_t nvs;
+    memset(&ota_progress, 0, sizeof(ota_progress));
+    if (nvs_open(OTA_NVS_NAMESPACE, NVS_READWRITE, &nvs) == ESP_OK) {
+        nvs_erase_key(nvs, "progress");
+        nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+}
 
+static void ota_manifest_cache_load(ota_manifest_cache_t *cache)
+{
+    nvs_handle_t nvs;
+    memset(cache, 0, sizeof(*cache));
+    if (nvs_open(OTA_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return;
+    }
+    size_t len = sizeof(*cache);
+    if (nvs_get_blob(nvs, "manifest", cache, &len) != ESP_OK || len != sizeof(*cache)) {
+        memset(cache, 0, sizeof(*cache));
+    }
+    nvs_close(nvs);
+}
 
-static void ota_via_http_client_task(void *pvParameter)
+/* NULL forgets the cached ETag so the next check fetches the manifest again */
+static void ota_manifest_cache_save(const ota_manifest_cache_t *cache)
 {
-    esp_err_t err;
-    /* update handle : set by esp_ota_begin(), must be freed via esp_ota_end() */
-    esp_ota_handle_t update_handle = 0 ;
-    const esp_partition_t *update_partition = NULL;
+    nvs_handle_t nvs;
+    if (nvs_open(OTA_NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
+        return;
+    }
+    if (cache != NULL) {
+        nvs_set_blob(nvs, "manifest", cache, sizeof(*cache));
+    } else {
+        nvs_erase_key(nvs, "manifest");
+    }
+    nvs_commit(nvs);
+    nvs_close(nvs);
+}
 
-    ESP_LOGI(TAG_OTA, "Starting OTA example task");
+static esp_err_t ota_http_event_handler(esp_http_client_event_t *evt)
+{
+    ota_http_headers_t *headers = evt->user_data;
 
-    const esp_partition_t *configured = esp_ota_get_boot_partition();
-    const esp_partition_t *running = esp_ota_get_running_partition();
+    if (evt->event_id == HTTP_EVENT_ON_HEADER && headers != NULL) {
+        if (strcasecmp(evt->header_key, "ETag") == 0) {
+            snprintf(headers->etag, sizeof(headers->etag), "%s", evt->header_value);
+        } else if (strcasecmp(evt->header_key, "X-Image-SHA256") == 0) {
+            snprintf(headers->sha256, sizeof(headers->sha256), "%s", evt->header_value);
+        }
+    }
+    return ESP_OK;
+}
 
-    if (configured != running) {
-        ESP_LOGW(TAG_OTA, "Configured OTA boot partition at offset 0x%08"PRIx32", but running from offset 0x%08"PRIx32,
-                 configured->address, running->address);
-        ESP_LOGW(TAG_OTA, "(This can happen if either the OTA boot data or preferred boot image become corrupted somehow.)");
+static bool ota_arena_open(void)
+{
+#if CONFIG_INTERCOM_STATIC_ALLOC
+    arena_init(&ota_arena, ota_arena_storage, sizeof(ota_arena_storage));
+#else
+    // One block per update instead of an allocation per buffer
+    void *storage = malloc(OTA_ARENA_SIZE);
+    if (storage == NULL) {
+        ESP_LOGE(TAG_OTA, "Failed to allocate %d bytes of OTA scratch memory", (int)OTA_ARENA_SIZE);
+        return false;
+    }
+    arena_init(&ota_arena, storage, OTA_ARENA_SIZE);
+#endif
+    return true;
+}
+
+static void ota_arena_close(void)
+{
+    ESP_LOGI(TAG_OTA, "OTA scratch high-water %d of %d bytes", (int)ota_arena.high_water, (int)ota_arena.size);
+#if !CONFIG_INTERCOM_STATIC_ALLOC
+    free(ota_arena.base);
+#endif
+    arena_init(&ota_arena, NULL, 0);
+}
+
+static bool ota_pipeline_init(ota_pipeline_t *pipeline)
+{
+    memset(pipeline, 0, sizeof(*pipeline));
+    arena_reset(&ota_arena);
+    // Created again for every session, each is deleted in ota_pipeline_deinit first
+    pipeline->free_queue = APP_QUEUE_CREATE(OTA_BUF_COUNT, sizeof(ota_chunk_t));
+    pipeline->full_queue = APP_QUEUE_CREATE(OTA_BUF_COUNT + 1, sizeof(ota_chunk_t));
+    pipeline->writer_done = APP_BINARY_SEMAPHORE_CREATE();
+    if (pipeline->free_queue == NULL || pipeline->full_queue == NULL || pipeline->writer_done == NULL) {
+        return false;
     }
 
-    ESP_LOGI(TAG_OTA, "Running partition type %d subtype %d (offset 0x%08"PRIx32")",
-             running->type, running->subtype, running->address);
+    for (uint8_t i = 0; i < OTA_BUF_COUNT; i++) {
+        pipeline->buffers[i] = arena_alloc(&ota_arena, OTA_BUF_SIZE);
+        if (pipeline->buffers[i] == NULL) {
+            return false;
+        }
+        ota_chunk_t chunk = { .index = i, .len = 0 };
+        xQueueSend(pipeline->free_queue, &chunk, 0);
+    }
+    return true;
+}
+
+static void ota_pipeline_deinit(ota_pipeline_t *pipeline)
+{
+    for (uint8_t i = 0; i < OTA_BUF_COUNT; i++) {
+        pipeline->buffers[i] = NULL;
+    }
+    if (pipeline->free_queue != NULL) {
+        vQueueDelete(pipeline->free_queue);
+    }
+    if (pipeline->full_queue != NULL) {
+        vQueueDelete(pipeline->full_queue);
+    }
+    if (pipeline->writer_done != NULL) {
+        vSemaphoreDelete(pipeline->writer_done);
+    }
+    arena_reset(&ota_arena);
+}
+
+/* Compare the image header with the running and last invalid apps */
+static bool ota_check_new_version(const uint8_t *data, int len, const esp_partition_t *running)
+{
+    esp_app_desc_t new_app_info;
+    if (len <= sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t)) {
+        ESP_LOGE(TAG_OTA, "received package is not fit len");
+        return false;
+    }
+
+    // check current version with downloading
+    memcpy(&new_app_info, &data[sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t)], sizeof(esp_app_desc_t));
+    ESP_LOGI(TAG_OTA, "New firmware version: %s", new_app_info.version);
+
+    esp_app_desc_t running_app_info;
+    if (esp_ota_get_partition_description(running, &running_app_info) == ESP_OK) {
+        ESP_LOGI(TAG_OTA, "Running firmware version: %s", running_app_info.version);
+    }
+
+    const esp_partition_t* last_invalid_app = esp_ota_get_last_invalid_partition();
+    esp_app_desc_t invalid_app_info;
+    if (esp_ota_get_partition_description(last_invalid_app, &invalid_app_info) == ESP_OK) {
+        ESP_LOGI(TAG_OTA, "Last invalid firmware version: %s", invalid_app_info.version);
+    }
+
+    // check current version with last invalid partition
+    if (last_invalid_app != NULL) {
+        if (memcmp(invalid_app_info.version, new_app_info.version, sizeof(new_app_info.version)) == 0) {
+            ESP_LOGW(TAG_OTA, "New version is the same as invalid version.");
+            ESP_LOGW(TAG_OTA, "Previously, there was an attempt to launch the firmware with %s version, but it failed.", invalid_app_info.version);
+            ESP_LOGW(TAG_OTA, "The firmware has been rolled back to the previous version.");
+            return false;
+        }
+    }
+#ifndef CONFIG_EXAMPLE_SKIP_VERSION_CHECK
+    if (memcmp(new_app_info.version, running_app_info.version, sizeof(new_app_info.version)) == 0) {
+        ESP_LOGW(TAG_OTA, "Current running version is the same as a new. We will not continue the update.");
+        return false;
+    }
+#endif
+    return true;
+}
+
+/* SHA-256 of the first len bytes of a partition */
+static bool ota_partition_sha256(const esp_partition_t *partition, uint32_t len, uint8_t *buffer, size_t buffer_size,
+                                 uint8_t digest[32])
+{
+    mbedtls_sha256_context ctx;
+
+    mbedtls_sha256_init(&ctx);
+    mbedtls_sha256_starts(&ctx, 0);
+    for (uint32_t pos = 0; pos < len; pos += buffer_size) {
+        uint32_t n = len - pos < buffer_size ? len - pos : buffer_size;
+        if (esp_partition_read(partition, pos, buffer, n) != ESP_OK) {
+            mbedtls_sha256_free(&ctx);
+            return false;
+        }
+        mbedtls_sha256_update(&ctx, buffer, n);
+    }
+    mbedtls_sha256_finish(&ctx, digest);
+    mbedtls_sha256_free(&ctx);
+    return true;
+}
+
+static void ota_hex(const uint8_t digest[32], char hex[65])
+{
+    for (int i = 0; i < 32; i++) {
+        snprintf(&hex[i * 2], 3, "%02x", digest[i]);
+    }
+}
+
+/* Write at the current progress offset, erasing sectors just ahead of the data */
+static esp_err_t ota_partition_write(ota_pipeline_t *pipeline, const uint8_t *data, int len)
+{
+    uint32_t end = ota_progress.offset + len;
+    if (end > pipeline->partition->size) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+    while (pipeline->erased_until < end) {
+        esp_err_t err = esp_partition_erase_range(pipeline->partition, pipeline->erased_until, SPI_FLASH_SEC_SIZE);
+        if (err != ESP_OK) {
+            return err;
+        }
+        pipeline->erased_until += SPI_FLASH_SEC_SIZE;
+    }
+
+    esp_err_t err = esp_partition_write(pipeline->partition, ota_progress.offset, data, len);
+    if (err != ESP_OK) {
+        return err;
+    }
+    ota_progress.offset = end;
+    if (ota_progress.artifact_flags == 0 && ota_progress.offset - pipeline->saved_offset >= OTA_RESUME_SAVE_INTERVAL) {
+        pipeline->saved_offset = ota_progress.offset;
+        ota_progress_save();
+    }
+    return ESP_OK;
+}
+
+static bool ota_decoder_check_head(void *ctx, const uint8_t *head, size_t len)
+{
+    ota_pipeline_t *pipeline = ctx;
+
+    if (!ota_check_new_version(head, len, pipeline->running)) {
+        pipeline->decoder_err = ESP_ERR_INVALID_VERSION;
+        return false;
+    }
+    set_intercom_state(ENUM_INTERCOM_STATE_OTA_UPDATING);
+    return true;
+}
+
+static int ota_decoder_write(void *ctx, const uint8_t *data, size_t len)
+{
+    ota_pipeline_t *pipeline = ctx;
+    pipeline->decoder_err = ota_partition_write(pipeline, data, len);
+    return pipeline->decoder_err == ESP_OK ? 0 : -1;
+}
+
+static int ota_decoder_read_base(void *ctx, uint32_t offset, uint8_t *buf, size_t len)
+{
+    ota_pipeline_t *pipeline = ctx;
+    pipeline->decoder_err = esp_partition_read(pipeline->running, offset, buf, len);
+    return pipeline->decoder_err == ESP_OK ? 0 : -1;
+}
+
+/* Check a compressed or delta artifact against the partitions before its payload is decoded */
+static bool ota_decoder_begin(void *ctx, const ota_decoder_t *decoder)
+{
+    ota_pipeline_t *pipeline = ctx;
+    const ota_artifact_header_t *header = &decoder->header;
+
+    ESP_LOGI(TAG_OTA, "OTA artifact:%s%s, image %" PRIu32 " bytes",
+             header->flags & OTA_ARTIFACT_COMPRESSED ? " compressed" : "",
+             header->flags & OTA_ARTIFACT_DELTA ? " delta" : "", header->image_size);
+    if (header->image_size > pipeline->partition->size) {
+        pipeline->decoder_err = ESP_ERR_INVALID_SIZE;
+        return false;
+    }
+
+    if (header->flags & OTA_ARTIFACT_DELTA) {
+        // The patch only makes sense against the exact image it was made from
+        uint8_t digest[32];
+        if (header->source_size > pipeline->running->size) {
+            pipeline->decoder_err = ESP_ERR_INVALID_SIZE;
+            return false;
+        }
+        if (!ota_partition_sha256(pipeline->running, header->source_size, decoder->patch->scratch,
+                                  sizeof(decoder->patch->scratch), digest)) {
+            pipeline->decoder_err = ESP_FAIL;
+            return false;
+        }
+        if (memcmp(digest, header->source_sha256, sizeof(digest)) != 0) {
+            ESP_LOGE(TAG_OTA, "Delta was made for a different base image than the running one");
+            pipeline->decoder_err = ESP_ERR_INVALID_VERSION;
+            return false;
+        }
+    }
+
+    // The transfer hash no longer describes the image, check the reconstructed one instead
+    ota_progress.artifact_flags = header->flags;
+    ota_progress.total = header->image_size;
+    ota_hex(header->image_sha256, ota_progress.sha256);
+    return true;
+}
+
+static const ota_decoder_ops_t ota_decoder_ops = {
+    .begin = ota_decoder_begin,
+    .check_head = ota_decoder_check_head,
+    .write = ota_decoder_write,
+    .read_base = ota_decoder_read_base,
+};
+
+/* Decode one downloaded buffer, a failed callback reports the flash error behind it */
+static esp_err_t ota_pipeline_decode(ota_pipeline_t *pipeline, const uint8_t *data, size_t len)
+{
+    switch (ota_decoder_feed(&pipeline->decoder, data, len)) {
+    case OTA_DECODER_OK:
+        return ESP_OK;
+    case OTA_DECODER_ERR_ARTIFACT:
+        ESP_LOGE(TAG_OTA, "Unsupported OTA artifact header");
+        return ESP_ERR_NOT_SUPPORTED;
+    case OTA_DECODER_ERR_NO_MEM:
+        return ESP_ERR_NO_MEM;
+    case OTA_DECODER_ERR_INFLATE:
+        ESP_LOGE(TAG_OTA, "Inflate error");
+        return ESP_ERR_INVALID_RESPONSE;
+    case OTA_DECODER_ERR_PATCH:
+        ESP_LOGE(TAG_OTA, "Delta patch error %d", pipeline->decoder.patch_err);
+        return ESP_ERR_INVALID_RESPONSE;
+    default:
+        return pipeline->decoder_err != ESP_OK ? pipeline->decoder_err : ESP_FAIL;
+    }
+}
+
+/* Flash writer: decodes and commits filled buffers while the next ones are downloaded */
+static void ota_flash_writer_task(void *pvParameter)
+{
+    ota_pipeline_t *pipeline = pvParameter;
+
+    while (1) {
+        ota_chunk_t chunk;
+        int64_t wait_start = esp_timer_get_time();
+        xQueueReceive(pipeline->full_queue, &chunk, portMAX_DELAY);
+        int64_t write_start = esp_timer_get_time();
+        ota_metrics_write_wait(&pipeline->metrics, write_start - wait_start);
+
+        if (chunk.len == 0) {
+            break;
+        }
+
+        // Keep draining after an error so the downloader never blocks on a buffer
+        if (pipeline->write_err == ESP_OK) {
+            esp_err_t err = ota_pipeline_decode(pipeline, pipeline->buffers[chunk.index], chunk.len);
+            if (err != ESP_OK) {
+                ESP_LOGE(TAG_OTA, "Image write at 0x%" PRIx32 " failed (%s)", ota_progress.offset, esp_err_to_name(err));
+                pipeline->write_err = err;
+            }
+            ota_metrics_chunk_written(&pipeline->metrics, chunk.len, esp_timer_get_time() - write_start);
+            ESP_LOGD(TAG_OTA, "Written image length %" PRIu32, ota_progress.offset);
+        }
+        xQueueSend(pipeline->free_queue, &chunk, portMAX_DELAY);
+    }
+
+    // Everything written so far is on flash, make it the resume point
+    if (ota_progress.artifact_flags == 0) {
+        ota_progress_save();
+    }
+    // The downloader deletes this task, so a static task block is never reused while still in use
+    xSemaphoreGive(pipeline->writer_done);
+    vTaskSuspend(NULL);
+}
+
+/* Fill a whole buffer from the connection, returns the bytes read or -1 on error */
+static int ota_read_chunk(esp_http_client_handle_t client, uint8_t *buffer)
+{
+    int filled = 0;
+    while (filled < OTA_BUF_SIZE) {
+        int data_read = esp_http_client_read(client, (char *)buffer + filled, OTA_BUF_SIZE - filled);
+        if (data_read < 0) {
+            ESP_LOGE(TAG_OTA, "Error: SSL data read error");
+            return -1;
+        } else if (data_read > 0) {
+            filled += data_read;
+        } else {
+           /*
+            * As esp_http_client_read never returns negative error code, we rely on
+            * `errno` to check for underlying transport connectivity closure if any
+            */
+            if (errno == ECONNRESET || errno == ENOTCONN) {
+                ESP_LOGE(TAG_OTA, "Connection closed, errno = %d", errno);
+                break;
+            }
+            if (esp_http_client_is_complete_data_received(client) == true) {
+                ESP_LOGI(TAG_OTA, "Connection closed");
+                break;
+            }
+        }
+    }
+    return filled;
+}
+
+static void ota_log_metrics(const ota_metrics_t *metrics)
+{
+    ESP_LOGI(TAG_OTA, "OTA %" PRIu64 " bytes in %" PRId64 " ms (%" PRIu32 " B/s), %" PRIu32 " chunks",
+             metrics->bytes, (metrics->end_us - metrics->start_us) / 1000,
+             ota_metrics_throughput(metrics), metrics->chunks);
+    ESP_LOGI(TAG_OTA, "Waiting for flash: %" PRId64 " ms (%" PRIu32 " stalls), waiting for network: %" PRId64 " ms (%" PRIu32 " stalls), flash busy: %" PRId64 " ms",
+             metrics->fetch_wait_us / 1000, metrics->fetch_stalls,
+             metrics->write_wait_us / 1000, metrics->write_stalls, metrics->write_busy_us / 1000);
+}
+
+/* Hash the written image and compare it with the expected hash */
+static bool ota_verify_image(const esp_partition_t *partition, uint8_t *buffer)
+{
+    if (ota_progress.sha256[0] == '\0') {
+        ESP_LOGW(TAG_OTA, "Server sent no X-Image-SHA256, relying on image validation only");
+        return true;
+    }
+
+    uint8_t digest[32];
+    char hex[65];
+    if (!ota_partition_sha256(partition, ota_progress.offset, buffer, OTA_BUF_SIZE, digest)) {
+        return false;
+    }
+    ota_hex(digest, hex);
+    if (strcasecmp(hex, ota_progress.sha256) != 0) {
+        ESP_LOGE(TAG_OTA, "Image hash mismatch: expected %s, got %s", ota_progress.sha256, hex);
+        return false;
+    }
+    ESP_LOGI(TAG_OTA, "Image hash verified: %s", hex);
+    return true;
+}
+
+/*
+ * One download attempt. Resumes with a Range request when NVS holds progress
+ * for the same update partition; If-Range makes the server send the whole
+ * image again if it changed in the meantime.
+ */
+static ota_session_result_t ota_download_session(ota_pipeline_t *pipeline, const esp_partition_t *update_partition,
+                                                 const esp_partition_t *running, const ota_manifest_t *manifest)
+{
+    esp_err_t err;
+    ota_http_headers_t headers = { 0 };
 
     esp_http_client_config_t config = {
-        .url = OTA_FIRMWARE_UPG_URL,
+        .url = manifest->url[0] != '\0' ? manifest->url : OTA_FIRMWARE_UPG_URL,
         .timeout_ms = OTA_FIRMWARE_RECV_TIMEOUT,
         .keep_alive_enable = true,
         .skip_cert_common_name_check = true,
         .disable_auto_redirect = false,
         .transport_type = HTTP_TRANSPORT_OVER_TCP,  // Force HTTP instead of HTTPS
+        .buffer_size = OTA_HTTP_RX_BUF_SIZE,
+        .event_handler = ota_http_event_handler,
+        .user_data = &headers,
     };
 
     esp_http_client_handle_t client = esp_http_client_init(&config);
     if (client == NULL) {
         ESP_LOGE(TAG_OTA, "Failed to initialise HTTP connection");
-        task_fatal_error();
+        return OTA_SESSION_RETRY;
+    }
+
+    bool resume = ota_progress.offset > 0 && ota_progress.partition_addr == update_partition->address &&
+                  ota_progress.etag[0] != '\0' && ota_progress.artifact_flags == 0;
+    uint32_t resume_from = ota_progress.offset & ~(SPI_FLASH_SEC_SIZE - 1);
+    if (resume) {
+        char range[32];
+        snprintf(range, sizeof(range), "bytes=%" PRIu32 "-", resume_from);
+        esp_http_client_set_header(client, "Range", range);
+        esp_http_client_set_header(client, "If-Range", ota_progress.etag);
+        ESP_LOGI(TAG_OTA, "Resuming download at %" PRIu32 " of %" PRIu32 " bytes", resume_from, ota_progress.total);
     }
 
     err = esp_http_client_open(client, 0);
     if (err != ESP_OK) {
         ESP_LOGE(TAG_OTA, "Failed to open HTTP connection: %s", esp_err_to_name(err));
         esp_http_client_cleanup(client);
-        task_fatal_error();
+        return OTA_SESSION_RETRY;
     }
 
-    esp_http_client_fetch_headers(client);
+    int64_t content_length = esp_http_client_fetch_headers(client);
+    int status = esp_http_client_get_status_code(client);
+
+    if (resume && status == 206 && strcmp(headers.etag, ota_progress.etag) == 0) {
+        ota_progress.offset = resume_from;
+    } else if (status == 200) {
+        if (resume) {
+            ESP_LOGW(TAG_OTA, "Server sent the full image, the stored download is discarded");
+        }
+        resume = false;
+        memset(&ota_progress, 0, sizeof(ota_progress));
+        ota_progress.partition_addr = update_partition->address;
+        ota_progress.total = content_length > 0 ? content_length : 0;
+        snprintf(ota_progress.etag, sizeof(ota_progress.etag), "%s", headers.etag);
+        snprintf(ota_progress.sha256, sizeof(ota_progress.sha256), "%s",
+                 headers.sha256[0] != '\0' ? headers.sha256 : manifest->sha256);
+    } else {
+        ESP_LOGE(TAG_OTA, "Unexpected HTTP status %d", status);
+        http_cleanup(client);
+        if (resume) {
+            ota_progress_clear();
+        }
+        return status >= 500 || resume ? OTA_SESSION_RETRY : OTA_SESSION_FATAL;
+    }
 
-    update_partition = esp_ota_get_next_update_partition(NULL);
-    assert(update_partition != NULL);
     ESP_LOGI(TAG_OTA, "Writing to partition subtype %d at offset 0x%"PRIx32,
              update_partition->subtype, update_partition->address);
 
-    int binary_file_length = 0;
+    if (!ota_pipeline_init(pipeline)) {
+        ESP_LOGE(TAG_OTA, "Failed to allocate %d x %d bytes of OTA buffers", OTA_BUF_COUNT, OTA_BUF_SIZE);
+        ota_pipeline_deinit(pipeline);
+        http_cleanup(client);
+        return OTA_SESSION_FATAL;
+    }
+    pipeline->partition = update_partition;
+    pipeline->running = running;
+    pipeline->erased_until = ota_progress.offset;
+    pipeline->saved_offset = ota_progress.offset;
+    ota_decoder_init(&pipeline->decoder, &ota_decoder_ops, pipeline, &ota_arena, OTA_IMAGE_HEAD_SIZE, resume);
+
     /*deal with all receive packet*/
-    bool image_header_was_checked = false;
-    while (1) {
-        int data_read = esp_http_client_read(client, ota_write_data, OTA_BUFFSIZE);
-        if (data_read < 0) {
-            ESP_LOGE(TAG_OTA, "Error: SSL data read error");
-            http_cleanup(client);
-            task_fatal_error();
-        } else if (data_read > 0) {
-            if (image_header_was_checked == false) {
-                esp_app_desc_t new_app_info;
-                if (data_read > sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) + sizeof(esp_app_desc_t)) {
-                    // check current version with downloading
-                    memcpy(&new_app_info, &ota_write_data[sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t)], sizeof(esp_app_desc_t));
-                    ESP_LOGI(TAG_OTA, "New firmware version: %s", new_app_info.version);
-
-                    esp_app_desc_t running_app_info;
-                    if (esp_ota_get_partition_description(running, &running_app_info) == ESP_OK) {
-                        ESP_LOGI(TAG_OTA, "Running firmware version: %s", running_app_info.version);
-                    }
-
-                    const esp_partition_t* last_invalid_app = esp_ota_get_last_invalid_partition();
-                    esp_app_desc_t invalid_app_info;
-                    if (esp_ota_get_partition_description(last_invalid_app, &invalid_app_info) == ESP_OK) {
-                        ESP_LOGI(TAG_OTA, "Last invalid firmware version: %s", invalid_app_info.version);
-                    }
-
-                    // check current version with last invalid partition
-                    if (last_invalid_app != NULL) {
-                        if (memcmp(invalid_app_info.version, new_app_info.version, sizeof(new_app_info.version)) == 0) {
-                            ESP_LOGW(TAG_OTA, "New version is the same as invalid version.");
-                            ESP_LOGW(TAG_OTA, "Previously, there was an attempt to launch the firmware with %s version, but it failed.", invalid_app_info.version);
-                            ESP_LOGW(TAG_OTA, "The firmware has been rolled back to the previous version.");
-                            http_cleanup(client);
-                            task_fatal_error();
-                        }
-                    }
-#ifndef CONFIG_EXAMPLE_SKIP_VERSION_CHECK
-                    if (memcmp(new_app_info.version, running_app_info.version, sizeof(new_app_info.version)) == 0) {
-                        ESP_LOGW(TAG_OTA, "Current running version is the same as a new. We will not continue the update.");
-                        http_cleanup(client);
-                        task_fatal_error();
-                    }
-#endif
+    bool writer_started = false;
+    bool download_ok = true;
+    while (pipeline->write_err == ESP_OK) {
+        ota_chunk_t chunk;
+        int64_t wait_start = esp_timer_get_time();
+        xQueueReceive(pipeline->free_queue, &chunk, portMAX_DELAY);
+        ota_metrics_fetch_wait(&pipeline->metrics, esp_timer_get_time() - wait_start);
 
-                    set_intercom_state(ENUM_INTERCOM_STATE_OTA_UPDATING);
-
-                    image_header_was_checked = true;
-
-                    err = esp_ota_begin(update_partition, OTA_WITH_SEQUENTIAL_WRITES, &update_handle);
-                    if (err != ESP_OK) {
-                        set_intercom_state(ENUM_INTERCOM_STATE_OTA_FAILURE);
-                        ESP_LOGE(TAG_OTA, "esp_ota_begin failed (%s)", esp_err_to_name(err));
-                        http_cleanup(client);
-                        esp_ota_abort(update_handle);
-                        task_fatal_error();
-                    }
-                    ESP_LOGI(TAG_OTA, "esp_ota_begin succeeded");
-                } else {
-                    ESP_LOGE(TAG_OTA, "received package is not fit len");
-                    http_cleanup(client);
-                    esp_ota_abort(update_handle);
-                    task_fatal_error();
-                }
-            }
-            err = esp_ota_write( update_handle, (const void *)ota_write_data, data_read);
-            if (err != ESP_OK) {
-                set_intercom_state(ENUM_INTERCOM_STATE_OTA_FAILURE);
-                http_cleanup(client);
-                esp_ota_abort(update_handle);
-                task_fatal_error();
-            }
-            binary_file_length += data_read;
-            ESP_LOGD(TAG_OTA, "Written image length %d", binary_file_length);
-        } else if (data_read == 0) {
-           /*
-            * As esp_http_client_read never returns negative error code, we rely on
-            * `errno` to check for underlying transport connectivity closure if any
-            */
-            if (errno == ECONNRESET || errno == ENOTCONN) {
-                ESP_LOGE(TAG_OTA, "Connection closed, errno = %d", errno);
-                break;
-            }
-            if (esp_http_client_is_complete_data_received(client) == true) {
-                ESP_LOGI(TAG_OTA, "Connection closed");
-                break;
+        chunk.len = ota_read_chunk(client, pipeline->buffers[chunk.index]);
+        if (chunk.len < 0) {
+            download_ok = false;
+            break;
+        }
+        if (chunk.len == 0) {
+            xQueueSend(pipeline->free_queue, &chunk, 0);
+            break;
+        }
+
+        if (!writer_started) {
+            ota_progress_save();
+
+            writer_started = true;
+            if (resume) {
+                set_intercom_state(ENUM_INTERCOM_STATE_OTA_UPDATING);
             }
+            ota_metrics_start(&pipeline->metrics, esp_timer_get_time());
+            pipeline->writer = APP_TASK_CREATE(&ota_flash_writer_task, "ota_flash_writer_task", 6144, pipeline, 5);
+        }
+        xQueueSend(pipeline->full_queue, &chunk, portMAX_DELAY);
+
+        if (chunk.len < OTA_BUF_SIZE) {
+            break;  // short read means the stream ended
         }
     }
-    ESP_LOGI(TAG_OTA, "Total Write binary data length: %d", binary_file_length);
-    if (esp_http_client_is_complete_data_received(client) != true) {
-        ESP_LOGE(TAG_OTA, "Error in receiving complete file");
-        set_intercom_state(ENUM_INTERCOM_STATE_OTA_FAILURE);
-        http_cleanup(client);
-        esp_ota_abort(update_handle);
-        task_fatal_error();
+
+    if (writer_started) {
+        // Let the writer drain what is queued and stop
+        ota_chunk_t end = { .index = 0, .len = 0 };
+        xQueueSend(pipeline->full_queue, &end, portMAX_DELAY);
+        xSemaphoreTake(pipeline->writer_done, portMAX_DELAY);
+        while (eTaskGetState(pipeline->writer) != eSuspended) {
+            vTaskDelay(1);
+        }
+        vTaskDelete(pipeline->writer);
+        ota_metrics_finish(&pipeline->metrics, esp_timer_get_time());
+        ota_log_metrics(&pipeline->metrics);
     }
 
-    err = esp_ota_end(update_handle);
-    if (err != ESP_OK) {
-        if (err == ESP_ERR_OTA_VALIDATE_FAILED) {
-            ESP_LOGE(TAG_OTA, "Image validation failed, image is corrupted");
+    bool complete = esp_http_client_is_complete_data_received(client);
+    bool decoded = ota_decoder_complete(&pipeline->decoder);
+    ota_decoder_end(&pipeline->decoder);
+    esp_err_t write_err = pipeline->write_err;
+    http_cleanup(client);
+    ota_pipeline_deinit(pipeline);
+
+    ESP_LOGI(TAG_OTA, "Total Write binary data length: %" PRIu32, ota_progress.offset);
+    if (write_err != ESP_OK) {
+        ota_progress_clear();
+        return OTA_SESSION_FATAL;
+    }
+    if (!download_ok || !complete) {
+        if (ota_progress.artifact_flags != 0) {
+            ESP_LOGE(TAG_OTA, "Error in receiving complete file, compressed and delta downloads restart");
         } else {
-            ESP_LOGE(TAG_OTA, "esp_ota_end failed (%s)!", esp_err_to_name(err));
+            ESP_LOGE(TAG_OTA, "Error in receiving complete file, %" PRIu32 " bytes kept for resume", ota_progress.offset);
         }
-        set_intercom_state(ENUM_INTERCOM_STATE_OTA_FAILURE);
+        return OTA_SESSION_RETRY;
+    }
+    if (!decoded) {
+        ESP_LOGE(TAG_OTA, "Download ended before the image was complete");
+        ota_progress_clear();
+        return OTA_SESSION_FATAL;
+    }
+    return OTA_SESSION_DONE;
+}
+
+/*
+ * Fetch the manifest and decide whether an update is offered. The ETag of a
+ * manifest that offered nothing is kept in NVS together with the running
+ * version, so later checks are a conditional request answered by a bodiless 304.
+ */
+static ota_check_result_t ota_check_manifest(const esp_partition_t *running, ota_manifest_t *manifest)
+{
+    static char body[OTA_MANIFEST_MAX_LEN];
+    ota_http_headers_t headers = { 0 };
+    ota_manifest_cache_t cache;
+
+    esp_app_desc_t running_app_info;
+    if (esp_ota_get_partition_description(running, &running_app_info) != ESP_OK) {
+        return OTA_CHECK_FAILED;
+    }
+    ota_manifest_cache_load(&cache);
+    if (strncmp(cache.running_version, running_app_info.version, sizeof(cache.running_version)) != 0) {
+        cache.etag[0] = '\0';
+    }
+
+    esp_http_client_config_t config = {
+        .url = OTA_MANIFEST_URL,
+        .timeout_ms = OTA_FIRMWARE_RECV_TIMEOUT,
+        .transport_type = HTTP_TRANSPORT_OVER_TCP,
+        .event_handler = ota_http_event_handler,
+        .user_data = &headers,
+    };
+    esp_http_client_handle_t client = esp_http_client_init(&config);
+    if (client == NULL) {
+        return OTA_CHECK_FAILED;
+    }
+    if (cache.etag[0] != '\0') {
+        esp_http_client_set_header(client, "If-None-Match", cache.etag);
+    }
+
+    esp_err_t err = esp_http_client_open(client, 0);
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG_OTA, "Failed to open manifest connection: %s", esp_err_to_name(err));
+        esp_http_client_cleanup(client);
+        return OTA_CHECK_FAILED;
+    }
+    esp_http_client_fetch_headers(client);
+    int status = esp_http_client_get_status_code(client);
+    if (status == 304) {
+        http_cleanup(client);
+        ESP_LOGI(TAG_OTA, "Manifest unchanged, running %s is current", running_app_info.version);
+        return OTA_CHECK_NONE;
+    }
+    if (status != 200) {
+        ESP_LOGE(TAG_OTA, "Manifest request failed with HTTP status %d", status);
         http_cleanup(client);
-        task_fatal_error();
+        return OTA_CHECK_FAILED;
+    }
+
+    int len = 0;
+    while (len < sizeof(body)) {
+        int n = esp_http_client_read(client, body + len, sizeof(body) - len);
+        if (n <= 0) {
+            break;
+        }
+        len += n;
+    }
+    bool complete = esp_http_client_is_complete_data_received(client);
+    http_cleanup(client);
+    if (!complete || !ota_manifest_parse(body, len, manifest)) {
+        ESP_LOGE(TAG_OTA, "Invalid manifest (%d bytes)", len);
+        return OTA_CHECK_FAILED;
+    }
+
+    const esp_partition_t *last_invalid_app = esp_ota_get_last_invalid_partition();
+    esp_app_desc_t invalid_app_info;
+    bool has_invalid = last_invalid_app != NULL &&
+                       esp_ota_get_partition_description(last_invalid_app, &invalid_app_info) == ESP_OK;
+
+    ota_manifest_action_t action = ota_manifest_check(manifest, running_app_info.version,
+                                                      has_invalid ? invalid_app_info.version : NULL);
+    if (action == OTA_MANIFEST_UPDATE) {
+        ESP_LOGI(TAG_OTA, "Manifest offers %s (running %s)", manifest->version, running_app_info.version);
+        ota_manifest_cache_save(NULL);
+        return OTA_CHECK_UPDATE;
+    }
+
+    if (action == OTA_MANIFEST_REJECTED) {
+        ESP_LOGW(TAG_OTA, "Manifest offers %s, which was rolled back before", manifest->version);
+    } else {
+        ESP_LOGI(TAG_OTA, "Manifest offers the running version %s", manifest->version);
+    }
+    snprintf(cache.etag, sizeof(cache.etag), "%s", headers.etag);
+    snprintf(cache.running_version, sizeof(cache.running_version), "%s", running_app_info.version);
+    ota_manifest_cache_save(cache.etag[0] != '\0' ? &cache : NULL);
+    return OTA_CHECK_NONE;
+}
+
+/* Download, verify and boot the offered image. Returns only if the update failed */
+static void ota_update(ota_pipeline_t *pipeline, const esp_partition_t *update_partition,
+                       const esp_partition_t *running, const ota_manifest_t *manifest, backoff_t *retry_backoff)
+{
+    if (manifest->size > update_partition->size) {
+        ESP_LOGE(TAG_OTA, "Image of %" PRIu32 " bytes does not fit the %" PRIu32 " byte partition",
+                 manifest->size, update_partition->size);
+        return;
+    }
+
+    ota_session_result_t result = OTA_SESSION_RETRY;
+    for (int attempt = 0; attempt < OTA_MAX_ATTEMPTS && result == OTA_SESSION_RETRY; attempt++) {
+        if (attempt > 0) {
+            uint32_t delay_ms = backoff_next_delay_ms(retry_backoff);
+            ESP_LOGI(TAG_OTA, "Retrying download in %" PRIu32 " ms", delay_ms);
+            vTaskDelay(pdMS_TO_TICKS(delay_ms));
+        }
+        result = ota_download_session(pipeline, update_partition, running, manifest);
+    }
+
+    if (result != OTA_SESSION_DONE) {
+        if (ota_progress.offset > 0) {
+            set_intercom_state(ENUM_INTERCOM_STATE_OTA_FAILURE);
+        }
+        return;
+    }
+
+    uint8_t *verify_buffer = arena_alloc(&ota_arena, OTA_BUF_SIZE);
+    bool hash_ok = verify_buffer != NULL && ota_verify_image(update_partition, verify_buffer);
+    arena_reset(&ota_arena);
+    ota_progress_clear();
+    if (!hash_ok) {
+        set_intercom_state(ENUM_INTERCOM_STATE_OTA_FAILURE);
+        return;
     }
 
-    err = esp_ota_set_boot_partition(update_partition);
+    // Validates the image before switching to it
+    esp_err_t err = esp_ota_set_boot_partition(update_partition);
     if (err != ESP_OK) {
-        ESP_LOGE(TAG_OTA, "esp_ota_set_boot_partition failed (%s)!", esp_err_to_name(err));
+        if (err == ESP_ERR_OTA_VALIDATE_FAILED) {
+            ESP_LOGE(TAG_OTA, "Image validation failed, image is corrupted");
+        } else {
+            ESP_LOGE(TAG_OTA, "esp_ota_set_boot_partition failed (%s)!", esp_err_to_name(err));
+        }
         set_intercom_state(ENUM_INTERCOM_STATE_OTA_FAILURE);
-        http_cleanup(client);
         return;
     }
     ESP_LOGI(TAG_OTA, "Prepare to restart system!");
     esp_restart();
 }
 
+/* Check interval with jitter so a fleet does not poll the server in lockstep */
+static uint32_t ota_check_interval_ms(void)
+{
+    uint32_t jitter = OTA_CHECK_INTERVAL_MS / 100 * OTA_CHECK_JITTER_PCT;
+    return OTA_CHECK_INTERVAL_MS - jitter + esp_random() % (2 * jitter + 1);
+}
+
+static void ota_via_http_client_task(void *pvParameter)
+{
+    static ota_pipeline_t pipeline;
+    static ota_manifest_t manifest;
+
+    ESP_LOGI(TAG_OTA, "Starting OTA example task");
+
+    const esp_partition_t *configured = esp_ota_get_boot_partition();
+    const esp_partition_t *running = esp_ota_get_running_partition();
+
+    if (configured != running) {
+        ESP_LOGW(TAG_OTA, "Configured OTA boot partition at offset 0x%08"PRIx32", but running from offset 0x%08"PRIx32,
+                 configured->address, running->address);
+        ESP_LOGW(TAG_OTA, "(This can happen if either the OTA boot data or preferred boot image become corrupted somehow.)");
+    }
+
+    ESP_LOGI(TAG_OTA, "Running partition type %d subtype %d (offset 0x%08"PRIx32")",
+             running->type, running->subtype, running->address);
+
+    const esp_partition_t *update_partition = esp_ota_get_next_update_partition(NULL);
+    assert(update_partition != NULL);
+
+    const backoff_config_t backoff_cfg = {
+        .min_ms = OTA_RETRY_MIN_MS,
+        .base_ms = OTA_RETRY_BASE_MS,
+        .cap_ms = OTA_RETRY_CAP_MS,
+        .stable_ms = UINT32_MAX,
+    };
+    backoff_t retry_backoff;
+    backoff_init(&retry_backoff, &backoff_cfg, esp_random());
+
+    ota_progress_load();
+
+    while (1) {
+        uint32_t delay_ms;
+        power_begin(POWER_ACTIVITY_OTA);
+        ota_check_result_t check = ota_check_manifest(running, &manifest);
+
+        if (check == OTA_CHECK_FAILED) {
+            delay_ms = backoff_next_delay_ms(&retry_backoff);
+            ESP_LOGW(TAG_OTA, "Manifest check failed, next check in %" PRIu32 " ms", delay_ms);
+        } else {
+            if (check == OTA_CHECK_UPDATE) {
+                if (ota_arena_open()) {
+                    ota_update(&pipeline, update_partition, running, &manifest, &retry_backoff);
+                    ota_arena_close();
+                }
+            }
+            backoff_init(&retry_backoff, &backoff_cfg, esp_random());
+            delay_ms = ota_check_interval_ms();
+            ESP_LOGI(TAG_OTA, "Next update check in %" PRIu32 " s", delay_ms / 1000);
+        }
+        power_end(POWER_ACTIVITY_OTA);
+        vTaskDelay(pdMS_TO_TICKS(delay_ms));
+        power_woke(POWER_TASK_OTA);
+    }
+}
+
 void task_ota_start() {
-    xTaskCreate(&ota_via_http_client_task, "ota_via_http_client_task", 8192, NULL, 5, NULL);
+    APP_TASK_CREATE(&ota_via_http_client_task, "ota_via_http_client_task", 8192, NULL, 5);
 }   
 
 void ota_check(){
@@ -221,6 +950,7 @@ void ota_check(){
                 set_intercom_state(ENUM_INTERCOM_STATE_OTA_SUCCESS);
                 vTaskDelay(1000 / portTICK_PERIOD_MS);
                 esp_ota_mark_app_valid_cancel_rollback();
+                clear_intercom_state(ENUM_INTERCOM_STATE_OTA_SUCCESS);
             } else {
                 ESP_LOGE(TAG_OTA, "Diagnostics failed! Start rollback to the previous version ...");
                 set_intercom_state(ENUM_INTERCOM_STATE_OTA_FAILURE);
@@ -1,7 +1,20 @@
 #include "stdbool.h"
 
-#define OTA_BUFFSIZE 1024
-static char ota_write_data[OTA_BUFFSIZE + 1] = { 0 };
+#define OTA_BUF_SIZE            CONFIG_INTERCOM_OTA_BUF_SIZE    // bytes per pipeline buffer
+#define OTA_BUF_COUNT           CONFIG_INTERCOM_OTA_BUF_COUNT   // buffers shared by downloader and writer
+#define OTA_HTTP_RX_BUF_SIZE    4096
+
+#define OTA_NVS_NAMESPACE           "ota_resume"
+#define OTA_ETAG_MAX_LEN            64
+#define OTA_RESUME_SAVE_INTERVAL    (64 * 1024)     // store the resume point every this many bytes
+#define OTA_MAX_ATTEMPTS            5               // download attempts per offered update
+#define OTA_RETRY_MIN_MS            2000
+#define OTA_RETRY_BASE_MS           5000
+#define OTA_RETRY_CAP_MS            60000
+
+#define OTA_MANIFEST_MAX_LEN        1024
+#define OTA_CHECK_INTERVAL_MS       ((uint32_t)CONFIG_INTERCOM_OTA_CHECK_INTERVAL_MIN * 60 * 1000)
+#define OTA_CHECK_JITTER_PCT        10              // +/- spread of the check interval
 
 static bool ota_post_diagnostic();
 
@@ -9,4 +22,4 @@ void ota_task(void *pvParameter);
 
 void ota_check();
 
-void task_ota_start();
\ No newline at end of file
+void task_ota_start();
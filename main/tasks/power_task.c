@@ -0,0 +1,190 @@
+#include "power_task.h"
+#include "app_alloc.h"
+#include "core/power_policy.h"
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#if CONFIG_PM_ENABLE
+#include "esp_pm.h"
+#endif
+
+const char *TAG_POWER = "intercom_power";
+
+static const uint8_t power_needs[POWER_ACTIVITY_COUNT] = {
+    [POWER_ACTIVITY_FRAME] = POWER_LEVEL_AWAKE,
+    [POWER_ACTIVITY_PUBLISH] = POWER_LEVEL_FULL,
+    [POWER_ACTIVITY_COMMAND] = POWER_LEVEL_FULL,
+    [POWER_ACTIVITY_OTA] = POWER_LEVEL_FULL,
+};
+
+static const char *power_activity_names[POWER_ACTIVITY_COUNT] = {
+    [POWER_ACTIVITY_FRAME] = "frame",
+    [POWER_ACTIVITY_PUBLISH] = "publish",
+    [POWER_ACTIVITY_COMMAND] = "command",
+    [POWER_ACTIVITY_OTA] = "ota",
+};
+
+static const char *power_task_names[POWER_TASK_COUNT] = {
+    [POWER_TASK_ADC] = "adc",
+    [POWER_TASK_MONITOR] = "monitor",
+    [POWER_TASK_MQTT] = "mqtt",
+    [POWER_TASK_RGB] = "rgb",
+    [POWER_TASK_EVENT_LOG] = "event_log",
+    [POWER_TASK_METRICS] = "metrics",
+    [POWER_TASK_DLOG] = "dlog",
+    [POWER_TASK_OTA] = "ota",
+    [POWER_TASK_CAPTURE] = "capture",
+};
+
+static power_policy_t power_policy;
+static SemaphoreHandle_t power_lock = NULL;     // callers on many tasks and the linger timer
+static esp_timer_handle_t power_timer = NULL;
+static atomic_uint power_wakeups[POWER_TASK_COUNT];
+static bool power_managed = false;              // esp_pm_configure succeeded
+#if CONFIG_PM_ENABLE
+static esp_pm_lock_handle_t power_no_sleep_lock = NULL;
+static esp_pm_lock_handle_t power_cpu_max_lock = NULL;
+#endif
+
+static int64_t power_now_us(void *ctx)
+{
+    return esp_timer_get_time();
+}
+
+/* Take the lock of the new level before letting go of the old one */
+static void power_apply(void *ctx, power_level_t from, power_level_t to)
+{
+#if CONFIG_PM_ENABLE
+    esp_pm_lock_handle_t locks[POWER_LEVEL_COUNT] = {
+        [POWER_LEVEL_IDLE] = NULL,
+        [POWER_LEVEL_AWAKE] = power_no_sleep_lock,
+        [POWER_LEVEL_FULL] = power_cpu_max_lock,
+    };
+    if (locks[to] != NULL) {
+        esp_pm_lock_acquire(locks[to]);
+    }
+    if (locks[from] != NULL) {
+        esp_pm_lock_release(locks[from]);
+    }
+#endif
+}
+
+static void power_arm_timer(void *ctx, uint64_t delay_us)
+{
+    esp_timer_stop(power_timer);
+    esp_timer_start_once(power_timer, delay_us);
+}
+
+static void power_timer_cb(void *arg)
+{
+    xSemaphoreTake(power_lock, portMAX_DELAY);
+    power_policy_expire(&power_policy);
+    xSemaphoreGive(power_lock);
+}
+
+void power_begin(power_activity_t activity)
+{
+    if (power_lock == NULL) {
+        return;
+    }
+    xSemaphoreTake(power_lock, portMAX_DELAY);
+    power_policy_begin(&power_policy, activity);
+    xSemaphoreGive(power_lock);
+}
+
+void power_end(power_activity_t activity)
+{
+    if (power_lock == NULL) {
+        return;
+    }
+    xSemaphoreTake(power_lock, portMAX_DELAY);
+    power_policy_end(&power_policy, activity);
+    xSemaphoreGive(power_lock);
+}
+
+void power_woke(power_task_t task)
+{
+    if (task < POWER_TASK_COUNT) {
+        atomic_fetch_add_explicit(&power_wakeups[task], 1, memory_order_relaxed);
+    }
+}
+
+int power_append_report(char *payload, int len, size_t size)
+{
+    power_stats_t stats = { 0 };
+    int64_t period_us = 0;
+
+    if (power_lock != NULL) {
+        xSemaphoreTake(power_lock, portMAX_DELAY);
+        power_policy_take_stats(&power_policy, &stats, &period_us);
+        xSemaphoreGive(power_lock);
+    }
+
+    len += snprintf(payload + len, size - len,
+                    ",\"power\":{\"pm\":%s,\"full_ms\":%" PRIu64 ",\"awake_ms\":%" PRIu64 ",\"idle_ms\":%" PRIu64 ",\"transitions\":%" PRIu32,
+                    power_managed ? "true" : "false", stats.level_us[POWER_LEVEL_FULL] / 1000,
+                    stats.level_us[POWER_LEVEL_AWAKE] / 1000, stats.level_us[POWER_LEVEL_IDLE] / 1000,
+                    stats.transitions);
+
+    // Per activity [runs, busy_ms]
+    for (int i = 0; i < POWER_ACTIVITY_COUNT && len < size; i++) {
+        len += snprintf(payload + len, size - len, "%s\"%s\":[%" PRIu32 ",%" PRIu64 "]", i == 0 ? ",\"activities\":{" : ",",
+                        power_activity_names[i], stats.begins[i], stats.busy_us[i] / 1000);
+    }
+    for (int i = 0; i < POWER_TASK_COUNT && len < size; i++) {
+        unsigned wakeups = atomic_exchange_explicit(&power_wakeups[i], 0, memory_order_relaxed);
+        len += snprintf(payload + len, size - len, "%s\"%s\":%u", i == 0 ? "},\"wakeups\":{" : ",",
+                        power_task_names[i], wakeups);
+    }
+    if (len < size) {
+        len += snprintf(payload + len, size - len, "}}");
+    }
+    return len;
+}
+
+void power_init()
+{
+#if CONFIG_PM_ENABLE
+    const esp_pm_config_t pm_config = {
+        .max_freq_mhz = CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+        .min_freq_mhz = POWER_MIN_FREQ_MHZ,
+#if CONFIG_FREERTOS_USE_TICKLESS_IDLE
+        .light_sleep_enable = true,
+#endif
+    };
+    esp_err_t err = esp_pm_configure(&pm_config);
+    if (err == ESP_OK) {
+        power_managed = true;
+        ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_NO_LIGHT_SLEEP, 0, "intercom_awake", &power_no_sleep_lock));
+        ESP_ERROR_CHECK(esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "intercom_full", &power_cpu_max_lock));
+        ESP_LOGI(TAG_POWER, "DFS %d-%d MHz, light sleep %s", POWER_MIN_FREQ_MHZ, CONFIG_ESP_DEFAULT_CPU_FREQ_MHZ,
+                 pm_config.light_sleep_enable ? "on" : "off");
+    } else {
+        ESP_LOGW(TAG_POWER, "esp_pm_configure failed (%s), running at full clock", esp_err_to_name(err));
+    }
+#else
+    ESP_LOGI(TAG_POWER, "CONFIG_PM_ENABLE is off, only counting activity and wakeups");
+#endif
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = power_timer_cb,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "power_linger",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &power_timer));
+
+    const power_ops_t ops = {
+        .now_us = power_now_us,
+        .apply = power_apply,
+        .arm_timer = power_arm_timer,
+    };
+    power_policy_init(&power_policy, &ops, power_needs, POWER_ACTIVITY_COUNT, POWER_LINGER_MS * 1000ULL);
+    power_lock = APP_MUTEX_CREATE();
+}
@@ -0,0 +1,40 @@
+#include <stddef.h>
+#include <stdint.h>
+
+#define POWER_MIN_FREQ_MHZ      CONFIG_INTERCOM_PM_MIN_FREQ_MHZ
+#define POWER_LINGER_MS         CONFIG_INTERCOM_PM_LINGER_MS    // level hold-off after the last activity
+
+/* Work that holds a power management lock while it runs */
+typedef enum {
+    POWER_ACTIVITY_FRAME,       // ring detection on one ADC frame, no light sleep
+    POWER_ACTIVITY_PUBLISH,     // MQTT publish, full CPU clock
+    POWER_ACTIVITY_COMMAND,     // handling a received MQTT message, full CPU clock
+    POWER_ACTIVITY_OTA,         // manifest check and update download, full CPU clock
+    POWER_ACTIVITY_COUNT,
+} power_activity_t;
+
+/* Tasks whose wakeups are counted */
+typedef enum {
+    POWER_TASK_ADC,
+    POWER_TASK_MONITOR,
+    POWER_TASK_MQTT,
+    POWER_TASK_RGB,
+    POWER_TASK_EVENT_LOG,
+    POWER_TASK_METRICS,
+    POWER_TASK_DLOG,
+    POWER_TASK_OTA,
+    POWER_TASK_CAPTURE,
+    POWER_TASK_COUNT,
+} power_task_t;
+
+void power_begin(power_activity_t activity);
+void power_end(power_activity_t activity);
+
+/* Call each time a task returns from a blocking wait, safe from any task */
+void power_woke(power_task_t task);
+
+/* Append the "power" object of the diagnostics report and start a new interval */
+int power_append_report(char *payload, int len, size_t size);
+
+/* Configure DFS and automatic light sleep, create the locks */
+void power_init();
@@ -1,14 +1,113 @@
 #include "rgb_state_task.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "driver/ledc.h"
 #include "esp_timer.h"
 #include "esp_log.h"
 #include "esp_task.h"
+#include "esp_bit_defs.h"
 #include "intercom_constants.h"
+#include "app_alloc.h"
+#include "power_task.h"
 #include "color.h"
+#include "core/rgb_pattern.h"
+#include "core/state_bus.h"
 
 const char *TAG_RGB = "intercom_state";
 
+#define RGB_NOTIFY_STATE    BIT0    // the state bus changed
+#define RGB_NOTIFY_FLASH    BIT1    // rgb_display() asked for a short flash
+#define RGB_FLASH_MS        100
+
+#if CONFIG_INTERCOM_RGB_HW_FADE
+#define RGB_HW_FADE true
+#else
+#define RGB_HW_FADE false
+#endif
+
+#define RGB_COLOR(...) ((rgb_color_t) { __VA_ARGS__ })
+
+/* Pattern shown for each intercom state, indexed by EnumIntercomState */
+static const rgb_pattern_t state_patterns[ENUM_INTERCOM_STATE_END] = {
+    [ENUM_INTERCOM_STATE_IDLE]              = { RGB_PATTERN_SOLID,      { RGB_STATUS_IDLE } },
+    [ENUM_INTERCOM_STATE_WIFI_CONNECTING]   = { RGB_PATTERN_BLINK,      { RGB_WIFI_CONNECTING } },
+    [ENUM_INTERCOM_STATE_WIFI_CONNECTED]    = { RGB_PATTERN_SOLID,      { RGB_WIFI_CONNECTED } },
+    [ENUM_INTERCOM_STATE_WIFI_DISCONNECTED] = { RGB_PATTERN_BLINK,      { RGB_WIFI_DISCONNECTED } },
+    [ENUM_INTERCOM_STATE_MQTT_CONNECTING]   = { RGB_PATTERN_BLINK,      { RGB_MQTT_CONNECTING } },
+    [ENUM_INTERCOM_STATE_MQTT_CONNECTED]    = { RGB_PATTERN_SOLID,      { RGB_MQTT_CONNECTED } },
+    [ENUM_INTERCOM_STATE_MQTT_DISCONNECTED] = { RGB_PATTERN_BLINK,      { RGB_MQTT_DISCONNECTED } },
+    [ENUM_INTERCOM_STATE_MQTT_SENDING]      = { RGB_PATTERN_BLINK,      { RGB_MQTT_SENDING } },
+    [ENUM_INTERCOM_STATE_MQTT_RECEIVING]    = { RGB_PATTERN_BLINK,      { RGB_MQTT_RECEIVING } },
+    [ENUM_INTERCOM_STATE_OTA_UPDATING]      = { RGB_PATTERN_BREATHE,    { RGB_OTA_UPDATING } },
+    [ENUM_INTERCOM_STATE_OTA_SUCCESS]       = { RGB_PATTERN_BLINK,      { RGB_OTA_SUCCESS } },
+    [ENUM_INTERCOM_STATE_OTA_FAILURE]       = { RGB_PATTERN_FAST_BLINK, { RGB_OTA_FAILURE } },
+};
+
+/* Fallback for unknown states - fast blink red */
+static const rgb_pattern_t error_pattern = { RGB_PATTERN_FAST_BLINK, { RGB_STATUS_ERROR } };
+
+static TaskHandle_t rgb_task_handle = NULL;
+static volatile uint32_t flash_color = 0;   // packed r | g << 8 | b << 16
+
+static state_bus_t intercom_state_bus;
+
+/* Slot owned by the subsystem that reports a state */
+static state_bus_slot_t intercom_state_slot(int state)
+{
+    switch (state) {
+    case ENUM_INTERCOM_STATE_WIFI_CONNECTING:
+    case ENUM_INTERCOM_STATE_WIFI_CONNECTED:
+    case ENUM_INTERCOM_STATE_WIFI_DISCONNECTED:
+        return STATE_BUS_WIFI;
+    case ENUM_INTERCOM_STATE_MQTT_SENDING:
+    case ENUM_INTERCOM_STATE_MQTT_RECEIVING:
+        return STATE_BUS_ACTIVITY;
+    case ENUM_INTERCOM_STATE_OTA_UPDATING:
+    case ENUM_INTERCOM_STATE_OTA_SUCCESS:
+    case ENUM_INTERCOM_STATE_OTA_FAILURE:
+        return STATE_BUS_OTA;
+    default:
+        return STATE_BUS_MQTT;
+    }
+}
+
+/*
+ * Composite state shown on the LED: OTA first, then short MQTT activity,
+ * then Wi-Fi while it is not connected, then the MQTT connection state.
+ */
+static uint16_t intercom_state_resolve(const state_bus_snapshot_t *snapshot)
+{
+    const uint16_t *slots = snapshot->slots;
+
+    if (slots[STATE_BUS_OTA] != STATE_BUS_NONE) {
+        return slots[STATE_BUS_OTA];
+    }
+    if (slots[STATE_BUS_ACTIVITY] != STATE_BUS_NONE) {
+        return slots[STATE_BUS_ACTIVITY];
+    }
+    if (slots[STATE_BUS_WIFI] != STATE_BUS_NONE && slots[STATE_BUS_WIFI] != ENUM_INTERCOM_STATE_WIFI_CONNECTED) {
+        return slots[STATE_BUS_WIFI];
+    }
+    if (slots[STATE_BUS_MQTT] != STATE_BUS_NONE) {
+        return slots[STATE_BUS_MQTT];
+    }
+    if (slots[STATE_BUS_WIFI] != STATE_BUS_NONE) {
+        return slots[STATE_BUS_WIFI];
+    }
+    return ENUM_INTERCOM_STATE_IDLE;
+}
+
+static void intercom_state_changed(void *ctx, state_bus_slot_t slot, uint16_t value)
+{
+    if (rgb_task_handle != NULL) {
+        xTaskNotify(rgb_task_handle, RGB_NOTIFY_STATE, eSetBits);
+    }
+}
+
 void rgb_state_init() {
+    state_bus_init(&intercom_state_bus, intercom_state_resolve);
+    state_bus_subscribe(&intercom_state_bus, intercom_state_changed, NULL);
+
 // Configure RGB pins for PWM
     ledc_timer_config_t ledc_timer = {
         .duty_resolution = LEDC_TIMER_8_BIT, // 8-bit resolution (0-255)
@@ -49,156 +148,132 @@ void rgb_state_init() {
     ledc_channel_config(&ledc_channel_g);
     ledc_channel_config(&ledc_channel_b);
 
+#if CONFIG_INTERCOM_RGB_HW_FADE
+    ledc_fade_func_install(0);
+#endif
 }
 
-void rgb_display(int8_t r, int8_t g, int8_t b) {
-    
-    // Set RGB LED color with PWM - map int8_t (-128 to 127) to 0-255 range
-    uint32_t r_duty = r < 0 ? 0 : (r > 100 ? 255 : r * 255 / 100);
-    uint32_t g_duty = g < 0 ? 0 : (g > 100 ? 255 : g * 255 / 100);
-    uint32_t b_duty = b < 0 ? 0 : (b > 100 ? 255 : b * 255 / 100);
-    
-    ledc_set_duty(LEDC_HIGH_SPEED_MODE, RGB_LEDC_CHANNEL_0, r_duty);
-    ledc_set_duty(LEDC_HIGH_SPEED_MODE, RGB_LEDC_CHANNEL_1, g_duty);
-    ledc_set_duty(LEDC_HIGH_SPEED_MODE, RGB_LEDC_CHANNEL_2, b_duty);
-    
-    ledc_update_duty(LEDC_HIGH_SPEED_MODE, RGB_LEDC_CHANNEL_0);
-    ledc_update_duty(LEDC_HIGH_SPEED_MODE, RGB_LEDC_CHANNEL_1);
-    ledc_update_duty(LEDC_HIGH_SPEED_MODE, RGB_LEDC_CHANNEL_2);
+static uint32_t rgb_level_to_duty(int level)
+{
+    // Map the 0-100 level range to the 8-bit duty range
+    return level < 0 ? 0 : (level > 100 ? 255 : level * 255 / 100);
+}
+
+/* Write the color to the LEDC channels, skipping channels whose duty is unchanged */
+static void rgb_apply(rgb_color_t color, uint32_t fade_ms)
+{
+    static const ledc_channel_t channels[3] = { RGB_LEDC_CHANNEL_0, RGB_LEDC_CHANNEL_1, RGB_LEDC_CHANNEL_2 };
+    static uint32_t current_duty[3] = { 0, 0, 0 };
+    const uint32_t duty[3] = {
+        rgb_level_to_duty(color.r),
+        rgb_level_to_duty(color.g),
+        rgb_level_to_duty(color.b),
+    };
+
+    for (int i = 0; i < 3; i++) {
+        if (duty[i] == current_duty[i]) {
+            continue;
+        }
+        current_duty[i] = duty[i];
+#if CONFIG_INTERCOM_RGB_HW_FADE
+        if (fade_ms > 0) {
+            ledc_set_fade_with_time(LEDC_HIGH_SPEED_MODE, channels[i], duty[i], fade_ms);
+            ledc_fade_start(LEDC_HIGH_SPEED_MODE, channels[i], LEDC_FADE_NO_WAIT);
+            continue;
+        }
+#endif
+        ledc_set_duty(LEDC_HIGH_SPEED_MODE, channels[i], duty[i]);
+        ledc_update_duty(LEDC_HIGH_SPEED_MODE, channels[i]);
+    }
 }
 
-int work_status = ENUM_INTERCOM_STATE_IDLE;
+/* Show a color briefly, the state pattern is restored by the renderer afterwards */
+void rgb_display(int8_t r, int8_t g, int8_t b) {
+    flash_color = (uint8_t)r | (uint8_t)g << 8 | (uint8_t)b << 16;
+    if (rgb_task_handle != NULL) {
+        xTaskNotify(rgb_task_handle, RGB_NOTIFY_FLASH, eSetBits);
+    }
+}
 
 void set_intercom_state(int state) {
     if (state <= ENUM_INTERCOM_STATE_BEGIN || state >= ENUM_INTERCOM_STATE_END) {
         ESP_LOGE(TAG_RGB, "Invalid intercom state: %d", state);
         return;
     }
-    work_status = state;
-    ESP_LOGI(TAG_RGB, "Intercom state changed to: %d", work_status);
+    if (state == ENUM_INTERCOM_STATE_IDLE) {
+        return;
+    }
+
+    state_bus_slot_t slot = intercom_state_slot(state);
+    if (state_bus_publish(&intercom_state_bus, slot, state)) {
+        ESP_LOGI(TAG_RGB, "Intercom state changed to: %d (slot %d)", state, slot);
+    }
+    if (slot == STATE_BUS_MQTT) {
+        /* a new connection state ends any sending / receiving indication */
+        state_bus_publish(&intercom_state_bus, STATE_BUS_ACTIVITY, STATE_BUS_NONE);
+    }
 }
 
+void clear_intercom_state(int state) {
+    state_bus_publish(&intercom_state_bus, intercom_state_slot(state), STATE_BUS_NONE);
+}
+
+int get_intercom_state(void) {
+    return state_bus_composite(&intercom_state_bus);
+}
+
+static const rgb_pattern_t *rgb_pattern_for_state(int state)
+{
+    if (state <= ENUM_INTERCOM_STATE_BEGIN || state >= ENUM_INTERCOM_STATE_END) {
+        return &error_pattern;
+    }
+    return &state_patterns[state];
+}
+
+/* Renderer: sleeps until the state changes or the current pattern step ends */
 void update_rgb_state_task(void *pvParameters) {
-    TickType_t last_update_time = xTaskGetTickCount();
-    bool blink_state = false;
-    uint8_t blink_counter = 0;
-    
+    int shown_state = get_intercom_state();
+    TickType_t pattern_start = xTaskGetTickCount();
+    TickType_t flash_until = 0;
+    bool flashing = false;
+
     while (1) {
-        // Update blink state every ~500ms (5 iterations at 100ms each)
-        blink_counter++;
-        if (blink_counter >= 5) {
-            blink_counter = 0;
-            blink_state = !blink_state;
+        uint32_t wait_ms;
+
+        if (flashing && (TickType_t)(xTaskGetTickCount() - flash_until) < portMAX_DELAY / 2) {
+            flashing = false;
+        }
+
+        if (flashing) {
+            uint32_t packed = flash_color;
+            rgb_apply(RGB_COLOR((int8_t)packed, (int8_t)(packed >> 8), (int8_t)(packed >> 16)), 0);
+            wait_ms = pdTICKS_TO_MS(flash_until - xTaskGetTickCount());
+        } else {
+            uint32_t elapsed_ms = pdTICKS_TO_MS(xTaskGetTickCount() - pattern_start);
+            rgb_pattern_step_t step = rgb_pattern_eval(rgb_pattern_for_state(shown_state), elapsed_ms,
+                                                       RGB_HW_FADE);
+            rgb_apply(step.color, step.fade_ms);
+            wait_ms = step.next_ms;
         }
-        
-        // Update RGB based on current intercom state
-        switch (work_status) {
-            case ENUM_INTERCOM_STATE_IDLE:
-                rgb_display(RGB_STATUS_IDLE);
-                break;
-                
-            case ENUM_INTERCOM_STATE_WIFI_CONNECTING:
-                // Blink light blue when WiFi connecting
-                if (blink_state) {
-                    rgb_display(RGB_WIFI_CONNECTING);
-                } else {
-                    rgb_display(RGB_STATUS_IDLE);
-                }
-                break;
-                
-            case ENUM_INTERCOM_STATE_WIFI_CONNECTED:
-                rgb_display(RGB_WIFI_CONNECTED);
-                break;
-                
-            case ENUM_INTERCOM_STATE_WIFI_DISCONNECTED:
-                // Blink orange when WiFi disconnected
-                if (blink_state) {
-                    rgb_display(RGB_WIFI_DISCONNECTED);
-                } else {
-                    rgb_display(RGB_STATUS_IDLE);
-                }
-                break;
-                
-            case ENUM_INTERCOM_STATE_MQTT_CONNECTING:
-                // Blink purple when MQTT connecting
-                if (blink_state) {
-                    rgb_display(RGB_MQTT_CONNECTING);
-                } else {
-                    rgb_display(RGB_STATUS_IDLE);
-                }
-                break;
-                
-            case ENUM_INTERCOM_STATE_MQTT_CONNECTED:
-                rgb_display(RGB_MQTT_CONNECTED);
-                break;
-                
-            case ENUM_INTERCOM_STATE_MQTT_DISCONNECTED:
-                // Blink yellow when MQTT disconnected
-                if (blink_state) {
-                    rgb_display(RGB_MQTT_DISCONNECTED);
-                } else {
-                    rgb_display(RGB_STATUS_IDLE);
-                }
-                break;
-                
-            case ENUM_INTERCOM_STATE_MQTT_SENDING:
-                // Blink magenta when sending MQTT
-                if (blink_state) {
-                    rgb_display(RGB_MQTT_SENDING);
-                } else {
-                    rgb_display(RGB_STATUS_IDLE);
-                }
-                break;
-                
-            case ENUM_INTERCOM_STATE_MQTT_RECEIVING:
-                // Blink cyan when receiving MQTT
-                if (blink_state) {
-                    rgb_display(RGB_MQTT_RECEIVING);
-                } else {
-                    rgb_display(RGB_STATUS_IDLE);
-                }
-                break;
-                
-            case ENUM_INTERCOM_STATE_OTA_UPDATING:
-                // Blink orange when OTA updating
-                if (blink_state) {
-                    rgb_display(RGB_OTA_UPDATING);
-                } else {
-                    rgb_display(RGB_STATUS_IDLE);
-                }
-                break;
-            case ENUM_INTERCOM_STATE_OTA_SUCCESS:
-                // Blink green when OTA successful
-                if (blink_state) {
-                    rgb_display(RGB_OTA_SUCCESS);
-                } else {
-                    rgb_display(RGB_STATUS_IDLE);
-                }
-
-                break;
-            case ENUM_INTERCOM_STATE_OTA_FAILURE:
-                // Fast blink red when OTA failed
-                if (blink_counter % 2 == 0) {
-                    rgb_display(RGB_OTA_FAILURE);
-                } else {
-                    rgb_display(RGB_STATUS_IDLE);
-                }
-                break;
-            default:
-                // Error state - fast blink red
-                if (blink_counter % 2 == 0) { // Faster blinking for error
-                    rgb_display(RGB_STATUS_ERROR);
-                } else {
-                    rgb_display(RGB_STATUS_IDLE);
-                }
-                break;
+
+        uint32_t notified = 0;
+        TickType_t timeout = wait_ms == RGB_PATTERN_FOREVER ? portMAX_DELAY : pdMS_TO_TICKS(wait_ms);
+        xTaskNotifyWait(0, UINT32_MAX, &notified, timeout);
+        power_woke(POWER_TASK_RGB);
+
+        if (notified & RGB_NOTIFY_FLASH) {
+            flashing = true;
+            flash_until = xTaskGetTickCount() + pdMS_TO_TICKS(RGB_FLASH_MS);
+        }
+
+        int state = get_intercom_state();
+        if (shown_state != state) {
+            shown_state = state;
+            pattern_start = xTaskGetTickCount();
         }
-        
-        // Run every 100ms
-        vTaskDelayUntil(&last_update_time, pdMS_TO_TICKS(100));
     }
 }
 
 void task_rgb_state_start(void) {
-    xTaskCreate(update_rgb_state_task, "rgb_status_task", 2048, NULL, 5, NULL);
+    rgb_task_handle = APP_TASK_CREATE(update_rgb_state_task, "rgb_status_task", 2048, NULL, 5);
 }
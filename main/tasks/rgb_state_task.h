@@ -23,4 +23,6 @@ enum EnumIntercomState {
 void rgb_state_init();
 void rgb_display(int8_t r, int8_t g, int8_t b);
 void task_rgb_state_start();
-void set_intercom_state(int state);
\ No newline at end of file
+void set_intercom_state(int state);
+void clear_intercom_state(int state);
+int get_intercom_state(void);
\ No newline at end of file
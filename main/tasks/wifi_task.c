@@ -1,35 +1,173 @@
 #include "wifi_task.h"
 #include "color.h"
 #include "intercom_constants.h"
+#include "app_alloc.h"
 #include "credentials.h"
 #include "rgb_state_task.h"
+#include "boot_task.h"
+#include "core/wifi_sm.h"
+
+#include <assert.h>
+#include <string.h>
 
 #include "esp_wifi.h"
 #include "esp_log.h"
+#include "esp_mac.h"
+#include "esp_random.h"
+#include "esp_timer.h"
+#include "nvs.h"
 
 const char *TAG_WIFI = "intercom_wifi";
 
+ESP_EVENT_DEFINE_BASE(INTERCOM_WIFI_EVENT);
+
+/* Custom event posted by the retry timer so the state machine only ever
+ * runs on the default event loop */
+#define INTERCOM_WIFI_EVENT_RETRY 0
+
+static wifi_sm_t wifi_sm;
+static esp_timer_handle_t wifi_retry_timer = NULL;
+
+/* Last AP we got an IP from, used to skip the scan on the next connect */
+typedef struct {
+    uint8_t bssid[6];
+    uint8_t channel;
+} wifi_ap_cache_t;
+
+static wifi_ap_cache_t ap_cache;
+
+static bool wifi_ap_cache_load(void)
+{
+    nvs_handle_t nvs;
+    if (nvs_open(WIFI_NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) {
+        return false;
+    }
+    size_t len = sizeof(ap_cache);
+    esp_err_t err = nvs_get_blob(nvs, "ap", &ap_cache, &len);
+    nvs_close(nvs);
+    return err == ESP_OK && len == sizeof(ap_cache) && ap_cache.channel != 0;
+}
+
+static void wifi_ap_cache_store(const wifi_ap_cache_t *cache)
+{
+    if (memcmp(cache, &ap_cache, sizeof(ap_cache)) == 0) {
+        return;
+    }
+    nvs_handle_t nvs;
+    if (nvs_open(WIFI_NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) {
+        return;
+    }
+    ap_cache = *cache;
+    nvs_set_blob(nvs, "ap", &ap_cache, sizeof(ap_cache));
+    nvs_commit(nvs);
+    nvs_close(nvs);
+}
+
+static void wifi_ap_cache_drop(void)
+{
+    nvs_handle_t nvs;
+    memset(&ap_cache, 0, sizeof(ap_cache));
+    if (nvs_open(WIFI_NVS_NAMESPACE, NVS_READWRITE, &nvs) == ESP_OK) {
+        nvs_erase_key(nvs, "ap");
+        nvs_commit(nvs);
+        nvs_close(nvs);
+    }
+}
+
+static void wifi_apply_config(bool fast_connect)
+{
+    wifi_config_t wifi_sta_config = {
+        .sta = {
+            .ssid = WIFI_SSID,
+            .password = WIFI_PASS,
+            .scan_method = WIFI_ALL_CHANNEL_SCAN,
+            .failure_retry_cnt = 5,
+            /* Authmode threshold resets to WPA2 as default if password matches WPA2 standards (password len => 8).
+             * If you want to connect the device to deprecated WEP/WPA networks, Please set the threshold value
+             * to WIFI_AUTH_WEP/WIFI_AUTH_WPA_PSK and set the password with length and format matching to
+            * WIFI_AUTH_WEP/WIFI_AUTH_WPA_PSK standards.
+             */
+            .threshold.authmode = WIFI_AUTH_WPA2_PSK,
+            .sae_pwe_h2e = WPA3_SAE_PWE_BOTH,
+        },
+    };
+    if (fast_connect) {
+        // Go straight to the cached AP, no scan
+        wifi_sta_config.sta.scan_method = WIFI_FAST_SCAN;
+        wifi_sta_config.sta.bssid_set = true;
+        memcpy(wifi_sta_config.sta.bssid, ap_cache.bssid, sizeof(ap_cache.bssid));
+        wifi_sta_config.sta.channel = ap_cache.channel;
+        wifi_sta_config.sta.failure_retry_cnt = 1;
+    }
+    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_sta_config));
+}
+
+static void wifi_retry_timer_cb(void *arg)
+{
+    esp_event_post(INTERCOM_WIFI_EVENT, INTERCOM_WIFI_EVENT_RETRY, NULL, 0, 0);
+}
+
+static void wifi_run_action(const wifi_sm_action_t *action)
+{
+    if (action->drop_cache) {
+        ESP_LOGW(TAG_WIFI, "Fast connect failed, falling back to a full scan");
+        wifi_ap_cache_drop();
+    }
+    if (action->save_ap) {
+        wifi_ap_record_t ap_info;
+        if (esp_wifi_sta_get_ap_info(&ap_info) == ESP_OK) {
+            wifi_ap_cache_t cache = { .channel = ap_info.primary };
+            memcpy(cache.bssid, ap_info.bssid, sizeof(cache.bssid));
+            wifi_ap_cache_store(&cache);
+        }
+    }
+    if (action->connect) {
+        set_intercom_state(ENUM_INTERCOM_STATE_WIFI_CONNECTING);
+        ESP_LOGI(TAG_WIFI, "Connect attempt %" PRIu32 "%s", wifi_sm.attempts,
+                 action->fast_connect ? " (fast connect)" : "");
+        wifi_apply_config(action->fast_connect);
+        esp_wifi_connect();
+    }
+    if (action->retry_delay_ms > 0) {
+        ESP_LOGI(TAG_WIFI, "Reconnecting in %" PRIu32 " ms", action->retry_delay_ms);
+        esp_timer_stop(wifi_retry_timer);
+        esp_timer_start_once(wifi_retry_timer, (uint64_t)action->retry_delay_ms * 1000);
+    }
+}
+
 void wifi_event_handler(void* arg, esp_event_base_t event_base,
                                int32_t event_id, void* event_data) {
+    int64_t now_ms = esp_timer_get_time() / 1000;
+    wifi_sm_action_t action;
+
     if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_START) {
-        set_intercom_state(ENUM_INTERCOM_STATE_WIFI_CONNECTING);
-        esp_wifi_connect();
+        action = wifi_sm_handle(&wifi_sm, WIFI_SM_EV_START, now_ms);
     } else if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
-        ESP_LOGI(TAG_WIFI, "Disconnected. Trying to reconnect...");
+        wifi_event_sta_disconnected_t* event = (wifi_event_sta_disconnected_t*) event_data;
+        ESP_LOGI(TAG_WIFI, "Disconnected, reason %d", event->reason);
         set_intercom_state(ENUM_INTERCOM_STATE_WIFI_DISCONNECTED);
-        vTaskDelay(pdMS_TO_TICKS(1000)); // Delay before reconnecting
-        set_intercom_state(ENUM_INTERCOM_STATE_WIFI_CONNECTING);
-        esp_wifi_connect();
         xEventGroupClearBits(wifi_event_group, WIFI_CONNECTED_BIT);
+        action = wifi_sm_handle(&wifi_sm, WIFI_SM_EV_DISCONNECTED, now_ms);
     } else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
         ip_event_got_ip_t* event = (ip_event_got_ip_t*) event_data;
-        ESP_LOGI(TAG_WIFI, "Got IP: " IPSTR, IP2STR(&event->ip_info.ip));
+        action = wifi_sm_handle(&wifi_sm, WIFI_SM_EV_GOT_IP, now_ms);
+        ESP_LOGI(TAG_WIFI, "Got IP: " IPSTR " in %" PRId64 " ms", IP2STR(&event->ip_info.ip), wifi_sm.time_to_ip_ms);
         set_intercom_state(ENUM_INTERCOM_STATE_WIFI_CONNECTED);
         xEventGroupSetBits(wifi_event_group, WIFI_CONNECTED_BIT);
+        boot_signal(BOOT_WIFI_IP);
+    } else if (event_base == INTERCOM_WIFI_EVENT && event_id == INTERCOM_WIFI_EVENT_RETRY) {
+        action = wifi_sm_handle(&wifi_sm, WIFI_SM_EV_RETRY, now_ms);
+    } else {
+        return;
     }
+    wifi_run_action(&action);
 }
 
-/* FreeRTOS event group to signal when we are connected*/
+int64_t wifi_time_to_ip_ms(void) {
+    return wifi_sm.time_to_ip_ms;
+}
+
+/* Start the Wi-Fi station, boot_signal(BOOT_WIFI_IP) reports the first IP */
 void wifi_init_sta(void) {
     // Wifi stack init
     ESP_ERROR_CHECK(esp_event_loop_create_default());
@@ -41,7 +179,25 @@ void wifi_init_sta(void) {
     ESP_ERROR_CHECK(esp_wifi_init(&cfg));
 
     // Init event group and register event handler
-    wifi_event_group = xEventGroupCreate();
+    wifi_event_group = APP_EVENT_GROUP_CREATE();
+
+    const backoff_config_t backoff_cfg = {
+        .min_ms = WIFI_RECONNECT_MIN_MS,
+        .base_ms = WIFI_RECONNECT_BASE_MS,
+        .cap_ms = WIFI_RECONNECT_CAP_MS,
+        .stable_ms = WIFI_RECONNECT_STABLE_MS,
+    };
+    bool cached = wifi_ap_cache_load();
+    wifi_sm_init(&wifi_sm, &backoff_cfg, esp_random(), cached);
+    if (cached) {
+        ESP_LOGI(TAG_WIFI, "Fast connect to " MACSTR " on channel %d", MAC2STR(ap_cache.bssid), ap_cache.channel);
+    }
+
+    const esp_timer_create_args_t timer_args = {
+        .callback = wifi_retry_timer_cb,
+        .name = "wifi_retry",
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &wifi_retry_timer));
 
     /* Register Event handler */
     ESP_ERROR_CHECK(esp_event_handler_instance_register(WIFI_EVENT,
@@ -54,48 +210,15 @@ void wifi_init_sta(void) {
                     &wifi_event_handler,
                     NULL,
                     NULL));
+    ESP_ERROR_CHECK(esp_event_handler_instance_register(INTERCOM_WIFI_EVENT,
+                    INTERCOM_WIFI_EVENT_RETRY,
+                    &wifi_event_handler,
+                    NULL,
+                    NULL));
 
-    // Initialize connect to AP
-    wifi_config_t wifi_sta_config = {
-        .sta = {
-            .ssid = WIFI_SSID,
-            .password = WIFI_PASS,
-            .scan_method = WIFI_ALL_CHANNEL_SCAN,
-            .failure_retry_cnt = 5,
-            /* Authmode threshold resets to WPA2 as default if password matches WPA2 standards (password len => 8).
-             * If you want to connect the device to deprecated WEP/WPA networks, Please set the threshold value
-             * to WIFI_AUTH_WEP/WIFI_AUTH_WPA_PSK and set the password with length and format matching to
-            * WIFI_AUTH_WEP/WIFI_AUTH_WPA_PSK standards.
-             */
-            .threshold.authmode = WIFI_AUTH_WPA2_PSK,
-            .sae_pwe_h2e = WPA3_SAE_PWE_BOTH,
-        },
-    };
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA) );
-    ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &wifi_sta_config));
+    wifi_apply_config(cached);
     ESP_ERROR_CHECK(esp_wifi_start() ); 
 
     ESP_LOGI(TAG_WIFI, "wifi_init_sta finished.");
-    
-    EventBits_t bits = xEventGroupWaitBits(wifi_event_group,
-                                           WIFI_CONNECTED_BIT | WIFI_FAIL_BIT,
-                                           pdFALSE,
-                                           pdFALSE,
-                                           portMAX_DELAY);
-
-    /* xEventGroupWaitBits() returns the bits before the call returned,
-     * hence we can test which event actually happened. */
-    if (bits & WIFI_CONNECTED_BIT) {
-        ESP_LOGI(TAG_WIFI, "connected to ap SSID:%s password:%s",
-                 WIFI_SSID, WIFI_PASS);
-    } else if (bits & WIFI_FAIL_BIT) {
-        ESP_LOGI(TAG_WIFI, "Failed to connect to SSID:%s, password:%s",
-                 WIFI_SSID, WIFI_PASS);
-    } else {
-        ESP_LOGE(TAG_WIFI, "UNEXPECTED EVENT");
-        return;
-    }
-
-    /* Set sta as the default interface */
-    // esp_netif_set_default_netif(esp_netif_sta);
 }
@@ -3,7 +3,14 @@
 #define WIFI_CONNECTED_BIT BIT0
 #define WIFI_FAIL_BIT      BIT1
 
+#define WIFI_NVS_NAMESPACE          "wifi_fc"
+#define WIFI_RECONNECT_MIN_MS       200
+#define WIFI_RECONNECT_BASE_MS      1000
+#define WIFI_RECONNECT_CAP_MS       30000
+#define WIFI_RECONNECT_STABLE_MS    30000
+
 static EventGroupHandle_t wifi_event_group = NULL;
 
 void wifi_event_handler(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data);
 void wifi_init_sta();
+int64_t wifi_time_to_ip_ms();
@@ -0,0 +1,52 @@
+#!/usr/bin/env python3
+"""Fail if application objects reference heap or dynamic RTOS allocation.
+
+Run by the build for the main component when CONFIG_INTERCOM_NO_APP_HEAP is
+set. Lists the undefined symbols of every object in the component archive
+and reports the ones calling the allocator directly or creating tasks,
+queues, semaphores or event groups from the heap. Allocations made inside
+ESP-IDF components (Wi-Fi, MQTT outbox, HTTP client) are not covered.
+
+Usage:
+    tools/check_app_heap.py build/esp-idf/main/libmain.a --nm xtensa-esp32-elf-nm
+"""
+
+import argparse
+import subprocess
+import sys
+
+FORBIDDEN = {
+    "malloc", "calloc", "realloc", "free", "strdup", "strndup",
+    "heap_caps_malloc", "heap_caps_calloc", "heap_caps_realloc", "heap_caps_free",
+    "xTaskCreatePinnedToCore", "xQueueGenericCreate", "xQueueCreateMutex",
+    "xQueueCreateCountingSemaphore", "xEventGroupCreate",
+}
+
+
+def undefined_symbols(nm, archive):
+    out = subprocess.run([nm, "-A", "-u", archive], check=True, capture_output=True, text=True).stdout
+    for line in out.splitlines():
+        # "libmain.a:mqtt_task.c.obj:         U malloc"
+        location, _, rest = line.rpartition(":")
+        fields = rest.split()
+        if len(fields) == 2 and fields[0] == "U":
+            yield location.rpartition(":")[2], fields[1]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("archive", help="component library, e.g. libmain.a")
+    parser.add_argument("--nm", default="nm", help="nm of the target toolchain")
+    args = parser.parse_args()
+
+    found = sorted({(obj, sym) for obj, sym in undefined_symbols(args.nm, args.archive) if sym in FORBIDDEN})
+    for obj, sym in found:
+        print("%s: calls %s" % (obj, sym), file=sys.stderr)
+    if found:
+        print("Application code allocates from the heap, see CONFIG_INTERCOM_STATIC_ALLOC", file=sys.stderr)
+        return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
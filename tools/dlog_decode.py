@@ -0,0 +1,197 @@
+#!/usr/bin/env python3
+"""Decode deferred log batches published on /topic/intercom/log.
+
+The batch layout is documented in main/core/dlog.h. Records only carry the
+addresses of their format string and tag plus the raw argument words, the
+text comes from the firmware ELF that produced them.
+
+Usage:
+    mosquitto_sub -h intercom.local -t /topic/intercom/log -N -C 10 > log.bin
+    tools/dlog_decode.py build/intercom.elf log.bin
+
+Several batches may be concatenated in one file, as mosquitto_sub -N writes them.
+"""
+
+import argparse
+import re
+import struct
+import sys
+
+MAGIC = ord("L")
+VERSION = 1
+HEADER = struct.Struct("<BBHII")
+RECORD = struct.Struct("<IIqBBBB")
+ANCHOR_SYMBOL = "dlog_anchor"
+LEVELS = {1: "E", 2: "W", 3: "I", 4: "D"}
+
+SHT_SYMTAB = 2
+SHT_NOBITS = 8
+SHF_ALLOC = 2
+
+CONVERSION = re.compile(r"%([-+ #0]*)(\*|\d+)?(?:\.(\*|\d*))?(hh|h|ll|l|L|j|z|t)?([diouxXcsfFeEgGaAp%])")
+
+
+class Elf:
+    """Just enough of an ELF reader to find strings by address and one symbol"""
+
+    def __init__(self, path):
+        with open(path, "rb") as f:
+            self.data = f.read()
+        if self.data[:4] != b"\x7fELF":
+            raise ValueError("%s is not an ELF file" % path)
+        self.is64 = self.data[4] == 2
+        if self.data[5] != 1:
+            raise ValueError("big-endian ELF not supported")
+        self.pointer_words = 2 if self.is64 else 1
+
+        if self.is64:
+            shoff, = struct.unpack_from("<Q", self.data, 0x28)
+            shentsize, shnum = struct.unpack_from("<HH", self.data, 0x3A)
+            section = struct.Struct("<IIQQQQIIQQ")
+        else:
+            shoff, = struct.unpack_from("<I", self.data, 0x20)
+            shentsize, shnum = struct.unpack_from("<HH", self.data, 0x2E)
+            section = struct.Struct("<IIIIIIIIII")
+
+        self.sections = []
+        for i in range(shnum):
+            _, kind, flags, addr, offset, size, link, _, _, entsize = section.unpack_from(self.data, shoff + i * shentsize)
+            self.sections.append((kind, flags, addr, offset, size, link, entsize))
+
+    def string_at(self, addr):
+        for kind, flags, start, offset, size, _, _ in self.sections:
+            if flags & SHF_ALLOC and kind != SHT_NOBITS and start <= addr < start + size:
+                begin = offset + addr - start
+                end = self.data.find(b"\0", begin, offset + size)
+                if end < 0:
+                    return None
+                return self.data[begin:end].decode("utf-8", "replace")
+        return None
+
+    def symbol(self, name):
+        wanted = name.encode()
+        symbol = struct.Struct("<IBBHQQ" if self.is64 else "<IIIBBH")
+        for kind, _, _, offset, size, link, entsize in self.sections:
+            if kind != SHT_SYMTAB:
+                continue
+            strtab = self.sections[link][3]
+            for pos in range(offset, offset + size, entsize):
+                fields = symbol.unpack_from(self.data, pos)
+                name_offset = fields[0]
+                value = fields[4] if self.is64 else fields[1]
+                end = self.data.find(b"\0", strtab + name_offset)
+                if self.data[strtab + name_offset:end] == wanted:
+                    return value
+        return None
+
+
+def render(fmt, words, elf, bias):
+    """printf with the argument words packed by the DLOG macros"""
+    words = list(words)
+
+    def take(n):
+        value = 0
+        for i in range(n):
+            value |= (words.pop(0) if words else 0) << (32 * i)
+        return value
+
+    def convert(match):
+        flags, width, precision, length, conv = match.groups()
+        if conv == "%":
+            return "%"
+        if width == "*":
+            width = str(take(1))
+        if precision == "*":
+            precision = str(take(1))
+        spec = "%" + flags + (width or "") + ("." + precision if precision is not None else "")
+
+        if conv in "fFeEgGaA":
+            value, = struct.unpack("<d", struct.pack("<Q", take(2)))
+            return (spec + conv.replace("a", "e").replace("A", "E")) % value
+        if conv == "s":
+            addr = take(elf.pointer_words)
+            text = elf.string_at((addr - bias) & 0xFFFFFFFF) if addr else None
+            return (spec + "s") % text if text is not None else "<str 0x%x>" % addr
+        if conv == "p":
+            return "0x%x" % take(elf.pointer_words)
+        if conv == "c":
+            return (spec + "c") % chr(take(1) & 0xFF)
+
+        n_words = 1
+        bits = 32
+        if length in ("ll", "j", "L") or (length in ("l", "z", "t") and elf.is64):
+            n_words, bits = 2, 64
+        elif length == "h":
+            bits = 16
+        elif length == "hh":
+            bits = 8
+        value = take(n_words) & ((1 << bits) - 1)
+        if conv in "di" and value >> (bits - 1):
+            value -= 1 << bits
+        if "#" in flags and conv in "oxX" and (value == 0 or conv == "o"):
+            # C prints 0 without a prefix and marks octal with a leading 0 digit, Python would write 0x0 and 0o
+            digits = len("%o" % value)
+            if conv == "o" and value != 0 and int(precision or 0) <= digits:
+                precision = str(digits + 1)
+            spec = "%" + flags.replace("#", "") + (width or "") + ("." + precision if precision is not None else "")
+        return (spec + ("d" if conv in "diu" else conv)) % value
+
+    return CONVERSION.sub(convert, fmt)
+
+
+def decode(data, elf, elf_anchor):
+    """Yields one text line per record, batches may be concatenated"""
+    pos = 0
+    last_dropped = 0
+    while pos < len(data):
+        if len(data) - pos < HEADER.size:
+            raise ValueError("batch header truncated at offset %d" % pos)
+        magic, version, n_records, anchor, dropped = HEADER.unpack_from(data, pos)
+        if magic != MAGIC:
+            raise ValueError("bad magic 0x%02x at offset %d" % (magic, pos))
+        if version != VERSION:
+            raise ValueError("unsupported version %d" % version)
+        pos += HEADER.size
+        bias = (anchor - elf_anchor) & 0xFFFFFFFF if elf_anchor is not None else 0
+        if dropped != last_dropped:
+            yield "# %d records dropped since boot" % dropped
+            last_dropped = dropped
+
+        for _ in range(n_records):
+            if len(data) - pos < RECORD.size:
+                raise ValueError("record truncated at offset %d" % pos)
+            fmt_addr, tag_addr, timestamp_us, level, core, n_words, _ = RECORD.unpack_from(data, pos)
+            pos += RECORD.size
+            if len(data) - pos < 4 * n_words:
+                raise ValueError("record words truncated at offset %d" % pos)
+            words = struct.unpack_from("<%dI" % n_words, data, pos)
+            pos += 4 * n_words
+
+            fmt = elf.string_at((fmt_addr - bias) & 0xFFFFFFFF)
+            tag = elf.string_at((tag_addr - bias) & 0xFFFFFFFF) or "?"
+            if fmt is None:
+                text = "<unknown format 0x%08x> %s" % (fmt_addr, " ".join("0x%08x" % w for w in words))
+            else:
+                text = render(fmt, words, elf, bias)
+            yield "%s (%d) %s: %s" % (LEVELS.get(level, "?"), timestamp_us // 1000, tag, text)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("elf", help="firmware ELF the batches came from")
+    parser.add_argument("files", nargs="*", help="binary batches (stdin if omitted)")
+    args = parser.parse_args()
+
+    elf = Elf(args.elf)
+    elf_anchor = elf.symbol(ANCHOR_SYMBOL)
+    if elf_anchor is None:
+        print("warning: no %s symbol, assuming no load bias" % ANCHOR_SYMBOL, file=sys.stderr)
+
+    blobs = [open(name, "rb").read() for name in args.files] or [sys.stdin.buffer.read()]
+    for blob in blobs:
+        for line in decode(blob, elf, elf_anchor):
+            print(line)
+
+
+if __name__ == "__main__":
+    main()
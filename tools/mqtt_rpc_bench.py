@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+"""Measure MQTT 5 request/response round trips against the intercom.
+
+Sends commands with a response topic and correlation data, waits for each
+reply and prints the round-trip percentiles next to the device-side latency
+reported in the reply. Works against any broker, e.g. a local mosquitto:
+
+    mosquitto -p 1883
+    tools/mqtt_rpc_bench.py --host localhost --count 50 --payload open_for_ms=100
+
+Requires paho-mqtt >= 2.0.
+"""
+
+import argparse
+import json
+import statistics
+import sys
+import threading
+import time
+import uuid
+
+import paho.mqtt.client as mqtt
+from paho.mqtt.packettypes import PacketTypes
+from paho.mqtt.properties import Properties
+
+COMMAND_TOPIC = "/topic/intercom/open_state"
+
+
+def percentile(values, pct):
+    values = sorted(values)
+    return values[min(len(values) - 1, int(len(values) * pct / 100))]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", default="localhost")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--username")
+    parser.add_argument("--password")
+    parser.add_argument("--topic", default=COMMAND_TOPIC)
+    parser.add_argument("--payload", default="open_for_ms=100")
+    parser.add_argument("--count", type=int, default=20)
+    parser.add_argument("--interval", type=float, default=0.5, help="seconds between requests")
+    parser.add_argument("--timeout", type=float, default=15.0, help="seconds to wait for each reply")
+    args = parser.parse_args()
+
+    response_topic = "/test/rpc/%s" % uuid.uuid4().hex[:8]
+    replies = {}
+    arrived = threading.Condition()
+
+    def on_message(client, userdata, msg):
+        correlation = getattr(msg.properties, "CorrelationData", None)
+        with arrived:
+            replies[correlation] = (time.monotonic(), msg.payload)
+            arrived.notify_all()
+
+    client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION2, protocol=mqtt.MQTTv5)
+    if args.username:
+        client.username_pw_set(args.username, args.password)
+    client.on_message = on_message
+    client.connect(args.host, args.port)
+    client.subscribe(response_topic, qos=1)
+    client.loop_start()
+    time.sleep(0.5)
+
+    round_trips = []
+    device_latencies = []
+    statuses = {}
+    for i in range(args.count):
+        correlation = ("%08d" % i).encode()
+        props = Properties(PacketTypes.PUBLISH)
+        props.ResponseTopic = response_topic
+        props.CorrelationData = correlation
+        sent = time.monotonic()
+        client.publish(args.topic, args.payload, qos=1, properties=props)
+
+        with arrived:
+            arrived.wait_for(lambda: correlation in replies, timeout=args.timeout)
+        if correlation not in replies:
+            statuses["lost"] = statuses.get("lost", 0) + 1
+            print("request %d: no reply" % i, file=sys.stderr)
+            continue
+
+        received, payload = replies.pop(correlation)
+        reply = json.loads(payload)
+        statuses[reply["status"]] = statuses.get(reply["status"], 0) + 1
+        round_trips.append((received - sent) * 1000)
+        device_latencies.append(reply.get("latency_us", 0) / 1000)
+        time.sleep(args.interval)
+
+    client.loop_stop()
+    client.disconnect()
+
+    print("replies: %s" % ", ".join("%s=%d" % kv for kv in sorted(statuses.items())))
+    if round_trips:
+        for name, values in (("round trip", round_trips), ("on device", device_latencies)):
+            print("%-10s ms: min %.1f  p50 %.1f  p90 %.1f  p99 %.1f  max %.1f  mean %.1f" % (
+                name, min(values), percentile(values, 50), percentile(values, 90),
+                percentile(values, 99), max(values), statistics.mean(values)))
+
+
+if __name__ == "__main__":
+    main()
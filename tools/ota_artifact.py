@@ -0,0 +1,197 @@
+#!/usr/bin/env python3
+"""Build compressed and delta OTA artifacts.
+
+The container and the delta op format are documented in
+main/core/ota_artifact.h and main/core/delta_patch.h. Every artifact is
+decoded again after it is built and compared with the target image.
+
+Usage:
+    tools/ota_artifact.py compress build/smart-intercom.bin firmware.iota
+    tools/ota_artifact.py delta old/smart-intercom.bin build/smart-intercom.bin firmware.iota
+    tools/ota_artifact.py apply firmware.iota out.bin --base old/smart-intercom.bin
+    tools/ota_artifact.py manifest build/smart-intercom.bin firmware.bin.json --url http://host/firmware.iota
+"""
+
+import argparse
+import hashlib
+import json
+import struct
+import sys
+import zlib
+
+MAGIC = 0x41544F49  # "IOTA"
+VERSION = 1
+HEADER = struct.Struct("<IBBHII32s32s")
+COMPRESSED = 1 << 0
+DELTA = 1 << 1
+
+OP_END = 0x00
+OP_COPY = 0x01
+OP_INSERT = 0x02
+
+BLOCK = 32  # base image is indexed in blocks of this size
+
+# esp_app_desc_t follows the image header (24 bytes) and first segment header (8 bytes)
+APP_DESC = struct.Struct("<II8x32s")
+APP_DESC_OFFSET = 32
+APP_DESC_MAGIC = 0xABCD5432
+
+
+def make_delta(base, image):
+    """Copy/insert ops rebuilding image from base, matched on BLOCK-aligned base blocks."""
+    index = {}
+    for off in range(0, len(base) - BLOCK + 1, BLOCK):
+        index.setdefault(base[off:off + BLOCK], off)
+
+    ops = bytearray()
+    literal_start = 0
+    i = 0
+    while i + BLOCK <= len(image):
+        off = index.get(image[i:i + BLOCK])
+        if off is None:
+            i += 1
+            continue
+        # Grow the match in both directions
+        while i > literal_start and off > 0 and image[i - 1] == base[off - 1]:
+            i -= 1
+            off -= 1
+        n = BLOCK
+        while i + n < len(image) and off + n < len(base) and image[i + n] == base[off + n]:
+            n += 1
+        if i > literal_start:
+            ops += struct.pack("<BI", OP_INSERT, i - literal_start) + image[literal_start:i]
+        ops += struct.pack("<BII", OP_COPY, off, n)
+        i += n
+        literal_start = i
+
+    if literal_start < len(image):
+        ops += struct.pack("<BI", OP_INSERT, len(image) - literal_start) + image[literal_start:]
+    ops.append(OP_END)
+    return bytes(ops)
+
+
+def apply_delta(base, ops):
+    out = bytearray()
+    pos = 0
+    while True:
+        op = ops[pos]
+        pos += 1
+        if op == OP_END:
+            return bytes(out)
+        if op == OP_COPY:
+            off, n = struct.unpack_from("<II", ops, pos)
+            pos += 8
+            if off + n > len(base):
+                raise ValueError("copy outside the base image")
+            out += base[off:off + n]
+        elif op == OP_INSERT:
+            (n,) = struct.unpack_from("<I", ops, pos)
+            pos += 4
+            out += ops[pos:pos + n]
+            pos += n
+        else:
+            raise ValueError("unknown op 0x%02x at %d" % (op, pos - 1))
+
+
+def build(image, base=None, compress=True):
+    flags = 0
+    payload = image
+    source_size = 0
+    source_sha256 = bytes(32)
+    if base is not None:
+        flags |= DELTA
+        payload = make_delta(base, image)
+        source_size = len(base)
+        source_sha256 = hashlib.sha256(base).digest()
+    if compress:
+        flags |= COMPRESSED
+        payload = zlib.compress(payload, 9)
+    header = HEADER.pack(MAGIC, VERSION, flags, 0, len(image), source_size, source_sha256,
+                         hashlib.sha256(image).digest())
+    return header + payload
+
+
+def decode(artifact, base=None):
+    magic, version, flags, _, image_size, source_size, source_sha256, image_sha256 = HEADER.unpack_from(artifact)
+    if magic != MAGIC or version != VERSION:
+        raise ValueError("not an OTA artifact")
+    payload = artifact[HEADER.size:]
+    if flags & COMPRESSED:
+        payload = zlib.decompress(payload)
+    if flags & DELTA:
+        if base is None:
+            raise ValueError("delta artifact needs --base")
+        base = base[:source_size]
+        if hashlib.sha256(base).digest() != source_sha256:
+            raise ValueError("base image does not match the one the delta was made from")
+        payload = apply_delta(base, payload)
+    if len(payload) != image_size or hashlib.sha256(payload).digest() != image_sha256:
+        raise ValueError("decoded image does not match its header")
+    return payload
+
+
+def app_version(image):
+    magic, _, version = APP_DESC.unpack_from(image, APP_DESC_OFFSET)
+    if magic != APP_DESC_MAGIC:
+        raise ValueError("no app description, not an ESP-IDF app image")
+    return version.split(b"\0", 1)[0].decode()
+
+
+def manifest(image, url=None):
+    """Version manifest (see main/core/ota_manifest.h) describing a raw image."""
+    doc = {"version": app_version(image), "size": len(image), "sha256": hashlib.sha256(image).hexdigest()}
+    if url:
+        doc["url"] = url
+    return json.dumps(doc, separators=(",", ":"))
+
+
+def read(path):
+    with open(path, "rb") as f:
+        return f.read()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    sub = parser.add_subparsers(dest="command", required=True)
+    p = sub.add_parser("compress", help="zlib-compress an image")
+    p.add_argument("image")
+    p.add_argument("output")
+    p = sub.add_parser("delta", help="patch against the image the devices run now")
+    p.add_argument("base")
+    p.add_argument("image")
+    p.add_argument("output")
+    p.add_argument("--no-compress", action="store_true", help="leave the op stream uncompressed")
+    p = sub.add_parser("apply", help="decode an artifact back into an image")
+    p.add_argument("artifact")
+    p.add_argument("output")
+    p.add_argument("--base")
+    p = sub.add_parser("manifest", help="version manifest for an image")
+    p.add_argument("image")
+    p.add_argument("output")
+    p.add_argument("--url", help="where devices download the image or an artifact of it")
+    args = parser.parse_args()
+
+    if args.command == "manifest":
+        with open(args.output, "w") as f:
+            f.write(manifest(read(args.image), args.url))
+        return
+
+    if args.command == "apply":
+        base = read(args.base) if args.base else None
+        image = decode(read(args.artifact), base)
+        with open(args.output, "wb") as f:
+            f.write(image)
+        return
+
+    image = read(args.image)
+    base = read(args.base) if args.command == "delta" else None
+    artifact = build(image, base, compress=not getattr(args, "no_compress", False))
+    if decode(artifact, base) != image:
+        sys.exit("round trip failed")
+    with open(args.output, "wb") as f:
+        f.write(artifact)
+    print("%s: %d -> %d bytes (%.1f%%)" % (args.output, len(image), len(artifact), 100.0 * len(artifact) / len(image)))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,136 @@
+#!/usr/bin/env python3
+"""Development HTTP server for OTA images.
+
+Serves files from a directory with the headers the firmware uses for
+resumable downloads: ETag, X-Image-SHA256 and Range / If-Range support.
+--cut-probability drops connections at random offsets to exercise resume,
+--seed makes the offsets repeat. --port 0 picks a free port, the banner
+names it.
+
+A request for <image>.json returns the version manifest of <image> (or the
+file itself if it exists) and answers If-None-Match with 304.
+
+Usage:
+    tools/ota_server.py --dir build --port 8001
+    tools/ota_server.py --dir build --port 8001 --cut-probability 0.3
+"""
+
+import argparse
+import hashlib
+import os
+import random
+import re
+from functools import partial
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+import ota_artifact
+
+CHUNK = 4096
+
+
+class OtaHandler(BaseHTTPRequestHandler):
+    def __init__(self, *args, directory, cut_probability, **kwargs):
+        self.directory = directory
+        self.cut_probability = cut_probability
+        super().__init__(*args, **kwargs)
+
+    def do_GET(self):
+        path = os.path.join(self.directory, os.path.basename(self.path.split("?")[0]))
+        if path.endswith(".json"):
+            self.send_manifest(path)
+            return
+        if not os.path.isfile(path):
+            self.send_error(404)
+            return
+
+        with open(path, "rb") as f:
+            data = f.read()
+        sha256 = hashlib.sha256(data).hexdigest()
+        etag = '"%s"' % sha256[:32]
+
+        start = 0
+        match = re.match(r"bytes=(\d+)-$", self.headers.get("Range", ""))
+        if_range = self.headers.get("If-Range")
+        if match and (if_range is None or if_range == etag):
+            start = int(match.group(1))
+            if start >= len(data):
+                self.send_response(416)
+                self.send_header("Content-Range", "bytes */%d" % len(data))
+                self.end_headers()
+                return
+            self.send_response(206)
+            self.send_header("Content-Range", "bytes %d-%d/%d" % (start, len(data) - 1, len(data)))
+        else:
+            self.send_response(200)
+
+        self.send_header("Content-Type", "application/octet-stream")
+        self.send_header("Content-Length", str(len(data) - start))
+        self.send_header("Accept-Ranges", "bytes")
+        self.send_header("ETag", etag)
+        self.send_header("X-Image-SHA256", sha256)
+        self.end_headers()
+
+        cut_at = None
+        if random.random() < self.cut_probability:
+            cut_at = random.randrange(start, len(data))
+            self.log_message("will cut the connection at byte %d", cut_at)
+
+        pos = start
+        while pos < len(data):
+            end = min(pos + CHUNK, len(data))
+            if cut_at is not None and end > cut_at:
+                self.wfile.write(data[pos:cut_at])
+                self.wfile.flush()
+                self.connection.close()
+                return
+            self.wfile.write(data[pos:end])
+            pos = end
+
+    def send_manifest(self, path):
+        if os.path.isfile(path):
+            with open(path, "rb") as f:
+                body = f.read()
+        elif os.path.isfile(path[:-len(".json")]):
+            with open(path[:-len(".json")], "rb") as f:
+                try:
+                    body = ota_artifact.manifest(f.read()).encode()
+                except ValueError as e:
+                    self.send_error(404, str(e))
+                    return
+        else:
+            self.send_error(404)
+            return
+
+        etag = '"%s"' % hashlib.sha256(body).hexdigest()[:32]
+        if self.headers.get("If-None-Match") == etag:
+            self.send_response(304)
+            self.send_header("ETag", etag)
+            self.end_headers()
+            return
+        self.send_response(200)
+        self.send_header("Content-Type", "application/json")
+        self.send_header("Content-Length", str(len(body)))
+        self.send_header("ETag", etag)
+        self.end_headers()
+        self.wfile.write(body)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--dir", default=".", help="directory with the images")
+    parser.add_argument("--port", type=int, default=8001)
+    parser.add_argument("--cut-probability", type=float, default=0.0,
+                        help="probability of dropping each response part way through")
+    parser.add_argument("--seed", type=int, help="seed for the cut offsets")
+    args = parser.parse_args()
+    if args.seed is not None:
+        random.seed(args.seed)
+
+    handler = partial(OtaHandler, directory=args.dir, cut_probability=args.cut_probability)
+    server = ThreadingHTTPServer(("", args.port), handler)
+    print("Serving %s on port %d" % (os.path.abspath(args.dir), server.server_address[1]), flush=True)
+    server.serve_forever()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,96 @@
+#!/usr/bin/env python3
+"""Decode binary telemetry batches published on /topic/intercom/telemetry.
+
+The layout is documented in main/core/telemetry_batch.h. Sample records and
+their expected output are in host/test/vectors/telemetry.
+
+Usage:
+    mosquitto_sub -h intercom.local -t /topic/intercom/telemetry -N -C 1 > batch.bin
+    tools/telemetry_decode.py batch.bin
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+MAGIC = ord("T")
+VERSION = 1
+HEADER = struct.Struct("<BBHIqHBBBH")
+PERIOD = struct.Struct("<HH")
+EVENT = struct.Struct("<BBIIH")
+EVENT_TYPES = {0: "start", 1: "stop"}
+
+
+def mask_channels(mask):
+    return [n for n in range(8) if mask & (1 << n)]
+
+
+def decode(data):
+    if len(data) < 2:
+        raise ValueError("record too short: %d bytes" % len(data))
+    magic, version = data[0], data[1]
+    if magic != MAGIC:
+        raise ValueError("bad magic 0x%02x" % magic)
+    if version != VERSION:
+        raise ValueError("unsupported version %d" % version)
+    if len(data) < HEADER.size:
+        raise ValueError("record too short: %d bytes" % len(data))
+
+    _, _, period_ms, seq, window_start_us, overruns, n_periods, n_events, mask, events_dropped = \
+        HEADER.unpack_from(data)
+    channels = mask_channels(mask)
+
+    expected = HEADER.size + n_periods * len(channels) * PERIOD.size + n_events * EVENT.size
+    if len(data) != expected:
+        raise ValueError("length %d does not match header (%d)" % (len(data), expected))
+
+    offset = HEADER.size
+    periods = []
+    for i in range(n_periods):
+        for channel in channels:
+            peak, mean = PERIOD.unpack_from(data, offset)
+            offset += PERIOD.size
+            periods.append({
+                "channel": channel,
+                "uptime_us": window_start_us + i * period_ms * 1000,
+                "peak": peak,
+                "mean": mean,
+            })
+
+    events = []
+    for _ in range(n_events):
+        kind, channel, offset_ms, duration_ms, peak = EVENT.unpack_from(data, offset)
+        offset += EVENT.size
+        events.append({
+            "event": EVENT_TYPES.get(kind, kind),
+            "channel": channel,
+            "uptime_us": window_start_us + offset_ms * 1000,
+            "duration_ms": duration_ms,
+            "peak": peak,
+        })
+
+    return {
+        "seq": seq,
+        "period_ms": period_ms,
+        "window_start_us": window_start_us,
+        "overruns": overruns,
+        "events_dropped": events_dropped,
+        "channels": channels,
+        "periods": periods,
+        "events": events,
+    }
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("files", nargs="*", help="binary records, one per file (stdin if omitted)")
+    args = parser.parse_args()
+
+    blobs = [open(name, "rb").read() for name in args.files] or [sys.stdin.buffer.read()]
+    for blob in blobs:
+        print(json.dumps(decode(blob), indent=2))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,156 @@
+#!/usr/bin/env python3
+"""Reassemble waveform captures published on /topic/intercom/capture.
+
+The chunk layout is documented in main/core/waveform_capture.h. Each capture
+is written as capture_<id>.csv (sample, time relative to the trigger, uptime,
+one raw value column per ADC channel) or capture_<id>.wav (16-bit, one audio
+channel per ADC channel at the sample rate, the 12-bit readings scaled to
+full range).
+
+Usage:
+    mosquitto_sub -h intercom.local -t /topic/intercom/capture -N > captures.bin
+    tools/waveform_decode.py captures.bin --format wav --out-dir captures/
+
+Chunks may arrive in any order and several captures may be concatenated in
+one file, as mosquitto_sub -N writes them.
+"""
+
+import argparse
+import csv
+import os
+import struct
+import sys
+import wave
+
+MAGIC = ord("W")
+VERSION = 1
+HEADER = struct.Struct("<BBHHHIHH")
+INFO = struct.Struct("<IIIIqB3x")
+ADC_MAX = 4095
+
+
+def mask_channels(mask):
+    return [n for n in range(16) if mask & (1 << n)]
+
+
+class Capture:
+    def __init__(self, capture_id, n_chunks, channels):
+        self.capture_id = capture_id
+        self.n_chunks = n_chunks
+        self.channels = channels    # ADC1 channel numbers
+        self.chunks = {}
+        self.info = None
+        self.trigger_channel = None
+
+    def add(self, chunk, offset, samples, info):
+        self.chunks[chunk] = (offset, samples)
+        if info is not None:
+            self.info = info[:5]
+            self.trigger_channel = info[5]
+
+    def complete(self):
+        return self.info is not None and len(self.chunks) == self.n_chunks
+
+    def samples(self):
+        """One tuple of values per sample, a value per channel"""
+        n_samples = self.info[1]
+        values = [(0,) * len(self.channels)] * n_samples
+        for offset, samples in self.chunks.values():
+            values[offset:offset + len(samples)] = samples
+        return values
+
+
+def parse(data):
+    """Yields (capture_id, chunk, n_chunks, channels, offset, samples, info) per chunk"""
+    pos = 0
+    while pos < len(data):
+        if len(data) - pos < HEADER.size:
+            raise ValueError("chunk header truncated at offset %d" % pos)
+        magic, version, capture_id, chunk, n_chunks, offset, count, mask = HEADER.unpack_from(data, pos)
+        if magic != MAGIC:
+            raise ValueError("bad magic 0x%02x at offset %d" % (magic, pos))
+        if version != VERSION:
+            raise ValueError("unsupported version %d" % version)
+        channels = mask_channels(mask)
+        pos += HEADER.size
+        info = None
+        if chunk == 0:
+            if len(data) - pos < INFO.size:
+                raise ValueError("chunk info truncated at offset %d" % pos)
+            info = INFO.unpack_from(data, pos)
+            pos += INFO.size
+        n = len(channels)
+        if len(data) - pos < 2 * count * n:
+            raise ValueError("chunk samples truncated at offset %d" % pos)
+        values = struct.unpack_from("<%dH" % (count * n), data, pos)
+        pos += 2 * count * n
+        samples = [values[i:i + n] for i in range(0, len(values), n)]
+        yield capture_id, chunk, n_chunks, channels, offset, samples, info
+
+
+def assemble(blobs):
+    """Returns the complete captures in arrival order and the ids left incomplete"""
+    pending = {}
+    done = []
+    for blob in blobs:
+        for capture_id, chunk, n_chunks, channels, offset, samples, info in parse(blob):
+            capture = pending.get(capture_id)
+            if capture is None or chunk in capture.chunks:
+                # A repeated chunk starts the next capture with this id
+                capture = pending[capture_id] = Capture(capture_id, n_chunks, channels)
+            capture.add(chunk, offset, samples, info)
+            if capture.complete():
+                done.append(capture)
+                del pending[capture_id]
+    return done, sorted(pending)
+
+
+def write_csv(capture, path):
+    sample_rate, _, trigger, _, start_us = capture.info
+    period_us = 1e6 / sample_rate
+    with open(path, "w", newline="") as f:
+        out = csv.writer(f)
+        names = ["ch%d" % c for c in capture.channels]
+        out.writerow(["sample", "t_ms", "uptime_us"] + names)
+        for i, values in enumerate(capture.samples()):
+            out.writerow([i, "%.3f" % ((i - trigger) * period_us / 1000), int(start_us + i * period_us)] + list(values))
+
+
+def write_wav(capture, path):
+    sample_rate = capture.info[0]
+    frames = b"".join(struct.pack("<h", min(32767, (v - (ADC_MAX + 1) // 2) * 16))
+                      for values in capture.samples() for v in values)
+    with wave.open(path, "wb") as f:
+        f.setnchannels(len(capture.channels))
+        f.setsampwidth(2)
+        f.setframerate(sample_rate)
+        f.writeframes(frames)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("files", nargs="*", help="binary chunks (stdin if omitted)")
+    parser.add_argument("--format", choices=("csv", "wav"), default="csv")
+    parser.add_argument("--out-dir", default=".")
+    args = parser.parse_args()
+
+    blobs = [open(name, "rb").read() for name in args.files] or [sys.stdin.buffer.read()]
+    captures, incomplete = assemble(blobs)
+    os.makedirs(args.out_dir, exist_ok=True)
+
+    for capture in captures:
+        sample_rate, n_samples, trigger, missed, start_us = capture.info
+        path = os.path.join(args.out_dir, "capture_%d.%s" % (capture.capture_id, args.format))
+        if args.format == "csv":
+            write_csv(capture, path)
+        else:
+            write_wav(capture, path)
+        print("%s: %d samples at %d Hz, trigger at %.1f ms on channel %d, uptime %.3f s, %d triggers missed since boot"
+              % (path, n_samples, sample_rate, trigger * 1000.0 / sample_rate, capture.trigger_channel,
+                 start_us / 1e6, missed))
+    for capture_id in incomplete:
+        print("warning: capture %d is missing chunks" % capture_id, file=sys.stderr)
+
+
+if __name__ == "__main__":
+    main()